@@ -2841,6 +2841,7 @@ struct loadparm_context *loadparm_init(TALLOC_CTX *mem_ctx)
 
         lpcfg_do_global_parameter(lp_ctx, "allow dns updates", "secure only");
 	lpcfg_do_global_parameter(lp_ctx, "dns zone scavenging", "False");
+	lpcfg_do_global_parameter(lp_ctx, "dns forwarder cache size", "4194304");
         lpcfg_do_global_parameter(lp_ctx, "dns forwarder", "");
 
 	lpcfg_do_global_parameter(lp_ctx, "algorithmic rid base", "1000");
@@ -3013,7 +3014,7 @@ struct loadparm_context *loadparm_init(TALLOC_CTX *mem_ctx)
 
 	lpcfg_do_global_parameter(lp_ctx, "enable core files", "yes");
 
-	lpcfg_do_global_parameter(lp_ctx, "winbind max domain connections", "1");
+	lpcfg_do_global_parameter(lp_ctx, "winbind max domain connections", "4");
 
 	lpcfg_do_global_parameter(lp_ctx, "case sensitive", "auto");
 
@@ -36,6 +36,9 @@
 #include "system/threads.h"
 #include <assert.h>
 #endif
+#ifdef HAVE_TEVENT_URING
+#include <linux/io_uring.h>
+#endif
 
 static int fde_count;
 
@@ -697,6 +700,393 @@ static bool test_event_fd2(struct torture_context *tctx,
 	return true;
 }
 
+struct test_ready_fds_state {
+	struct tevent_fd **fdes;
+	int *fds;
+	unsigned *counts;
+	unsigned num_fds;
+	unsigned num_events;
+	bool free_sibling;
+	bool drain_sibling;
+	bool *drained;
+	const char *error;
+};
+
+static void test_ready_fds_handler(struct tevent_context *ev,
+				   struct tevent_fd *fde,
+				   uint16_t flags,
+				   void *private_data)
+{
+	struct test_ready_fds_state *state =
+		(struct test_ready_fds_state *)private_data;
+	unsigned i;
+
+	for (i = 0; i < state->num_fds; i++) {
+		if (state->fdes[i] == fde) {
+			break;
+		}
+	}
+	if (i == state->num_fds) {
+		state->error = "handler called for a freed fde";
+		return;
+	}
+
+	if (state->drained != NULL && state->drained[i]) {
+		state->error = "handler called for a drained fd";
+		return;
+	}
+
+	state->counts[i] += 1;
+	state->num_events += 1;
+
+	if (state->free_sibling && (i % 2) == 0) {
+		/*
+		 * The odd fds are ready as well and may have been
+		 * harvested together with us.
+		 */
+		TALLOC_FREE(state->fdes[i + 1]);
+	}
+
+	if (state->drain_sibling && (i % 2) == 0 && !state->drained[i + 1]) {
+		struct tevent_fd *sibling = state->fdes[i + 1];
+		char c;
+
+		/*
+		 * Empty the sibling's pipe and wait for it again, its
+		 * handler must not be called for the old readiness.
+		 */
+		tevent_fd_set_flags(sibling, 0);
+		if (read(state->fds[(i + 1) * 2], &c, 1) != 1) {
+			state->error = "read failed";
+			return;
+		}
+		state->drained[i + 1] = true;
+		tevent_fd_set_flags(sibling, TEVENT_FD_READ);
+	}
+}
+
+static bool test_ready_fds_setup(struct torture_context *tctx,
+				 struct tevent_context *ev,
+				 struct test_ready_fds_state *state,
+				 unsigned num_fds)
+{
+	unsigned i;
+	char c = 0;
+
+	state->num_fds = num_fds;
+	state->fdes = talloc_zero_array(ev, struct tevent_fd *, num_fds);
+	state->fds = talloc_array(ev, int, num_fds * 2);
+	state->counts = talloc_zero_array(ev, unsigned, num_fds);
+	torture_assert(tctx, state->fdes != NULL && state->fds != NULL &&
+		       state->counts != NULL, "out of memory");
+	if (state->drain_sibling) {
+		state->drained = talloc_zero_array(ev, bool, num_fds);
+		torture_assert(tctx, state->drained != NULL, "out of memory");
+	}
+
+	for (i = 0; i < num_fds; i++) {
+		int *fd = &state->fds[i * 2];
+
+		torture_assert_int_equal(tctx, pipe(fd), 0, "pipe failed");
+		do_write(fd[1], &c, 1);
+
+		/*
+		 * Nobody reads from the pipe, so the fd stays
+		 * readable for the whole test.
+		 */
+		state->fdes[i] = tevent_add_fd(ev, ev, fd[0], TEVENT_FD_READ,
+					       test_ready_fds_handler, state);
+		torture_assert(tctx, state->fdes[i] != NULL,
+			       "tevent_add_fd failed");
+		tevent_fd_set_auto_close(state->fdes[i]);
+	}
+
+	return true;
+}
+
+static void test_ready_fds_teardown(struct test_ready_fds_state *state)
+{
+	unsigned i;
+
+	for (i = 0; i < state->num_fds; i++) {
+		close(state->fds[i * 2 + 1]);
+	}
+}
+
+static bool test_event_sibling_ready_fd(struct torture_context *tctx,
+					const char *backend,
+					struct test_ready_fds_state *state)
+{
+	struct tevent_context *ev;
+	unsigned i;
+	bool ok;
+
+	ev = tevent_context_init_byname(tctx, backend);
+	if (ev == NULL) {
+		torture_skip(tctx, talloc_asprintf(tctx,
+			     "event backend '%s' not supported\n",
+			     backend));
+		return true;
+	}
+	tevent_set_debug_stderr(ev);
+
+	ok = test_ready_fds_setup(tctx, ev, state, 32);
+	if (!ok) {
+		talloc_free(ev);
+		return false;
+	}
+
+	for (i = 0; i < state->num_fds * 10; i++) {
+		if (tevent_loop_once(ev) == -1) {
+			state->error = "tevent_loop_once failed";
+			break;
+		}
+		if (state->error != NULL) {
+			break;
+		}
+	}
+
+	test_ready_fds_teardown(state);
+	talloc_free(ev);
+
+	torture_assert(tctx, state->error == NULL, state->error);
+
+	return true;
+}
+
+/*
+ * Handlers freeing other fd events must not see them called
+ * afterwards, even if the backend harvested them in the same
+ * batch.
+ */
+static bool test_event_free_ready_fd(struct torture_context *tctx,
+				     const void *test_data)
+{
+	const char *backend = (const char *)test_data;
+	struct test_ready_fds_state state = { .free_sibling = true };
+
+	return test_event_sibling_ready_fd(tctx, backend, &state);
+}
+
+/*
+ * Handlers emptying another fd and changing its flags must not see
+ * its handler called for the readiness the backend harvested before.
+ */
+static bool test_event_drain_ready_fd(struct torture_context *tctx,
+				      const void *test_data)
+{
+	const char *backend = (const char *)test_data;
+	struct test_ready_fds_state state = { .drain_sibling = true };
+
+	return test_event_sibling_ready_fd(tctx, backend, &state);
+}
+
+/*
+ * Measure how many fd events per second a backend dispatches with
+ * a number of fds that are always readable, and check that none of
+ * them is starved.
+ */
+static bool test_event_ready_fds(struct torture_context *tctx,
+				 const void *test_data)
+{
+	const char *backend = (const char *)test_data;
+	unsigned num_fds = torture_setting_int(tctx, "ready_fds", 64);
+	unsigned num_loops = torture_setting_int(tctx, "ready_fds_loops",
+						 100000);
+	struct test_ready_fds_state state = { .free_sibling = false };
+	struct tevent_context *ev;
+	struct timeval start;
+	double elapsed;
+	unsigned min_count = UINT_MAX;
+	unsigned max_count = 0;
+	unsigned i;
+	bool ok;
+
+	ev = tevent_context_init_byname(tctx, backend);
+	if (ev == NULL) {
+		torture_skip(tctx, talloc_asprintf(tctx,
+			     "event backend '%s' not supported\n",
+			     backend));
+		return true;
+	}
+	tevent_set_debug_stderr(ev);
+
+	ok = test_ready_fds_setup(tctx, ev, &state, num_fds);
+	if (!ok) {
+		talloc_free(ev);
+		return false;
+	}
+
+	start = timeval_current();
+	for (i = 0; i < num_loops; i++) {
+		if (tevent_loop_once(ev) == -1) {
+			state.error = "tevent_loop_once failed";
+			break;
+		}
+	}
+	elapsed = timeval_elapsed(&start);
+
+	for (i = 0; i < num_fds; i++) {
+		min_count = MIN(min_count, state.counts[i]);
+		max_count = MAX(max_count, state.counts[i]);
+	}
+
+	test_ready_fds_teardown(&state);
+	talloc_free(ev);
+
+	torture_assert(tctx, state.error == NULL, state.error);
+
+	torture_comment(tctx, "backend '%s' - %u fds: %u events in %.3fs "
+			"(%.0f events/sec), %u to %u per fd\n",
+			backend, num_fds, state.num_events, elapsed,
+			elapsed > 0 ? state.num_events / elapsed : 0.0,
+			min_count, max_count);
+
+	torture_assert(tctx, min_count > 0, "an fd was starved");
+	torture_assert(tctx, max_count - min_count <= max_count / 2,
+		       "fd events were not dispatched fairly");
+
+	return true;
+}
+
+#ifdef HAVE_TEVENT_URING
+struct test_uring_buffers {
+	struct iovec iov;
+	char data[16];
+};
+
+static struct tevent_req *test_uring_readv_send(TALLOC_CTX *mem_ctx,
+						struct tevent_context *ev,
+						int fd)
+{
+	struct test_uring_buffers *b = NULL;
+	struct io_uring_sqe sqe = {
+		.opcode = IORING_OP_READV,
+		.fd = fd,
+		.len = 1,
+	};
+
+	b = talloc_zero(mem_ctx, struct test_uring_buffers);
+	if (b == NULL) {
+		return NULL;
+	}
+	b->iov = (struct iovec) {
+		.iov_base = b->data,
+		.iov_len = sizeof(b->data),
+	};
+	sqe.addr = (uint64_t)(uintptr_t)&b->iov;
+
+	return tevent_uring_sqe_send(mem_ctx, ev, &sqe, b);
+}
+#endif
+
+/*
+ * Operations queued with tevent_uring_sqe_send() complete on
+ * io_uring contexts and fail with ENOSYS everywhere else.
+ */
+static bool test_event_uring_sqe(struct torture_context *tctx,
+				 const void *test_data)
+{
+	struct tevent_context *ev = NULL;
+	const char *backend = (const char *)test_data;
+	struct tevent_req *req = NULL;
+	int32_t res = 0;
+	int ret;
+
+	ev = tevent_context_init_byname(tctx, backend);
+	if (ev == NULL) {
+		torture_skip(tctx, talloc_asprintf(tctx,
+			     "event backend '%s' not supported\n",
+			     backend));
+		return true;
+	}
+
+	if (!tevent_context_have_uring(ev)) {
+		req = tevent_uring_sqe_send(ev, ev, NULL, NULL);
+		torture_assert(tctx, req != NULL,
+			       "tevent_uring_sqe_send failed");
+		torture_assert(tctx, tevent_req_poll(req, ev),
+			       "tevent_req_poll failed");
+		ret = tevent_uring_sqe_recv(req, NULL, &res, NULL);
+		torture_assert_int_equal(tctx, ret, ENOSYS,
+					 "expected ENOSYS");
+		talloc_free(ev);
+		return true;
+	}
+
+#ifdef HAVE_TEVENT_URING
+	{
+		struct test_uring_buffers *b = NULL;
+		struct tevent_req *wakeup = NULL;
+		char hello[] = "hello";
+		int fds[2];
+
+		ret = pipe(fds);
+		torture_assert(tctx, ret == 0, "pipe failed");
+
+		do_write(fds[1], hello, 5);
+
+		req = test_uring_readv_send(ev, ev, fds[0]);
+		torture_assert(tctx, req != NULL,
+			       "tevent_uring_sqe_send failed");
+		torture_assert(tctx, tevent_req_poll(req, ev),
+			       "tevent_req_poll failed");
+		ret = tevent_uring_sqe_recv(req, ev, &res, &b);
+		torture_assert_int_equal(tctx, ret, 0,
+					 "tevent_uring_sqe_recv failed");
+		torture_assert_int_equal(tctx, res, 5, "short read");
+		torture_assert(tctx, memcmp(b->data, "hello", 5) == 0,
+			       "wrong data");
+		TALLOC_FREE(req);
+		TALLOC_FREE(b);
+
+		/*
+		 * Freeing a pending request cancels it, the buffers
+		 * stay with the ring until the kernel is done.
+		 */
+		req = test_uring_readv_send(ev, ev, fds[0]);
+		torture_assert(tctx, req != NULL,
+			       "tevent_uring_sqe_send failed");
+		wakeup = tevent_wakeup_send(ev, ev,
+					    timeval_current_ofs(0, 1000));
+		torture_assert(tctx, wakeup != NULL,
+			       "tevent_wakeup_send failed");
+		torture_assert(tctx, tevent_req_poll(wakeup, ev),
+			       "tevent_req_poll failed");
+		TALLOC_FREE(wakeup);
+		torture_assert(tctx, tevent_req_is_in_progress(req),
+			       "read from an empty pipe completed");
+		TALLOC_FREE(req);
+
+		do_write(fds[1], hello, 5);
+
+		req = test_uring_readv_send(ev, ev, fds[0]);
+		torture_assert(tctx, req != NULL,
+			       "tevent_uring_sqe_send failed");
+		torture_assert(tctx, tevent_req_poll(req, ev),
+			       "tevent_req_poll failed");
+		ret = tevent_uring_sqe_recv(req, ev, &res, &b);
+		torture_assert_int_equal(tctx, ret, 0,
+					 "tevent_uring_sqe_recv failed");
+		torture_assert_int_equal(tctx, res, 5,
+					 "cancelled read consumed data");
+		TALLOC_FREE(req);
+
+		/* this one is still pending when the context goes away */
+		req = test_uring_readv_send(tctx, ev, fds[0]);
+		torture_assert(tctx, req != NULL,
+			       "tevent_uring_sqe_send failed");
+		talloc_free(ev);
+		TALLOC_FREE(req);
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+#endif
+
+	return true;
+}
+
 struct test_wrapper_state {
 	struct torture_context *tctx;
 	int num_events;
@@ -1761,6 +2151,157 @@ static bool test_multi_tevent_threaded_2(struct torture_context *test,
 	talloc_free(ev);
 	return true;
 }
+
+/*
+ * Many threads scheduling immediates into one event context at
+ * full speed, as the pthreadpool_tevent job completions do.
+ */
+struct threaded_bench_producer;
+
+struct threaded_bench_item {
+	struct threaded_bench_producer *producer;
+	unsigned seq;
+};
+
+struct threaded_bench_producer {
+	pthread_t thread;
+	struct tevent_threaded_context *tctx;
+	struct tevent_immediate **ims;
+	struct threaded_bench_item *items;
+	unsigned num_ims;
+	unsigned next_seq;
+	bool out_of_order;
+};
+
+static unsigned threaded_bench_done;
+
+static void threaded_bench_handler(struct tevent_context *ev,
+				   struct tevent_immediate *im,
+				   void *private_data)
+{
+	struct threaded_bench_item *item = private_data;
+	struct threaded_bench_producer *producer = item->producer;
+
+	if (item->seq != producer->next_seq) {
+		producer->out_of_order = true;
+	}
+	producer->next_seq = item->seq + 1;
+	threaded_bench_done += 1;
+}
+
+static void *threaded_bench_fn(void *private_data)
+{
+	struct threaded_bench_producer *producer = private_data;
+	unsigned i;
+
+	for (i = 0; i < producer->num_ims; i++) {
+		tevent_threaded_schedule_immediate(producer->tctx,
+						   producer->ims[i],
+						   threaded_bench_handler,
+						   &producer->items[i]);
+	}
+
+	return NULL;
+}
+
+static void threaded_bench_trace(enum tevent_trace_point point,
+				 void *private_data)
+{
+	unsigned *num_waits = private_data;
+
+	if (point == TEVENT_TRACE_BEFORE_WAIT) {
+		*num_waits += 1;
+	}
+}
+
+static bool test_threaded_immediates_bench(struct torture_context *test,
+					   const void *test_data)
+{
+	unsigned num_threads =
+		torture_setting_int(test, "threaded_producers", 16);
+	unsigned num_ims =
+		torture_setting_int(test, "threaded_immediates", 10000);
+	struct threaded_bench_producer *producers = NULL;
+	struct tevent_context *ev = NULL;
+	struct tevent_threaded_context *tctx = NULL;
+	struct timeval start;
+	unsigned num_waits = 0;
+	double elapsed;
+	unsigned i, j;
+	int ret;
+
+	threaded_bench_done = 0;
+
+	ev = tevent_context_init(test);
+	torture_assert(test, ev != NULL, "tevent_context_init failed");
+
+	tctx = tevent_threaded_context_create(ev, ev);
+	torture_assert(test, tctx != NULL,
+		       "tevent_threaded_context_create failed");
+
+	producers = talloc_zero_array(ev, struct threaded_bench_producer,
+				      num_threads);
+	torture_assert(test, producers != NULL, "talloc failed");
+
+	for (i = 0; i < num_threads; i++) {
+		struct threaded_bench_producer *p = &producers[i];
+
+		p->tctx = tctx;
+		p->num_ims = num_ims;
+		p->ims = talloc_array(producers, struct tevent_immediate *,
+				      num_ims);
+		torture_assert(test, p->ims != NULL, "talloc failed");
+		p->items = talloc_array(producers, struct threaded_bench_item,
+					num_ims);
+		torture_assert(test, p->items != NULL, "talloc failed");
+
+		for (j = 0; j < num_ims; j++) {
+			p->items[j] = (struct threaded_bench_item) {
+				.producer = p, .seq = j,
+			};
+			p->ims[j] = tevent_create_immediate(p->ims);
+			torture_assert(test, p->ims[j] != NULL,
+				       "tevent_create_immediate failed");
+		}
+	}
+
+	tevent_set_trace_callback(ev, threaded_bench_trace, &num_waits);
+
+	start = timeval_current();
+
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_create(&producers[i].thread, NULL,
+				     threaded_bench_fn, &producers[i]);
+		torture_assert(test, ret == 0, "pthread_create failed");
+	}
+
+	while (threaded_bench_done < num_threads * num_ims) {
+		ret = tevent_loop_once(ev);
+		torture_assert(test, ret == 0, "tevent_loop_once failed");
+	}
+
+	elapsed = timeval_elapsed(&start);
+
+	tevent_set_trace_callback(ev, NULL, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		void *retval;
+		ret = pthread_join(producers[i].thread, &retval);
+		torture_assert(test, ret == 0, "pthread_join failed");
+		torture_assert(test, !producers[i].out_of_order,
+			       "immediates of a thread ran out of order");
+	}
+
+	torture_comment(test, "%u threads scheduled %u immediates in %.3fs "
+			"(%.0f immediates/sec), the loop waited %u times\n",
+			num_threads, threaded_bench_done, elapsed,
+			elapsed > 0 ? threaded_bench_done / elapsed : 0.0,
+			num_waits);
+
+	talloc_free(tctx);
+	talloc_free(ev);
+	return true;
+}
 #endif
 
 struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
@@ -1786,6 +2327,22 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					       "fd2",
 					       test_event_fd2,
 					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "free_ready_fd",
+					       test_event_free_ready_fd,
+					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "drain_ready_fd",
+					       test_event_drain_ready_fd,
+					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "ready_fds",
+					       test_event_ready_fds,
+					       (const void *)list[i]);
+		torture_suite_add_simple_tcase_const(backend_suite,
+					       "uring_sqe",
+					       test_event_uring_sqe,
+					       (const void *)list[i]);
 		torture_suite_add_simple_tcase_const(backend_suite,
 					       "wrapper",
 					       test_wrapper,
@@ -1815,6 +2372,10 @@ struct torture_suite *torture_local_event(TALLOC_CTX *mem_ctx)
 					     test_multi_tevent_threaded_2,
 					     NULL);
 
+	torture_suite_add_simple_tcase_const(suite, "threaded_immediates_bench",
+					     test_threaded_immediates_bench,
+					     NULL);
+
 #endif
 
 	return suite;
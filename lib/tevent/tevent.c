@@ -133,6 +133,9 @@ static void tevent_backend_init(void)
 #elif defined(HAVE_SOLARIS_PORTS)
 	tevent_port_init();
 #endif
+#ifdef HAVE_TEVENT_URING
+	tevent_uring_init();
+#endif
 
 	tevent_standard_init();
 }
@@ -201,16 +204,18 @@ static void tevent_atfork_prepare(void)
 
 		for (tctx = ev->threaded_contexts; tctx != NULL;
 		     tctx = tctx->next) {
-			ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
+			ret = pthread_rwlock_wrlock(&tctx->event_ctx_lock);
 			if (ret != 0) {
-				tevent_abort(ev, "pthread_mutex_lock failed");
+				tevent_abort(ev, "pthread_rwlock_wrlock failed");
 			}
 		}
 
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
 		ret = pthread_mutex_lock(&ev->scheduled_mutex);
 		if (ret != 0) {
 			tevent_abort(ev, "pthread_mutex_lock failed");
 		}
+#endif
 	}
 }
 
@@ -223,17 +228,19 @@ static void tevent_atfork_parent(void)
 	     ev = DLIST_PREV(ev)) {
 		struct tevent_threaded_context *tctx;
 
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
 		ret = pthread_mutex_unlock(&ev->scheduled_mutex);
 		if (ret != 0) {
 			tevent_abort(ev, "pthread_mutex_unlock failed");
 		}
+#endif
 
 		for (tctx = DLIST_TAIL(ev->threaded_contexts); tctx != NULL;
 		     tctx = DLIST_PREV(tctx)) {
-			ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+			ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 			if (ret != 0) {
 				tevent_abort(
-					ev, "pthread_mutex_unlock failed");
+					ev, "pthread_rwlock_unlock failed");
 			}
 		}
 	}
@@ -257,19 +264,21 @@ static void tevent_atfork_child(void)
 		     tctx = DLIST_PREV(tctx)) {
 			tctx->event_ctx = NULL;
 
-			ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+			ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 			if (ret != 0) {
 				tevent_abort(
-					ev, "pthread_mutex_unlock failed");
+					ev, "pthread_rwlock_unlock failed");
 			}
 		}
 
 		ev->threaded_contexts = NULL;
 
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
 		ret = pthread_mutex_unlock(&ev->scheduled_mutex);
 		if (ret != 0) {
 			tevent_abort(ev, "pthread_mutex_unlock failed");
 		}
+#endif
 	}
 
 	ret = pthread_mutex_unlock(&tevent_contexts_mutex);
@@ -324,7 +333,7 @@ int tevent_common_context_destructor(struct tevent_context *ev)
 	while (ev->threaded_contexts != NULL) {
 		struct tevent_threaded_context *tctx = ev->threaded_contexts;
 
-		ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
+		ret = pthread_rwlock_wrlock(&tctx->event_ctx_lock);
 		if (ret != 0) {
 			abort();
 		}
@@ -333,12 +342,12 @@ int tevent_common_context_destructor(struct tevent_context *ev)
 		 * Indicate to the thread that the tevent_context is
 		 * gone. The counterpart of this is in
 		 * _tevent_threaded_schedule_immediate, there we read
-		 * this under the threaded_context's mutex.
+		 * this under the threaded_context's read lock.
 		 */
 
 		tctx->event_ctx = NULL;
 
-		ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+		ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 		if (ret != 0) {
 			abort();
 		}
@@ -346,10 +355,12 @@ int tevent_common_context_destructor(struct tevent_context *ev)
 		DLIST_REMOVE(ev->threaded_contexts, tctx);
 	}
 
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
 	ret = pthread_mutex_destroy(&ev->scheduled_mutex);
 	if (ret != 0) {
 		abort();
 	}
+#endif
 #endif
 
 	for (gl = ev->wrapper.list; gl; gl = gn) {
@@ -423,14 +434,18 @@ static int tevent_common_context_constructor(struct tevent_context *ev)
 		return ret;
 	}
 
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
 	ret = pthread_mutex_init(&ev->scheduled_mutex, NULL);
 	if (ret != 0) {
 		return ret;
 	}
+#endif
 
 	ret = pthread_mutex_lock(&tevent_contexts_mutex);
 	if (ret != 0) {
+#ifndef HAVE___ATOMIC_COMPARE_EXCHANGE_N
 		pthread_mutex_destroy(&ev->scheduled_mutex);
+#endif
 		return ret;
 	}
 
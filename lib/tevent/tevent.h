@@ -1592,6 +1592,84 @@ struct tevent_req *tevent_wakeup_send(TALLOC_CTX *mem_ctx,
  */
 bool tevent_wakeup_recv(struct tevent_req *req);
 
+struct io_uring_sqe;
+
+/**
+ * @brief Check if an event context runs on an io_uring.
+ *
+ * Only event contexts created with the "io_uring" backend
+ * (and wrappers around them) accept submissions via
+ * tevent_uring_sqe_send().
+ *
+ * @param[in]  ev       The event context to check.
+ *
+ * @return              True if tevent_uring_sqe_send() can be used.
+ *
+ * @note Available as of tevent 0.10.3
+ */
+bool tevent_context_have_uring(struct tevent_context *ev);
+
+/**
+ * @brief Queue an operation on the io_uring of an event context.
+ *
+ * The submission queue entry is copied onto the ring of the event
+ * loop and submitted together with the loop's own requests the next
+ * time it waits for events, so socket and file I/O can share the
+ * ring with the fd and timer events. The user_data of the entry is
+ * reserved for tevent.
+ *
+ * All memory the kernel accesses (data buffers, iovecs, sockaddrs...)
+ * has to be passed as talloc children of the buffers argument. The
+ * ring takes ownership of it until the operation completed, even if
+ * the request is freed before: freeing the request cancels the
+ * operation, but the buffers are only freed after the kernel
+ * reported the completion.
+ *
+ * @param[in]  mem_ctx  The talloc memory context to use.
+ *
+ * @param[in]  ev       The event context to work on.
+ *
+ * @param[in]  sqe      The submission queue entry to queue.
+ *
+ * @param[in]  buffers  The talloc memory used by the operation, may be NULL.
+ *
+ * @return              The new request, NULL on error. Fails with ENOSYS
+ *                      if the event context doesn't run on an io_uring.
+ *
+ * @see tevent_uring_sqe_recv()
+ * @see tevent_context_have_uring()
+ *
+ * @note Available as of tevent 0.10.3
+ */
+struct tevent_req *tevent_uring_sqe_send(TALLOC_CTX *mem_ctx,
+					 struct tevent_context *ev,
+					 const struct io_uring_sqe *sqe,
+					 void *buffers);
+
+/**
+ * @brief Get the result of an operation queued on the io_uring.
+ *
+ * @param[in]  req      The tevent request to check.
+ *
+ * @param[in]  mem_ctx  The talloc memory context to move the buffers to.
+ *
+ * @param[out] res      The res field of the completion queue entry,
+ *                      a negative errno on failure.
+ *
+ * @param[out] pbuffers A pointer to a void pointer receiving the buffers
+ *                      passed to tevent_uring_sqe_send(), may be NULL.
+ *
+ * @return              0 if the operation completed, an errno otherwise.
+ *
+ * @see tevent_uring_sqe_send()
+ *
+ * @note Available as of tevent 0.10.3
+ */
+int tevent_uring_sqe_recv(struct tevent_req *req,
+			  TALLOC_CTX *mem_ctx,
+			  int32_t *res,
+			  void *pbuffers);
+
 /* @} */
 
 /**
@@ -32,6 +32,11 @@
 #include "tevent_internal.h"
 #include "tevent_util.h"
 
+/*
+ * The number of events harvested by a single epoll_wait() call.
+ */
+#define MAXEVENTS 64
+
 struct epoll_event_context {
 	/* a pointer back to the generic event_context */
 	struct tevent_context *ev;
@@ -41,6 +46,16 @@ struct epoll_event_context {
 
 	pid_t pid;
 
+	/*
+	 * The events returned by the last epoll_wait(), only
+	 * events[next_event] to events[num_events-1] are still to
+	 * be dispatched. An event of an fde that is freed or gets
+	 * new flags in the meantime has its data.ptr set to NULL.
+	 */
+	struct epoll_event events[MAXEVENTS];
+	int num_events;
+	int next_event;
+
 	bool panic_force_replay;
 	bool *panic_state;
 	bool (*panic_fallback)(struct tevent_context *ev, bool replay);
@@ -179,6 +194,21 @@ static uint32_t epoll_map_flags(uint16_t flags)
 	return ret;
 }
 
+/*
+  drop the not yet dispatched events of an fde
+*/
+static void epoll_forget_events(struct epoll_event_context *epoll_ev,
+				struct tevent_fd *fde)
+{
+	int i;
+
+	for (i = epoll_ev->next_event; i < epoll_ev->num_events; i++) {
+		if (epoll_ev->events[i].data.ptr == fde) {
+			epoll_ev->events[i].data.ptr = NULL;
+		}
+	}
+}
+
 /*
  free the epoll fd
 */
@@ -229,6 +259,10 @@ static void epoll_check_reopen(struct epoll_event_context *epoll_ev)
 		return;
 	}
 
+	/* The events we harvested belong to our parent */
+	epoll_ev->num_events = 0;
+	epoll_ev->next_event = 0;
+
 	close(epoll_ev->epoll_fd);
 	epoll_ev->epoll_fd = epoll_create(64);
 	if (epoll_ev->epoll_fd == -1) {
@@ -625,17 +659,28 @@ static bool epoll_handle_hup_or_err(struct epoll_event_context *epoll_ev,
 	return false;
 }
 
+static int epoll_dispatch_events(struct epoll_event_context *epoll_ev);
+
 /*
   event loop handling using epoll
 */
 static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval *tvalp)
 {
-	int ret, i;
-#define MAXEVENTS 1
-	struct epoll_event events[MAXEVENTS];
+	int ret;
 	int timeout = -1;
 	int wait_errno;
 
+	if (epoll_ev->next_event < epoll_ev->num_events) {
+		/*
+		 * Only one handler is called per loop_once, so timers,
+		 * immediates and signals get their turn between the
+		 * events we already have. Ask the kernel again only
+		 * once every fd of the last batch had its turn, which
+		 * keeps busy fds from starving the others.
+		 */
+		return epoll_dispatch_events(epoll_ev);
+	}
+
 	if (tvalp) {
 		/* it's better to trigger timed events a bit later than too early */
 		timeout = ((tvalp->tv_usec+999) / 1000) + (tvalp->tv_sec*1000);
@@ -647,7 +692,7 @@ static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval
 	}
 
 	tevent_trace_point_callback(epoll_ev->ev, TEVENT_TRACE_BEFORE_WAIT);
-	ret = epoll_wait(epoll_ev->epoll_fd, events, MAXEVENTS, timeout);
+	ret = epoll_wait(epoll_ev->epoll_fd, epoll_ev->events, MAXEVENTS, timeout);
 	wait_errno = errno;
 	tevent_trace_point_callback(epoll_ev->ev, TEVENT_TRACE_AFTER_WAIT);
 
@@ -668,12 +713,30 @@ static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval
 		return 0;
 	}
 
-	for (i=0;i<ret;i++) {
-		struct tevent_fd *fde = talloc_get_type(events[i].data.ptr,
-						       struct tevent_fd);
+	epoll_ev->num_events = MAX(ret, 0);
+	epoll_ev->next_event = 0;
+
+	return epoll_dispatch_events(epoll_ev);
+}
+
+/*
+  call the handler of the next harvested event that is still wanted
+*/
+static int epoll_dispatch_events(struct epoll_event_context *epoll_ev)
+{
+	while (epoll_ev->next_event < epoll_ev->num_events) {
+		struct epoll_event *event =
+			&epoll_ev->events[epoll_ev->next_event++];
+		struct tevent_fd *fde = NULL;
 		uint16_t flags = 0;
 		struct tevent_fd *mpx_fde = NULL;
 
+		if (event->data.ptr == NULL) {
+			/* The fde was freed by an earlier handler */
+			continue;
+		}
+
+		fde = talloc_get_type(event->data.ptr, struct tevent_fd);
 		if (fde == NULL) {
 			epoll_panic(epoll_ev, "epoll_wait() gave bad data", true);
 			return -1;
@@ -686,7 +749,7 @@ static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval
 			mpx_fde = talloc_get_type_abort(fde->additional_data,
 							struct tevent_fd);
 		}
-		if (events[i].events & (EPOLLHUP|EPOLLERR)) {
+		if (event->events & (EPOLLHUP|EPOLLERR)) {
 			bool handled_fde = epoll_handle_hup_or_err(epoll_ev, fde);
 			bool handled_mpx = epoll_handle_hup_or_err(epoll_ev, mpx_fde);
 
@@ -706,8 +769,8 @@ static int epoll_event_loop(struct epoll_event_context *epoll_ev, struct timeval
 			}
 			flags |= TEVENT_FD_READ;
 		}
-		if (events[i].events & EPOLLIN) flags |= TEVENT_FD_READ;
-		if (events[i].events & EPOLLOUT) flags |= TEVENT_FD_WRITE;
+		if (event->events & EPOLLIN) flags |= TEVENT_FD_READ;
+		if (event->events & EPOLLOUT) flags |= TEVENT_FD_WRITE;
 
 		if (flags & TEVENT_FD_WRITE) {
 			if (fde->flags & TEVENT_FD_WRITE) {
@@ -794,6 +857,12 @@ static int epoll_event_fd_destructor(struct tevent_fd *fde)
 	 */
 	DLIST_REMOVE(ev->fd_events, fde);
 
+	/*
+	 * An event harvested together with the one whose handler
+	 * is freeing us must not be dispatched to freed memory.
+	 */
+	epoll_forget_events(epoll_ev, fde);
+
 	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
 		mpx_fde = talloc_get_type_abort(fde->additional_data,
 						struct tevent_fd);
@@ -884,6 +953,17 @@ static void epoll_event_set_fd_flags(struct tevent_fd *fde, uint16_t flags)
 
 	fde->flags = flags;
 
+	/*
+	 * A harvested event may be stale by now, e.g. the fd was
+	 * drained while its handler waited for nothing. The fd is
+	 * level triggered, so if it is still ready the next
+	 * epoll_wait() reports it again.
+	 */
+	epoll_forget_events(epoll_ev, fde);
+	if (fde->additional_flags & EPOLL_ADDITIONAL_FD_FLAG_HAS_MPX) {
+		epoll_forget_events(epoll_ev, fde->additional_data);
+	}
+
 	epoll_ev->panic_state = &panic_triggered;
 	epoll_check_reopen(epoll_ev);
 	if (panic_triggered) {
@@ -263,7 +263,11 @@ struct tevent_threaded_context {
 	struct tevent_threaded_context *next, *prev;
 
 #ifdef HAVE_PTHREAD
-	pthread_mutex_t event_ctx_mutex;
+	/*
+	 * Read locked by the threads scheduling immediates,
+	 * write locked to change event_ctx.
+	 */
+	pthread_rwlock_t event_ctx_lock;
 #endif
 	struct tevent_context *event_ctx;
 };
@@ -307,9 +311,17 @@ struct tevent_context {
 	/* list of timed events - used by common code */
 	struct tevent_timer *timer_events;
 
+#ifdef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+	/*
+	 * Immediates scheduled from other threads, a lock-free
+	 * stack (newest first) only accessed with atomic operations.
+	 */
+	struct tevent_immediate *scheduled_immediates;
+#else
 	/* List of scheduled immediates */
 	pthread_mutex_t scheduled_mutex;
 	struct tevent_immediate *scheduled_immediates;
+#endif
 
 	/* this is private for the events_ops implementation */
 	void *additional_data;
@@ -465,6 +477,9 @@ void tevent_epoll_set_panic_fallback(struct tevent_context *ev,
 #ifdef HAVE_SOLARIS_PORTS
 bool tevent_port_init(void);
 #endif
+#ifdef HAVE_TEVENT_URING
+bool tevent_uring_init(void);
+#endif
 
 
 void tevent_trace_point_callback(struct tevent_context *ev,
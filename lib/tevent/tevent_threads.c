@@ -396,22 +396,22 @@ static int tevent_threaded_context_destructor(
 
 	/*
 	 * We have to coordinate with _tevent_threaded_schedule_immediate's
-	 * unlock of the event_ctx_mutex. We're in the main thread here,
+	 * unlock of the event_ctx_lock. We're in the main thread here,
 	 * and we can be scheduled before the helper thread finalizes its
 	 * call _tevent_threaded_schedule_immediate. This means we would
-	 * pthreadpool_destroy a locked mutex, which is illegal.
+	 * destroy a locked rwlock, which is illegal.
 	 */
-	ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
+	ret = pthread_rwlock_wrlock(&tctx->event_ctx_lock);
 	if (ret != 0) {
 		abort();
 	}
 
-	ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+	ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 	if (ret != 0) {
 		abort();
 	}
 
-	ret = pthread_mutex_destroy(&tctx->event_ctx_mutex);
+	ret = pthread_rwlock_destroy(&tctx->event_ctx_lock);
 	if (ret != 0) {
 		abort();
 	}
@@ -439,7 +439,7 @@ struct tevent_threaded_context *tevent_threaded_context_create(
 	}
 	tctx->event_ctx = ev;
 
-	ret = pthread_mutex_init(&tctx->event_ctx_mutex, NULL);
+	ret = pthread_rwlock_init(&tctx->event_ctx_lock, NULL);
 	if (ret != 0) {
 		TALLOC_FREE(tctx);
 		return NULL;
@@ -474,9 +474,14 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	const char *create_location = im->create_location;
 	struct tevent_context *main_ev = NULL;
 	struct tevent_wrapper_glue *glue = NULL;
+	struct tevent_immediate *head = NULL;
 	int ret, wakeup_fd;
 
-	ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
+	/*
+	 * Many threads can schedule immediates at the same time, the
+	 * lock only keeps the event context from going away under us.
+	 */
+	ret = pthread_rwlock_rdlock(&tctx->event_ctx_lock);
 	if (ret != 0) {
 		abort();
 	}
@@ -485,7 +490,7 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 		/*
 		 * Our event context is already gone.
 		 */
-		ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+		ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 		if (ret != 0) {
 			abort();
 		}
@@ -524,31 +529,58 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 	 */
 	talloc_set_destructor(im, tevent_threaded_schedule_immediate_destructor);
 
+#ifdef HAVE___ATOMIC_COMPARE_EXCHANGE_N
+	/*
+	 * Push onto the lock-free stack, the release makes the
+	 * initialization of im visible to the main thread.
+	 */
+	head = __atomic_load_n(&main_ev->scheduled_immediates,
+			       __ATOMIC_RELAXED);
+	do {
+		im->next = head;
+	} while (!__atomic_compare_exchange_n(&main_ev->scheduled_immediates,
+					      &head, im, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+#else
 	ret = pthread_mutex_lock(&main_ev->scheduled_mutex);
 	if (ret != 0) {
 		abort();
 	}
 
+	head = main_ev->scheduled_immediates;
 	DLIST_ADD_END(main_ev->scheduled_immediates, im);
-	wakeup_fd = main_ev->wakeup_fd;
 
 	ret = pthread_mutex_unlock(&main_ev->scheduled_mutex);
 	if (ret != 0) {
 		abort();
 	}
+#endif
+	wakeup_fd = main_ev->wakeup_fd;
 
-	ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+	ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 	if (ret != 0) {
 		abort();
 	}
 
+	if (head != NULL) {
+		/*
+		 * The stack was not empty, so whoever pushed onto the
+		 * empty stack already woke up the main thread and it
+		 * did not collect the stack yet. A burst of
+		 * immediates only costs a single wakeup. The same
+		 * holds for the list of the mutex based fallback.
+		 */
+		return;
+	}
+
 	/*
 	 * We might want to wake up the main thread under the lock. We
 	 * had a slightly similar situation in pthreadpool, changed
 	 * with 1c4284c7395f23. This is not exactly the same, as the
 	 * wakeup is only a last-resort thing in case the main thread
 	 * is sleeping. Doing the wakeup under the lock can easily
-	 * lead to a contended mutex, which is much more expensive
+	 * lead to a contended lock, which is much more expensive
 	 * than a noncontended one. So I'd opt for the lower footprint
 	 * initially. Maybe we have to change that later.
 	 */
@@ -563,7 +595,52 @@ void _tevent_threaded_schedule_immediate(struct tevent_threaded_context *tctx,
 
 void tevent_common_threaded_activate_immediate(struct tevent_context *ev)
 {
-#ifdef HAVE_PTHREAD
+#if defined(HAVE_PTHREAD) && defined(HAVE___ATOMIC_COMPARE_EXCHANGE_N)
+	struct tevent_immediate *list = NULL;
+	struct tevent_immediate *next = NULL;
+	struct tevent_immediate *im = NULL;
+
+	if (__atomic_load_n(&ev->scheduled_immediates,
+			    __ATOMIC_RELAXED) == NULL) {
+		return;
+	}
+
+	/*
+	 * Take the whole stack, the acquire pairs with the release
+	 * in _tevent_threaded_schedule_immediate. Threads pushing
+	 * from now on find an empty stack and wake us up again.
+	 */
+	im = __atomic_exchange_n(&ev->scheduled_immediates, NULL,
+				 __ATOMIC_ACQUIRE);
+
+	/*
+	 * The stack is newest first, reverse it to run the
+	 * immediates in the order they were scheduled.
+	 */
+	for (; im != NULL; im = next) {
+		next = im->next;
+		im->next = list;
+		list = im;
+	}
+
+	for (im = list; im != NULL; im = next) {
+		struct tevent_immediate copy = *im;
+
+		next = im->next;
+		im->next = NULL;
+
+		tevent_debug(ev, TEVENT_DEBUG_TRACE,
+			     "Schedule immediate event \"%s\": %p from thread into main\n",
+			     im->handler_name, im);
+		im->handler_name = NULL;
+		_tevent_schedule_immediate(im,
+					   ev,
+					   copy.handler,
+					   copy.private_data,
+					   copy.handler_name,
+					   copy.schedule_location);
+	}
+#elif defined(HAVE_PTHREAD)
 	int ret;
 	ret = pthread_mutex_lock(&ev->scheduled_mutex);
 	if (ret != 0) {
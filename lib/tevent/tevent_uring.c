@@ -0,0 +1,1259 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   main select loop and event handling - io_uring implementation
+
+     ** NOTE! The following LGPL license applies to the tevent
+     ** library. This does NOT imply that all of Samba is released
+     ** under the LGPL
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "replace.h"
+#include "system/filesys.h"
+#include "system/select.h"
+#include "tevent.h"
+#include "tevent_internal.h"
+#include "tevent_util.h"
+
+struct tevent_uring_sqe_state {
+	struct uring_op *op;
+	int32_t res;
+	void *buffers;
+};
+
+#ifdef HAVE_TEVENT_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * The number of submission queue entries we ask the kernel for,
+ * the completion queue is twice as large.
+ */
+#define URING_ENTRIES 256
+
+/*
+ * An armed timeout is kept if it fires at most this many
+ * microseconds after the next timer is due, so that we don't
+ * replace it on every loop iteration.
+ */
+#define URING_TIMEOUT_SLACK_USEC 100
+
+/*
+ * Every object we pass to the kernel as user_data starts with
+ * a struct uring_token, user_data 0 marks completions we
+ * are not interested in.
+ */
+enum uring_kind {
+	URING_KIND_FD,
+	URING_KIND_TIMEOUT,
+	URING_KIND_OP,
+};
+
+struct uring_token {
+	struct uring_token *prev, *next;
+	enum uring_kind kind;
+};
+
+/*
+ * The io_uring state of a tevent_fd, hung off fde->additional_data.
+ *
+ * It is allocated on the uring_event_context as the kernel may
+ * still hold a poll request for it after the fde is gone.
+ */
+struct uring_fd_state {
+	struct uring_token token;
+	struct tevent_fd *fde;
+	/* the poll mask of the armed poll request */
+	uint32_t poll_events;
+	/* a poll request is with the kernel */
+	bool armed;
+	/* a POLL_REMOVE for the poll request is submitted */
+	bool cancelling;
+	/* a completion waits in the batch or is being dispatched */
+	bool queued;
+	/* the flags changed since the queued completion was reaped */
+	bool stale;
+};
+
+struct uring_timeout {
+	struct uring_token token;
+	struct __kernel_timespec ts;
+	struct timeval expiry;
+};
+
+struct uring_op {
+	struct uring_token token;
+	struct uring_event_context *uring_ev;
+	/* NULL once the caller is no longer interested */
+	struct tevent_req *req;
+	void *buffers;
+};
+
+struct uring_completion {
+	struct uring_token *token;
+	int32_t res;
+};
+
+struct uring_event_context {
+	/* a pointer back to the generic event_context */
+	struct tevent_context *ev;
+
+	int ring_fd;
+	pid_t pid;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_tail;
+
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* everything the kernel will report a completion for */
+	struct uring_token *inflight;
+
+	/* the timeout armed for the next timer */
+	struct uring_timeout *timeout;
+
+	/*
+	 * The completions harvested from the ring but
+	 * not dispatched yet.
+	 */
+	struct uring_completion *batch;
+	unsigned batch_size;
+	unsigned num_batch;
+	unsigned next_batch;
+};
+
+static const struct tevent_ops uring_event_ops;
+
+static void uring_ring_unmap(struct uring_event_context *uring_ev)
+{
+	if (uring_ev->sqes != NULL) {
+		munmap(uring_ev->sqes, uring_ev->sqes_size);
+		uring_ev->sqes = NULL;
+	}
+	if (uring_ev->cq_ring != NULL &&
+	    uring_ev->cq_ring != uring_ev->sq_ring) {
+		munmap(uring_ev->cq_ring, uring_ev->cq_ring_size);
+	}
+	uring_ev->cq_ring = NULL;
+	if (uring_ev->sq_ring != NULL) {
+		munmap(uring_ev->sq_ring, uring_ev->sq_ring_size);
+		uring_ev->sq_ring = NULL;
+	}
+	if (uring_ev->ring_fd != -1) {
+		close(uring_ev->ring_fd);
+		uring_ev->ring_fd = -1;
+	}
+}
+
+/*
+  create the ring and map the submission and completion queues
+*/
+static int uring_ring_init(struct uring_event_context *uring_ev)
+{
+	struct io_uring_params p = { .flags = 0, };
+	uint8_t *sq_ring = NULL;
+	uint8_t *cq_ring = NULL;
+	unsigned *sq_array = NULL;
+	unsigned i;
+	int fd;
+
+	fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (fd == -1) {
+		return -1;
+	}
+	uring_ev->ring_fd = fd;
+	uring_ev->pid = getpid();
+
+	/*
+	 * Without IORING_FEAT_NODROP the kernel drops completions
+	 * on overflow and we would lose track of our fd events.
+	 */
+	if (!(p.features & IORING_FEAT_NODROP)) {
+		uring_ring_unmap(uring_ev);
+		errno = ENOSYS;
+		return -1;
+	}
+
+	uring_ev->sq_ring_size = p.sq_off.array +
+		p.sq_entries * sizeof(unsigned);
+	uring_ev->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		uring_ev->sq_ring_size = MAX(uring_ev->sq_ring_size,
+					     uring_ev->cq_ring_size);
+		uring_ev->cq_ring_size = uring_ev->sq_ring_size;
+	}
+
+	sq_ring = mmap(NULL, uring_ev->sq_ring_size,
+		       PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+		       fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED) {
+		uring_ring_unmap(uring_ev);
+		return -1;
+	}
+	uring_ev->sq_ring = sq_ring;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq_ring = sq_ring;
+	} else {
+		cq_ring = mmap(NULL, uring_ev->cq_ring_size,
+			       PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+			       fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED) {
+			uring_ring_unmap(uring_ev);
+			return -1;
+		}
+	}
+	uring_ev->cq_ring = cq_ring;
+
+	uring_ev->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	uring_ev->sqes = mmap(NULL, uring_ev->sqes_size,
+			      PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+			      fd, IORING_OFF_SQES);
+	if (uring_ev->sqes == MAP_FAILED) {
+		uring_ev->sqes = NULL;
+		uring_ring_unmap(uring_ev);
+		return -1;
+	}
+
+	uring_ev->sq_khead = (unsigned *)(sq_ring + p.sq_off.head);
+	uring_ev->sq_ktail = (unsigned *)(sq_ring + p.sq_off.tail);
+	uring_ev->sq_mask = *(unsigned *)(sq_ring + p.sq_off.ring_mask);
+	uring_ev->sq_entries = p.sq_entries;
+	uring_ev->sq_tail = *uring_ev->sq_ktail;
+
+	/*
+	 * We always fill the sqes in ring order,
+	 * so the index array is the identity.
+	 */
+	sq_array = (unsigned *)(sq_ring + p.sq_off.array);
+	for (i = 0; i < p.sq_entries; i++) {
+		sq_array[i] = i;
+	}
+
+	uring_ev->cq_khead = (unsigned *)(cq_ring + p.cq_off.head);
+	uring_ev->cq_ktail = (unsigned *)(cq_ring + p.cq_off.tail);
+	uring_ev->cq_mask = *(unsigned *)(cq_ring + p.cq_off.ring_mask);
+	uring_ev->cqes = (struct io_uring_cqe *)(cq_ring + p.cq_off.cqes);
+
+	if (uring_ev->batch_size < p.cq_entries) {
+		struct uring_completion *batch = NULL;
+
+		batch = talloc_realloc(uring_ev, uring_ev->batch,
+				       struct uring_completion,
+				       p.cq_entries);
+		if (batch == NULL) {
+			uring_ring_unmap(uring_ev);
+			errno = ENOMEM;
+			return -1;
+		}
+		uring_ev->batch = batch;
+		uring_ev->batch_size = p.cq_entries;
+	}
+
+	return 0;
+}
+
+/*
+  publish the queued sqes and optionally wait for completions
+*/
+static int uring_enter(struct uring_event_context *uring_ev,
+		       unsigned min_complete)
+{
+	unsigned to_submit;
+	unsigned flags = 0;
+	int ret;
+
+	__atomic_store_n(uring_ev->sq_ktail, uring_ev->sq_tail,
+			 __ATOMIC_RELEASE);
+	to_submit = uring_ev->sq_tail -
+		__atomic_load_n(uring_ev->sq_khead, __ATOMIC_ACQUIRE);
+
+	if (to_submit == 0 && min_complete == 0) {
+		return 0;
+	}
+	if (min_complete > 0) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	ret = syscall(__NR_io_uring_enter, uring_ev->ring_fd,
+		      to_submit, min_complete, flags, NULL, 0);
+	return ret;
+}
+
+static void uring_batch_add(struct uring_event_context *uring_ev,
+			    struct uring_token *token,
+			    int32_t res)
+{
+	if (uring_ev->num_batch == uring_ev->batch_size) {
+		struct uring_completion *batch = NULL;
+		unsigned size = uring_ev->batch_size * 2;
+
+		batch = talloc_realloc(uring_ev, uring_ev->batch,
+				       struct uring_completion, size);
+		if (batch == NULL) {
+			tevent_abort(uring_ev->ev,
+				     "io_uring completion batch "
+				     "allocation failed");
+			return;
+		}
+		uring_ev->batch = batch;
+		uring_ev->batch_size = size;
+	}
+
+	uring_ev->batch[uring_ev->num_batch++] = (struct uring_completion) {
+		.token = token,
+		.res = res,
+	};
+}
+
+/*
+  move the completions from the ring into our batch
+*/
+static void uring_reap(struct uring_event_context *uring_ev)
+{
+	unsigned head = *uring_ev->cq_khead;
+	unsigned tail = __atomic_load_n(uring_ev->cq_ktail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe =
+			&uring_ev->cqes[head & uring_ev->cq_mask];
+		struct uring_token *token =
+			(struct uring_token *)(uintptr_t)cqe->user_data;
+		struct uring_fd_state *state = NULL;
+
+		if (token == NULL) {
+			continue;
+		}
+
+		DLIST_REMOVE(uring_ev->inflight, token);
+
+		switch (token->kind) {
+		case URING_KIND_FD:
+			state = (struct uring_fd_state *)token;
+			state->armed = false;
+			state->cancelling = false;
+			state->queued = true;
+			uring_batch_add(uring_ev, token, cqe->res);
+			break;
+		case URING_KIND_TIMEOUT:
+			if (uring_ev->timeout == (struct uring_timeout *)token) {
+				uring_ev->timeout = NULL;
+			}
+			/*
+			 * Nothing to dispatch, the loop runs the
+			 * timers if nothing else is pending.
+			 */
+			talloc_free(token);
+			break;
+		case URING_KIND_OP:
+			uring_batch_add(uring_ev, token, cqe->res);
+			break;
+		}
+	}
+
+	__atomic_store_n(uring_ev->cq_khead, head, __ATOMIC_RELEASE);
+}
+
+/*
+  get a zeroed submission queue entry, it is submitted
+  with the next uring_enter()
+*/
+static struct io_uring_sqe *uring_get_sqe(struct uring_event_context *uring_ev)
+{
+	struct io_uring_sqe *sqe = NULL;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		unsigned head = __atomic_load_n(uring_ev->sq_khead,
+						__ATOMIC_ACQUIRE);
+
+		if (uring_ev->sq_tail - head < uring_ev->sq_entries) {
+			break;
+		}
+
+		/*
+		 * The queue is full, hand it to the kernel. If that
+		 * fails with EBUSY the completion queue overflowed
+		 * and we need to drain it first.
+		 */
+		uring_reap(uring_ev);
+		uring_enter(uring_ev, 0);
+	}
+
+	if (uring_ev->sq_tail - *uring_ev->sq_khead >= uring_ev->sq_entries) {
+		return NULL;
+	}
+
+	sqe = &uring_ev->sqes[uring_ev->sq_tail & uring_ev->sq_mask];
+	*sqe = (struct io_uring_sqe) { .opcode = IORING_OP_NOP, };
+	uring_ev->sq_tail++;
+
+	return sqe;
+}
+
+static struct io_uring_sqe *uring_get_sqe_abort(
+	struct uring_event_context *uring_ev)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(uring_ev);
+
+	if (sqe == NULL) {
+		tevent_abort(uring_ev->ev,
+			     "io_uring submission queue stuck");
+	}
+	return sqe;
+}
+
+static void uring_submit_cancel(struct uring_event_context *uring_ev,
+				uint8_t opcode,
+				struct uring_token *token)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe_abort(uring_ev);
+
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = opcode;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)token;
+	sqe->user_data = 0;
+}
+
+static uint32_t uring_map_flags(uint16_t flags)
+{
+	uint32_t ret = 0;
+	if (flags & TEVENT_FD_READ) ret |= POLLIN;
+	if (flags & TEVENT_FD_WRITE) ret |= POLLOUT;
+	return ret;
+}
+
+/*
+  arm a one-shot poll request for the fde, if it waits for anything
+*/
+static void uring_fd_arm(struct uring_event_context *uring_ev,
+			 struct uring_fd_state *state)
+{
+	struct io_uring_sqe *sqe = NULL;
+	uint32_t poll_events;
+
+	if (state->fde == NULL || state->armed || state->queued) {
+		return;
+	}
+
+	poll_events = uring_map_flags(state->fde->flags);
+	if (poll_events == 0) {
+		return;
+	}
+
+	sqe = uring_get_sqe_abort(uring_ev);
+	if (sqe == NULL) {
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = state->fde->fd;
+#ifdef WORDS_BIGENDIAN
+	sqe->poll32_events = (poll_events << 16) | (poll_events >> 16);
+#else
+	sqe->poll32_events = poll_events;
+#endif
+	sqe->user_data = (uint64_t)(uintptr_t)state;
+
+	state->poll_events = poll_events;
+	state->armed = true;
+	DLIST_ADD_END(uring_ev->inflight, &state->token);
+}
+
+/*
+  forget the io_uring state inherited from the parent and
+  start over with a new ring
+*/
+static void uring_check_reopen(struct uring_event_context *uring_ev)
+{
+	struct uring_token *token = NULL;
+	struct uring_token *next = NULL;
+	struct tevent_fd *fde = NULL;
+	int ret;
+
+	if (uring_ev->pid == getpid()) {
+		return;
+	}
+
+	/*
+	 * The rings are shared memory with the parent,
+	 * we must not touch them anymore.
+	 */
+	uring_ring_unmap(uring_ev);
+	uring_ev->timeout = NULL;
+
+	/*
+	 * Everything in flight belongs to the parent, the
+	 * operations fail with ECANCELED, the fds are
+	 * armed again on the new ring.
+	 */
+	for (token = uring_ev->inflight; token != NULL; token = next) {
+		struct uring_fd_state *state = NULL;
+
+		next = token->next;
+		DLIST_REMOVE(uring_ev->inflight, token);
+
+		switch (token->kind) {
+		case URING_KIND_FD:
+			state = (struct uring_fd_state *)token;
+			state->armed = false;
+			state->cancelling = false;
+			if (state->fde == NULL && !state->queued) {
+				talloc_free(state);
+			}
+			break;
+		case URING_KIND_TIMEOUT:
+			talloc_free(token);
+			break;
+		case URING_KIND_OP:
+			uring_batch_add(uring_ev, token, -ECANCELED);
+			break;
+		}
+	}
+
+	ret = uring_ring_init(uring_ev);
+	if (ret != 0) {
+		tevent_debug(uring_ev->ev, TEVENT_DEBUG_FATAL,
+			     "Failed to recreate the io_uring after fork: %s\n",
+			     strerror(errno));
+		tevent_abort(uring_ev->ev, "uring_ring_init() failed");
+		return;
+	}
+
+	for (fde = uring_ev->ev->fd_events; fde != NULL; fde = fde->next) {
+		uring_fd_arm(uring_ev, fde->additional_data);
+	}
+}
+
+static int uring_ctx_destructor(struct uring_event_context *uring_ev)
+{
+	struct uring_token *token = NULL;
+	bool have_ops = false;
+
+	if (uring_ev->ring_fd == -1 ||
+	    uring_ev->pid != getpid()) {
+		uring_ring_unmap(uring_ev);
+		return 0;
+	}
+
+	/*
+	 * The kernel may still write into the buffers of pending
+	 * operations, so we have to wait for them before we can
+	 * free them.
+	 */
+	for (token = uring_ev->inflight; token != NULL; token = token->next) {
+		if (token->kind != URING_KIND_OP) {
+			continue;
+		}
+		uring_submit_cancel(uring_ev, IORING_OP_ASYNC_CANCEL, token);
+		have_ops = true;
+	}
+
+	while (have_ops) {
+		int ret;
+
+		ret = uring_enter(uring_ev, 1);
+		if (ret == -1 && errno != EINTR &&
+		    errno != EAGAIN && errno != EBUSY) {
+			break;
+		}
+		uring_reap(uring_ev);
+
+		have_ops = false;
+		for (token = uring_ev->inflight;
+		     token != NULL;
+		     token = token->next) {
+			if (token->kind == URING_KIND_OP) {
+				have_ops = true;
+				break;
+			}
+		}
+	}
+
+	uring_ring_unmap(uring_ev);
+	return 0;
+}
+
+/*
+  create a uring_event_context structure.
+*/
+static int uring_event_context_init(struct tevent_context *ev)
+{
+	struct uring_event_context *uring_ev = NULL;
+	int ret;
+
+	/*
+	 * We might be called during tevent_re_initialise()
+	 * which means we need to free our old additional_data.
+	 */
+	TALLOC_FREE(ev->additional_data);
+
+	uring_ev = talloc_zero(ev, struct uring_event_context);
+	if (uring_ev == NULL) {
+		return -1;
+	}
+	uring_ev->ev = ev;
+	uring_ev->ring_fd = -1;
+
+	ret = uring_ring_init(uring_ev);
+	if (ret != 0) {
+		talloc_free(uring_ev);
+		return ret;
+	}
+	talloc_set_destructor(uring_ev, uring_ctx_destructor);
+
+	ev->additional_data = uring_ev;
+	return 0;
+}
+
+/*
+  destroy an fd_event
+*/
+static int uring_event_fd_destructor(struct tevent_fd *fde)
+{
+	struct tevent_context *ev = fde->event_ctx;
+	struct uring_event_context *uring_ev = NULL;
+	struct uring_fd_state *state = fde->additional_data;
+
+	if (ev == NULL || state == NULL) {
+		return tevent_common_fd_destructor(fde);
+	}
+
+	uring_ev = talloc_get_type_abort(ev->additional_data,
+					 struct uring_event_context);
+
+	uring_check_reopen(uring_ev);
+
+	state->fde = NULL;
+	fde->additional_data = NULL;
+
+	if (state->armed) {
+		/*
+		 * The poll request holds a reference to the file,
+		 * remove it right away so that closing the fd
+		 * really closes the file.
+		 */
+		if (!state->cancelling) {
+			uring_submit_cancel(uring_ev,
+					    IORING_OP_POLL_REMOVE,
+					    &state->token);
+			state->cancelling = true;
+		}
+		uring_enter(uring_ev, 0);
+	} else if (!state->queued) {
+		talloc_free(state);
+	}
+
+	return tevent_common_fd_destructor(fde);
+}
+
+/*
+  add a fd based event
+  return NULL on failure (memory allocation error)
+*/
+static struct tevent_fd *uring_event_add_fd(struct tevent_context *ev,
+					    TALLOC_CTX *mem_ctx,
+					    int fd, uint16_t flags,
+					    tevent_fd_handler_t handler,
+					    void *private_data,
+					    const char *handler_name,
+					    const char *location)
+{
+	struct uring_event_context *uring_ev =
+		talloc_get_type_abort(ev->additional_data,
+		struct uring_event_context);
+	struct uring_fd_state *state = NULL;
+	struct tevent_fd *fde;
+
+	fde = tevent_common_add_fd(ev, mem_ctx, fd, flags,
+				   handler, private_data,
+				   handler_name, location);
+	if (fde == NULL) {
+		return NULL;
+	}
+
+	state = talloc_zero(uring_ev, struct uring_fd_state);
+	if (state == NULL) {
+		talloc_free(fde);
+		return NULL;
+	}
+	state->token.kind = URING_KIND_FD;
+	state->fde = fde;
+
+	fde->additional_data = state;
+	talloc_set_destructor(fde, uring_event_fd_destructor);
+
+	uring_check_reopen(uring_ev);
+	uring_fd_arm(uring_ev, state);
+
+	return fde;
+}
+
+/*
+  set the fd event flags
+*/
+static void uring_event_set_fd_flags(struct tevent_fd *fde, uint16_t flags)
+{
+	struct tevent_context *ev = fde->event_ctx;
+	struct uring_event_context *uring_ev = NULL;
+	struct uring_fd_state *state = NULL;
+
+	if (fde->flags == flags) {
+		return;
+	}
+
+	fde->flags = flags;
+
+	if (ev == NULL) {
+		return;
+	}
+
+	uring_ev = talloc_get_type_abort(ev->additional_data,
+					 struct uring_event_context);
+
+	uring_check_reopen(uring_ev);
+
+	state = fde->additional_data;
+
+	if (state->queued) {
+		/*
+		 * The queued completion may report a readiness
+		 * that is gone by now, only use it to rearm.
+		 */
+		state->stale = true;
+	}
+
+	if (!state->armed) {
+		/*
+		 * If a completion is queued, the fde is
+		 * rearmed with the new flags after it
+		 * was dispatched.
+		 */
+		uring_fd_arm(uring_ev, state);
+		return;
+	}
+
+	if (state->cancelling) {
+		return;
+	}
+
+	if (state->poll_events == uring_map_flags(flags)) {
+		return;
+	}
+
+	/*
+	 * The completion of the removed poll request
+	 * rearms the fde with the new flags.
+	 */
+	uring_submit_cancel(uring_ev, IORING_OP_POLL_REMOVE, &state->token);
+	state->cancelling = true;
+}
+
+/*
+  make sure a timeout completes when the next timer is due
+*/
+static void uring_arm_timeout(struct uring_event_context *uring_ev,
+			      const struct timeval *tvalp)
+{
+	struct uring_timeout *timeout = uring_ev->timeout;
+	struct io_uring_sqe *sqe = NULL;
+	struct timeval expiry;
+
+	expiry = tevent_timeval_current_ofs(tvalp->tv_sec, tvalp->tv_usec);
+
+	if (timeout != NULL) {
+		struct timeval limit = tevent_timeval_add(
+			&expiry, 0, URING_TIMEOUT_SLACK_USEC);
+
+		/*
+		 * A timeout that fires too early is harmless,
+		 * the loop just calculates the next delay.
+		 */
+		if (tevent_timeval_compare(&timeout->expiry, &limit) <= 0) {
+			return;
+		}
+
+		uring_submit_cancel(uring_ev,
+				    IORING_OP_TIMEOUT_REMOVE,
+				    &timeout->token);
+		uring_ev->timeout = NULL;
+	}
+
+	timeout = talloc_zero(uring_ev, struct uring_timeout);
+	if (timeout == NULL) {
+		/*
+		 * We wake up with the next fd event,
+		 * that's all we can do.
+		 */
+		return;
+	}
+	timeout->token.kind = URING_KIND_TIMEOUT;
+	timeout->ts.tv_sec = tvalp->tv_sec;
+	timeout->ts.tv_nsec = tvalp->tv_usec * 1000;
+	timeout->expiry = expiry;
+
+	sqe = uring_get_sqe_abort(uring_ev);
+	if (sqe == NULL) {
+		talloc_free(timeout);
+		return;
+	}
+	sqe->opcode = IORING_OP_TIMEOUT;
+	sqe->fd = -1;
+	sqe->addr = (uint64_t)(uintptr_t)&timeout->ts;
+	sqe->len = 1;
+	sqe->off = 0;
+	sqe->user_data = (uint64_t)(uintptr_t)timeout;
+
+	DLIST_ADD_END(uring_ev->inflight, &timeout->token);
+	uring_ev->timeout = timeout;
+}
+
+/*
+  dispatch the completion of a poll request,
+  returns true if a handler was called
+*/
+static bool uring_dispatch_fd(struct uring_event_context *uring_ev,
+			      struct uring_fd_state *state,
+			      int32_t res)
+{
+	struct tevent_fd *fde = state->fde;
+	uint16_t flags = 0;
+
+	if (fde == NULL) {
+		talloc_free(state);
+		return false;
+	}
+
+	if (res == -ECANCELED || state->stale) {
+		/* removed or changed by uring_event_set_fd_flags() */
+		state->queued = false;
+		state->stale = false;
+		uring_fd_arm(uring_ev, state);
+		return false;
+	}
+
+	if (res < 0 || (res & (POLLHUP|POLLERR|POLLNVAL))) {
+		/*
+		 * If we only wait for TEVENT_FD_WRITE, we should not
+		 * tell the event handler about it, and remove the
+		 * writeable flag, as we only report errors when
+		 * waiting for read events, to match the select()
+		 * behavior.
+		 */
+		if (!(fde->flags & TEVENT_FD_READ)) {
+			fde->flags &= ~TEVENT_FD_WRITE;
+			state->queued = false;
+			return false;
+		}
+		flags |= TEVENT_FD_READ;
+	}
+	if (res > 0) {
+		if (res & POLLIN) flags |= TEVENT_FD_READ;
+		if (res & POLLOUT) flags |= TEVENT_FD_WRITE;
+	}
+
+	/*
+	 * Make sure we only pass the flags
+	 * the handler is expecting.
+	 */
+	flags &= fde->flags;
+	if (flags == 0) {
+		state->queued = false;
+		uring_fd_arm(uring_ev, state);
+		return false;
+	}
+
+	/*
+	 * The state stays queued while the handler runs,
+	 * so that it survives a talloc_free() of the fde.
+	 */
+	tevent_common_invoke_fd_handler(fde, flags, NULL);
+
+	state->queued = false;
+	state->stale = false;
+	if (state->fde == NULL) {
+		talloc_free(state);
+		return true;
+	}
+	uring_fd_arm(uring_ev, state);
+	return true;
+}
+
+static bool uring_dispatch_op(struct uring_event_context *uring_ev,
+			      struct uring_op *op,
+			      int32_t res)
+{
+	struct tevent_req *req = op->req;
+	struct tevent_uring_sqe_state *state = NULL;
+
+	if (req == NULL) {
+		talloc_free(op);
+		return false;
+	}
+
+	state = tevent_req_data(req, struct tevent_uring_sqe_state);
+	state->op = NULL;
+	state->res = res;
+	state->buffers = talloc_move(state, &op->buffers);
+	op->req = NULL;
+	talloc_free(op);
+
+	tevent_req_done(req);
+	return true;
+}
+
+/*
+  dispatch the harvested completions until
+  a handler was called
+*/
+static bool uring_dispatch(struct uring_event_context *uring_ev)
+{
+	while (uring_ev->next_batch < uring_ev->num_batch) {
+		struct uring_completion c =
+			uring_ev->batch[uring_ev->next_batch++];
+		bool called = false;
+
+		switch (c.token->kind) {
+		case URING_KIND_FD:
+			called = uring_dispatch_fd(
+				uring_ev,
+				(struct uring_fd_state *)c.token,
+				c.res);
+			break;
+		case URING_KIND_OP:
+			called = uring_dispatch_op(
+				uring_ev,
+				(struct uring_op *)c.token,
+				c.res);
+			break;
+		case URING_KIND_TIMEOUT:
+			break;
+		}
+
+		if (called) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+  event loop handling using io_uring
+*/
+static int uring_event_loop(struct uring_event_context *uring_ev,
+			    struct timeval *tvalp)
+{
+	struct tevent_context *ev = uring_ev->ev;
+	int ret;
+	int wait_errno;
+
+	if (uring_ev->next_batch == uring_ev->num_batch) {
+		uring_ev->next_batch = 0;
+		uring_ev->num_batch = 0;
+		uring_reap(uring_ev);
+	}
+
+	while (uring_ev->num_batch == 0) {
+		uring_arm_timeout(uring_ev, tvalp);
+
+		if (ev->signal_events && tevent_common_check_signal(ev)) {
+			uring_enter(uring_ev, 0);
+			return 0;
+		}
+
+		tevent_trace_point_callback(ev, TEVENT_TRACE_BEFORE_WAIT);
+		ret = uring_enter(uring_ev, 1);
+		wait_errno = errno;
+		tevent_trace_point_callback(ev, TEVENT_TRACE_AFTER_WAIT);
+
+		if (ret == -1 && wait_errno == EINTR && ev->signal_events) {
+			if (tevent_common_check_signal(ev)) {
+				return 0;
+			}
+		}
+
+		if (ret == -1 && wait_errno != EINTR &&
+		    wait_errno != EAGAIN && wait_errno != EBUSY) {
+			tevent_debug(ev, TEVENT_DEBUG_FATAL,
+				     "io_uring_enter() failed: %s\n",
+				     strerror(wait_errno));
+			errno = wait_errno;
+			return -1;
+		}
+
+		uring_reap(uring_ev);
+
+		if (uring_ev->timeout == NULL) {
+			/* the next timer is due */
+			break;
+		}
+
+		/*
+		 * Only completions of removed poll requests or
+		 * timeouts, wait again as the timer is not due yet.
+		 */
+	}
+
+	if (!uring_dispatch(uring_ev)) {
+		/* we don't care about a possible delay here */
+		tevent_common_loop_timer_delay(ev);
+	}
+
+	return 0;
+}
+
+/*
+  do a single event loop using the events defined in ev
+*/
+static int uring_event_loop_once(struct tevent_context *ev,
+				 const char *location)
+{
+	struct uring_event_context *uring_ev =
+		talloc_get_type_abort(ev->additional_data,
+		struct uring_event_context);
+	struct timeval tval;
+
+	if (ev->signal_events &&
+	    tevent_common_check_signal(ev)) {
+		return 0;
+	}
+
+	if (ev->threaded_contexts != NULL) {
+		tevent_common_threaded_activate_immediate(ev);
+	}
+
+	if (ev->immediate_events &&
+	    tevent_common_loop_immediate(ev)) {
+		return 0;
+	}
+
+	tval = tevent_common_loop_timer_delay(ev);
+	if (tevent_timeval_is_zero(&tval)) {
+		return 0;
+	}
+
+	uring_check_reopen(uring_ev);
+
+	return uring_event_loop(uring_ev, &tval);
+}
+
+static const struct tevent_ops uring_event_ops = {
+	.context_init		= uring_event_context_init,
+	.add_fd			= uring_event_add_fd,
+	.set_fd_close_fn	= tevent_common_fd_set_close_fn,
+	.get_fd_flags		= tevent_common_fd_get_flags,
+	.set_fd_flags		= uring_event_set_fd_flags,
+	.add_timer		= tevent_common_add_timer_v2,
+	.schedule_immediate	= tevent_common_schedule_immediate,
+	.add_signal		= tevent_common_add_signal,
+	.loop_once		= uring_event_loop_once,
+	.loop_wait		= tevent_common_loop_wait,
+};
+
+_PRIVATE_ bool tevent_uring_init(void)
+{
+	return tevent_register_backend("io_uring", &uring_event_ops);
+}
+
+static struct uring_event_context *uring_event_context(
+	struct tevent_context *ev)
+{
+	struct tevent_context *main_ev = tevent_wrapper_main_ev(ev);
+
+	if (main_ev == NULL || main_ev->ops != &uring_event_ops) {
+		return NULL;
+	}
+
+	return talloc_get_type_abort(main_ev->additional_data,
+				     struct uring_event_context);
+}
+
+bool tevent_context_have_uring(struct tevent_context *ev)
+{
+	return uring_event_context(ev) != NULL;
+}
+
+static int uring_op_destructor(struct uring_op *op)
+{
+	if (op->req != NULL) {
+		struct tevent_uring_sqe_state *state =
+			tevent_req_data(op->req,
+			struct tevent_uring_sqe_state);
+		state->op = NULL;
+		op->req = NULL;
+	}
+	return 0;
+}
+
+static void tevent_uring_sqe_cleanup(struct tevent_req *req,
+				     enum tevent_req_state req_state)
+{
+	struct tevent_uring_sqe_state *state =
+		tevent_req_data(req, struct tevent_uring_sqe_state);
+	struct uring_op *op = state->op;
+
+	if (op == NULL) {
+		return;
+	}
+
+	/*
+	 * The kernel still owns the buffers, the op
+	 * is freed when the cancelled request completes.
+	 */
+	state->op = NULL;
+	op->req = NULL;
+	uring_check_reopen(op->uring_ev);
+	if (op->uring_ev->ring_fd == -1) {
+		return;
+	}
+	uring_submit_cancel(op->uring_ev, IORING_OP_ASYNC_CANCEL,
+			    &op->token);
+
+	/*
+	 * Cancel right away, otherwise the operation may
+	 * still consume data the caller expects elsewhere.
+	 */
+	uring_enter(op->uring_ev, 0);
+}
+
+struct tevent_req *tevent_uring_sqe_send(TALLOC_CTX *mem_ctx,
+					 struct tevent_context *ev,
+					 const struct io_uring_sqe *sqe,
+					 void *buffers)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_uring_sqe_state *state = NULL;
+	struct uring_event_context *uring_ev = NULL;
+	struct io_uring_sqe *ring_sqe = NULL;
+	struct uring_op *op = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct tevent_uring_sqe_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	uring_ev = uring_event_context(ev);
+	if (uring_ev == NULL) {
+		tevent_req_error(req, ENOSYS);
+		return tevent_req_post(req, ev);
+	}
+
+	uring_check_reopen(uring_ev);
+
+	op = talloc_zero(uring_ev, struct uring_op);
+	if (tevent_req_nomem(op, req)) {
+		return tevent_req_post(req, ev);
+	}
+	op->token.kind = URING_KIND_OP;
+	op->uring_ev = uring_ev;
+
+	ring_sqe = uring_get_sqe(uring_ev);
+	if (ring_sqe == NULL) {
+		talloc_free(op);
+		tevent_req_error(req, EAGAIN);
+		return tevent_req_post(req, ev);
+	}
+	*ring_sqe = *sqe;
+	ring_sqe->user_data = (uint64_t)(uintptr_t)op;
+
+	op->req = req;
+	op->buffers = talloc_steal(op, buffers);
+	talloc_set_destructor(op, uring_op_destructor);
+	DLIST_ADD_END(uring_ev->inflight, &op->token);
+
+	state->op = op;
+	tevent_req_set_cleanup_fn(req, tevent_uring_sqe_cleanup);
+
+	return req;
+}
+
+#else /* HAVE_TEVENT_URING */
+
+bool tevent_context_have_uring(struct tevent_context *ev)
+{
+	return false;
+}
+
+struct tevent_req *tevent_uring_sqe_send(TALLOC_CTX *mem_ctx,
+					 struct tevent_context *ev,
+					 const struct io_uring_sqe *sqe,
+					 void *buffers)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_uring_sqe_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct tevent_uring_sqe_state);
+	if (req == NULL) {
+		return NULL;
+	}
+
+	tevent_req_error(req, ENOSYS);
+	return tevent_req_post(req, ev);
+}
+
+#endif /* HAVE_TEVENT_URING */
+
+int tevent_uring_sqe_recv(struct tevent_req *req,
+			  TALLOC_CTX *mem_ctx,
+			  int32_t *res,
+			  void *pbuffers)
+{
+	struct tevent_uring_sqe_state *state =
+		tevent_req_data(req, struct tevent_uring_sqe_state);
+	enum tevent_req_state req_state;
+	uint64_t error;
+
+	if (tevent_req_is_error(req, &req_state, &error)) {
+		tevent_req_received(req);
+		if (req_state == TEVENT_REQ_USER_ERROR) {
+			return (int)error;
+		}
+		if (req_state == TEVENT_REQ_TIMED_OUT) {
+			return ETIMEDOUT;
+		}
+		return ENOMEM;
+	}
+
+	*res = state->res;
+	if (pbuffers != NULL) {
+		void **pp = (void **)pbuffers;
+		*pp = talloc_move(mem_ctx, &state->buffers);
+	}
+	tevent_req_received(req);
+	return 0;
+}
@@ -244,7 +244,7 @@ static int tevent_wrapper_context_destructor(struct tevent_context *wrap_ev)
 			continue;
 		}
 
-		ret = pthread_mutex_lock(&tctx->event_ctx_mutex);
+		ret = pthread_rwlock_wrlock(&tctx->event_ctx_lock);
 		if (ret != 0) {
 			abort();
 		}
@@ -253,12 +253,12 @@ static int tevent_wrapper_context_destructor(struct tevent_context *wrap_ev)
 		 * Indicate to the thread that the tevent_context is
 		 * gone. The counterpart of this is in
 		 * _tevent_threaded_schedule_immediate, there we read
-		 * this under the threaded_context's mutex.
+		 * this under the threaded_context's read lock.
 		 */
 
 		tctx->event_ctx = NULL;
 
-		ret = pthread_mutex_unlock(&tctx->event_ctx_mutex);
+		ret = pthread_rwlock_unlock(&tctx->event_ctx_lock);
 		if (ret != 0) {
 			abort();
 		}
@@ -131,6 +131,9 @@ char *talloc_strdup_upper(TALLOC_CTX *ctx, const char *src);
 char *strupper_talloc_n_handle(struct smb_iconv_handle *iconv_handle,
 				TALLOC_CTX *ctx, const char *src, size_t n);
 char *strupper_talloc_n(TALLOC_CTX *ctx, const char *src, size_t n);
+char *strfold_talloc_n_handle(struct smb_iconv_handle *iconv_handle,
+			      TALLOC_CTX *ctx, const char *src, size_t n);
+char *strfold_talloc(TALLOC_CTX *ctx, const char *src);
  char *strlower_talloc_handle(struct smb_iconv_handle *iconv_handle,
 			      TALLOC_CTX *ctx, const char *src);
 char *strlower_talloc(TALLOC_CTX *ctx, const char *src);
@@ -33,6 +33,15 @@
 #include <unicode/utrans.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#ifdef HAVE_UTF8_AVX2
+#include <immintrin.h>
+#endif
+
 #ifdef strcasecmp
 #undef strcasecmp
 #endif
@@ -804,6 +813,160 @@ static size_t iconv_copy(void *cd, const char **inbuf, size_t *inbytesleft,
 	return 0;
 }
 
+/*
+  Most of the UTF-8 and UTF-16LE strings we see are plain ASCII, so
+  runs of ASCII characters are converted a vector at a time. Anything
+  else is left to the character by character code in utf8_pull() and
+  utf8_push(), which keeps the handling of invalid sequences unchanged.
+
+  The AVX2 versions are only used if the CPU supports them, SSE2 and
+  NEON are always available on the platforms we use them on.
+*/
+
+#ifdef HAVE_UTF8_AVX2
+static bool utf8_have_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static size_t utf8_pull_ascii_avx2(const uint8_t *c, uint8_t *uc, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(c + i));
+		__m256i lo, hi;
+
+		if (_mm256_movemask_epi8(v) != 0) {
+			break;
+		}
+		lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+		hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+		_mm256_storeu_si256((__m256i *)(uc + 2*i), lo);
+		_mm256_storeu_si256((__m256i *)(uc + 2*i + 32), hi);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t utf8_push_ascii_avx2(const uint8_t *uc, uint8_t *c, size_t n)
+{
+	const __m256i mask = _mm256_set1_epi16((short)0xff80);
+	size_t i;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)(uc + 2*i));
+		__m256i b = _mm256_loadu_si256((const __m256i *)(uc + 2*i + 32));
+		__m256i t = _mm256_and_si256(_mm256_or_si256(a, b), mask);
+		__m256i v;
+
+		if (!_mm256_testz_si256(t, t)) {
+			break;
+		}
+		/* packus works per 128 bit lane, restore the order */
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+		_mm256_storeu_si256((__m256i *)(c + i), v);
+	}
+
+	return i;
+}
+#endif
+
+/*
+  convert the ASCII characters at the start of c (at most n) to
+  UTF-16LE, returns the number of characters converted
+*/
+static size_t utf8_pull_ascii(const uint8_t *c, uint8_t *uc, size_t n)
+{
+	size_t i = 0;
+
+#ifdef HAVE_UTF8_AVX2
+	if (n >= 32 && utf8_have_avx2()) {
+		i = utf8_pull_ascii_avx2(c, uc, n);
+	}
+#endif
+
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(c + i));
+		__m128i z = _mm_setzero_si128();
+
+		if (_mm_movemask_epi8(v) != 0) {
+			break;
+		}
+		_mm_storeu_si128((__m128i *)(uc + 2*i),
+				 _mm_unpacklo_epi8(v, z));
+		_mm_storeu_si128((__m128i *)(uc + 2*i + 16),
+				 _mm_unpackhi_epi8(v, z));
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t w;
+
+		w.val[0] = vld1q_u8(c + i);
+		if (vmaxvq_u8(w.val[0]) >= 0x80) {
+			break;
+		}
+		w.val[1] = vdupq_n_u8(0);
+		vst2q_u8(uc + 2*i, w);
+	}
+#endif
+
+	for (; i < n && (c[i] & 0x80) == 0; i++) {
+		uc[2*i] = c[i];
+		uc[2*i+1] = 0;
+	}
+
+	return i;
+}
+
+/*
+  convert the UTF-16LE characters below 0x80 at the start of uc
+  (at most n) to ASCII, returns the number of characters converted
+*/
+static size_t utf8_push_ascii(const uint8_t *uc, uint8_t *c, size_t n)
+{
+	size_t i = 0;
+
+#ifdef HAVE_UTF8_AVX2
+	if (n >= 32 && utf8_have_avx2()) {
+		i = utf8_push_ascii_avx2(uc, c, n);
+	}
+#endif
+
+#if defined(__SSE2__)
+	for (; i + 16 <= n; i += 16) {
+		const __m128i mask = _mm_set1_epi16((short)0xff80);
+		__m128i a = _mm_loadu_si128((const __m128i *)(uc + 2*i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(uc + 2*i + 16));
+		__m128i t = _mm_and_si128(_mm_or_si128(a, b), mask);
+
+		t = _mm_cmpeq_epi16(t, _mm_setzero_si128());
+		if (_mm_movemask_epi8(t) != 0xffff) {
+			break;
+		}
+		_mm_storeu_si128((__m128i *)(c + i), _mm_packus_epi16(a, b));
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t w = vld2q_u8(uc + 2*i);
+
+		if (vmaxvq_u8(w.val[1]) != 0 || vmaxvq_u8(w.val[0]) >= 0x80) {
+			break;
+		}
+		vst1q_u8(c + i, w.val[0]);
+	}
+#endif
+
+	for (; i < n && uc[2*i+1] == 0 && (uc[2*i] & 0x80) == 0; i++) {
+		c[i] = uc[2*i];
+	}
+
+	return i;
+}
+
 /*
   this takes a UTF8 sequence and produces a UTF16 sequence
  */
@@ -816,12 +979,12 @@ static size_t utf8_pull(void *cd, const char **inbuf, size_t *inbytesleft,
 
 	while (in_left >= 1 && out_left >= 2) {
 		if ((c[0] & 0x80) == 0) {
-			uc[0] = c[0];
-			uc[1] = 0;
-			c  += 1;
-			in_left  -= 1;
-			out_left -= 2;
-			uc += 2;
+			size_t n = utf8_pull_ascii(c, uc,
+						   MIN(in_left, out_left / 2));
+			c  += n;
+			in_left  -= n;
+			out_left -= 2 * n;
+			uc += 2 * n;
 			continue;
 		}
 
@@ -940,11 +1103,12 @@ static size_t utf8_push(void *cd, const char **inbuf, size_t *inbytesleft,
 
 		if (uc[1] == 0 && !(uc[0] & 0x80)) {
 			/* simplest case */
-			c[0] = uc[0];
-			in_left  -= 2;
-			out_left -= 1;
-			uc += 2;
-			c  += 1;
+			size_t n = utf8_push_ascii(uc, c,
+						   MIN(in_left / 2, out_left));
+			in_left  -= 2 * n;
+			out_left -= n;
+			uc += 2 * n;
+			c  += n;
 			continue;
 		}
 
@@ -311,6 +311,101 @@ static bool test_count_chars_m(struct torture_context *tctx)
 	return true;
 }
 
+/*
+  build a random name from a mix of ASCII and codepoints with case
+  mappings, optionally changing the case of each character at random
+*/
+static void random_name(char *buf, size_t bufsize,
+			const codepoint_t *cps, size_t num_cps,
+			bool twiddle)
+{
+	static const codepoint_t others[] = {
+		0xe9, 0xc9, 0xdf, 0x3c3, 0x3a3, 0x3c2, 0x430, 0x410,
+		0x131, 0x130, 0x1e9e, 0x2c6f, 0x250, 0x24d0, 0xff41, 0x4e2d
+	};
+	size_t i, len = 0;
+
+	for (i = 0; i < num_cps && len + 5 < bufsize; i++) {
+		codepoint_t c = cps[i];
+		ssize_t size;
+
+		if (c >= 128) {
+			c = others[c % ARRAY_SIZE(others)];
+		}
+		if (twiddle) {
+			c = (random() % 2) ? toupper_m(c) : tolower_m(c);
+		}
+		size = push_codepoint(buf + len, c);
+		if (size == -1) {
+			break;
+		}
+		len += size;
+	}
+	buf[len] = 0;
+}
+
+static bool test_strfold(struct torture_context *tctx)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	/* file.{accented e} in iso8859-1 */
+	const char file_iso8859_1[7] = { 0x66, 0x69, 0x6c, 0x65, 0x2d, 0xe9, 0 };
+	int i;
+
+	torture_assert_str_equal(tctx, strfold_talloc(mem_ctx, "foo.txt"),
+				 "FOO.TXT", "ASCII");
+	torture_assert_str_equal(tctx,
+		strfold_talloc(mem_ctx, "a long name that needs more than one vector.doc"),
+		"A LONG NAME THAT NEEDS MORE THAN ONE VECTOR.DOC", "long ASCII");
+	torture_assert_str_equal(tctx, strfold_talloc(mem_ctx, "[`az{@AZ]"),
+				 "[`AZ{@AZ]", "ASCII boundaries");
+	torture_assert_str_equal(tctx, strfold_talloc(mem_ctx, "file-\xc3\xa9"),
+				 "FILE-\xc3\x89", "accented e");
+	torture_assert_str_equal(tctx, strfold_talloc(mem_ctx, file_iso8859_1),
+				 "FILE-\xe9", "invalid UTF-8 is kept");
+	torture_assert_str_equal(tctx, strfold_talloc(mem_ctx, ""), "", "empty");
+	torture_assert(tctx, strfold_talloc(mem_ctx, NULL) == NULL, "NULL");
+
+	for (i = 0; i < 10000; i++) {
+		codepoint_t cps[64];
+		char name1[400], name2[400], name3[400];
+		char *fold1, *fold2, *fold3, *upper;
+		size_t j, len = random() % ARRAY_SIZE(cps);
+
+		for (j = 0; j < len; j++) {
+			cps[j] = (random() % 4) ? 32 + random() % 95 : 128 + random();
+		}
+		random_name(name1, sizeof(name1), cps, len, false);
+		random_name(name2, sizeof(name2), cps, len, true);
+		if (len > 0 && random() % 2) {
+			cps[random() % len] = 32 + random() % 95;
+		}
+		random_name(name3, sizeof(name3), cps, len, true);
+
+		fold1 = strfold_talloc(mem_ctx, name1);
+		fold2 = strfold_talloc(mem_ctx, name2);
+		fold3 = strfold_talloc(mem_ctx, name3);
+		upper = strupper_talloc(mem_ctx, name1);
+		torture_assert(tctx, fold1 && fold2 && fold3 && upper,
+			       "out of memory");
+
+		torture_assert_str_equal(tctx, fold1, upper,
+					 "fold should match strupper_talloc");
+		torture_assert_str_equal(tctx, fold1, fold2,
+					 "case changes should fold to the same key");
+		torture_assert_int_equal(tctx, strcasecmp_m(name1, name2), 0,
+					 "strcasecmp_m should match");
+		torture_assert_int_equal(tctx,
+			strcmp(fold1, fold3) == 0,
+			strcasecmp_m(name1, name3) == 0,
+			"folded keys should compare like strcasecmp_m");
+
+		talloc_free_children(mem_ctx);
+	}
+
+	talloc_free(mem_ctx);
+	return true;
+}
+
 struct torture_suite *torture_local_charset(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "charset");
@@ -337,6 +432,7 @@ struct torture_suite *torture_local_charset(TALLOC_CTX *mem_ctx)
 	torture_suite_add_simple_test(suite, "strhaslower", test_strhaslower);
 	torture_suite_add_simple_test(suite, "strhasupper", test_strhasupper);
 	torture_suite_add_simple_test(suite, "count_chars_m", test_count_chars_m);
+	torture_suite_add_simple_test(suite, "strfold", test_strfold);
 
 	return suite;
 }
@@ -414,6 +414,191 @@ static bool test_random_5m(struct torture_context *tctx)
 }
 
 
+/*
+  convert a buffer with smb_iconv(), either in one call or in small
+  output chunks, resuming after E2BIG. The small chunks keep the
+  converters off their vectorised ASCII paths, so comparing the two
+  checks those paths against the scalar code.
+*/
+static size_t convert_chunked(smb_iconv_t cd,
+			      const uint8_t *in, size_t inlen,
+			      uint8_t *out, size_t outlen,
+			      size_t chunk, size_t *consumed, int *err)
+{
+	const char *ptr_in = (const char *)in;
+	char *ptr_out = (char *)out;
+	size_t size_in = inlen;
+
+	*err = 0;
+	while (size_in > 0) {
+		size_t left = MIN(chunk, outlen - (ptr_out - (char *)out));
+		size_t ret;
+
+		errno = 0;
+		ret = smb_iconv(cd, &ptr_in, &size_in, &ptr_out, &left);
+		if (ret != (size_t)-1) {
+			break;
+		}
+		if (errno != E2BIG || ptr_out == (char *)out + outlen) {
+			*err = errno;
+			break;
+		}
+	}
+
+	*consumed = inlen - size_in;
+	return ptr_out - (char *)out;
+}
+
+static bool test_fast_path_buffer(struct torture_context *tctx,
+				  smb_iconv_t cd,
+				  const uint8_t *in, size_t inlen)
+{
+	uint8_t out1[2000], out2[2000];
+	size_t len1, len2, consumed1, consumed2;
+	int err1, err2;
+
+	len1 = convert_chunked(cd, in, inlen, out1, sizeof(out1),
+			       sizeof(out1), &consumed1, &err1);
+	len2 = convert_chunked(cd, in, inlen, out2, sizeof(out2),
+			       8, &consumed2, &err2);
+
+	torture_assert_int_equal(tctx, err1, err2, "errno mismatch");
+	torture_assert_int_equal(tctx, consumed1, consumed2,
+				 "consumed length mismatch");
+	torture_assert_int_equal(tctx, len1, len2, "output length mismatch");
+	torture_assert(tctx, memcmp(out1, out2, len1) == 0, "output mismatch");
+
+	return true;
+}
+
+static bool test_utf8_fast_paths(struct torture_context *tctx)
+{
+	smb_iconv_t pull, push;
+	uint8_t inbuf[500];
+	unsigned int i;
+
+	pull = smb_iconv_open_ex(tctx, "UTF-16LE", "UTF-8", true);
+	torture_assert(tctx, pull != (smb_iconv_t)-1,
+		       "failed to open UTF-8 to UTF-16LE");
+	push = smb_iconv_open_ex(tctx, "UTF-8", "UTF-16LE", true);
+	torture_assert(tctx, push != (smb_iconv_t)-1,
+		       "failed to open UTF-16LE to UTF-8");
+
+	for (i=0;i<200000;i++) {
+		size_t size = random() % sizeof(inbuf);
+		unsigned int ascii = random() % 100;
+		unsigned int c;
+
+		/* mostly long ASCII runs, with the odd invalid byte */
+		for (c=0;c<size;c++) {
+			if (random() % 100 < ascii) {
+				inbuf[c] = random() % 128;
+			} else {
+				inbuf[c] = random();
+			}
+		}
+		if (!test_fast_path_buffer(tctx, pull, inbuf, size)) {
+			torture_comment(tctx, "i=%u failed UTF-8 pull\n", i);
+			return false;
+		}
+
+		for (c=1;c<size;c+=2) {
+			if (random() % 50 == 0) {
+				inbuf[c] = (random() % 2) ? 0xd8 : 0xdc;
+			}
+		}
+		if (!test_fast_path_buffer(tctx, push, inbuf, size)) {
+			torture_comment(tctx, "i=%u failed UTF-8 push\n", i);
+			return false;
+		}
+	}
+
+	smb_iconv_close(pull);
+	smb_iconv_close(push);
+	return true;
+}
+
+static void bench_convert(struct torture_context *tctx,
+			  smb_iconv_t cd, const char *name,
+			  const uint8_t *in, size_t inlen,
+			  uint8_t *out, size_t outlen)
+{
+	struct timeval tv = timeval_current();
+	size_t total = 0;
+
+	while (timeval_elapsed(&tv) < 1.0) {
+		const char *ptr_in = (const char *)in;
+		char *ptr_out = (char *)out;
+		size_t size_in = inlen;
+		size_t size_out = outlen;
+
+		smb_iconv(cd, &ptr_in, &size_in, &ptr_out, &size_out);
+		total += inlen - size_in;
+	}
+
+	torture_comment(tctx, "%-28s %8.1f MB/sec\n", name,
+			total / timeval_elapsed(&tv) / 1.0e6);
+}
+
+static bool test_utf8_throughput(struct torture_context *tctx)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	const size_t len = 1024 * 1024;
+	smb_iconv_t pull, push;
+	uint8_t *ascii, *mixed, *utf16_ascii, *utf16_mixed, *out;
+	size_t i, ascii16_len, mixed16_len, consumed;
+	int err;
+
+	pull = smb_iconv_open_ex(mem_ctx, "UTF-16LE", "UTF-8", true);
+	torture_assert(tctx, pull != (smb_iconv_t)-1,
+		       "failed to open UTF-8 to UTF-16LE");
+	push = smb_iconv_open_ex(mem_ctx, "UTF-8", "UTF-16LE", true);
+	torture_assert(tctx, push != (smb_iconv_t)-1,
+		       "failed to open UTF-16LE to UTF-8");
+
+	ascii = talloc_array(mem_ctx, uint8_t, len);
+	mixed = talloc_array(mem_ctx, uint8_t, len);
+	utf16_ascii = talloc_array(mem_ctx, uint8_t, len * 2);
+	utf16_mixed = talloc_array(mem_ctx, uint8_t, len * 2);
+	out = talloc_array(mem_ctx, uint8_t, len * 3);
+	torture_assert(tctx, out != NULL, "out of memory");
+
+	/*
+	  file names: mostly ASCII, with an accented character in every
+	  few names for the mixed case
+	*/
+	for (i=0;i<len;i++) {
+		ascii[i] = 'a' + (i % 26);
+		if (i % 32 == 0) {
+			ascii[i] = '/';
+		}
+	}
+	memcpy(mixed, ascii, len);
+	for (i=0;i+1<len;i+=96) {
+		mixed[i] = 0xc3;
+		mixed[i+1] = 0xa9;
+	}
+
+	ascii16_len = convert_chunked(pull, ascii, len, utf16_ascii, len * 2,
+				      len * 2, &consumed, &err);
+	torture_assert_int_equal(tctx, err, 0, "ASCII conversion failed");
+	mixed16_len = convert_chunked(pull, mixed, len, utf16_mixed, len * 2,
+				      len * 2, &consumed, &err);
+	torture_assert_int_equal(tctx, err, 0, "mixed conversion failed");
+
+	bench_convert(tctx, pull, "UTF-8 -> UTF-16LE (ASCII)",
+		      ascii, len, out, len * 3);
+	bench_convert(tctx, pull, "UTF-8 -> UTF-16LE (mixed)",
+		      mixed, len, out, len * 3);
+	bench_convert(tctx, push, "UTF-16LE -> UTF-8 (ASCII)",
+		      utf16_ascii, ascii16_len, out, len * 3);
+	bench_convert(tctx, push, "UTF-16LE -> UTF-8 (mixed)",
+		      utf16_mixed, mixed16_len, out, len * 3);
+
+	talloc_free(mem_ctx);
+	return true;
+}
+
 static bool test_string2key(struct torture_context *tctx)
 {
 	uint16_t *buf;
@@ -481,6 +666,12 @@ struct torture_suite *torture_local_iconv(TALLOC_CTX *mem_ctx)
 
 	torture_suite_add_simple_test(suite, "string2key",
 				      test_string2key);
+
+	torture_suite_add_simple_test(suite, "UTF-8 fast paths",
+				      test_utf8_fast_paths);
+
+	torture_suite_add_simple_test(suite, "UTF-8 throughput",
+				      test_utf8_throughput);
 	return suite;
 }
 
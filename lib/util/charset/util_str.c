@@ -50,12 +50,19 @@ _PUBLIC_ int strcasecmp_m_handle(struct smb_iconv_handle *iconv_handle,
 	if (s2 == NULL) return 1;
 
 	while (*s1 && *s2) {
-		c1 = next_codepoint_handle(iconv_handle, s1, &size1);
-		c2 = next_codepoint_handle(iconv_handle, s2, &size2);
-
-		if (c1 == INVALID_CODEPOINT ||
-		    c2 == INVALID_CODEPOINT) {
-			return strcasecmp(s1, s2);
+		if (((*s1 | *s2) & 0x80) == 0) {
+			/* both ASCII, no need to ask iconv */
+			c1 = (unsigned char)*s1;
+			c2 = (unsigned char)*s2;
+			size1 = size2 = 1;
+		} else {
+			c1 = next_codepoint_handle(iconv_handle, s1, &size1);
+			c2 = next_codepoint_handle(iconv_handle, s2, &size2);
+
+			if (c1 == INVALID_CODEPOINT ||
+			    c2 == INVALID_CODEPOINT) {
+				return strcasecmp(s1, s2);
+			}
 		}
 
 		s1 += size1;
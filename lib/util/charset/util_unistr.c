@@ -21,6 +21,12 @@
 #include "includes.h"
 #include "system/locale.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /**
  String replace.
  NOTE: oldc and newc must be 7 bit characters
@@ -154,6 +160,140 @@ _PUBLIC_ char *strupper_talloc(TALLOC_CTX *ctx, const char *src)
 	return strupper_talloc_n(ctx, src, src?strlen(src):0);
 }
 
+/*
+  upper case the ASCII characters at the start of src (at most n) into
+  dest, returns the number of bytes done
+*/
+static size_t strfold_ascii(const uint8_t *src, uint8_t *dest, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i before_a = _mm_set1_epi8('a' - 1);
+	const __m128i after_z = _mm_set1_epi8('z' + 1);
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lower;
+
+		if (_mm_movemask_epi8(v) != 0) {
+			break;
+		}
+		lower = _mm_and_si128(_mm_cmpgt_epi8(v, before_a),
+				      _mm_cmplt_epi8(v, after_z));
+		v = _mm_xor_si128(v, _mm_and_si128(lower, case_bit));
+		_mm_storeu_si128((__m128i *)(dest + i), v);
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t v = vld1q_u8(src + i);
+		uint8x16_t lower;
+
+		if (vmaxvq_u8(v) >= 0x80) {
+			break;
+		}
+		lower = vandq_u8(vcgeq_u8(v, vdupq_n_u8('a')),
+				 vcleq_u8(v, vdupq_n_u8('z')));
+		v = veorq_u8(v, vandq_u8(lower, vdupq_n_u8(0x20)));
+		vst1q_u8(dest + i, v);
+	}
+#endif
+
+	for (; i < n && src[i] < 0x80; i++) {
+		uint8_t c = src[i];
+
+		if (c >= 'a' && c <= 'z') {
+			c ^= 0x20;
+		}
+		dest[i] = c;
+	}
+
+	return i;
+}
+
+/**
+ Fold a string for case insensitive comparison, allocated with talloc
+ source length limited to n bytes, iconv handle supplied
+
+ The folded form of a string is its upper case form, so two strings
+ that strcasecmp_m() considers equal fold to the same bytes and can
+ be compared with strcmp() or hashed. Bytes that are not valid in the
+ unix charset are copied unchanged, so different invalid names never
+ fold to the same key. ASCII is folded independent of the locale.
+**/
+_PUBLIC_ char *strfold_talloc_n_handle(struct smb_iconv_handle *iconv_handle,
+				       TALLOC_CTX *ctx, const char *src, size_t n)
+{
+	const uint8_t *s = (const uint8_t *)src;
+	size_t size = 0;
+	char *dest;
+
+	if (src == NULL) {
+		return NULL;
+	}
+
+	n = strnlen(src, n);
+
+	/* upper casing adds at most one byte to a character */
+	dest = talloc_array(ctx, char, 2*(n+1));
+	if (dest == NULL) {
+		return NULL;
+	}
+
+	while (n > 0) {
+		size_t c_size;
+		ssize_t len;
+		codepoint_t c;
+
+		if (*s < 0x80) {
+			c_size = strfold_ascii(s, (uint8_t *)dest + size, n);
+			s += c_size;
+			n -= c_size;
+			size += c_size;
+			continue;
+		}
+
+		c = next_codepoint_handle_ext(iconv_handle, (const char *)s,
+					      n, CH_UNIX, &c_size);
+		if (c == INVALID_CODEPOINT) {
+			dest[size++] = *s;
+			s += 1;
+			n -= 1;
+			continue;
+		}
+		s += c_size;
+		n -= c_size;
+
+		len = push_codepoint_handle(iconv_handle, dest + size,
+					    toupper_m(c));
+		if (len == -1) {
+			talloc_free(dest);
+			return NULL;
+		}
+		size += len;
+	}
+
+	dest[size] = 0;
+
+	/* trim it so talloc_append_string() works */
+	dest = talloc_realloc(ctx, dest, char, size+1);
+
+	talloc_set_name_const(dest, dest);
+
+	return dest;
+}
+
+/**
+ Fold a string for case insensitive comparison, allocated with talloc
+**/
+_PUBLIC_ char *strfold_talloc(TALLOC_CTX *ctx, const char *src)
+{
+	struct smb_iconv_handle *iconv_handle = get_iconv_handle();
+	return strfold_talloc_n_handle(iconv_handle, ctx, src,
+				       src?strlen(src):0);
+}
+
 /**
  talloc_strdup() a unix string to upper case.
 **/
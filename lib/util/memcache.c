@@ -61,6 +61,11 @@ static bool memcache_is_talloc(enum memcache_number n)
 	case SHARE_MODE_LOCK_CACHE:
 	case GETWD_CACHE:
 	case VIRUSFILTER_SCAN_RESULTS_CACHE_TALLOC:
+	case ACLREAD_SD_CACHE:
+	case KDC_KEYS_CACHE:
+	case DNS_RECORDS_CACHE:
+	case DNS_WILDCARD_RECORDS_CACHE:
+	case VFS_ACL_COMMON_SD_CACHE:
 		result = true;
 		break;
 	default:
@@ -47,6 +47,13 @@ enum memcache_number {
 	SHARE_MODE_LOCK_CACHE,	/* talloc */
 	VIRUSFILTER_SCAN_RESULTS_CACHE_TALLOC, /* talloc */
 	DFREE_CACHE,
+	ACLREAD_SD_CACHE,	/* talloc */
+	ACLREAD_ACCESS_CACHE,
+	KDC_KEYS_CACHE,		/* talloc */
+	DNS_RECORDS_CACHE,	/* talloc */
+	DNS_WILDCARD_RECORDS_CACHE, /* talloc */
+	DNS_FORWARDER_CACHE,
+	VFS_ACL_COMMON_SD_CACHE, /* talloc */
 };
 
 /*
@@ -241,6 +241,438 @@ int ms_fnmatch_protocol(const char *pattern, const char *string, int protocol,
 }
 
 
+/*
+  A compiled pattern gives the same answers as ms_fnmatch_protocol(),
+  but does the work that only depends on the pattern once. Patterns
+  of the form "*", "prefix*" and "*suffix" with an ASCII literal part
+  are matched directly against the bytes of ASCII names, everything
+  else is matched by a forward simulation of the pattern over the
+  string, keeping the set of live pattern positions in a bitmap. That
+  takes time proportional to the length of the string times the
+  number of wildcards and never backtracks.
+*/
+
+enum ms_fnmatch_kind {
+	MS_FNMATCH_LITERAL,
+	MS_FNMATCH_ALL,
+	MS_FNMATCH_PREFIX,
+	MS_FNMATCH_SUFFIX,
+	MS_FNMATCH_GENERAL,
+};
+
+struct ms_fnmatch_token {
+	codepoint_t c;
+	codepoint_t upper;
+};
+
+struct ms_fnmatch_pattern {
+	enum ms_fnmatch_kind kind;
+	bool is_case_sensitive;
+	char *pattern;
+
+	/* the literal part of prefix and suffix patterns */
+	const char *fixed;
+	size_t fixed_len;
+	uint8_t fold[128];
+
+	/*
+	  every token has two states, the second is only used by
+	  '<' once the string position is past the last '.'
+	*/
+	size_t num_tokens;
+	struct ms_fnmatch_token *tokens;
+	size_t num_words;
+
+	/* the first of the '*'s ending the pattern, they match anything */
+	size_t star_tail;
+};
+
+static bool ms_fnmatch_fixed_part(struct ms_fnmatch_pattern *pat,
+				  const char *fixed, size_t len)
+{
+	size_t i;
+
+	if (len == 0) {
+		return false;
+	}
+	for (i=0; i<len; i++) {
+		if (fixed[i] & 0x80) {
+			return false;
+		}
+		if (strchr("*<>?\"", fixed[i]) != NULL) {
+			return false;
+		}
+	}
+	pat->fixed = fixed;
+	pat->fixed_len = len;
+	return true;
+}
+
+/**
+ * Compile a pattern for ms_fnmatch_compiled(), which gives the same
+ * results as ms_fnmatch_protocol() with the same arguments
+ */
+struct ms_fnmatch_pattern *ms_fnmatch_compile(TALLOC_CTX *mem_ctx,
+					      const char *pattern,
+					      int protocol,
+					      bool is_case_sensitive)
+{
+	struct ms_fnmatch_pattern *pat;
+	size_t i, len, size, stars;
+	const char *p;
+
+	pat = talloc_zero(mem_ctx, struct ms_fnmatch_pattern);
+	if (pat == NULL) {
+		return NULL;
+	}
+	pat->is_case_sensitive = is_case_sensitive;
+
+	pat->pattern = talloc_strdup(pat, pattern);
+	if (pat->pattern == NULL) {
+		TALLOC_FREE(pat);
+		return NULL;
+	}
+
+	if (strpbrk(pattern, "<>*?\"") == NULL) {
+		pat->kind = MS_FNMATCH_LITERAL;
+		return pat;
+	}
+
+	if (protocol <= PROTOCOL_LANMAN2) {
+		char *t = pat->pattern;
+
+		/* the same translation as ms_fnmatch_protocol() */
+		for (i=0;t[i];i++) {
+			if (t[i] == '?') {
+				t[i] = '>';
+			} else if (t[i] == '.' &&
+				   (t[i+1] == '?' ||
+				    t[i+1] == '*' ||
+				    t[i+1] == 0)) {
+				t[i] = '"';
+			} else if (t[i] == '*' &&
+				   t[i+1] == '.') {
+				t[i] = '<';
+			}
+		}
+	}
+
+	for (i=0; i<128; i++) {
+		pat->fold[i] = toupper_m(i);
+	}
+
+	len = strlen(pat->pattern);
+	stars = strspn(pat->pattern, "*");
+
+	if (stars == len) {
+		pat->kind = MS_FNMATCH_ALL;
+		return pat;
+	}
+
+	/* prefix and suffix patterns fall back to these for non-ASCII names */
+	pat->tokens = talloc_array(pat, struct ms_fnmatch_token, len);
+	if (pat->tokens == NULL) {
+		TALLOC_FREE(pat);
+		return NULL;
+	}
+	for (p = pat->pattern; *p != '\0'; p += size) {
+		codepoint_t c = next_codepoint(p, &size);
+		struct ms_fnmatch_token *tok = &pat->tokens[pat->num_tokens++];
+
+		tok->c = c;
+		tok->upper = toupper_m(c);
+	}
+	pat->num_words = (2 * pat->num_tokens + 1 + 63) / 64;
+
+	pat->star_tail = pat->num_tokens;
+	while (pat->star_tail > 0 &&
+	       pat->tokens[pat->star_tail - 1].c == '*') {
+		pat->star_tail -= 1;
+	}
+
+	pat->kind = MS_FNMATCH_GENERAL;
+
+	if (stars > 0 &&
+	    ms_fnmatch_fixed_part(pat, pat->pattern + stars, len - stars)) {
+		pat->kind = MS_FNMATCH_SUFFIX;
+		return pat;
+	}
+	for (i=len; i>0 && pat->pattern[i-1] == '*'; i--) {
+		;
+	}
+	if (i < len && ms_fnmatch_fixed_part(pat, pat->pattern, i)) {
+		pat->kind = MS_FNMATCH_PREFIX;
+	}
+
+	return pat;
+}
+
+static bool ms_fnmatch_fixed_eq(const struct ms_fnmatch_pattern *pat,
+				const uint8_t *s)
+{
+	size_t i;
+
+	for (i=0; i<pat->fixed_len; i++) {
+		uint8_t c = pat->fixed[i];
+
+		if (s[i] == c) {
+			continue;
+		}
+		if (pat->is_case_sensitive || pat->fold[s[i]] != pat->fold[c]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#define MS_FNMATCH_SET(set, state) \
+	((set)[(state) / 64] |= ((uint64_t)1 << ((state) % 64)))
+#define MS_FNMATCH_ISSET(set, state) \
+	(((set)[(state) / 64] & ((uint64_t)1 << ((state) % 64))) != 0)
+
+/*
+  move to token t at string offset pos, '<' starts in its second
+  state if pos is already past the last '.'
+*/
+static size_t ms_fnmatch_arrive(const struct ms_fnmatch_pattern *pat,
+				uint64_t *set, size_t t,
+				ssize_t pos, ssize_t ldot)
+{
+	size_t state = 2*t;
+
+	if (t < pat->num_tokens && pat->tokens[t].c == '<' &&
+	    (ldot == -1 || pos > ldot)) {
+		state += 1;
+	}
+	MS_FNMATCH_SET(set, state);
+	return state;
+}
+
+/*
+  if the only live state is a '*' or '<' in front of an ASCII
+  character, skip the ASCII characters that can't start a match of it
+*/
+static ssize_t ms_fnmatch_skip(const struct ms_fnmatch_pattern *pat,
+			       const uint8_t *s, ssize_t pos, size_t state,
+			       ssize_t ldot)
+{
+	const struct ms_fnmatch_token *tok;
+	size_t t = state / 2;
+	ssize_t end = SSIZE_MAX;
+
+	if (t + 1 >= pat->num_tokens) {
+		return pos;
+	}
+	if (pat->tokens[t].c == '<' && state % 2 == 0) {
+		/* '<' before the last '.' can't move past it */
+		end = ldot;
+	} else if (pat->tokens[t].c != '*' && pat->tokens[t].c != '<') {
+		return pos;
+	}
+	tok = &pat->tokens[t+1];
+	if (tok->c >= 0x80 || strchr("*<>?\"", tok->c) != NULL) {
+		return pos;
+	}
+
+	while (pos < end && s[pos] != '\0' && s[pos] < 0x80 &&
+	       s[pos] != tok->c &&
+	       (pat->is_case_sensitive || pat->fold[s[pos]] != tok->upper)) {
+		pos++;
+	}
+	return pos;
+}
+
+static int ms_fnmatch_general(const struct ms_fnmatch_pattern *pat,
+			      const char *string)
+{
+	const uint8_t *s = (const uint8_t *)string;
+	const size_t num_tokens = pat->num_tokens;
+	const size_t num_words = pat->num_words;
+	uint64_t cur[num_words], next[num_words];
+	const char *ldot_p = strrchr(string, '.');
+	ssize_t ldot = (ldot_p != NULL) ? ldot_p - string : -1;
+	ssize_t pos = 0;
+	size_t num_live, last;
+	size_t t, w;
+
+	memset(cur, 0, sizeof(cur));
+	last = ms_fnmatch_arrive(pat, cur, 0, pos, ldot);
+	num_live = 1;
+
+	while (true) {
+		bool at_end;
+		codepoint_t c = 0, upper = 0;
+		size_t size = 0;
+
+		if (num_live == 1) {
+			pos = ms_fnmatch_skip(pat, s, pos, last, ldot);
+		}
+
+		at_end = (s[pos] == '\0');
+		if (at_end) {
+			;
+		} else if (s[pos] < 0x80) {
+			c = s[pos];
+			size = 1;
+		} else {
+			c = next_codepoint(string + pos, &size);
+		}
+
+		/* the moves that don't consume a character */
+		for (t=0; t<num_tokens; t++) {
+			codepoint_t tc = pat->tokens[t].c;
+
+			if ((cur[(2*t) / 64] >> ((2*t) % 64) & 3) == 0) {
+				continue;
+			}
+			if (tc == '*' || tc == '<' ||
+			    (tc == '>' && (at_end || c == '.')) ||
+			    (tc == '"' && at_end)) {
+				ms_fnmatch_arrive(pat, cur, t+1, pos, ldot);
+			}
+		}
+
+		if (at_end) {
+			return MS_FNMATCH_ISSET(cur, 2*num_tokens) ? 0 : -1;
+		}
+		if (pat->star_tail < num_tokens &&
+		    MS_FNMATCH_ISSET(cur, 2*pat->star_tail)) {
+			/* the rest of the string is matched by '*' */
+			return 0;
+		}
+
+		if (pat->is_case_sensitive) {
+			upper = c;
+		} else if (c < 0x80) {
+			upper = pat->fold[c];
+		} else {
+			upper = toupper_m(c);
+		}
+
+		memset(next, 0, sizeof(next));
+		num_live = 0;
+		for (t=0; t<num_tokens; t++) {
+			const struct ms_fnmatch_token *tok = &pat->tokens[t];
+			ssize_t npos = pos + size;
+			bool move = false;
+
+			if ((cur[(2*t) / 64] >> ((2*t) % 64) & 3) == 0) {
+				continue;
+			}
+			if (MS_FNMATCH_ISSET(cur, 2*t + 1)) {
+				/* '<' past the last '.' */
+				MS_FNMATCH_SET(next, 2*t + 1);
+				last = 2*t + 1;
+				num_live += 1;
+			}
+			if (!MS_FNMATCH_ISSET(cur, 2*t)) {
+				continue;
+			}
+
+			switch (tok->c) {
+			case '*':
+				MS_FNMATCH_SET(next, 2*t);
+				last = 2*t;
+				num_live += 1;
+				break;
+			case '<':
+				/* stops after the last '.' */
+				if (pos <= ldot) {
+					MS_FNMATCH_SET(next, 2*t);
+					last = 2*t;
+					num_live += 1;
+				}
+				break;
+			case '?':
+				move = true;
+				break;
+			case '>':
+				move = (c != '.' || s[npos] == '\0');
+				break;
+			case '"':
+				move = (c == '.');
+				break;
+			default:
+				move = (tok->c == c ||
+					(!pat->is_case_sensitive &&
+					 tok->upper == upper));
+				break;
+			}
+
+			if (move && !MS_FNMATCH_ISSET(next, 2*t + 2) &&
+			    !MS_FNMATCH_ISSET(next, 2*t + 3)) {
+				last = ms_fnmatch_arrive(pat, next, t+1,
+							 npos, ldot);
+				num_live += 1;
+			}
+		}
+
+		if (num_live == 0) {
+			return -1;
+		}
+		for (w=0; w<num_words; w++) {
+			cur[w] = next[w];
+		}
+		pos += size;
+	}
+}
+
+/**
+ * Match a string against a pattern compiled with ms_fnmatch_compile()
+ */
+int ms_fnmatch_compiled(const struct ms_fnmatch_pattern *pat,
+			const char *string)
+{
+	const uint8_t *s = (const uint8_t *)string;
+	size_t i, len;
+
+	if (strcmp(string, "..") == 0) {
+		string = ".";
+		s = (const uint8_t *)string;
+	}
+
+	switch (pat->kind) {
+	case MS_FNMATCH_LITERAL:
+		return strcasecmp_m(pat->pattern, string);
+
+	case MS_FNMATCH_ALL:
+		return 0;
+
+	case MS_FNMATCH_PREFIX:
+		for (i=0; i<pat->fixed_len; i++) {
+			if (s[i] == '\0') {
+				return -1;
+			}
+			if (s[i] & 0x80) {
+				return ms_fnmatch_general(pat, string);
+			}
+		}
+		return ms_fnmatch_fixed_eq(pat, s) ? 0 : -1;
+
+	case MS_FNMATCH_SUFFIX:
+		/*
+		  only for ASCII names, in other charsets than UTF-8 an
+		  ASCII byte at the end may belong to a longer character
+		*/
+		for (len=0; s[len] != '\0'; len++) {
+			if (s[len] & 0x80) {
+				return ms_fnmatch_general(pat, string);
+			}
+		}
+		if (len < pat->fixed_len) {
+			return -1;
+		}
+		return ms_fnmatch_fixed_eq(pat, s + len - pat->fixed_len) ?
+			0 : -1;
+
+	case MS_FNMATCH_GENERAL:
+		return ms_fnmatch_general(pat, string);
+	}
+
+	return -1;
+}
+
+
 /** a generic fnmatch function - uses for non-CIFS pattern matching */
 int gen_fnmatch(const char *pattern, const char *string)
 {
@@ -584,6 +584,20 @@ _PUBLIC_ int sys_fsusage(const char *path, uint64_t *dfree, uint64_t *dsize);
 int ms_fnmatch_protocol(const char *pattern, const char *string, int protocol,
 			bool is_case_sensitive);
 
+struct ms_fnmatch_pattern;
+
+/**
+ * Prepare a pattern once for matching many strings against it with
+ * ms_fnmatch_compiled(), the results are the same as from
+ * ms_fnmatch_protocol() with the same arguments.
+ */
+struct ms_fnmatch_pattern *ms_fnmatch_compile(TALLOC_CTX *mem_ctx,
+					      const char *pattern,
+					      int protocol,
+					      bool is_case_sensitive);
+int ms_fnmatch_compiled(const struct ms_fnmatch_pattern *pat,
+			const char *string);
+
 /** a generic fnmatch function - uses for non-CIFS pattern matching */
 int gen_fnmatch(const char *pattern, const char *string);
 
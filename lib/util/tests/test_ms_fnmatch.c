@@ -99,6 +99,94 @@ static void test_ms_fn_match_protocol_nt1_case_sensitive(void **state)
 	assert_int_equal(cmp, 0);
 }
 
+static void test_ms_fn_match_compiled_fixed(void **state)
+{
+	const char *patterns[] = {
+		"*", "*.*", "*.dwg", "*.DWG", "abc*", "ABC*.*", "?????",
+		"<.dwg", "*.", "a>c", "a\"b", "*<*", "foo", "*abc*d",
+		"\xc3\xa9*", "*\xc3\x89",
+	};
+	const char *names[] = {
+		"", ".", "..", "abc", "ABC.dwg", "abc.def.dwg", "foo",
+		"FOO", "a.c", "abcd", "x.abc.d", "drawing.dwgx",
+		"\xc3\xa9t\xc3\xa9", "\xc3\x89T\xc3\x89", "\xc3\xa9.dwg",
+	};
+	int protocols[] = { PROTOCOL_LANMAN2, PROTOCOL_NT1 };
+	size_t i, j, k;
+	int cs;
+
+	for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+	for (k = 0; k < ARRAY_SIZE(protocols); k++) {
+	for (cs = 0; cs < 2; cs++) {
+		struct ms_fnmatch_pattern *pat = NULL;
+
+		pat = ms_fnmatch_compile(NULL, patterns[i], protocols[k], cs);
+		assert_non_null(pat);
+
+		for (j = 0; j < ARRAY_SIZE(names); j++) {
+			int expected = ms_fnmatch_protocol(patterns[i],
+							   names[j],
+							   protocols[k],
+							   cs);
+			int cmp = ms_fnmatch_compiled(pat, names[j]);
+
+			assert_int_equal(cmp == 0, expected == 0);
+		}
+		TALLOC_FREE(pat);
+	}
+	}
+	}
+}
+
+static void random_name(char *buf, size_t len, bool wild)
+{
+	const char *chars[] = {
+		"a", "B", ".", ".", "x", "\xc3\xa9", "\xc3\x89", "I", "i",
+		"\xc4\xb1",
+	};
+	const char *wildcards[] = { "*", "?", "<", ">", "\"" };
+	size_t i;
+
+	buf[0] = '\0';
+	for (i = 0; i < len; i++) {
+		if (wild && random() % 3 == 0) {
+			strcat(buf, wildcards[random() % ARRAY_SIZE(wildcards)]);
+		} else {
+			strcat(buf, chars[random() % ARRAY_SIZE(chars)]);
+		}
+	}
+}
+
+static void test_ms_fn_match_compiled_random(void **state)
+{
+	int i, j;
+
+	srandom(1);
+
+	for (i = 0; i < 20000; i++) {
+		struct ms_fnmatch_pattern *pat = NULL;
+		int protocol = (random() % 2) ? PROTOCOL_NT1 : PROTOCOL_LANMAN2;
+		bool cs = random() % 2;
+		char pattern[64];
+
+		random_name(pattern, random() % 8, true);
+		pat = ms_fnmatch_compile(NULL, pattern, protocol, cs);
+		assert_non_null(pat);
+
+		for (j = 0; j < 10; j++) {
+			char name[64];
+			int expected, cmp;
+
+			random_name(name, random() % 10, false);
+			expected = ms_fnmatch_protocol(pattern, name,
+						       protocol, cs);
+			cmp = ms_fnmatch_compiled(pat, name);
+			assert_int_equal(cmp == 0, expected == 0);
+		}
+		TALLOC_FREE(pat);
+	}
+}
+
 int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_ms_fn_match_protocol_no_wildcard),
@@ -107,6 +195,8 @@ int main(void) {
 		cmocka_unit_test(test_ms_fn_match_protocol_mapped_char),
 		cmocka_unit_test(test_ms_fn_match_protocol_nt1_any_char),
 		cmocka_unit_test(test_ms_fn_match_protocol_nt1_case_sensitive),
+		cmocka_unit_test(test_ms_fn_match_compiled_fixed),
+		cmocka_unit_test(test_ms_fn_match_compiled_random),
 	};
 
 	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
@@ -105,8 +105,10 @@ void se_map_standard(uint32_t *access_mask, const struct standard_mapping *mappi
 /*
   perform a SEC_FLAG_MAXIMUM_ALLOWED access check
 */
-static uint32_t access_check_max_allowed(const struct security_descriptor *sd,
-					const struct security_token *token)
+static uint32_t access_check_max_allowed(
+	const struct security_descriptor *sd,
+	const struct security_token *token,
+	const struct security_token_sid_index *idx)
 {
 	uint32_t denied = 0, granted = 0;
 	bool am_owner = false;
@@ -114,13 +116,13 @@ static uint32_t access_check_max_allowed(const struct security_descriptor *sd,
 	unsigned i;
 
 	if (sd->dacl == NULL) {
-		if (security_token_has_sid(token, sd->owner_sid)) {
+		if (security_token_index_has_sid(token, idx, sd->owner_sid)) {
 			granted |= SEC_STD_WRITE_DAC | SEC_STD_READ_CONTROL;
 		}
 		return granted;
 	}
 
-	if (security_token_has_sid(token, sd->owner_sid)) {
+	if (security_token_index_has_sid(token, idx, sd->owner_sid)) {
 		/*
 		 * Check for explicit owner rights: if there are none, we remove
 		 * the default owner right SEC_STD_WRITE_DAC|SEC_STD_READ_CONTROL
@@ -162,7 +164,7 @@ static uint32_t access_check_max_allowed(const struct security_descriptor *sd,
 		}
 
 		if (!is_owner_rights_ace &&
-		    !security_token_has_sid(token, &ace->trustee))
+		    !security_token_index_has_sid(token, idx, &ace->trustee))
 		{
 			continue;
 		}
@@ -184,14 +186,31 @@ static uint32_t access_check_max_allowed(const struct security_descriptor *sd,
 }
 
 /*
-  The main entry point for access checking. If returning ACCESS_DENIED
-  this function returns the denied bits in the uint32_t pointed
-  to by the access_granted pointer.
+  build a SID index for the token if the check is big enough to
+  benefit from it, the caller frees it
 */
-NTSTATUS se_access_check(const struct security_descriptor *sd,
-			  const struct security_token *token,
-			  uint32_t access_desired,
-			  uint32_t *access_granted)
+static struct security_token_sid_index *access_check_sid_index(
+	const struct security_descriptor *sd,
+	const struct security_token *token,
+	uint32_t access_desired)
+{
+	uint32_t num_lookups = 1;
+
+	if (sd->dacl != NULL) {
+		num_lookups += sd->dacl->num_aces;
+	}
+	if (access_desired & SEC_FLAG_MAXIMUM_ALLOWED) {
+		num_lookups *= 2;
+	}
+
+	return security_token_sid_index(NULL, token, num_lookups);
+}
+
+static NTSTATUS access_check_token(const struct security_descriptor *sd,
+				   const struct security_token *token,
+				   const struct security_token_sid_index *idx,
+				   uint32_t access_desired,
+				   uint32_t *access_granted)
 {
 	uint32_t i;
 	uint32_t bits_remaining;
@@ -206,7 +225,7 @@ NTSTATUS se_access_check(const struct security_descriptor *sd,
 	if (access_desired & SEC_FLAG_MAXIMUM_ALLOWED) {
 		uint32_t orig_access_desired = access_desired;
 
-		access_desired |= access_check_max_allowed(sd, token);
+		access_desired |= access_check_max_allowed(sd, token, idx);
 		access_desired &= ~SEC_FLAG_MAXIMUM_ALLOWED;
 		*access_granted = access_desired;
 		bits_remaining = access_desired;
@@ -227,7 +246,7 @@ NTSTATUS se_access_check(const struct security_descriptor *sd,
 		goto done;
 	}
 
-	if (security_token_has_sid(token, sd->owner_sid)) {
+	if (security_token_index_has_sid(token, idx, sd->owner_sid)) {
 		/*
 		 * Check for explicit owner rights: if there are none, we remove
 		 * the default owner right SEC_STD_WRITE_DAC|SEC_STD_READ_CONTROL
@@ -269,7 +288,7 @@ NTSTATUS se_access_check(const struct security_descriptor *sd,
 		}
 
 		if (!is_owner_rights_ace &&
-		    !security_token_has_sid(token, &ace->trustee))
+		    !security_token_index_has_sid(token, idx, &ace->trustee))
 		{
 			continue;
 		}
@@ -317,6 +336,30 @@ done:
 	return NT_STATUS_OK;
 }
 
+/*
+  The main entry point for access checking. If returning ACCESS_DENIED
+  this function returns the denied bits in the uint32_t pointed
+  to by the access_granted pointer.
+*/
+NTSTATUS se_access_check(const struct security_descriptor *sd,
+			  const struct security_token *token,
+			  uint32_t access_desired,
+			  uint32_t *access_granted)
+{
+	struct security_token_sid_index *idx =
+		access_check_sid_index(sd, token, access_desired);
+	NTSTATUS status;
+
+	status = access_check_token(sd,
+				    token,
+				    idx,
+				    access_desired,
+				    access_granted);
+	TALLOC_FREE(idx);
+
+	return status;
+}
+
 /*
   The main entry point for access checking FOR THE FILE SERVER ONLY !
   If returning ACCESS_DENIED this function returns the denied bits in
@@ -327,16 +370,47 @@ NTSTATUS se_file_access_check(const struct security_descriptor *sd,
 			  bool priv_open_requested,
 			  uint32_t access_desired,
 			  uint32_t *access_granted)
+{
+	return se_file_access_check_index(sd,
+					  token,
+					  NULL,
+					  priv_open_requested,
+					  access_desired,
+					  access_granted);
+}
+
+/*
+  se_file_access_check() with a SID index the caller built for token
+  with security_token_sid_index() and keeps as long as the token. If
+  sid_index is NULL an index is built for this check if it pays off.
+*/
+NTSTATUS se_file_access_check_index(
+			  const struct security_descriptor *sd,
+			  const struct security_token *token,
+			  const struct security_token_sid_index *sid_index,
+			  bool priv_open_requested,
+			  uint32_t access_desired,
+			  uint32_t *access_granted)
 {
 	uint32_t bits_remaining;
+	struct security_token_sid_index *tmp_idx = NULL;
+	const struct security_token_sid_index *idx = sid_index;
 	NTSTATUS status;
 
+	if (idx == NULL) {
+		tmp_idx = access_check_sid_index(sd, token, access_desired);
+		idx = tmp_idx;
+	}
+
 	if (!priv_open_requested) {
 		/* Fall back to generic se_access_check(). */
-		return se_access_check(sd,
-				token,
-				access_desired,
-				access_granted);
+		status = access_check_token(sd,
+					    token,
+					    idx,
+					    access_desired,
+					    access_granted);
+		TALLOC_FREE(tmp_idx);
+		return status;
 	}
 
 	/*
@@ -349,7 +423,7 @@ NTSTATUS se_file_access_check(const struct security_descriptor *sd,
 	if (access_desired & SEC_FLAG_MAXIMUM_ALLOWED) {
 		uint32_t orig_access_desired = access_desired;
 
-		access_desired |= access_check_max_allowed(sd, token);
+		access_desired |= access_check_max_allowed(sd, token, idx);
 		access_desired &= ~SEC_FLAG_MAXIMUM_ALLOWED;
 
 		if (security_token_has_privilege(token, SEC_PRIV_BACKUP)) {
@@ -366,10 +440,12 @@ NTSTATUS se_file_access_check(const struct security_descriptor *sd,
 			access_desired));
 	}
 
-	status = se_access_check(sd,
-				token,
-				access_desired,
-				access_granted);
+	status = access_check_token(sd,
+				    token,
+				    idx,
+				    access_desired,
+				    access_granted);
+	TALLOC_FREE(tmp_idx);
 
 	if (!NT_STATUS_EQUAL(status, NT_STATUS_ACCESS_DENIED)) {
 		return status;
@@ -478,34 +554,14 @@ static NTSTATUS check_object_specific_access(struct security_ace *ace,
 	return NT_STATUS_OK;
 }
 
-/**
- * @brief Perform directoryservice (DS) related access checks for a given user
- *
- * Perform DS access checks for the user represented by its security_token, on
- * the provided security descriptor. If an tree associating GUID and access
- * required is provided then object access (OA) are checked as well. *
- * @param[in]   sd             The security descritor against which the required
- *                             access are requested
- *
- * @param[in]   token          The security_token associated with the user to
- *                             test
- *
- * @param[in]   access_desired A bitfield of rights that must be granted for the
- *                             given user in the specified SD.
- *
- * If one
- * of the entry in the tree grants all the requested rights for the given GUID
- * FIXME
- * tree can be null if not null it's the
- * Lots of code duplication, it will ve united in just one
- * function eventually */
-
-NTSTATUS sec_access_check_ds(const struct security_descriptor *sd,
-			     const struct security_token *token,
-			     uint32_t access_desired,
-			     uint32_t *access_granted,
-			     struct object_tree *tree,
-			     struct dom_sid *replace_sid)
+static NTSTATUS access_check_ds_token(
+	const struct security_descriptor *sd,
+	const struct security_token *token,
+	const struct security_token_sid_index *idx,
+	uint32_t access_desired,
+	uint32_t *access_granted,
+	struct object_tree *tree,
+	struct dom_sid *replace_sid)
 {
 	uint32_t i;
 	uint32_t bits_remaining;
@@ -518,7 +574,7 @@ NTSTATUS sec_access_check_ds(const struct security_descriptor *sd,
 
 	/* handle the maximum allowed flag */
 	if (access_desired & SEC_FLAG_MAXIMUM_ALLOWED) {
-		access_desired |= access_check_max_allowed(sd, token);
+		access_desired |= access_check_max_allowed(sd, token, idx);
 		access_desired &= ~SEC_FLAG_MAXIMUM_ALLOWED;
 		*access_granted = access_desired;
 		bits_remaining = access_desired;
@@ -534,7 +590,7 @@ NTSTATUS sec_access_check_ds(const struct security_descriptor *sd,
 
 	/* the owner always gets SEC_STD_WRITE_DAC and SEC_STD_READ_CONTROL */
 	if ((bits_remaining & (SEC_STD_WRITE_DAC|SEC_STD_READ_CONTROL)) &&
-	    security_token_has_sid(token, sd->owner_sid)) {
+	    security_token_index_has_sid(token, idx, sd->owner_sid)) {
 		bits_remaining &= ~(SEC_STD_WRITE_DAC|SEC_STD_READ_CONTROL);
 	}
 
@@ -571,7 +627,7 @@ NTSTATUS sec_access_check_ds(const struct security_descriptor *sd,
 			trustee = &ace->trustee;
 		}
 
-		if (!security_token_has_sid(token, trustee)) {
+		if (!security_token_index_has_sid(token, idx, trustee)) {
 			continue;
 		}
 
@@ -613,3 +669,48 @@ done:
 
 	return NT_STATUS_OK;
 }
+
+/**
+ * @brief Perform directoryservice (DS) related access checks for a given user
+ *
+ * Perform DS access checks for the user represented by its security_token, on
+ * the provided security descriptor. If an tree associating GUID and access
+ * required is provided then object access (OA) are checked as well. *
+ * @param[in]   sd             The security descritor against which the required
+ *                             access are requested
+ *
+ * @param[in]   token          The security_token associated with the user to
+ *                             test
+ *
+ * @param[in]   access_desired A bitfield of rights that must be granted for the
+ *                             given user in the specified SD.
+ *
+ * If one
+ * of the entry in the tree grants all the requested rights for the given GUID
+ * FIXME
+ * tree can be null if not null it's the
+ * Lots of code duplication, it will ve united in just one
+ * function eventually */
+
+NTSTATUS sec_access_check_ds(const struct security_descriptor *sd,
+			     const struct security_token *token,
+			     uint32_t access_desired,
+			     uint32_t *access_granted,
+			     struct object_tree *tree,
+			     struct dom_sid *replace_sid)
+{
+	struct security_token_sid_index *idx =
+		access_check_sid_index(sd, token, access_desired);
+	NTSTATUS status;
+
+	status = access_check_ds_token(sd,
+				       token,
+				       idx,
+				       access_desired,
+				       access_granted,
+				       tree,
+				       replace_sid);
+	TALLOC_FREE(idx);
+
+	return status;
+}
@@ -65,6 +65,20 @@ NTSTATUS se_file_access_check(const struct security_descriptor *sd,
 			 uint32_t access_desired,
 			 uint32_t *access_granted);
 
+/*
+  se_file_access_check() for callers that keep a SID index next to a
+  long lived token, see security_token_sid_index()
+*/
+struct security_token_sid_index;
+
+NTSTATUS se_file_access_check_index(
+			 const struct security_descriptor *sd,
+			 const struct security_token *token,
+			 const struct security_token_sid_index *sid_index,
+			 bool priv_open_requested,
+			 uint32_t access_desired,
+			 uint32_t *access_granted);
+
 /* modified access check for the purposes of DS security
  * Lots of code duplication, it will ve united in just one
  * function eventually */
@@ -81,6 +81,34 @@ int dom_sid_compare(const struct dom_sid *sid1, const struct dom_sid *sid2)
 	return dom_sid_compare_auth(sid1, sid2);
 }
 
+/*****************************************************************
+ Compare two sids for sorting. dom_sid_compare() subtracts unsigned
+ sub_auths, which is fine to test for equality but not a total order.
+*****************************************************************/
+
+int dom_sid_compare_total(const struct dom_sid *sid1,
+			  const struct dom_sid *sid2)
+{
+	int i;
+
+	if (sid1 == sid2)
+		return 0;
+	if (!sid1)
+		return -1;
+	if (!sid2)
+		return 1;
+
+	if (sid1->num_auths != sid2->num_auths)
+		return (sid1->num_auths < sid2->num_auths) ? -1 : 1;
+
+	for (i = sid1->num_auths-1; i >= 0; --i)
+		if (sid1->sub_auths[i] != sid2->sub_auths[i])
+			return (sid1->sub_auths[i] < sid2->sub_auths[i]) ?
+				-1 : 1;
+
+	return dom_sid_compare_auth(sid1, sid2);
+}
+
 /*****************************************************************
  Compare two sids.
 *****************************************************************/
@@ -79,6 +79,8 @@ bool dom_sid_lookup_is_predefined_domain(const char *domain);
 int dom_sid_compare_auth(const struct dom_sid *sid1,
 			 const struct dom_sid *sid2);
 int dom_sid_compare(const struct dom_sid *sid1, const struct dom_sid *sid2);
+int dom_sid_compare_total(const struct dom_sid *sid1,
+			  const struct dom_sid *sid2);
 int dom_sid_compare_domain(const struct dom_sid *sid1,
 			   const struct dom_sid *sid2);
 bool dom_sid_equal(const struct dom_sid *sid1, const struct dom_sid *sid2);
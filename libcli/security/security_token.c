@@ -25,6 +25,7 @@
 #include "libcli/security/security_token.h"
 #include "libcli/security/dom_sid.h"
 #include "libcli/security/privileges.h"
+#include "lib/util/tsort.h"
 
 /*
   return a blank security token
@@ -114,6 +115,127 @@ bool security_token_has_sid(const struct security_token *token, const struct dom
 	return false;
 }
 
+/*
+ * Access checks test the trustee of every ACE against all SIDs of the
+ * token. For tokens with many group SIDs and a check with many lookups
+ * the caller builds a sorted copy of the SIDs and uses a binary search
+ * instead.
+ *
+ * The index is owned by the caller. The token itself is an IDL
+ * generated structure that is copied around by value, so we can't
+ * hang the index off it, and a process wide cache is unsafe for
+ * threaded callers. Callers that keep a token for many checks build
+ * the index once next to it, everyone else builds it per check.
+ */
+
+#define SECURITY_TOKEN_SID_INDEX_MIN_SIDS 32
+
+struct security_token_sid_index {
+	uint32_t num_sids;
+	struct dom_sid *sorted;
+};
+
+struct security_token_sid_index *security_token_sid_index(
+	TALLOC_CTX *mem_ctx,
+	const struct security_token *token,
+	uint32_t num_lookups)
+{
+	struct security_token_sid_index *idx = NULL;
+	uint32_t log2_sids = 0;
+	uint32_t n;
+
+	if (token->num_sids < SECURITY_TOKEN_SID_INDEX_MIN_SIDS) {
+		return NULL;
+	}
+
+	/*
+	 * Sorting costs about num_sids * log2(num_sids) compares, a
+	 * linear search about num_sids / 2. Only sort if enough
+	 * lookups follow to pay for it.
+	 */
+	for (n = token->num_sids; n > 1; n >>= 1) {
+		log2_sids += 1;
+	}
+	if (num_lookups < 2 * log2_sids) {
+		return NULL;
+	}
+
+	idx = talloc(mem_ctx, struct security_token_sid_index);
+	if (idx == NULL) {
+		return NULL;
+	}
+	idx->num_sids = token->num_sids;
+
+	idx->sorted = talloc_memdup(idx, token->sids,
+				    token->num_sids * sizeof(struct dom_sid));
+	if (idx->sorted == NULL) {
+		TALLOC_FREE(idx);
+		return NULL;
+	}
+	TYPESAFE_QSORT(idx->sorted, idx->num_sids, dom_sid_compare_total);
+
+	return idx;
+}
+
+struct security_token_sid_index *security_token_sid_index_dup(
+	TALLOC_CTX *mem_ctx,
+	const struct security_token_sid_index *idx)
+{
+	struct security_token_sid_index *copy = NULL;
+
+	if (idx == NULL) {
+		return NULL;
+	}
+
+	copy = talloc(mem_ctx, struct security_token_sid_index);
+	if (copy == NULL) {
+		return NULL;
+	}
+	copy->num_sids = idx->num_sids;
+
+	copy->sorted = talloc_memdup(copy, idx->sorted,
+				     idx->num_sids * sizeof(struct dom_sid));
+	if (copy->sorted == NULL) {
+		TALLOC_FREE(copy);
+		return NULL;
+	}
+
+	return copy;
+}
+
+bool security_token_index_has_sid(const struct security_token *token,
+				  const struct security_token_sid_index *idx,
+				  const struct dom_sid *sid)
+{
+	int32_t b, e;
+
+	if (idx == NULL) {
+		return security_token_has_sid(token, sid);
+	}
+	if (sid == NULL) {
+		return false;
+	}
+
+	b = 0;
+	e = (int32_t)idx->num_sids - 1;
+
+	while (b <= e) {
+		int32_t i = (b + e) / 2;
+		int cmp = dom_sid_compare_total(sid, &idx->sorted[i]);
+
+		if (cmp == 0) {
+			return true;
+		}
+		if (cmp < 0) {
+			e = i - 1;
+		} else {
+			b = i + 1;
+		}
+	}
+
+	return false;
+}
+
 bool security_token_has_sid_string(const struct security_token *token, const char *sid_string)
 {
 	bool ret;
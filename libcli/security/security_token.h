@@ -49,6 +49,31 @@ bool security_token_is_anonymous(const struct security_token *token);
 
 bool security_token_has_sid(const struct security_token *token, const struct dom_sid *sid);
 
+/*
+ * For tokens with many SIDs security_token_sid_index() returns a sorted
+ * copy of the SIDs allocated on mem_ctx, security_token_index_has_sid()
+ * then finds a SID with a binary search. For small tokens or only a few
+ * expected lookups it returns NULL and security_token_index_has_sid()
+ * searches the token itself. The index is a snapshot of the token, the
+ * caller frees it with the token or once it is done with the access
+ * check. A caller keeping the index for the lifetime of the token
+ * passes UINT32_MAX as num_lookups.
+ */
+struct security_token_sid_index;
+
+struct security_token_sid_index *security_token_sid_index(
+	TALLOC_CTX *mem_ctx,
+	const struct security_token *token,
+	uint32_t num_lookups);
+
+struct security_token_sid_index *security_token_sid_index_dup(
+	TALLOC_CTX *mem_ctx,
+	const struct security_token_sid_index *idx);
+
+bool security_token_index_has_sid(const struct security_token *token,
+				  const struct security_token_sid_index *idx,
+				  const struct dom_sid *sid);
+
 bool security_token_has_sid_string(const struct security_token *token, const char *sid_string);
 
 bool security_token_has_builtin_guests(const struct security_token *token);
@@ -25,10 +25,17 @@
 
 #include "replace.h"
 #include "system/select.h"
+#include "system/shmem.h"
 #include "winbind_client.h"
+#include "winbind_nss_cache.h"
 
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
+#include "system/threads.h"
+#endif
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_ATOMIC_THREAD_FENCE)
+#define WINBINDD_NSS_CACHE_SUPPORTED 1
 #endif
 
 static char client_name[32];
@@ -159,6 +166,8 @@ static void winbind_destructor(void)
 	ctx = get_wb_global_ctx();
 	winbind_close_sock(ctx);
 	put_wb_global_ctx();
+
+	winbindd_nss_cache_close();
 }
 
 #define CONNECT_TIMEOUT 30
@@ -415,6 +424,320 @@ static const char *winbindd_socket_dir(void)
 	return WINBINDD_SOCKET_DIR;
 }
 
+#ifdef WINBINDD_NSS_CACHE_SUPPORTED
+
+/* The passwd/group cache published by winbindd, see winbind_nss_cache.h */
+
+static struct {
+	const struct winbindd_nss_cache_header *hdr;
+	size_t size;
+	time_t last_open;
+} wb_nss_cache;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t wb_nss_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void winbindd_nss_cache_unmap(void)
+{
+	if (wb_nss_cache.hdr != NULL) {
+		munmap(discard_const_p(void, wb_nss_cache.hdr),
+		       wb_nss_cache.size);
+		wb_nss_cache.hdr = NULL;
+		wb_nss_cache.size = 0;
+	}
+}
+
+static bool winbindd_nss_cache_map(void)
+{
+	struct winbindd_nss_cache_header hdr;
+	char path[PATH_MAX];
+	struct stat st;
+	time_t now;
+	size_t size;
+	ssize_t nread;
+	void *p;
+	int fd;
+	int ret;
+
+	if (wb_nss_cache.hdr != NULL) {
+		volatile const uint32_t *valid = &wb_nss_cache.hdr->valid;
+
+		if (*valid == 1) {
+			return true;
+		}
+		winbindd_nss_cache_unmap();
+	}
+
+	/*
+	 * Without winbindd or with the cache switched off, don't
+	 * try to open the file for every single lookup.
+	 */
+	now = time(NULL);
+	if (now == wb_nss_cache.last_open) {
+		return false;
+	}
+	wb_nss_cache.last_open = now;
+
+	ret = snprintf(path, sizeof(path), "%s/%s",
+		       winbindd_socket_dir(), WINBINDD_NSS_CACHE_NAME);
+	if ((ret < 0) || ((size_t)ret >= sizeof(path))) {
+		return false;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+
+	/* Only trust a file that winbindd could have written */
+	ret = fstat(fd, &st);
+	if ((ret == -1) ||
+	    !S_ISREG(st.st_mode) ||
+	    ((st.st_mode & (S_IWGRP|S_IWOTH)) != 0) ||
+	    !winbind_privileged_pipe_is_root(st.st_uid)) {
+		close(fd);
+		return false;
+	}
+
+	nread = pread(fd, &hdr, sizeof(hdr), 0);
+	if ((nread != sizeof(hdr)) ||
+	    (hdr.magic != WINBINDD_NSS_CACHE_MAGIC) ||
+	    (hdr.version != WINBINDD_NSS_CACHE_VERSION) ||
+	    (hdr.valid != 1) ||
+	    (hdr.num_slots == 0)) {
+		close(fd);
+		return false;
+	}
+
+	size = sizeof(hdr) +
+		(size_t)hdr.num_slots * sizeof(struct winbindd_nss_cache_slot);
+	if ((off_t)size > st.st_size) {
+		close(fd);
+		return false;
+	}
+
+	p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+
+	wb_nss_cache.hdr = p;
+	wb_nss_cache.size = size;
+	return true;
+}
+
+static bool winbindd_nss_cache_read_slot(
+	const struct winbindd_nss_cache_slot *slot,
+	struct winbindd_nss_cache_slot *copy)
+{
+	volatile const uint32_t *seqnum = &slot->seqnum;
+	uint32_t seq1, seq2;
+	int i;
+
+	for (i=0; i<3; i++) {
+		seq1 = *seqnum;
+		atomic_thread_fence(memory_order_seq_cst);
+		memcpy(copy, slot, sizeof(*copy));
+		atomic_thread_fence(memory_order_seq_cst);
+		seq2 = *seqnum;
+
+		if ((seq1 == seq2) && ((seq1 % 2) == 0)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool winbindd_nss_cache_find(uint32_t type,
+				    uint64_t key_id,
+				    const char *key_name,
+				    struct winbindd_nss_cache_slot *found)
+{
+	const struct winbindd_nss_cache_slot *slots = NULL;
+	uint32_t num_slots;
+	uint32_t h;
+	uint32_t i;
+	time_t now;
+
+	if (!winbindd_nss_cache_map()) {
+		return false;
+	}
+
+	slots = (const struct winbindd_nss_cache_slot *)
+		(wb_nss_cache.hdr + 1);
+	num_slots = wb_nss_cache.hdr->num_slots;
+	now = time(NULL);
+
+	h = winbindd_nss_cache_hash(type, key_id, key_name);
+
+	for (i=0; i<WINBINDD_NSS_CACHE_PROBES; i++) {
+		const struct winbindd_nss_cache_slot *slot =
+			&slots[(h + i) % num_slots];
+		bool ok;
+
+		/*
+		 * Cheap unlocked check first, the full copy below is
+		 * consistent.
+		 */
+		if ((slot->type != type) || (slot->key_id != key_id)) {
+			continue;
+		}
+
+		ok = winbindd_nss_cache_read_slot(slot, found);
+		if (!ok) {
+			continue;
+		}
+
+		found->key_name[sizeof(found->key_name)-1] = '\0';
+
+		if ((found->type != type) ||
+		    (found->key_id != key_id) ||
+		    (strcmp(found->key_name, key_name) != 0)) {
+			continue;
+		}
+		if (found->expiry <= (uint64_t)now) {
+			return false;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+static void winbindd_nss_cache_terminate(char *str, size_t len)
+{
+	str[len-1] = '\0';
+}
+
+/**
+ * @brief Answer a getpw/getgr request from winbindd's shared cache
+ *
+ * @param[in]  req_type  WINBINDD_GETPWNAM, _GETPWUID, _GETGRNAM or _GETGRGID
+ * @param[in]  request   The request that would be sent to winbindd
+ * @param[out] response  Filled like winbindd would on a hit
+ *
+ * @return true on a hit, false if winbindd needs to be asked.
+ */
+bool winbindd_nss_cache_lookup(int req_type,
+			       const struct winbindd_request *request,
+			       struct winbindd_response *response)
+{
+	struct winbindd_nss_cache_slot slot;
+	uint32_t type;
+	uint64_t key_id = 0;
+	const char *key_name = "";
+	bool ok;
+
+	switch (req_type) {
+	case WINBINDD_GETPWNAM:
+		type = WINBINDD_NSS_CACHE_PWNAM;
+		key_name = request->data.username;
+		break;
+	case WINBINDD_GETPWUID:
+		type = WINBINDD_NSS_CACHE_PWUID;
+		key_id = request->data.uid;
+		break;
+	case WINBINDD_GETGRNAM:
+		type = WINBINDD_NSS_CACHE_GRNAM;
+		key_name = request->data.groupname;
+		break;
+	case WINBINDD_GETGRGID:
+		type = WINBINDD_NSS_CACHE_GRGID;
+		key_id = request->data.gid;
+		break;
+	default:
+		return false;
+	}
+
+	if (winbind_env_set()) {
+		return false;
+	}
+
+	if (strnlen(key_name, sizeof(fstring)) >= sizeof(fstring)) {
+		return false;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&wb_nss_cache_mutex);
+#endif
+	ok = winbindd_nss_cache_find(type, key_id, key_name, &slot);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&wb_nss_cache_mutex);
+#endif
+	if (!ok) {
+		return false;
+	}
+
+	*response = (struct winbindd_response) {
+		.length = sizeof(struct winbindd_response),
+		.result = WINBINDD_OK,
+	};
+
+	switch (type) {
+	case WINBINDD_NSS_CACHE_PWNAM:
+	case WINBINDD_NSS_CACHE_PWUID: {
+		struct winbindd_pw *pw = &response->data.pw;
+
+		*pw = slot.data.pw;
+		winbindd_nss_cache_terminate(pw->pw_name,
+					     sizeof(pw->pw_name));
+		winbindd_nss_cache_terminate(pw->pw_passwd,
+					     sizeof(pw->pw_passwd));
+		winbindd_nss_cache_terminate(pw->pw_gecos,
+					     sizeof(pw->pw_gecos));
+		winbindd_nss_cache_terminate(pw->pw_dir,
+					     sizeof(pw->pw_dir));
+		winbindd_nss_cache_terminate(pw->pw_shell,
+					     sizeof(pw->pw_shell));
+		break;
+	}
+	default: {
+		struct winbindd_gr *gr = &response->data.gr;
+
+		*gr = slot.data.gr;
+		winbindd_nss_cache_terminate(gr->gr_name,
+					     sizeof(gr->gr_name));
+		winbindd_nss_cache_terminate(gr->gr_passwd,
+					     sizeof(gr->gr_passwd));
+		gr->num_gr_mem = 0;
+		gr->gr_mem_ofs = 0;
+		break;
+	}
+	}
+
+	return true;
+}
+
+void winbindd_nss_cache_close(void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&wb_nss_cache_mutex);
+#endif
+	winbindd_nss_cache_unmap();
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&wb_nss_cache_mutex);
+#endif
+}
+
+#else /* WINBINDD_NSS_CACHE_SUPPORTED */
+
+bool winbindd_nss_cache_lookup(int req_type,
+			       const struct winbindd_request *request,
+			       struct winbindd_response *response)
+{
+	return false;
+}
+
+void winbindd_nss_cache_close(void)
+{
+	return;
+}
+
+#endif /* WINBINDD_NSS_CACHE_SUPPORTED */
+
 /* Connect to winbindd socket */
 
 static int winbind_open_pipe_sock(struct winbindd_context *ctx,
@@ -46,6 +46,11 @@ NSS_STATUS winbindd_priv_request_response(struct winbindd_context *ctx,
 
 void winbind_set_client_name(const char *name);
 
+bool winbindd_nss_cache_lookup(int req_type,
+			       const struct winbindd_request *request,
+			       struct winbindd_response *response);
+void winbindd_nss_cache_close(void);
+
 #define winbind_env_set() \
 	(strcmp(getenv(WINBINDD_DONT_ENV)?getenv(WINBINDD_DONT_ENV):"0","1") == 0)
 
@@ -0,0 +1,94 @@
+/*
+   Unix SMB/CIFS implementation.
+
+   Layout of the passwd/group cache winbindd shares with nss_winbind
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NSSWITCH_WINBIND_NSS_CACHE_H_
+#define _NSSWITCH_WINBIND_NSS_CACHE_H_
+
+#include "winbind_struct_protocol.h"
+
+/*
+ * If "winbind nss cache size" is set, the winbindd parent process
+ * publishes the passwd and group entries it returned recently in a
+ * file next to its socket. nss_winbind maps this file read-only and
+ * answers getpwnam, getpwuid, getgrnam and getgrgid from it without
+ * talking to winbindd.
+ *
+ * The file is a header followed by num_slots slots, an open
+ * addressing hash table with WINBINDD_NSS_CACHE_PROBES slots probed
+ * per key. winbindd is the only writer. While it changes a slot the
+ * slot's seqnum is odd, readers copy a slot and retry or ignore it if
+ * seqnum was odd or changed during the copy.
+ *
+ * When winbindd creates a new file or exits, it sets "valid" in the
+ * old file to 0, readers then remap the file.
+ */
+
+#define WINBINDD_NSS_CACHE_NAME "nsscache"
+#define WINBINDD_NSS_CACHE_MAGIC 0x77626e63 /* "wbnc" */
+#define WINBINDD_NSS_CACHE_VERSION 1
+#define WINBINDD_NSS_CACHE_PROBES 8
+
+enum winbindd_nss_cache_type {
+	WINBINDD_NSS_CACHE_EMPTY = 0,
+	WINBINDD_NSS_CACHE_PWNAM,
+	WINBINDD_NSS_CACHE_PWUID,
+	WINBINDD_NSS_CACHE_GRNAM,
+	WINBINDD_NSS_CACHE_GRGID,
+};
+
+struct winbindd_nss_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t valid;
+	uint32_t num_slots;
+};
+
+struct winbindd_nss_cache_slot {
+	uint32_t seqnum;
+	uint32_t type;		/* enum winbindd_nss_cache_type */
+	uint64_t key_id;	/* uid or gid */
+	uint64_t expiry;	/* time_t */
+	fstring key_name;	/* user or group name as asked for */
+	union {
+		struct winbindd_pw pw;
+		struct winbindd_gr gr;
+	} data;
+};
+
+static inline uint32_t winbindd_nss_cache_hash(uint32_t type,
+					       uint64_t key_id,
+					       const char *key_name)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	h = (h ^ type) * 16777619U;
+
+	for (i=0; i<sizeof(key_id); i++) {
+		h = (h ^ ((key_id >> (i*8)) & 0xff)) * 16777619U;
+	}
+
+	for (i=0; key_name[i] != '\0'; i++) {
+		h = (h ^ (uint8_t)key_name[i]) * 16777619U;
+	}
+
+	return h;
+}
+
+#endif /* _NSSWITCH_WINBIND_NSS_CACHE_H_ */
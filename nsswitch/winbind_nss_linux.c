@@ -554,8 +554,13 @@ _nss_winbind_getpwuid_r(uid_t uid, struct passwd *result, char *buffer,
 			},
 		};
 
-		winbind_set_client_name("nss_winbind");
-		ret = winbindd_request_response(NULL, WINBINDD_GETPWUID, &request, &response);
+		if (winbindd_nss_cache_lookup(WINBINDD_GETPWUID, &request, &response)) {
+			ret = NSS_STATUS_SUCCESS;
+		} else {
+			winbind_set_client_name("nss_winbind");
+			ret = winbindd_request_response(NULL, WINBINDD_GETPWUID,
+							&request, &response);
+		}
 
 		if (ret == NSS_STATUS_SUCCESS) {
 			ret = fill_pwent(result, &response.data.pw,
@@ -635,8 +640,13 @@ _nss_winbind_getpwnam_r(const char *name, struct passwd *result, char *buffer,
 		request.data.username
 			[sizeof(request.data.username) - 1] = '\0';
 
-		winbind_set_client_name("nss_winbind");
-		ret = winbindd_request_response(NULL, WINBINDD_GETPWNAM, &request, &response);
+		if (winbindd_nss_cache_lookup(WINBINDD_GETPWNAM, &request, &response)) {
+			ret = NSS_STATUS_SUCCESS;
+		} else {
+			winbind_set_client_name("nss_winbind");
+			ret = winbindd_request_response(NULL, WINBINDD_GETPWNAM,
+							&request, &response);
+		}
 
 		if (ret == NSS_STATUS_SUCCESS) {
 			ret = fill_pwent(result, &response.data.pw, &buffer,
@@ -916,9 +926,13 @@ _nss_winbind_getgrnam_r(const char *name,
 		request.data.groupname
 			[sizeof(request.data.groupname) - 1] = '\0';
 
-		winbind_set_client_name("nss_winbind");
-		ret = winbindd_request_response(NULL, WINBINDD_GETGRNAM,
-						&request, &response);
+		if (winbindd_nss_cache_lookup(WINBINDD_GETGRNAM, &request, &response)) {
+			ret = NSS_STATUS_SUCCESS;
+		} else {
+			winbind_set_client_name("nss_winbind");
+			ret = winbindd_request_response(NULL, WINBINDD_GETGRNAM,
+							&request, &response);
+		}
 
 		if (ret == NSS_STATUS_SUCCESS) {
 			ret = fill_grent(result, &response.data.gr,
@@ -1001,9 +1015,13 @@ _nss_winbind_getgrgid_r(gid_t gid,
 
 		request.data.gid = gid;
 
-		winbind_set_client_name("nss_winbind");
-		ret = winbindd_request_response(NULL, WINBINDD_GETGRGID,
-						&request, &response);
+		if (winbindd_nss_cache_lookup(WINBINDD_GETGRGID, &request, &response)) {
+			ret = NSS_STATUS_SUCCESS;
+		} else {
+			winbind_set_client_name("nss_winbind");
+			ret = winbindd_request_response(NULL, WINBINDD_GETGRGID,
+							&request, &response);
+		}
 
 		if (ret == NSS_STATUS_SUCCESS) {
 
@@ -26,7 +26,7 @@ import errno
 import samba.ndr as ndr
 from samba import credentials, param
 from samba.tests import TestCase
-from samba.dcerpc import dns, dnsp, dnsserver
+from samba.dcerpc import dns, dnsp, dnsserver, irpc
 from samba.netcmd.dns import TXTRecord, dns_record_match, data_to_dns_record
 from samba.tests.subunitrun import SubunitOptions, TestProgram
 import samba.getopt as options
@@ -603,4 +603,99 @@ class TestDnsForwarding(DNSTest):
             self.fail("DNS server is too slow (timeout %s)" % timeout)
 
 
+    def forwarded_query(self, name):
+        ad = contact_real_server(server_ip, 53)
+        p = self.make_name_packet(dns.DNS_OPCODE_QUERY)
+        q = self.make_name_question(name, dns.DNS_QTYPE_CNAME,
+                                    dns.DNS_QCLASS_IN)
+        self.finish_name_packet(p, [q])
+        p.operation |= dns.DNS_FLAG_RECURSION_DESIRED
+        send_packet = ndr.ndr_pack(p)
+
+        ad.send(send_packet, 0)
+        ad.settimeout(timeout)
+        return ad
+
+    def forwarded_reply(self, ad):
+        try:
+            data = ad.recv(0xffff + 2, 0)
+        except socket.timeout:
+            self.fail("DNS server is too slow (timeout %s)" % timeout)
+        return ndr.ndr_unpack(dns.name_packet, data)
+
+    def forwarder_cache_stats(self):
+        conn = irpc.irpc("irpc:dnssrv", self.lp)
+        return conn.dnssrv_forwarder_cache_info()
+
+    def test_forwarder_cache(self):
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        s.send(b'ttl 900', 0)
+        name = "cached-%d.dsfsdfs" % random.randint(0, 1 << 30)
+
+        data = self.forwarded_reply(self.forwarded_query(name))
+        self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+        self.assertEqual('forwarder1', data.answers[0].rdata)
+        self.assertEqual(900, data.answers[0].ttl)
+
+        # The forwarder no longer answers, so this has to come from
+        # the cache.
+        s.send(b'timeout 10000', 0)
+        data = self.forwarded_reply(self.forwarded_query(name))
+        self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+        self.assertEqual('forwarder1', data.answers[0].rdata)
+        self.assertLessEqual(data.answers[0].ttl, 900)
+
+    def test_forwarder_cache_expiry(self):
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        s.send(b'ttl 1', 0)
+        name = "expired-%d.dsfsdfs" % random.randint(0, 1 << 30)
+
+        data = self.forwarded_reply(self.forwarded_query(name))
+        self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+        self.assertEqual(1, data.answers[0].ttl)
+
+        # Once the first reply has expired we must see the new TTL
+        s.send(b'ttl 900', 0)
+        time.sleep(2)
+        data = self.forwarded_reply(self.forwarded_query(name))
+        self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+        self.assertEqual(900, data.answers[0].ttl)
+
+    def test_forwarder_cache_no_ttl(self):
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        name = "uncached-%d.dsfsdfs" % random.randint(0, 1 << 30)
+
+        before = self.forwarder_cache_stats()
+        for i in range(2):
+            data = self.forwarded_reply(self.forwarded_query(name))
+            self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+            self.assertEqual('forwarder1', data.answers[0].rdata)
+        after = self.forwarder_cache_stats()
+
+        self.assertEqual(before.hits, after.hits)
+        self.assertEqual(before.stored, after.stored)
+        self.assertEqual(before.misses + 2, after.misses)
+
+    def test_forwarder_coalescing(self):
+        s = self.start_toy_server(dns_servers[0], 53, 'forwarder1')
+        s.send(b'ttl 900', 0)
+        s.send(b'timeout 1', 0)
+        name = "coalesced-%d.dsfsdfs" % random.randint(0, 1 << 30)
+
+        before = self.forwarder_cache_stats()
+        queries = [self.forwarded_query(name) for i in range(3)]
+        for ad in queries:
+            data = self.forwarded_reply(ad)
+            self.assert_dns_rcode_equals(data, dns.DNS_RCODE_OK)
+            self.assertEqual('forwarder1', data.answers[0].rdata)
+        data = self.forwarded_reply(self.forwarded_query(name))
+        self.assertEqual('forwarder1', data.answers[0].rdata)
+        after = self.forwarder_cache_stats()
+
+        self.assertEqual(before.misses + 1, after.misses)
+        self.assertEqual(before.coalesced + 2, after.coalesced)
+        self.assertEqual(before.stored + 1, after.stored)
+        self.assertEqual(before.hits + 1, after.hits)
+
+
 TestProgram(module=__name__, opts=subunitopts)
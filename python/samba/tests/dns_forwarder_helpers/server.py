@@ -36,6 +36,7 @@ def debug(msg):
 
 
 timeout = 0
+ttl = 0
 
 
 def answer_question(data, question):
@@ -43,7 +44,7 @@ def answer_question(data, question):
     r.name = question.name
     r.rr_type = dns.DNS_QTYPE_CNAME
     r.rr_class = dns.DNS_QCLASS_IN
-    r.ttl = 900
+    r.ttl = ttl
     r.length = 0xffff
     r.rdata = SERVER_ID
     return r
@@ -82,6 +83,13 @@ class DnsHandler(SocketServer.BaseRequestHandler):
             debug("timing out at %s" % timeout)
             return
 
+        global ttl
+        m = re.match(b'^ttl\s+(\d+)$', data.strip())
+        if m:
+            ttl = int(m.group(1))
+            debug("answering with ttl %d" % ttl)
+            return
+
         t = Timer(timeout, self.really_handle, [data, socket])
         t.start()
 
@@ -0,0 +1,188 @@
+# Unix SMB/CIFS implementation.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+"""Replay a mix of AS-REQs and TGS-REQs against the KDC and report the
+request rate.
+
+The number of logons and the number of service tickets requested per
+logon can be changed with the KDC_PERF_LOGONS and KDC_PERF_TGS_PER_LOGON
+environment variables.
+"""
+
+import sys
+import os
+import time
+
+sys.path.insert(0, "bin/python")
+os.environ["PYTHONUNBUFFERED"] = "1"
+
+import samba.tests
+from samba.tests.krb5.raw_testcase import RawKerberosTest
+import samba.tests.krb5.rfc4120_pyasn1 as krb5_asn1
+
+KDC_ERR_PREAUTH_REQUIRED = 25
+KRB_AS_REP = 11
+KRB_TGS_REP = 13
+KRB_ERROR = 30
+
+
+def env_int(name, default):
+    value = samba.tests.env_get_var_value(name, allow_missing=True)
+    if value is None:
+        return default
+    return int(value)
+
+
+class KdcPerformanceTests(RawKerberosTest):
+
+    def setUp(self):
+        super(KdcPerformanceTests, self).setUp()
+        self.n_logons = env_int('KDC_PERF_LOGONS', 200)
+        self.n_tgs = env_int('KDC_PERF_TGS_PER_LOGON', 5)
+
+        self.user_creds = self.get_user_creds()
+        self.realm = self.user_creds.get_realm()
+        self.cname = self.PrincipalName_create(
+            name_type=1, names=[self.user_creds.get_username()])
+        self.krbtgt_sname = self.PrincipalName_create(
+            name_type=2, names=["krbtgt", self.realm])
+        self.host_sname = self.PrincipalName_create(
+            name_type=2, names=["host", self.host])
+        self.etypes = (18, 17, 23)
+        self.key = None
+
+    def _send(self, req):
+        self.connect()
+        try:
+            return self.send_recv_transaction(req)
+        finally:
+            self._disconnect("request done")
+
+    def _as_req(self, padata):
+        kdc_options = krb5_asn1.KDCOptions('forwardable')
+        req = self.AS_REQ_create(padata=padata,
+                                 kdc_options=str(kdc_options),
+                                 cname=self.cname,
+                                 realm=self.realm,
+                                 sname=self.krbtgt_sname,
+                                 from_time=None,
+                                 till_time=self.get_KerberosTime(offset=36000),
+                                 renew_time=None,
+                                 nonce=0x7fffffff,
+                                 etypes=self.etypes,
+                                 addresses=None,
+                                 EncAuthorizationData=None,
+                                 EncAuthorizationData_key=None,
+                                 additional_tickets=None)
+        return self._send(req)
+
+    def _get_password_key(self):
+        rep = self._as_req(None)
+        self.assertEqual(rep['msg-type'], KRB_ERROR)
+        self.assertEqual(rep['error-code'], KDC_ERR_PREAUTH_REQUIRED)
+        rep_padata = self.der_decode(rep['e-data'],
+                                     asn1Spec=krb5_asn1.METHOD_DATA())
+        etype_info2 = None
+        for pa in rep_padata:
+            if pa['padata-type'] == 19:
+                etype_info2 = pa['padata-value']
+                break
+        self.assertIsNotNone(etype_info2)
+        etype_info2 = self.der_decode(etype_info2,
+                                      asn1Spec=krb5_asn1.ETYPE_INFO2())
+        return self.PasswordKey_from_etype_info2(self.user_creds,
+                                                 etype_info2[0])
+
+    def _logon(self):
+        """An AS-REQ with encrypted timestamp pre-authentication"""
+        (patime, pausec) = self.get_KerberosTimeWithUsec()
+        pa_ts = self.PA_ENC_TS_ENC_create(patime, pausec)
+        pa_ts = self.der_encode(pa_ts, asn1Spec=krb5_asn1.PA_ENC_TS_ENC())
+        pa_ts = self.EncryptedData_create(self.key, 1, pa_ts)
+        pa_ts = self.der_encode(pa_ts, asn1Spec=krb5_asn1.EncryptedData())
+        pa_ts = self.PA_DATA_create(2, pa_ts)
+
+        rep = self._as_req([pa_ts])
+        self.assertEqual(rep['msg-type'], KRB_AS_REP)
+
+        enc_part2 = self.key.decrypt(3, rep['enc-part']['cipher'])
+        try:
+            enc_part2 = self.der_decode(enc_part2,
+                                        asn1Spec=krb5_asn1.EncASRepPart())
+        except Exception:
+            enc_part2 = self.der_decode(enc_part2,
+                                        asn1Spec=krb5_asn1.EncTGSRepPart())
+        return (rep['ticket'], self.EncryptionKey_import(enc_part2['key']))
+
+    def _service_ticket(self, ticket, session_key):
+        kdc_options = krb5_asn1.KDCOptions('forwardable')
+        subkey = self.RandomKey(session_key.etype)
+        (ctime, cusec) = self.get_KerberosTimeWithUsec()
+        req = self.TGS_REQ_create(padata=[],
+                                  cusec=cusec,
+                                  ctime=ctime,
+                                  ticket=ticket,
+                                  kdc_options=str(kdc_options),
+                                  cname=self.cname,
+                                  realm=self.realm,
+                                  sname=self.host_sname,
+                                  from_time=None,
+                                  till_time=self.get_KerberosTime(offset=36000),
+                                  renew_time=None,
+                                  nonce=0x7ffffffe,
+                                  etypes=self.etypes,
+                                  addresses=None,
+                                  EncAuthorizationData=None,
+                                  EncAuthorizationData_key=None,
+                                  additional_tickets=None,
+                                  ticket_session_key=session_key,
+                                  authenticator_subkey=subkey)
+        rep = self._send(req)
+        self.assertEqual(rep['msg-type'], KRB_TGS_REP)
+
+    def _report(self, what, n, t):
+        print("%d %s took %.3fs (%.1f requests/sec)" %
+              (n, what, t, n / t if t else 0.0), file=sys.stderr)
+
+    def test_as_req(self):
+        self.key = self._get_password_key()
+        t = time.time()
+        for i in range(self.n_logons):
+            self._logon()
+        self._report("AS-REQs", self.n_logons, time.time() - t)
+
+    def test_tgs_req(self):
+        self.key = self._get_password_key()
+        (ticket, session_key) = self._logon()
+        n = self.n_logons * self.n_tgs
+        t = time.time()
+        for i in range(n):
+            self._service_ticket(ticket, session_key)
+        self._report("TGS-REQs", n, time.time() - t)
+
+    def test_logon_mix(self):
+        """Each logon followed by a few service tickets, as seen at a
+        morning logon peak"""
+        self.key = self._get_password_key()
+        n = 0
+        t = time.time()
+        for i in range(self.n_logons):
+            (ticket, session_key) = self._logon()
+            n += 1
+            for j in range(self.n_tgs):
+                self._service_ticket(ticket, session_key)
+                n += 1
+        self._report("AS/TGS requests", n, time.time() - t)
@@ -14,6 +14,7 @@
 
 import os
 from selftesthelpers import source4dir, bindir, python, plantestsuite_loadlist
+from selftesthelpers import planpythontestsuite
 
 samba4srcdir = source4dir()
 samba4bindir = bindir()
@@ -80,6 +81,8 @@ plantestsuite_loadlist("samba4.ldap.vlv.python(ad_dc_ntvfs)", "ad_dc_ntvfs",
                         '$SERVER', '-U"$USERNAME%$PASSWORD"',
                         '--workgroup=$DOMAIN', '$LOADLIST', '$LISTOPT'])
 
+planpythontestsuite("ad_dc_ntvfs", "samba.tests.krb5.kdc_performance")
+
 # this one doesn't tidy itself up fully, so leave it as last unless
 # you want a messy database.
 plantestsuite_loadlist("samba4.ldap.ad_dc_medley_performance.python(ad_dc_ntvfs)",
@@ -2350,6 +2350,10 @@ sub provision($$)
 	path = $shrdir
 	comment = Load dirsort module
 	vfs objects = dirsort acl_xattr fake_acls xattr_tdb streams_depot
+[dircache]
+	path = $shrdir
+	comment = Load dircache module
+	vfs objects = dircache
 [tmpenc]
 	path = $shrdir
 	comment = encrypt smb username is [%U]
@@ -2774,6 +2778,9 @@ sub provision($$)
 	copy = tmp
 	acl_xattr:ignore system acls = yes
 	acl_xattr:default acl style = windows
+[acl_xattr_sd_cache]
+	copy = tmp
+	acl_xattr:sd cache size = 1024
 
 [mangle_illegal]
 	copy = tmp
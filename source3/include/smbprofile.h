@@ -30,6 +30,7 @@ struct tevent_context;
 	\
 	SMBPROFILE_STATS_SECTION_START(global, "SMBD loop") \
 	SMBPROFILE_STATS_COUNT(connect) \
+	SMBPROFILE_STATS_BASIC(connect_setup) \
 	SMBPROFILE_STATS_COUNT(disconnect) \
 	SMBPROFILE_STATS_BASIC(idle) \
 	SMBPROFILE_STATS_TIME(cpu_user) \
@@ -339,6 +340,18 @@ struct profile_stats {
 #define SMBPROFILE_COUNT_INCREMENT(_name, _area, _v) \
 	_SMBPROFILE_COUNT_INCREMENT(_name##_stats, _area, _v)
 
+#define _SMBPROFILE_BASIC_ADD(_stats, _area, _usec) do { \
+	if (smbprofile_state.config.do_count) { \
+		(_area)->values._stats.count += 1; \
+		if (smbprofile_state.config.do_times) { \
+			(_area)->values._stats.time += (_usec); \
+		} \
+		smbprofile_dump_schedule(); \
+	} \
+} while(0)
+#define SMBPROFILE_BASIC_ADD(_name, _area, _usec) \
+	_SMBPROFILE_BASIC_ADD(_name##_stats, _area, _usec)
+
 #define SMBPROFILE_TIME_ASYNC_STATE(_async_name) \
 	struct smbprofile_stats_time_async _async_name;
 #define _SMBPROFILE_TIME_ASYNC_START(_stats, _area, _async) do { \
@@ -546,6 +559,8 @@ static inline uint64_t profile_timestamp(void)
 
 #define SMBPROFILE_COUNT_INCREMENT(_name, _area, _v)
 
+#define SMBPROFILE_BASIC_ADD(_name, _area, _usec)
+
 #define SMBPROFILE_TIME_ASYNC_STATE(_async_name)
 #define SMBPROFILE_TIME_ASYNC_START(_name, _area, _async)
 #define SMBPROFILE_TIME_ASYNC_END(_async)
@@ -327,6 +327,7 @@
  * Version 43 - SMB_VFS_READ_DFS_PATHAT() should take a non-const name.
 		There's no easy way to return stat info for a DFS link
 		otherwise.
+ * Version 43 - Add sid_index to struct vuid_cache_entry
  */
 
 #define SMB_VFS_INTERFACE_VERSION 43
@@ -495,6 +496,7 @@ typedef struct files_struct {
 
 struct vuid_cache_entry {
 	struct auth_session_info *session_info;
+	struct security_token_sid_index *sid_index;
 	uint64_t vuid; /* SMB2 compat */
 	bool read_only;
 	uint32_t share_access;
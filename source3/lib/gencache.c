@@ -30,6 +30,7 @@
 #include "zlib.h"
 #include "lib/util/strv.h"
 #include "lib/util/util_paths.h"
+#include "lib/util/memcache.h"
 
 #undef  DBGC_CLASS
 #define DBGC_CLASS DBGC_TDB
@@ -38,6 +39,25 @@
 
 static struct tdb_wrap *cache;
 
+/*
+ * Per-process front cache for gencache_parse(). gencache.tdb is opened
+ * with TDB_SEQNUM, so every store or delete done by any process bumps
+ * the tdb sequence number. The records in the front cache were read
+ * while the sequence number was gencache_front_seqnum, all of them are
+ * thrown away as soon as it changed. Keys not found in gencache.tdb are
+ * cached as empty values.
+ */
+static struct memcache *gencache_front;
+static int gencache_front_seqnum;
+
+static struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t flushes;
+} gencache_front_stats;
+
+#define GENCACHE_FRONT_REPORT_INTERVAL 10000
+
 /**
  * @file gencache.c
  * @brief Generic, persistent and shared between processes cache mechanism
@@ -71,8 +91,10 @@ static bool gencache_init(void)
 {
 	char* cache_fname = NULL;
 	int open_flags = O_RDWR|O_CREAT;
-	int tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_NOSYNC|TDB_MUTEX_LOCKING;
+	int tdb_flags = TDB_INCOMPATIBLE_HASH|TDB_NOSYNC|TDB_MUTEX_LOCKING|
+		TDB_SEQNUM;
 	int hash_size;
+	int front_size;
 
 	/* skip file open if it's already opened */
 	if (cache) {
@@ -154,9 +176,51 @@ static bool gencache_init(void)
 	}
 	TALLOC_FREE(cache_fname);
 
+	front_size = lp_parm_int(-1, "gencache", "front_cache_size", 1024);
+	if (front_size > 0) {
+		gencache_front = memcache_init(NULL, (size_t)front_size * 1024);
+		gencache_front_seqnum = tdb_get_seqnum(cache->tdb);
+	}
+
 	return true;
 }
 
+static void gencache_front_report(void)
+{
+	uint64_t lookups = gencache_front_stats.hits +
+		gencache_front_stats.misses;
+
+	if ((lookups % GENCACHE_FRONT_REPORT_INTERVAL) != 0) {
+		return;
+	}
+
+	DBG_DEBUG("front cache: %"PRIu64" hits, %"PRIu64" misses "
+		  "(%"PRIu64"%% hit ratio), %"PRIu64" flushes\n",
+		  gencache_front_stats.hits,
+		  gencache_front_stats.misses,
+		  gencache_front_stats.hits * 100 / lookups,
+		  gencache_front_stats.flushes);
+}
+
+/*
+ * Throw away the front cache if any process changed gencache.tdb since
+ * we filled it. This has to be called before reading gencache.tdb, so
+ * that records read afterwards are at least as new as the sequence
+ * number we remember.
+ */
+static void gencache_front_revalidate(void)
+{
+	int seqnum = tdb_get_seqnum(cache->tdb);
+
+	if (seqnum == gencache_front_seqnum) {
+		return;
+	}
+
+	memcache_flush(gencache_front, GENCACHE_RAM);
+	gencache_front_seqnum = seqnum;
+	gencache_front_stats.flushes += 1;
+}
+
 /*
  * Walk the hash chain for "key", deleting all expired entries for
  * that hash chain
@@ -404,11 +468,67 @@ static int gencache_parse_fn(TDB_DATA key, TDB_DATA data, void *private_data)
 		state->format_error = true;
 		return 0;
 	}
+
+	if (gencache_front != NULL) {
+		/*
+		 * The front cache stores the timeout followed by the
+		 * payload, that's the record without the trailing crc.
+		 */
+		memcache_add(gencache_front,
+			     GENCACHE_RAM,
+			     data_blob_const(key.dptr, key.dsize),
+			     data_blob_const(data.dptr,
+					     data.dsize - sizeof(uint32_t)));
+	}
+
 	state->parser(&t, payload, state->private_data);
 
 	return 0;
 }
 
+/*
+ * Try to answer gencache_parse() from the front cache. Returns true if
+ * the key was found there, *found tells whether it exists in
+ * gencache.tdb.
+ */
+static bool gencache_front_parse(TDB_DATA key,
+				 struct gencache_parse_state *state,
+				 bool *found)
+{
+	struct gencache_timeout t;
+	DATA_BLOB value;
+	bool ok;
+
+	gencache_front_revalidate();
+
+	ok = memcache_lookup(gencache_front,
+			     GENCACHE_RAM,
+			     data_blob_const(key.dptr, key.dsize),
+			     &value);
+	if (!ok) {
+		gencache_front_stats.misses += 1;
+		gencache_front_report();
+		return false;
+	}
+
+	gencache_front_stats.hits += 1;
+	gencache_front_report();
+
+	if (value.length == 0) {
+		*found = false;
+		return true;
+	}
+
+	memcpy(&t.timeout, value.data, sizeof(time_t));
+	state->parser(&t,
+		      data_blob_const(value.data + sizeof(time_t),
+				      value.length - sizeof(time_t)),
+		      state->private_data);
+
+	*found = true;
+	return true;
+}
+
 bool gencache_parse(const char *keystr,
 		    void (*parser)(const struct gencache_timeout *timeout,
 				   DATA_BLOB blob,
@@ -428,11 +548,26 @@ bool gencache_parse(const char *keystr,
 		return false;
 	}
 
+	if (gencache_front != NULL) {
+		bool found;
+
+		if (gencache_front_parse(key, &state, &found)) {
+			return found;
+		}
+	}
+
 	ret = tdb_parse_record(cache->tdb, key,
 			       gencache_parse_fn, &state);
 	if ((ret == -1) && (tdb_error(cache->tdb) == TDB_ERR_CORRUPT)) {
 		goto wipe;
 	}
+	if ((ret == -1) && (tdb_error(cache->tdb) == TDB_ERR_NOEXIST) &&
+	    (gencache_front != NULL)) {
+		memcache_add(gencache_front,
+			     GENCACHE_RAM,
+			     data_blob_const(key.dptr, key.dsize),
+			     data_blob_null);
+	}
 	if (ret == -1) {
 		return false;
 	}
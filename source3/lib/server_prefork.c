@@ -42,6 +42,8 @@ struct prefork_pool {
 
 	prefork_sigchld_fn_t *sigchld_fn;
 	void *sigchld_data;
+
+	struct tevent_signal *sigchld_se;
 };
 
 static bool prefork_setup_sigchld_handler(struct tevent_context *ev_ctx,
@@ -450,6 +452,24 @@ void prefork_warn_active_children(struct messaging_context *msg_ctx,
 	}
 }
 
+void prefork_send_message_to_all(struct messaging_context *msg_ctx,
+				 struct prefork_pool *pfp,
+				 uint32_t msg_type,
+				 const DATA_BLOB *data)
+{
+	int i;
+
+	for (i = 0; i < pfp->pool_size; i++) {
+		if (pfp->pool[i].status == PF_WORKER_NONE) {
+			continue;
+		}
+
+		messaging_send(msg_ctx,
+				pid_to_procid(pfp->pool[i].pid),
+				msg_type, data);
+	}
+}
+
 static void prefork_sigchld_handler(struct tevent_context *ev_ctx,
 				    struct tevent_signal *se,
 				    int signum, int count,
@@ -479,10 +499,58 @@ static bool prefork_setup_sigchld_handler(struct tevent_context *ev_ctx,
 		DEBUG(0, ("Failed to setup SIGCHLD handler!\n"));
 		return false;
 	}
+	pfp->sigchld_se = se;
 
 	return true;
 }
 
+void prefork_disable_sigchld_handler(struct prefork_pool *pfp)
+{
+	TALLOC_FREE(pfp->sigchld_se);
+}
+
+bool prefork_child_exited(struct prefork_pool *pfp, pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < pfp->pool_size; i++) {
+		if (pfp->pool[i].status == PF_WORKER_NONE ||
+		    pfp->pool[i].pid != pid) {
+			continue;
+		}
+
+		/* reset all fields,
+		 * this makes status = PF_WORK_NONE */
+		memset(&pfp->pool[i], 0, sizeof(struct pf_worker_data));
+		return true;
+	}
+
+	return false;
+}
+
+pid_t prefork_detach_idle_child(struct prefork_pool *pfp)
+{
+	pid_t pid;
+	int i;
+
+	for (i = 0; i < pfp->pool_size; i++) {
+		if (pfp->pool[i].status != PF_WORKER_ACCEPTING ||
+		    pfp->pool[i].num_clients != 0 ||
+		    pfp->pool[i].cmds == PF_SRV_MSG_EXIT) {
+			continue;
+		}
+
+		pid = pfp->pool[i].pid;
+
+		/* the child is on its own from now on, free the slot
+		 * so that a replacement can be forked */
+		memset(&pfp->pool[i], 0, sizeof(struct pf_worker_data));
+		return pid;
+	}
+
+	return -1;
+}
+
 void prefork_set_sigchld_callback(struct prefork_pool *pfp,
 				  prefork_sigchld_fn_t *sigchld_fn,
 				  void *private_data)
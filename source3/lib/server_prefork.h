@@ -256,6 +256,20 @@ void prefork_send_signal_to_all(struct prefork_pool *pfp, int signal_num);
 void prefork_warn_active_children(struct messaging_context *msg_ctx,
 				  struct prefork_pool *pfp);
 
+/**
+* @brief Send a message to all children in the pool, for example to pass
+*	 on a message the parent got to the children that are still idle.
+*
+* @param msg_ctx	The messaging context.
+* @param pfp		The pool.
+* @param msg_type	The message type.
+* @param data		The message data.
+*/
+void prefork_send_message_to_all(struct messaging_context *msg_ctx,
+				 struct prefork_pool *pfp,
+				 uint32_t msg_type,
+				 const DATA_BLOB *data);
+
 /**
 * @brief Sets the SIGCHLD callback
 *
@@ -267,6 +281,42 @@ void prefork_set_sigchld_callback(struct prefork_pool *pfp,
 				  prefork_sigchld_fn_t *sigchld_fn,
 				  void *private_data);
 
+/**
+* @brief Stop the pool from reaping its children on SIGCHLD, for parents
+*	 that reap all of their children themselves with waitpid(-1).
+*	 Such a parent must report each child it reaps with
+*	 prefork_child_exited().
+*
+* @param pfp		The pool handler.
+*/
+void prefork_disable_sigchld_handler(struct prefork_pool *pfp);
+
+/**
+* @brief Tell the pool that the parent reaped one of its children.
+*
+* @param pfp		The pool.
+* @param pid		The pid of the child that exited.
+*
+* @return True if the child belonged to the pool, False otherwise.
+*/
+bool prefork_child_exited(struct prefork_pool *pfp, pid_t pid);
+
+/**
+* @brief Take an idle child out of the pool, for parents that accept
+*	 connections themselves and pass them to their children.
+*	 A child is idle when it has set its status to PF_WORKER_ACCEPTING
+*	 and has no clients.
+*
+* @param pfp		The pool.
+*
+* @return The pid of the child, or -1 if no child is idle.
+*
+* NOTE: The slot of the child is freed, so a replacement can be forked with
+*	prefork_add_children(). The detached child must not touch its
+*	pf_worker_data anymore.
+*/
+pid_t prefork_detach_idle_child(struct prefork_pool *pfp);
+
 /* ==== Functions used by children ==== */
 
 /**
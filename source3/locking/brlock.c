@@ -51,6 +51,12 @@ struct byte_range_lock {
 	unsigned int num_locks;
 	bool modified;
 	struct lock_struct *lock_data;
+	/*
+	 * Interval tree over lock_data, built on demand by
+	 * brl_index_build(). Dropped whenever lock_data changes.
+	 */
+	uint64_t *index_max_last;
+	unsigned int index_level;
 	struct db_record *record;
 };
 
@@ -422,6 +428,281 @@ static int lock_compare(const struct lock_struct *lck1,
 }
 #endif
 
+/****************************************************************************
+ The locks in a byte_range_lock are sorted by start offset. Locks with
+ the same start stay in the order they were added, Windows unlock
+ semantics depend on that. On top of the sorted array we build an
+ implicit interval tree: The array is the in-order walk of a complete
+ binary tree, index_max_last[i] is the highest last byte covered by
+ any lock in the subtree rooted at i. This finds the locks overlapping
+ a range in O(log n) plus the number of overlaps.
+****************************************************************************/
+
+/*
+ * Last byte covered by a lock for the interval tree. byte_range_overlap()
+ * lets a zero length lock conflict only at its start offset.
+ */
+
+static uint64_t brl_last(const struct lock_struct *lck)
+{
+	if (lck->size == 0) {
+		return lck->start;
+	}
+	if (!byte_range_valid(lck->start, lck->size)) {
+		return UINT64_MAX;
+	}
+	return lck->start + lck->size - 1;
+}
+
+/*
+ * First lock starting at or after start
+ */
+
+static unsigned int brl_lower_bound(const struct lock_struct *locks,
+				    unsigned int num_locks,
+				    uint64_t start)
+{
+	unsigned int lo = 0, hi = num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start < start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * First lock starting after start, where a new lock with this start goes
+ */
+
+static unsigned int brl_upper_bound(const struct lock_struct *locks,
+				    unsigned int num_locks,
+				    uint64_t start)
+{
+	unsigned int lo = 0, hi = num_locks;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (locks[mid].start <= start) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Stable insertion sort by start. Cheap for the nearly sorted arrays
+ * the POSIX lock code and old records give us.
+ */
+
+static void brl_sort_locks(struct lock_struct *locks, unsigned int num_locks)
+{
+	unsigned int i;
+
+	for (i = 1; i < num_locks; i++) {
+		struct lock_struct tmp;
+		unsigned int j;
+
+		if (locks[i-1].start <= locks[i].start) {
+			continue;
+		}
+
+		tmp = locks[i];
+		j = brl_upper_bound(locks, i, tmp.start);
+		memmove(&locks[j+1], &locks[j], sizeof(*locks) * (i - j));
+		locks[j] = tmp;
+	}
+}
+
+static void brl_index_drop(struct byte_range_lock *br_lck)
+{
+	TALLOC_FREE(br_lck->index_max_last);
+	br_lck->index_level = 0;
+}
+
+static bool brl_index_build(struct byte_range_lock *br_lck)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+	size_t n = br_lck->num_locks;
+	uint64_t *max_last = NULL;
+	uint64_t last = 0;
+	size_t i, last_i = 0;
+	unsigned int k;
+
+	if ((br_lck->index_max_last != NULL) || (n == 0)) {
+		return true;
+	}
+
+	max_last = talloc_array(br_lck, uint64_t, n);
+	if (max_last == NULL) {
+		return false;
+	}
+
+	/* Leaves are at the even indexes */
+	for (i = 0; i < n; i += 2) {
+		last_i = i;
+		last = max_last[i] = brl_last(&locks[i]);
+	}
+
+	/* Inner nodes, bottom up. Level k nodes are at (2^k-1) + j*2^(k+1) */
+	for (k = 1; ((size_t)1 << k) <= n; k++) {
+		size_t x = (size_t)1 << (k - 1);
+		size_t step = x << 2;
+
+		for (i = (x << 1) - 1; i < n; i += step) {
+			uint64_t left = max_last[i - x];
+			uint64_t right = (i + x < n) ? max_last[i + x] : last;
+			uint64_t m = brl_last(&locks[i]);
+
+			m = MAX(m, left);
+			m = MAX(m, right);
+			max_last[i] = m;
+		}
+
+		/*
+		 * Move last_i to the parent of the rightmost node, its
+		 * right subtree might be incomplete.
+		 */
+		last_i = ((last_i >> k) & 1) ? last_i - x : last_i + x;
+		if ((last_i < n) && (max_last[last_i] > last)) {
+			last = max_last[last_i];
+		}
+	}
+
+	br_lck->index_max_last = max_last;
+	br_lck->index_level = k - 1;
+	return true;
+}
+
+static bool brl_add_idx(TALLOC_CTX *mem_ctx,
+			unsigned int **pidx,
+			unsigned int *pnum_idx,
+			size_t i)
+{
+	unsigned int *idx = *pidx;
+	unsigned int num_idx = *pnum_idx;
+
+	if ((num_idx % 8) == 0) {
+		idx = talloc_realloc(mem_ctx, idx, unsigned int, num_idx + 8);
+		if (idx == NULL) {
+			return false;
+		}
+		*pidx = idx;
+	}
+	idx[num_idx] = i;
+	*pnum_idx = num_idx + 1;
+	return true;
+}
+
+struct brl_index_node {
+	size_t x;		/* index into lock_data */
+	unsigned int k;		/* level in the tree, leaves are 0 */
+	bool left_done;
+};
+
+/****************************************************************************
+ Find the locks that might overlap plock, in array order. The caller
+ still has to check for a conflict, this is just a superset.
+****************************************************************************/
+
+static bool brl_find_overlapping(TALLOC_CTX *mem_ctx,
+				 struct byte_range_lock *br_lck,
+				 const struct lock_struct *plock,
+				 unsigned int **pidx,
+				 unsigned int *pnum_idx)
+{
+	const struct lock_struct *locks = br_lck->lock_data;
+	size_t n = br_lck->num_locks;
+	uint64_t qstart = plock->start;
+	uint64_t qlast = brl_last(plock);
+	struct brl_index_node stack[128];
+	unsigned int t = 0;
+	bool ok;
+
+	*pidx = NULL;
+	*pnum_idx = 0;
+
+	if (n == 0) {
+		return true;
+	}
+
+	ok = brl_index_build(br_lck);
+	if (!ok) {
+		return false;
+	}
+
+	stack[t++] = (struct brl_index_node) {
+		.x = ((size_t)1 << br_lck->index_level) - 1,
+		.k = br_lck->index_level,
+	};
+
+	while (t > 0) {
+		struct brl_index_node z = stack[--t];
+
+		if (z.k <= 3) {
+			/* Small subtree, just scan it */
+			size_t i = (z.x >> z.k) << z.k;
+			size_t end = i + ((size_t)1 << (z.k + 1)) - 1;
+
+			end = MIN(end, n);
+
+			for (; (i < end) && (locks[i].start <= qlast); i++) {
+				if (brl_last(&locks[i]) < qstart) {
+					continue;
+				}
+				ok = brl_add_idx(mem_ctx, pidx, pnum_idx, i);
+				if (!ok) {
+					goto nomem;
+				}
+			}
+			continue;
+		}
+
+		if (!z.left_done) {
+			size_t y = z.x - ((size_t)1 << (z.k - 1));
+
+			/* Come back for this node after its left subtree */
+			stack[t++] = (struct brl_index_node) {
+				.x = z.x, .k = z.k, .left_done = true,
+			};
+			if ((y >= n) || (br_lck->index_max_last[y] >= qstart)) {
+				stack[t++] = (struct brl_index_node) {
+					.x = y, .k = z.k - 1,
+				};
+			}
+			continue;
+		}
+
+		if ((z.x >= n) || (locks[z.x].start > qlast)) {
+			/* Nothing in the right subtree can overlap */
+			continue;
+		}
+		if (brl_last(&locks[z.x]) >= qstart) {
+			ok = brl_add_idx(mem_ctx, pidx, pnum_idx, z.x);
+			if (!ok) {
+				goto nomem;
+			}
+		}
+		stack[t++] = (struct brl_index_node) {
+			.x = z.x + ((size_t)1 << (z.k - 1)), .k = z.k - 1,
+		};
+	}
+
+	return true;
+nomem:
+	TALLOC_FREE(*pidx);
+	*pnum_idx = 0;
+	return false;
+}
+
 /****************************************************************************
  Lock a range of bytes - Windows lock semantics.
 ****************************************************************************/
@@ -429,11 +710,12 @@ static int lock_compare(const struct lock_struct *lck1,
 NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 				  struct lock_struct *plock)
 {
-	unsigned int i;
+	unsigned int i, j, num_overlapping;
+	unsigned int *overlapping = NULL;
 	files_struct *fsp = br_lck->fsp;
 	struct lock_struct *locks = br_lck->lock_data;
 	NTSTATUS status;
-	bool valid;
+	bool valid, ok;
 
 	SMB_ASSERT(plock->lock_type != UNLOCK_LOCK);
 
@@ -442,7 +724,15 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		return NT_STATUS_INVALID_LOCK_RANGE;
 	}
 
-	for (i=0; i < br_lck->num_locks; i++) {
+	ok = brl_find_overlapping(
+		talloc_tos(), br_lck, plock, &overlapping, &num_overlapping);
+	if (!ok) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	for (j=0; j < num_overlapping; j++) {
+		i = overlapping[j];
+
 		/* Do any Windows or POSIX locks conflict ? */
 		if (brl_conflict(&locks[i], plock)) {
 			if (!serverid_exists(&locks[i].context.pid)) {
@@ -452,6 +742,7 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 			}
 			/* Remember who blocked us. */
 			plock->context.smblctx = locks[i].context.smblctx;
+			TALLOC_FREE(overlapping);
 			return NT_STATUS_LOCK_NOT_GRANTED;
 		}
 #if ZERO_ZERO
@@ -461,6 +752,7 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		}
 #endif
 	}
+	TALLOC_FREE(overlapping);
 
 	contend_level2_oplocks_begin(fsp, LEVEL2_CONTEND_WINDOWS_BRL);
 
@@ -500,10 +792,16 @@ NTSTATUS brl_lock_windows_default(struct byte_range_lock *br_lck,
 		goto fail;
 	}
 
-	memcpy(&locks[br_lck->num_locks], plock, sizeof(struct lock_struct));
+	/* Keep the list sorted by start, behind locks with the same start */
+	i = brl_upper_bound(locks, br_lck->num_locks, plock->start);
+	memmove(&locks[i+1],
+		&locks[i],
+		sizeof(struct lock_struct) * (br_lck->num_locks - i));
+	memcpy(&locks[i], plock, sizeof(struct lock_struct));
 	br_lck->num_locks += 1;
 	br_lck->lock_data = locks;
 	br_lck->modified = True;
+	brl_index_drop(br_lck);
 
 	return NT_STATUS_OK;
  fail:
@@ -894,14 +1192,12 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 					     LEVEL2_CONTEND_POSIX_BRL);
 	}
 
-	/* Try and add the lock in order, sorted by lock start. */
-	for (i=0; i < count; i++) {
-		struct lock_struct *curr_lock = &tp[i];
-
-		if (curr_lock->start <= plock->start) {
-			continue;
-		}
-	}
+	/*
+	 * Splitting and merging might have changed the order, sort
+	 * before adding the lock in order.
+	 */
+	brl_sort_locks(tp, count);
+	i = brl_upper_bound(tp, count, plock->start);
 
 	if (i < count) {
 		memmove(&tp[i+1], &tp[i],
@@ -958,6 +1254,7 @@ static NTSTATUS brl_lock_posix(struct byte_range_lock *br_lck,
 	br_lck->lock_data = tp;
 	locks = tp;
 	br_lck->modified = True;
+	brl_index_drop(br_lck);
 
 	/* A successful downgrade from write to read lock can trigger a lock
 	   re-evalutation where waiting readers can now proceed. */
@@ -1074,9 +1371,17 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 	}
 #endif
 
-	for (i = 0; i < br_lck->num_locks; i++) {
+	for (i = brl_lower_bound(locks, br_lck->num_locks, plock->start);
+	     i < br_lck->num_locks;
+	     i++) {
 		struct lock_struct *lock = &locks[i];
 
+		if (lock->start != plock->start) {
+			/* Sorted by start, there's no match */
+			i = br_lck->num_locks;
+			break;
+		}
+
 		/* Only remove our own locks that match in start, size, and flavour. */
 		if (brl_same_context(&lock->context, &plock->context) &&
 					lock->fnum == plock->fnum &&
@@ -1100,6 +1405,7 @@ bool brl_unlock_windows_default(struct byte_range_lock *br_lck,
 	ARRAY_DEL_ELEMENT(locks, i, br_lck->num_locks);
 	br_lck->num_locks -= 1;
 	br_lck->modified = True;
+	brl_index_drop(br_lck);
 
 	/* Unlock the underlying POSIX regions. */
 	if(lp_posix_locking(br_lck->fsp->conn->params)) {
@@ -1241,11 +1547,14 @@ static bool brl_unlock_posix(struct byte_range_lock *br_lck,
 	contend_level2_oplocks_end(br_lck->fsp,
 				   LEVEL2_CONTEND_POSIX_BRL);
 
+	brl_sort_locks(tp, count);
+
 	br_lck->num_locks = count;
 	TALLOC_FREE(br_lck->lock_data);
 	locks = tp;
 	br_lck->lock_data = tp;
 	br_lck->modified = True;
+	brl_index_drop(br_lck);
 
 	return True;
 }
@@ -1297,18 +1606,29 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 		  const struct lock_struct *rw_probe)
 {
 	bool ret = True;
-	unsigned int i;
+	unsigned int i, j, num_overlapping;
+	unsigned int *overlapping = NULL;
 	struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
+	bool ok;
+
+	ok = brl_find_overlapping(
+		talloc_tos(), br_lck, rw_probe, &overlapping, &num_overlapping);
+	if (!ok) {
+		return false;
+	}
 
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
+	for (j=0; j < num_overlapping; j++) {
+		i = overlapping[j];
+
 		/*
 		 * Our own locks don't conflict.
 		 */
 		if (brl_conflict_other(&locks[i], rw_probe)) {
 			if (br_lck->record == NULL) {
 				/* readonly */
+				TALLOC_FREE(overlapping);
 				return false;
 			}
 
@@ -1318,9 +1638,11 @@ bool brl_locktest(struct byte_range_lock *br_lck,
 				continue;
 			}
 
+			TALLOC_FREE(overlapping);
 			return False;
 		}
 	}
+	TALLOC_FREE(overlapping);
 
 	/*
 	 * There is no lock held by an SMB daemon, check to
@@ -1365,10 +1687,12 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 		enum brl_type *plock_type,
 		enum brl_flavour lock_flav)
 {
-	unsigned int i;
+	unsigned int i, j, num_overlapping;
+	unsigned int *overlapping = NULL;
 	struct lock_struct lock;
 	const struct lock_struct *locks = br_lck->lock_data;
 	files_struct *fsp = br_lck->fsp;
+	bool ok;
 
 	lock.context.smblctx = *psmblctx;
 	lock.context.pid = pid;
@@ -1379,11 +1703,20 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
 	lock.lock_type = *plock_type;
 	lock.lock_flav = lock_flav;
 
+	ok = brl_find_overlapping(
+		talloc_tos(), br_lck, &lock, &overlapping, &num_overlapping);
+	if (!ok) {
+		return NT_STATUS_NO_MEMORY;
+	}
+
 	/* Make sure existing locks don't conflict */
-	for (i=0; i < br_lck->num_locks; i++) {
-		const struct lock_struct *exlock = &locks[i];
+	for (j=0; j < num_overlapping; j++) {
+		const struct lock_struct *exlock = NULL;
 		bool conflict = False;
 
+		i = overlapping[j];
+		exlock = &locks[i];
+
 		if (exlock->lock_flav == WINDOWS_LOCK) {
 			conflict = brl_conflict(exlock, &lock);
 		} else {
@@ -1395,9 +1728,11 @@ NTSTATUS brl_lockquery(struct byte_range_lock *br_lck,
         		*pstart = exlock->start;
 		        *psize = exlock->size;
         		*plock_type = exlock->lock_type;
+			TALLOC_FREE(overlapping);
 			return NT_STATUS_LOCK_NOT_GRANTED;
 		}
 	}
+	TALLOC_FREE(overlapping);
 
 	/*
 	 * There is no lock held by an SMB daemon, check to
@@ -1715,9 +2050,9 @@ static void byte_range_lock_flush(struct byte_range_lock *br_lck)
 		if (locks[i].context.pid.pid == 0) {
 			/*
 			 * Autocleanup, the process conflicted and does not
-			 * exist anymore.
+			 * exist anymore. Keep the list sorted.
 			 */
-			locks[i] = locks[br_lck->num_locks-1];
+			ARRAY_DEL_ELEMENT(locks, i, br_lck->num_locks);
 			br_lck->num_locks -= 1;
 		} else {
 			i += 1;
@@ -1779,6 +2114,10 @@ static bool brl_parse_data(struct byte_range_lock *br_lck, TDB_DATA data)
 		DEBUG(1, ("talloc_memdup failed\n"));
 		return false;
 	}
+
+	/* Records written by older versions are not sorted */
+	brl_sort_locks(br_lck->lock_data, br_lck->num_locks);
+
 	return true;
 }
 
@@ -1866,8 +2205,16 @@ static void brl_get_locks_readonly_parser(TDB_DATA key, TDB_DATA data,
 		(struct brl_get_locks_readonly_state *)private_data;
 	struct byte_range_lock *br_lck;
 
+	/*
+	 * Leave room for the index, brl_locktest() on this cached
+	 * copy builds it on first use.
+	 */
 	br_lck = talloc_pooled_object(
-		state->mem_ctx, struct byte_range_lock, 1, data.dsize);
+		state->mem_ctx,
+		struct byte_range_lock,
+		2,
+		data.dsize + (data.dsize / sizeof(struct lock_struct)) *
+			     sizeof(uint64_t));
 	if (br_lck == NULL) {
 		*state->br_lock = NULL;
 		return;
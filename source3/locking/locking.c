@@ -1014,7 +1014,7 @@ bool set_sticky_write_time(struct file_id fileid, struct timespec write_time)
 	}
 
 	if (lck->data->changed_write_time != nt) {
-		lck->data->modified = True;
+		lck->data->header_modified = true;
 		lck->data->changed_write_time = nt;
 	}
 
@@ -1039,7 +1039,7 @@ bool set_write_time(struct file_id fileid, struct timespec write_time)
 	}
 
 	if (lck->data->old_write_time != nt) {
-		lck->data->modified = True;
+		lck->data->header_modified = true;
 		lck->data->old_write_time = nt;
 	}
 
@@ -162,6 +162,7 @@ NTSTATUS share_mode_watch_recv(
 
 struct share_mode_lock *fetch_share_mode_unlocked(TALLOC_CTX *mem_ctx,
 						  struct file_id id);
+struct timespec fetch_share_mode_write_time(struct file_id id);
 struct tevent_req *fetch_share_mode_send(TALLOC_CTX *mem_ctx,
 					 struct tevent_context *ev,
 					 struct file_id id,
@@ -168,6 +168,7 @@ static void share_mode_memcache_store(struct share_mode_data *d)
 
 	/* Ensure everything stored in the cache is pristine. */
 	d->modified = false;
+	d->header_modified = false;
 	d->fresh = false;
 
 	/*
@@ -189,42 +190,36 @@ static void share_mode_memcache_store(struct share_mode_data *d)
  * NB. We use ndr_pull_hyper on a stack-created
  * struct ndr_pull with no talloc allowed, as we
  * need this to be really fast as an ndr-peek into
- * the first 10 bytes of the blob.
+ * the first 8 bytes of the blob.
  */
 
 static enum ndr_err_code get_share_mode_blob_header(
-	const uint8_t *buf, size_t buflen, uint64_t *pepoch, uint16_t *pflags)
+	const uint8_t *buf, size_t buflen, uint64_t *pepoch)
 {
 	struct ndr_pull ndr = {
 		.data = discard_const_p(uint8_t, buf),
 		.data_size = buflen,
 	};
 	NDR_CHECK(ndr_pull_hyper(&ndr, NDR_SCALARS, pepoch));
-	NDR_CHECK(ndr_pull_uint16(&ndr, NDR_SCALARS, pflags));
 	return NDR_ERR_SUCCESS;
 }
 
 struct fsp_update_share_mode_flags_state {
-	enum ndr_err_code ndr_err;
+	bool ok;
 	uint16_t share_mode_flags;
 };
 
 static void fsp_update_share_mode_flags_fn(
-	const uint8_t *buf,
-	size_t buflen,
-	bool *modified_dependent,
-	void *private_data)
-{
-	struct fsp_update_share_mode_flags_state *state = private_data;
-	uint64_t seq;
-
-	state->ndr_err = get_share_mode_blob_header(
-		buf, buflen, &seq, &state->share_mode_flags);
-}
+	struct server_id exclusive,
+	size_t num_shared,
+	struct server_id *shared,
+	const uint8_t *data,
+	size_t datalen,
+	void *private_data);
 
 static NTSTATUS fsp_update_share_mode_flags(struct files_struct *fsp)
 {
-	struct fsp_update_share_mode_flags_state state = {0};
+	struct fsp_update_share_mode_flags_state state = { .ok = false };
 	int seqnum = g_lock_seqnum(lock_ctx);
 	NTSTATUS status;
 
@@ -232,18 +227,24 @@ static NTSTATUS fsp_update_share_mode_flags(struct files_struct *fsp)
 		return NT_STATUS_OK;
 	}
 
-	status = share_mode_do_locked(
-		fsp->file_id, fsp_update_share_mode_flags_fn, &state);
+	/*
+	 * The flags are in the fixed-size record header, we can look
+	 * at them without taking the lock.
+	 */
+	status = g_lock_dump(
+		lock_ctx,
+		locking_key(&fsp->file_id),
+		fsp_update_share_mode_flags_fn,
+		&state);
 	if (!NT_STATUS_IS_OK(status)) {
-		DBG_DEBUG("share_mode_do_locked returned %s\n",
+		DBG_DEBUG("g_lock_dump returned %s\n",
 			  nt_errstr(status));
 		return status;
 	}
 
-	if (!NDR_ERR_CODE_IS_SUCCESS(state.ndr_err)) {
-		DBG_DEBUG("get_share_mode_blob_header returned %s\n",
-			  ndr_errstr(state.ndr_err));
-		return ndr_map_error2ntstatus(state.ndr_err);
+	if (!state.ok) {
+		DBG_DEBUG("locking_tdb_data_get failed\n");
+		return NT_STATUS_INTERNAL_DB_CORRUPTION;
 	}
 
 	fsp->share_mode_flags_seqnum = seqnum;
@@ -279,7 +280,6 @@ static struct share_mode_data *share_mode_memcache_fetch(
 	enum ndr_err_code ndr_err;
 	struct share_mode_data *d;
 	uint64_t unique_content_epoch;
-	uint16_t flags;
 	void *ptr;
 	struct file_id id;
 	struct file_id_buf idbuf;
@@ -303,7 +303,7 @@ static struct share_mode_data *share_mode_memcache_fetch(
 	}
 	/* sequence number key is at start of blob. */
 	ndr_err = get_share_mode_blob_header(
-		buf, buflen, &unique_content_epoch, &flags);
+		buf, buflen, &unique_content_epoch);
 	if (ndr_err != NDR_ERR_SUCCESS) {
 		/* Bad blob. Remove entry. */
 		DBG_DEBUG("bad blob %u key %s\n",
@@ -412,14 +412,28 @@ static bool share_mode_entry_get(
  * locking.tdb records consist of
  *
  * uint32_t share_mode_data_len
+ * uint16_t flags                  share_mode_data.flags
+ * uint16_t reserved
+ * NTTIME old_write_time           share_mode_data.old_write_time
+ * NTTIME changed_write_time       share_mode_data.changed_write_time
  * uint8_t [share_mode_data]       This is struct share_mode_data in NDR
  *
  * 0 [SHARE_MODE_ENTRY_SIZE]       Sorted array of share modes,
  * 1 [SHARE_MODE_ENTRY_SIZE]       filling up the rest of the data in the
  * 2 [SHARE_MODE_ENTRY_SIZE]       g_lock.c maintained record in locking.tdb
+ *
+ * All header fields are little-endian. The flags and write times
+ * are not part of the NDR blob: Changing them only rewrites the
+ * header, the blob is stored as is and its unique_content_epoch
+ * stays valid for the memcache.
  */
 
+#define LOCKING_TDB_HEADER_SIZE 24
+
 struct locking_tdb_data {
+	uint16_t flags;
+	NTTIME old_write_time;
+	NTTIME changed_write_time;
 	const uint8_t *share_mode_data_buf;
 	size_t share_mode_data_len;
 	const uint8_t *share_entries;
@@ -430,19 +444,24 @@ static bool locking_tdb_data_get(
 	struct locking_tdb_data *data, const uint8_t *buf, size_t buflen)
 {
 	uint32_t share_mode_data_len, share_entries_len;
+	uint16_t flags;
+	NTTIME old_write_time, changed_write_time;
 
 	if (buflen == 0) {
 		*data = (struct locking_tdb_data) { 0 };
 		return true;
 	}
-	if (buflen < sizeof(uint32_t)) {
+	if (buflen < LOCKING_TDB_HEADER_SIZE) {
 		return false;
 	}
 
 	share_mode_data_len = PULL_LE_U32(buf, 0);
+	flags = PULL_LE_U16(buf, 4);
+	old_write_time = PULL_LE_U64(buf, 8);
+	changed_write_time = PULL_LE_U64(buf, 16);
 
-	buf += sizeof(uint32_t);
-	buflen -= sizeof(uint32_t);
+	buf += LOCKING_TDB_HEADER_SIZE;
+	buflen -= LOCKING_TDB_HEADER_SIZE;
 
 	if (buflen < share_mode_data_len) {
 		return false;
@@ -455,6 +474,9 @@ static bool locking_tdb_data_get(
 	}
 
 	*data = (struct locking_tdb_data) {
+		.flags = flags,
+		.old_write_time = old_write_time,
+		.changed_write_time = changed_write_time,
 		.share_mode_data_buf = buf,
 		.share_mode_data_len = share_mode_data_len,
 		.share_entries = buf + share_mode_data_len,
@@ -464,6 +486,21 @@ static bool locking_tdb_data_get(
 	return true;
 }
 
+static void fsp_update_share_mode_flags_fn(
+	struct server_id exclusive,
+	size_t num_shared,
+	struct server_id *shared,
+	const uint8_t *data,
+	size_t datalen,
+	void *private_data)
+{
+	struct fsp_update_share_mode_flags_state *state = private_data;
+	struct locking_tdb_data ltdb = { 0 };
+
+	state->ok = locking_tdb_data_get(&ltdb, data, datalen);
+	state->share_mode_flags = ltdb.flags;
+}
+
 struct locking_tdb_data_fetch_state {
 	TALLOC_CTX *mem_ctx;
 	uint8_t *data;
@@ -532,7 +569,7 @@ static NTSTATUS locking_tdb_data_store(
 	const TDB_DATA *share_mode_dbufs,
 	size_t num_share_mode_dbufs)
 {
-	uint8_t share_mode_data_len_buf[4];
+	uint8_t header_buf[LOCKING_TDB_HEADER_SIZE];
 	TDB_DATA dbufs[num_share_mode_dbufs+3];
 	NTSTATUS status;
 
@@ -550,11 +587,15 @@ static NTSTATUS locking_tdb_data_store(
 		return status;
 	}
 
-	PUSH_LE_U32(share_mode_data_len_buf, 0, ltdb->share_mode_data_len);
+	PUSH_LE_U32(header_buf, 0, ltdb->share_mode_data_len);
+	PUSH_LE_U16(header_buf, 4, ltdb->flags);
+	PUSH_LE_U16(header_buf, 6, 0);
+	PUSH_LE_U64(header_buf, 8, ltdb->old_write_time);
+	PUSH_LE_U64(header_buf, 16, ltdb->changed_write_time);
 
 	dbufs[0] = (TDB_DATA) {
-		.dptr = share_mode_data_len_buf,
-		.dsize = sizeof(share_mode_data_len_buf),
+		.dptr = header_buf,
+		.dsize = sizeof(header_buf),
 	};
 	dbufs[1] = (TDB_DATA) {
 		.dptr = discard_const_p(uint8_t, ltdb->share_mode_data_buf),
@@ -591,9 +632,10 @@ static NTSTATUS locking_tdb_data_store(
 static struct share_mode_data *parse_share_modes(
 	TALLOC_CTX *mem_ctx,
 	const TDB_DATA key,
-	const uint8_t *buf,
-	size_t buflen)
+	const struct locking_tdb_data *ltdb)
 {
+	const uint8_t *buf = ltdb->share_mode_data_buf;
+	size_t buflen = ltdb->share_mode_data_len;
 	struct share_mode_data *d;
 	enum ndr_err_code ndr_err;
 	DATA_BLOB blob;
@@ -601,7 +643,7 @@ static struct share_mode_data *parse_share_modes(
 	/* See if we already have a cached copy of this key. */
 	d = share_mode_memcache_fetch(mem_ctx, key, buf, buflen);
 	if (d != NULL) {
-		return d;
+		goto done;
 	}
 
 	d = talloc(mem_ctx, struct share_mode_data);
@@ -622,11 +664,6 @@ static struct share_mode_data *parse_share_modes(
 		goto fail;
 	}
 
-	if (DEBUGLEVEL >= 10) {
-		DEBUG(10, ("parse_share_modes:\n"));
-		NDR_PRINT_DEBUG(share_mode_data, d);
-	}
-
 	/*
 	 * We have a non-zero locking.tdb record that was correctly
 	 * parsed. This means a share_entries.tdb entry exists,
@@ -635,6 +672,20 @@ static struct share_mode_data *parse_share_modes(
 	 */
 	d->have_share_modes = true;
 
+done:
+	/*
+	 * The cached blob does not cover the record header, which
+	 * might have changed without a new unique_content_epoch.
+	 */
+	d->flags = ltdb->flags;
+	d->old_write_time = ltdb->old_write_time;
+	d->changed_write_time = ltdb->changed_write_time;
+
+	if (DEBUGLEVEL >= 10) {
+		DEBUG(10, ("parse_share_modes:\n"));
+		NDR_PRINT_DEBUG(share_mode_data, d);
+	}
+
 	return d;
 fail:
 	TALLOC_FREE(d);
@@ -652,7 +703,7 @@ static NTSTATUS share_mode_data_store(struct share_mode_data *d)
 	DATA_BLOB blob = { 0 };
 	NTSTATUS status;
 
-	if (!d->modified) {
+	if (!d->modified && !d->header_modified) {
 		DBG_DEBUG("not modified\n");
 		return NT_STATUS_OK;
 	}
@@ -662,13 +713,28 @@ static NTSTATUS share_mode_data_store(struct share_mode_data *d)
 		NDR_PRINT_DEBUG(share_mode_data, d);
 	}
 
-	d->unique_content_epoch = generate_unique_u64(d->unique_content_epoch);
-
 	status = locking_tdb_data_fetch(key, d, &ltdb);
 	if (!NT_STATUS_IS_OK(status)) {
 		return status;
 	}
 
+	ltdb->flags = d->flags;
+	ltdb->old_write_time = d->old_write_time;
+	ltdb->changed_write_time = d->changed_write_time;
+
+	if (!d->modified &&
+	    (ltdb->share_mode_data_len != 0) &&
+	    (ltdb->num_share_entries != 0)) {
+		/*
+		 * Only the header changed, keep the blob and its
+		 * unique_content_epoch as they are.
+		 */
+		DBG_DEBUG("header modified\n");
+		goto store;
+	}
+
+	d->unique_content_epoch = generate_unique_u64(d->unique_content_epoch);
+
 	if (ltdb->num_share_entries != 0) {
 		enum ndr_err_code ndr_err;
 
@@ -688,6 +754,7 @@ static NTSTATUS share_mode_data_store(struct share_mode_data *d)
 	ltdb->share_mode_data_buf = blob.data;
 	ltdb->share_mode_data_len = blob.length;
 
+store:
 	status = locking_tdb_data_store(key, ltdb, NULL, 0);
 	TALLOC_FREE(ltdb);
 	return status;
@@ -814,11 +881,7 @@ static void get_static_share_mode_data_fn(
 			return;
 		}
 	} else {
-		d = parse_share_modes(
-			lock_ctx,
-			key,
-			ltdb.share_mode_data_buf,
-			ltdb.share_mode_data_len);
+		d = parse_share_modes(lock_ctx, key, &ltdb);
 		if (d == NULL) {
 			state->status = NT_STATUS_INTERNAL_DB_CORRUPTION;
 			return;
@@ -1223,10 +1286,7 @@ static void fetch_share_mode_unlocked_parser(
 	}
 
 	state->lck->data = parse_share_modes(
-		state->lck,
-		state->key,
-		ltdb.share_mode_data_buf,
-		ltdb.share_mode_data_len);
+		state->lck, state->key, &ltdb);
 	if (state->lck->data == NULL) {
 		DBG_DEBUG("parse_share_modes failed\n");
 		TALLOC_FREE(state->lck);
@@ -1256,6 +1316,77 @@ struct share_mode_lock *fetch_share_mode_unlocked(TALLOC_CTX *mem_ctx,
 	return state.lck;
 }
 
+struct fetch_share_mode_write_time_state {
+	struct timespec write_time;
+};
+
+static void fetch_share_mode_write_time_parser(
+	struct server_id exclusive,
+	size_t num_shared,
+	struct server_id *shared,
+	const uint8_t *data,
+	size_t datalen,
+	void *private_data)
+{
+	struct fetch_share_mode_write_time_state *state = private_data;
+	struct locking_tdb_data ltdb = { 0 };
+
+	if (datalen != 0) {
+		bool ok = locking_tdb_data_get(&ltdb, data, datalen);
+		if (!ok) {
+			DBG_DEBUG("locking_tdb_data_get failed\n");
+			return;
+		}
+	}
+
+	if (ltdb.share_mode_data_len == 0) {
+		/* Likely a ctdb tombstone record, ignore it */
+		return;
+	}
+
+	/*
+	 * The write times are in the record header, no need to
+	 * parse the share_mode_data blob.
+	 */
+	if (!null_nttime(ltdb.changed_write_time)) {
+		state->write_time = nt_time_to_full_timespec(
+			ltdb.changed_write_time);
+	} else {
+		state->write_time = nt_time_to_full_timespec(
+			ltdb.old_write_time);
+	}
+}
+
+/**
+ * @brief Get the write time of a file from locking.tdb
+ *
+ * A cheaper get_file_infos() for directory listings: It reads the
+ * record with a single g_lock_dump() and only extracts the write time
+ * from its header, without creating a share_mode_lock.
+ *
+ * @param[in]  id       The file id to look up
+ *
+ * @return The write time, an omit timespec if the file has no share
+ *         mode record
+ **/
+struct timespec fetch_share_mode_write_time(struct file_id id)
+{
+	struct fetch_share_mode_write_time_state state = {
+		.write_time = make_omit_timespec(),
+	};
+	NTSTATUS status;
+
+	status = g_lock_dump(lock_ctx,
+			     locking_key(&id),
+			     fetch_share_mode_write_time_parser,
+			     &state);
+	if (!NT_STATUS_IS_OK(status) &&
+	    !NT_STATUS_EQUAL(status, NT_STATUS_NOT_FOUND)) {
+		DBG_DEBUG("g_lock_dump failed: %s\n", nt_errstr(status));
+	}
+	return state.write_time;
+}
+
 struct fetch_share_mode_state {
 	struct file_id id;
 	struct share_mode_lock *lck;
@@ -1360,10 +1491,7 @@ static void fetch_share_mode_fn(
 	}
 
 	state->lck->data = parse_share_modes(
-		state->lck,
-		locking_key(&state->id),
-		ltdb.share_mode_data_buf,
-		ltdb.share_mode_data_len);
+		state->lck, locking_key(&state->id), &ltdb);
 	if (state->lck->data == NULL) {
 		DBG_DEBUG("parse_share_modes failed\n");
 		TALLOC_FREE(state->lck);
@@ -1455,11 +1583,7 @@ static void share_mode_forall_dump_fn(
 		return;
 	}
 
-	d = parse_share_modes(
-		talloc_tos(),
-		state->key,
-		ltdb.share_mode_data_buf,
-		ltdb.share_mode_data_len);
+	d = parse_share_modes(talloc_tos(), state->key, &ltdb);
 	if (d == NULL) {
 		DBG_DEBUG("parse_share_modes() failed\n");
 		return;
@@ -2483,7 +2607,7 @@ bool downgrade_share_oplock(struct share_mode_lock *lck, files_struct *fsp)
 	}
 
 	lck->data->flags |= SHARE_MODE_LEASE_READ;
-	lck->data->modified = true;
+	lck->data->header_modified = true;
 
 	return true;
 }
@@ -29,6 +29,7 @@
 #include "../librpc/gen_ndr/ndr_security.h"
 #include "../lib/util/bitmap.h"
 #include "passdb/lookup_sid.h"
+#include "lib/util/memcache.h"
 
 #include <gnutls/gnutls.h>
 #include <gnutls/crypto.h>
@@ -48,6 +49,7 @@ bool init_acl_common_config(vfs_handle_struct *handle,
 {
 	struct acl_common_config *config = NULL;
 	const struct enum_list *default_acl_style_list = NULL;
+	int sd_cache_size;
 
 	default_acl_style_list = get_default_acl_style_list();
 
@@ -68,6 +70,25 @@ bool init_acl_common_config(vfs_handle_struct *handle,
 						 default_acl_style_list,
 						 DEFAULT_ACL_POSIX);
 
+	sd_cache_size = lp_parm_int(SNUM(handle->conn),
+				    module_name,
+				    "sd cache size",
+				    0);
+	if (sd_cache_size > 0) {
+		config->sd_cache = memcache_init(config,
+						 (size_t)sd_cache_size * 1024);
+		if (config->sd_cache == NULL) {
+			DBG_ERR("memcache_init() failed\n");
+			TALLOC_FREE(config);
+			errno = ENOMEM;
+			return false;
+		}
+		config->sd_cache_max_age = lp_parm_int(SNUM(handle->conn),
+						       module_name,
+						       "sd cache max age",
+						       10);
+	}
+
 	SMB_VFS_HANDLE_SET_DATA(handle, config, NULL,
 				struct acl_common_config,
 				return false);
@@ -76,6 +97,145 @@ bool init_acl_common_config(vfs_handle_struct *handle,
 }
 
 
+/*******************************************************************
+ Cache of validated security descriptors.
+
+ Reading the NT ACL of a file means fetching the blob, parsing it,
+ reading and hashing the file system ACL to validate the blob. Files
+ are often opened many times in a row, so we remember the result.
+
+ An entry is only used as long as ctime, birth time, owner, group
+ and mode of the file are unchanged. The birth time tells apart a
+ new file that got the inode of a deleted one. Storing the NT ACL
+ blob in an xattr or changing the POSIX ACL changes the ctime, for
+ blobs stored elsewhere sd_cache_seqnum_fn is part of the key.
+ Changes done by this process flush the cache.
+
+ With a coarse file system timestamp granularity a change within the
+ same timestamp interval does not change the ctime. So we don't cache
+ descriptors of files whose ctime is that close to the current time,
+ they could still change unnoticed. As a last resort, entries expire
+ after "sd cache max age" seconds.
+
+ Only the descriptor is cached. smbd core still runs the access check
+ against the current token for every open, no granted access masks
+ per token are cached.
+*******************************************************************/
+
+/* Covers file systems with a timestamp granularity of up to 2 seconds */
+#define ACL_COMMON_SD_CACHE_RACY_NSEC (2 * 1000000000LL)
+
+struct acl_common_sd_cache_entry {
+	time_t inserted;
+	struct security_descriptor *psd;
+};
+
+struct acl_common_sd_cache_key {
+	struct file_id id;
+	struct timespec btime;
+	struct timespec ctime;
+	uid_t uid;
+	gid_t gid;
+	mode_t mode;
+	uint32_t security_info;
+	int seqnum;
+};
+
+static void acl_common_sd_cache_make_key(vfs_handle_struct *handle,
+					 struct acl_common_config *config,
+					 const SMB_STRUCT_STAT *sbuf,
+					 uint32_t security_info,
+					 struct acl_common_sd_cache_key *key)
+{
+	/* The key is used as a blob, don't leave padding undefined */
+	ZERO_STRUCTP(key);
+
+	key->id = vfs_file_id_from_sbuf(handle->conn, sbuf);
+	key->btime = sbuf->st_ex_btime;
+	key->ctime = sbuf->st_ex_ctime;
+	key->uid = sbuf->st_ex_uid;
+	key->gid = sbuf->st_ex_gid;
+	key->mode = sbuf->st_ex_mode;
+	key->security_info = security_info;
+
+	if (config->sd_cache_seqnum_fn != NULL) {
+		key->seqnum = config->sd_cache_seqnum_fn();
+	}
+}
+
+static struct security_descriptor *acl_common_sd_cache_fetch(
+	struct acl_common_config *config,
+	const struct acl_common_sd_cache_key *key,
+	TALLOC_CTX *mem_ctx)
+{
+	struct acl_common_sd_cache_entry *entry = NULL;
+	DATA_BLOB key_blob = data_blob_const(key, sizeof(*key));
+
+	entry = memcache_lookup_talloc(config->sd_cache,
+				       VFS_ACL_COMMON_SD_CACHE,
+				       key_blob);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	if (time_mono(NULL) - entry->inserted > config->sd_cache_max_age) {
+		memcache_delete(config->sd_cache,
+				VFS_ACL_COMMON_SD_CACHE,
+				key_blob);
+		return NULL;
+	}
+
+	/* Callers modify what they get, hand out a copy */
+	return security_descriptor_copy(mem_ctx, entry->psd);
+}
+
+static void acl_common_sd_cache_store(
+	struct acl_common_config *config,
+	const struct acl_common_sd_cache_key *key,
+	const struct security_descriptor *psd)
+{
+	struct acl_common_sd_cache_entry *entry = NULL;
+	struct timespec now = timespec_current();
+
+	if (nsec_time_diff(&now, &key->ctime) <
+	    ACL_COMMON_SD_CACHE_RACY_NSEC) {
+		/* Might still change without changing the ctime */
+		return;
+	}
+
+	entry = talloc(config, struct acl_common_sd_cache_entry);
+	if (entry == NULL) {
+		return;
+	}
+	entry->inserted = time_mono(NULL);
+
+	entry->psd = security_descriptor_copy(entry, psd);
+	if (entry->psd == NULL) {
+		TALLOC_FREE(entry);
+		return;
+	}
+
+	memcache_add_talloc(config->sd_cache,
+			    VFS_ACL_COMMON_SD_CACHE,
+			    data_blob_const(key, sizeof(*key)),
+			    &entry);
+}
+
+void acl_common_sd_cache_flush(vfs_handle_struct *handle)
+{
+	struct acl_common_config *config = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config,
+				struct acl_common_config,
+				return);
+
+	if (config->sd_cache == NULL) {
+		return;
+	}
+
+	memcache_flush(config->sd_cache, VFS_ACL_COMMON_SD_CACHE);
+}
+
 /*******************************************************************
  Hash a security descriptor.
 *******************************************************************/
@@ -618,6 +778,8 @@ NTSTATUS fget_nt_acl_common(
 	const struct smb_filename *smb_fname = fsp->fsp_name;
 	bool psd_is_from_fs = false;
 	struct acl_common_config *config = NULL;
+	struct acl_common_sd_cache_key cache_key = { .seqnum = 0 };
+	bool use_cache = false;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config,
 				struct acl_common_config,
@@ -625,6 +787,25 @@ NTSTATUS fget_nt_acl_common(
 
 	DBG_DEBUG("name=%s\n", smb_fname->base_name);
 
+	if (config->sd_cache != NULL) {
+		status = vfs_stat_fsp(fsp);
+		use_cache = NT_STATUS_IS_OK(status);
+	}
+	if (use_cache) {
+		acl_common_sd_cache_make_key(handle,
+					config,
+					&fsp->fsp_name->st,
+					security_info,
+					&cache_key);
+
+		psd = acl_common_sd_cache_fetch(config, &cache_key, mem_ctx);
+		if (psd != NULL) {
+			DBG_DEBUG("sd cache hit for %s\n",
+				  smb_fname->base_name);
+			goto done;
+		}
+	}
+
 	status = fget_acl_blob_fn(mem_ctx, handle, fsp, &blob);
 	if (NT_STATUS_IS_OK(status)) {
 		status = validate_nt_acl_blob(mem_ctx,
@@ -714,6 +895,11 @@ NTSTATUS fget_nt_acl_common(
 		psd->type &= ~SEC_DESC_DACL_PROTECTED;
 	}
 
+	if (use_cache) {
+		acl_common_sd_cache_store(config, &cache_key, psd);
+	}
+
+done:
 	if (!(security_info & SECINFO_OWNER)) {
 		psd->owner_sid = NULL;
 	}
@@ -768,6 +954,8 @@ NTSTATUS get_nt_acl_common_at(
 	struct security_descriptor *psd = NULL;
 	bool psd_is_from_fs = false;
 	struct acl_common_config *config = NULL;
+	struct acl_common_sd_cache_key cache_key = { .seqnum = 0 };
+	bool use_cache = false;
 
 	SMB_VFS_HANDLE_GET_DATA(handle, config,
 				struct acl_common_config,
@@ -775,6 +963,31 @@ NTSTATUS get_nt_acl_common_at(
 
 	DBG_DEBUG("name=%s\n", smb_fname_in->base_name);
 
+	if (config->sd_cache != NULL) {
+		SMB_STRUCT_STAT sbuf;
+		int ret;
+
+		ret = vfs_stat_smb_basename(handle->conn,
+					    smb_fname_in,
+					    &sbuf);
+		if (ret == 0) {
+			acl_common_sd_cache_make_key(handle,
+						config,
+						&sbuf,
+						security_info,
+						&cache_key);
+			use_cache = true;
+		}
+	}
+	if (use_cache) {
+		psd = acl_common_sd_cache_fetch(config, &cache_key, mem_ctx);
+		if (psd != NULL) {
+			DBG_DEBUG("sd cache hit for %s\n",
+				  smb_fname_in->base_name);
+			goto done;
+		}
+	}
+
 	status = get_acl_blob_at_fn(mem_ctx,
 				handle,
 				dirfsp,
@@ -883,6 +1096,11 @@ NTSTATUS get_nt_acl_common_at(
 		psd->type &= ~SEC_DESC_DACL_PROTECTED;
 	}
 
+	if (use_cache) {
+		acl_common_sd_cache_store(config, &cache_key, psd);
+	}
+
+done:
 	if (!(security_info & SECINFO_OWNER)) {
 		psd->owner_sid = NULL;
 	}
@@ -1009,7 +1227,7 @@ static NTSTATUS store_v3_blob(
  Store a security descriptor given an fsp.
 *********************************************************************/
 
-NTSTATUS fset_nt_acl_common(
+static NTSTATUS store_nt_acl_common(
 	NTSTATUS (*fget_acl_blob_fn)(TALLOC_CTX *ctx,
 				    vfs_handle_struct *handle,
 				    files_struct *fsp,
@@ -1186,6 +1404,38 @@ NTSTATUS fset_nt_acl_common(
 	return status;
 }
 
+NTSTATUS fset_nt_acl_common(
+	NTSTATUS (*fget_acl_blob_fn)(TALLOC_CTX *ctx,
+				    vfs_handle_struct *handle,
+				    files_struct *fsp,
+				    DATA_BLOB *pblob),
+	NTSTATUS (*store_acl_blob_fsp_fn)(vfs_handle_struct *handle,
+					  files_struct *fsp,
+					  DATA_BLOB *pblob),
+	const char *module_name,
+	vfs_handle_struct *handle, files_struct *fsp,
+	uint32_t security_info_sent,
+	const struct security_descriptor *orig_psd)
+{
+	NTSTATUS status;
+
+	status = store_nt_acl_common(fget_acl_blob_fn,
+				     store_acl_blob_fsp_fn,
+				     module_name,
+				     handle,
+				     fsp,
+				     security_info_sent,
+				     orig_psd);
+
+	/*
+	 * Also on failure, we might have changed the underlying ACL
+	 * or the owner
+	 */
+	acl_common_sd_cache_flush(handle);
+
+	return status;
+}
+
 static int acl_common_remove_object(vfs_handle_struct *handle,
 					const struct smb_filename *smb_fname,
 					bool is_directory)
@@ -1356,6 +1606,7 @@ int chmod_acl_module_common(struct vfs_handle_struct *handle,
 {
 	if (smb_fname->flags & SMB_FILENAME_POSIX_PATH) {
 		/* Only allow this on POSIX pathnames. */
+		acl_common_sd_cache_flush(handle);
 		return SMB_VFS_NEXT_CHMOD(handle, smb_fname, mode);
 	}
 	return 0;
@@ -1366,6 +1617,7 @@ int fchmod_acl_module_common(struct vfs_handle_struct *handle,
 {
 	if (fsp->posix_flags & FSP_POSIX_FLAGS_OPEN) {
 		/* Only allow this on POSIX opens. */
+		acl_common_sd_cache_flush(handle);
 		return SMB_VFS_NEXT_FCHMOD(handle, fsp, mode);
 	}
 	return 0;
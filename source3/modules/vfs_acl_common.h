@@ -27,10 +27,23 @@
 struct acl_common_config {
 	bool ignore_system_acls;
 	enum default_acl_style default_acl_style;
+
+	/*
+	 * Security descriptors already read and validated, enabled
+	 * with "<module>:sd cache size". If the ACL blobs are not
+	 * stored with the file, so that changing them does not change
+	 * the file's ctime, sd_cache_seqnum_fn has to return a number
+	 * that changes with every change of the blobs. Entries are
+	 * dropped after sd_cache_max_age seconds.
+	 */
+	struct memcache *sd_cache;
+	int sd_cache_max_age;
+	int (*sd_cache_seqnum_fn)(void);
 };
 
 bool init_acl_common_config(vfs_handle_struct *handle,
 			    const char *module_name);
+void acl_common_sd_cache_flush(vfs_handle_struct *handle);
 
 int rmdir_acl_common(struct vfs_handle_struct *handle,
 			struct files_struct *dirfsp,
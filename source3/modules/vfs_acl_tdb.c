@@ -57,7 +57,7 @@ static bool acl_tdb_init(void)
 	}
 
 	become_root();
-	acl_db = db_open(NULL, dbname, 0, TDB_DEFAULT, O_RDWR|O_CREAT, 0600,
+	acl_db = db_open(NULL, dbname, 0, TDB_SEQNUM, O_RDWR|O_CREAT, 0600,
 			 DBWRAP_LOCK_ORDER_1, DBWRAP_FLAG_NONE);
 	unbecome_root();
 
@@ -76,6 +76,16 @@ static bool acl_tdb_init(void)
 	return true;
 }
 
+/*******************************************************************
+ Storing a blob in acl_db does not touch the file, so the cache of
+ validated security descriptors needs to see changes in acl_db.
+*******************************************************************/
+
+static int acl_tdb_seqnum(void)
+{
+	return dbwrap_get_seqnum(acl_db);
+}
+
 /*******************************************************************
  Lower ref count and close acl_db if zero.
 *******************************************************************/
@@ -333,6 +343,8 @@ static int connect_acl_tdb(struct vfs_handle_struct *handle,
 				struct acl_common_config,
 				return -1);
 
+	config->sd_cache_seqnum_fn = acl_tdb_seqnum;
+
 	if (config->ignore_system_acls) {
 		mode_t create_mask = lp_create_mask(SNUM(handle->conn));
 		char *create_mask_str = NULL;
@@ -405,6 +417,7 @@ static int sys_acl_set_file_tdb(vfs_handle_struct *handle,
 	}
 
 	acl_tdb_delete(handle, db, &smb_fname->st);
+	acl_common_sd_cache_flush(handle);
 
 fail:
 	TALLOC_FREE(smb_fname);
@@ -440,6 +453,7 @@ static int sys_acl_set_fd_tdb(vfs_handle_struct *handle,
 	}
 
 	acl_tdb_delete(handle, db, &fsp->fsp_name->st);
+	acl_common_sd_cache_flush(handle);
 	return 0;
 }
 
@@ -240,6 +240,7 @@ static int sys_acl_set_file_xattr(vfs_handle_struct *handle,
 	SMB_VFS_REMOVEXATTR(handle->conn, smb_fname,
 			XATTR_NTACL_NAME);
 	unbecome_root();
+	acl_common_sd_cache_flush(handle);
 
 	return ret;
 }
@@ -262,6 +263,7 @@ static int sys_acl_set_fd_xattr(vfs_handle_struct *handle,
 	become_root();
 	SMB_VFS_FREMOVEXATTR(fsp, XATTR_NTACL_NAME);
 	unbecome_root();
+	acl_common_sd_cache_flush(handle);
 
 	return ret;
 }
@@ -0,0 +1,1192 @@
+/*
+ * VFS module to share directory listings between smbd processes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A directory is read in full on the first FDOPENDIR. The names, the
+ * stat information returned by READDIR and, once asked for, the DOS
+ * attributes of the entries are stored in dircache.tdb, keyed by the
+ * file_id of the directory. Further listings of the directory in any
+ * smbd process using this module are served from the record as long as
+ * the mtime and ctime of the directory did not change and the record is
+ * not older than "dircache:max age" seconds.
+ *
+ * A directory changed within the timestamp granularity of the file
+ * system might change again without changing its mtime, so it is not
+ * stored until its timestamps are older than that.
+ *
+ * Changes to the entries that don't touch the directory itself (writes,
+ * truncates, timestamp, mode, owner, ACL, xattr and DOS attribute
+ * changes) done via this module remove the record of the parent
+ * directory once they succeeded. For writes this is done on the first
+ * write to a file and again when it is closed.
+ */
+
+#include "includes.h"
+#include "smbd/smbd.h"
+#include "system/filesys.h"
+#include "dbwrap/dbwrap.h"
+#include "dbwrap/dbwrap_open.h"
+#include "util_tdb.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_VFS
+
+#define DIRCACHE_MODULE_NAME "dircache"
+
+/* Bump when the record layout changes */
+#define DIRCACHE_VERSION 1
+
+#define DIRCACHE_FAKE_DIR_CREATE_TIMES 0x1
+
+/* Total size of all records in the database */
+#define DIRCACHE_SIZE_KEY "DIRCACHE/SIZE"
+
+/* Covers file systems with a timestamp granularity of up to 2 seconds */
+#define DIRCACHE_RACY_NSEC (2 * 1000000000LL)
+
+static unsigned int ref_count;
+static struct db_context *dircache_db;
+
+/*
+ * A record is a struct dircache_header, followed by num_entries
+ * struct dircache_entry and names_len bytes of NULL terminated names.
+ * It's only shared between processes of the same binary, so the
+ * structs are stored as they are.
+ */
+
+struct dircache_header {
+	uint32_t version;
+	uint32_t stat_size;
+	struct timespec dir_mtime;
+	struct timespec dir_ctime;
+	uint64_t stored;
+	uint32_t flags;
+	uint32_t num_entries;
+	uint32_t names_len;
+};
+
+#define DIRCACHE_ENTRY_DOSMODE 0x1
+
+struct dircache_entry {
+	SMB_STRUCT_STAT st;
+	uint32_t flags;
+	uint32_t dosmode;
+	uint32_t name_ofs;
+};
+
+struct dircache_dir {
+	struct dircache_dir *prev, *next;
+	DIR *dirp;
+	files_struct *fsp;
+	struct file_id id;
+	uint8_t *rec;
+	size_t rec_len;
+	struct dircache_header *hdr;
+	struct dircache_entry *entries;
+	const char *names;
+	long pos;
+	bool dirty;
+	struct dirent dirent;
+};
+
+struct dircache_config {
+	int max_age;
+	int max_entries;
+	int32_t max_size;
+	uint32_t flags;
+	struct dircache_dir *dirs;
+};
+
+/*******************************************************************
+ Open dircache_db if not already open, increment ref count.
+*******************************************************************/
+
+static bool dircache_db_init(void)
+{
+	char *dbname = NULL;
+
+	if (dircache_db != NULL) {
+		ref_count++;
+		return true;
+	}
+
+	dbname = lock_path(talloc_tos(), "dircache.tdb");
+	if (dbname == NULL) {
+		errno = ENOSYS;
+		return false;
+	}
+
+	become_root();
+	dircache_db = db_open(NULL, dbname, 0,
+			      TDB_CLEAR_IF_FIRST|TDB_INCOMPATIBLE_HASH,
+			      O_RDWR|O_CREAT, 0600,
+			      DBWRAP_LOCK_ORDER_3, DBWRAP_FLAG_NONE);
+	unbecome_root();
+
+	if (dircache_db == NULL) {
+		DBG_ERR("Could not open %s: %s\n", dbname, strerror(errno));
+		TALLOC_FREE(dbname);
+		errno = ENOSYS;
+		return false;
+	}
+
+	ref_count++;
+	TALLOC_FREE(dbname);
+	return true;
+}
+
+static TDB_DATA dircache_key(const struct file_id *id)
+{
+	return make_tdb_data((const uint8_t *)id, sizeof(*id));
+}
+
+static struct dircache_dir *dircache_find_dir(struct dircache_config *config,
+					      DIR *dirp)
+{
+	struct dircache_dir *dir = NULL;
+
+	for (dir = config->dirs; dir != NULL; dir = dir->next) {
+		if (dir->dirp == dirp) {
+			return dir;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Point the dir at a record, after checking it is complete and
+ * describes the current state of the directory.
+ */
+
+static bool dircache_set_rec(struct dircache_config *config,
+			     struct dircache_dir *dir,
+			     uint8_t *rec,
+			     size_t rec_len)
+{
+	const SMB_STRUCT_STAT *st = &dir->fsp->fsp_name->st;
+	struct dircache_header *hdr = (struct dircache_header *)rec;
+	struct dircache_entry *entries = NULL;
+	const char *names = NULL;
+	size_t entries_len;
+	uint32_t i;
+
+	if (rec_len < sizeof(*hdr)) {
+		return false;
+	}
+	if ((hdr->version != DIRCACHE_VERSION) ||
+	    (hdr->stat_size != sizeof(SMB_STRUCT_STAT)) ||
+	    (hdr->flags != config->flags))
+	{
+		return false;
+	}
+	if ((timespec_compare(&hdr->dir_mtime, &st->st_ex_mtime) != 0) ||
+	    (timespec_compare(&hdr->dir_ctime, &st->st_ex_ctime) != 0))
+	{
+		DBG_DEBUG("Directory %s changed\n", fsp_str_dbg(dir->fsp));
+		return false;
+	}
+	if ((uint64_t)time(NULL) - hdr->stored > (uint64_t)config->max_age) {
+		DBG_DEBUG("Record for %s expired\n", fsp_str_dbg(dir->fsp));
+		return false;
+	}
+
+	entries_len = (size_t)hdr->num_entries * sizeof(*entries);
+	if ((hdr->names_len == 0) ||
+	    (rec_len != sizeof(*hdr) + entries_len + hdr->names_len))
+	{
+		return false;
+	}
+
+	entries = (struct dircache_entry *)(rec + sizeof(*hdr));
+	names = (const char *)(rec + sizeof(*hdr) + entries_len);
+
+	if (names[hdr->names_len - 1] != '\0') {
+		return false;
+	}
+	for (i = 0; i < hdr->num_entries; i++) {
+		if (entries[i].name_ofs >= hdr->names_len) {
+			return false;
+		}
+	}
+
+	dir->rec = rec;
+	dir->rec_len = rec_len;
+	dir->hdr = hdr;
+	dir->entries = entries;
+	dir->names = names;
+	return true;
+}
+
+static void dircache_get_len_parser(TDB_DATA key,
+				    TDB_DATA data,
+				    void *private_data)
+{
+	size_t *len = private_data;
+
+	*len = data.dsize;
+}
+
+/*
+ * Remove the record of a directory, used when one of its entries is
+ * changed without touching the directory.
+ */
+
+static void dircache_delete(struct file_id id)
+{
+	TDB_DATA key = dircache_key(&id);
+	int32_t size = 0;
+	size_t len = 0;
+	NTSTATUS status;
+
+	status = dbwrap_parse_record(
+		dircache_db, key, dircache_get_len_parser, &len);
+	if (!NT_STATUS_IS_OK(status)) {
+		return;
+	}
+
+	status = dbwrap_delete(dircache_db, key);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_delete failed: %s\n", nt_errstr(status));
+		return;
+	}
+
+	dbwrap_change_int32_atomic_bystring(
+		dircache_db, DIRCACHE_SIZE_KEY, &size, -(int32_t)len);
+}
+
+/*
+ * A file created in the same timestamp interval as the one the
+ * directory was last changed in doesn't change the mtime of the
+ * directory, so we could not tell the record is outdated.
+ */
+
+static bool dircache_dir_is_racy(const struct dircache_header *hdr)
+{
+	struct timespec now = timespec_current();
+
+	return (nsec_time_diff(&now, &hdr->dir_mtime) < DIRCACHE_RACY_NSEC) ||
+	       (nsec_time_diff(&now, &hdr->dir_ctime) < DIRCACHE_RACY_NSEC);
+}
+
+/*
+ * Store a freshly read directory, replacing an outdated record of
+ * old_len bytes. Flush the whole cache if it would grow beyond
+ * "dircache:max size".
+ */
+
+static void dircache_store_new(struct dircache_config *config,
+			       struct dircache_dir *dir,
+			       size_t old_len)
+{
+	TDB_DATA key = dircache_key(&dir->id);
+	int32_t delta = (int32_t)dir->rec_len - (int32_t)old_len;
+	int32_t size = 0;
+	NTSTATUS status;
+
+	if (dir->rec_len > (size_t)config->max_size) {
+		return;
+	}
+
+	if (dircache_dir_is_racy(dir->hdr)) {
+		DBG_DEBUG("%s changed recently, not storing it\n",
+			  fsp_str_dbg(dir->fsp));
+		return;
+	}
+
+	status = dbwrap_change_int32_atomic_bystring(
+		dircache_db, DIRCACHE_SIZE_KEY, &size, delta);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("Could not update size: %s\n", nt_errstr(status));
+		return;
+	}
+
+	if (size + delta > config->max_size) {
+		DBG_NOTICE("dircache.tdb reached %"PRIi32" bytes, flushing\n",
+			   size + delta);
+		dbwrap_wipe(dircache_db);
+		return;
+	}
+
+	status = dbwrap_store(dircache_db,
+			      key,
+			      make_tdb_data(dir->rec, dir->rec_len),
+			      TDB_REPLACE);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_store failed: %s\n", nt_errstr(status));
+	}
+}
+
+/*
+ * Write back the DOS attributes collected while listing a directory
+ * served from or stored to the cache, unless the record was replaced
+ * or removed in the meantime.
+ */
+
+static void dircache_store_dirty(struct dircache_dir *dir)
+{
+	struct db_record *rec = NULL;
+	TDB_DATA value;
+	NTSTATUS status;
+
+	rec = dbwrap_fetch_locked(dircache_db, talloc_tos(),
+				  dircache_key(&dir->id));
+	if (rec == NULL) {
+		return;
+	}
+
+	value = dbwrap_record_get_value(rec);
+	if ((value.dsize != dir->rec_len) ||
+	    (memcmp(value.dptr, dir->hdr, sizeof(*dir->hdr)) != 0))
+	{
+		DBG_DEBUG("Record for %s changed\n", fsp_str_dbg(dir->fsp));
+		TALLOC_FREE(rec);
+		return;
+	}
+
+	status = dbwrap_record_store(
+		rec, make_tdb_data(dir->rec, dir->rec_len), 0);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_DEBUG("dbwrap_record_store failed: %s\n",
+			  nt_errstr(status));
+	}
+	TALLOC_FREE(rec);
+}
+
+/*
+ * Read the whole directory and build the record for it.
+ */
+
+static bool dircache_read_dir(vfs_handle_struct *handle,
+			      struct dircache_config *config,
+			      struct dircache_dir *dir)
+{
+	const SMB_STRUCT_STAT *dir_st = &dir->fsp->fsp_name->st;
+	struct dircache_entry *entries = NULL;
+	char *names = NULL;
+	size_t num_entries = 0;
+	size_t entries_allocated = 0;
+	size_t names_len = 0;
+	size_t names_allocated = 0;
+	struct dircache_header hdr;
+	size_t entries_len;
+	uint8_t *rec = NULL;
+	size_t rec_len;
+	struct dirent *dp = NULL;
+	SMB_STRUCT_STAT st;
+	bool ok = false;
+
+	while ((dp = SMB_VFS_NEXT_READDIR(handle, dir->dirp, &st)) != NULL) {
+		size_t len = strlen(dp->d_name) + 1;
+
+		if (num_entries >= (size_t)config->max_entries) {
+			DBG_DEBUG("%s has more than %d entries\n",
+				  fsp_str_dbg(dir->fsp),
+				  config->max_entries);
+			goto done;
+		}
+
+		if (num_entries == entries_allocated) {
+			struct dircache_entry *tmp = NULL;
+
+			entries_allocated += 4096;
+			tmp = talloc_realloc(dir,
+					     entries,
+					     struct dircache_entry,
+					     entries_allocated);
+			if (tmp == NULL) {
+				goto done;
+			}
+			entries = tmp;
+		}
+
+		if (names_len + len > names_allocated) {
+			char *tmp = NULL;
+
+			names_allocated = MAX(names_allocated * 2,
+					      names_len + len);
+			tmp = talloc_realloc(dir, names, char, names_allocated);
+			if (tmp == NULL) {
+				goto done;
+			}
+			names = tmp;
+		}
+
+		ZERO_STRUCT(entries[num_entries]);
+		entries[num_entries].st = st;
+		entries[num_entries].name_ofs = names_len;
+		num_entries += 1;
+
+		memcpy(names + names_len, dp->d_name, len);
+		names_len += len;
+	}
+
+	if (num_entries == 0) {
+		goto done;
+	}
+
+	ZERO_STRUCT(hdr);
+	hdr.version = DIRCACHE_VERSION;
+	hdr.stat_size = sizeof(SMB_STRUCT_STAT);
+	hdr.dir_mtime = dir_st->st_ex_mtime;
+	hdr.dir_ctime = dir_st->st_ex_ctime;
+	hdr.stored = time(NULL);
+	hdr.flags = config->flags;
+	hdr.num_entries = num_entries;
+	hdr.names_len = names_len;
+
+	entries_len = num_entries * sizeof(struct dircache_entry);
+	rec_len = sizeof(hdr) + entries_len + names_len;
+
+	rec = talloc_size(dir, rec_len);
+	if (rec == NULL) {
+		goto done;
+	}
+	memcpy(rec, &hdr, sizeof(hdr));
+	memcpy(rec + sizeof(hdr), entries, entries_len);
+	memcpy(rec + sizeof(hdr) + entries_len, names, names_len);
+
+	ok = dircache_set_rec(config, dir, rec, rec_len);
+	if (!ok) {
+		TALLOC_FREE(rec);
+	}
+done:
+	TALLOC_FREE(entries);
+	TALLOC_FREE(names);
+	return ok;
+}
+
+static int dircache_connect(vfs_handle_struct *handle,
+			    const char *service,
+			    const char *user)
+{
+	struct dircache_config *config = NULL;
+	unsigned long max_size;
+	int ret;
+	bool ok;
+
+	ret = SMB_VFS_NEXT_CONNECT(handle, service, user);
+	if (ret < 0) {
+		return ret;
+	}
+
+	config = talloc_zero(handle->conn, struct dircache_config);
+	if (config == NULL) {
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	config->max_age = lp_parm_int(
+		SNUM(handle->conn), DIRCACHE_MODULE_NAME, "max age", 60);
+	config->max_entries = lp_parm_int(
+		SNUM(handle->conn), DIRCACHE_MODULE_NAME, "max entries", 10000);
+	max_size = lp_parm_ulong(
+		SNUM(handle->conn), DIRCACHE_MODULE_NAME, "max size", 65536);
+	config->max_size = MIN(max_size, INT32_MAX / 1024) * 1024;
+
+	if (lp_fake_directory_create_times(SNUM(handle->conn))) {
+		config->flags |= DIRCACHE_FAKE_DIR_CREATE_TIMES;
+	}
+
+	ok = dircache_db_init();
+	if (!ok) {
+		TALLOC_FREE(config);
+		SMB_VFS_NEXT_DISCONNECT(handle);
+		return -1;
+	}
+
+	SMB_VFS_HANDLE_SET_DATA(handle, config, NULL,
+				struct dircache_config, return -1);
+
+	return 0;
+}
+
+static void dircache_disconnect(vfs_handle_struct *handle)
+{
+	SMB_VFS_NEXT_DISCONNECT(handle);
+	ref_count--;
+	if (ref_count == 0) {
+		TALLOC_FREE(dircache_db);
+	}
+}
+
+static DIR *dircache_fdopendir(vfs_handle_struct *handle,
+			       files_struct *fsp,
+			       const char *mask,
+			       uint32_t attr)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+	TDB_DATA value = { .dsize = 0 };
+	DIR *dirp = NULL;
+	NTSTATUS status;
+	bool ok;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return NULL);
+
+	dirp = SMB_VFS_NEXT_FDOPENDIR(handle, fsp, mask, attr);
+	if (dirp == NULL) {
+		return NULL;
+	}
+
+	/* From here on, failures just leave the directory uncached. */
+
+	status = vfs_stat_fsp(fsp);
+	if (!NT_STATUS_IS_OK(status)) {
+		return dirp;
+	}
+
+	dir = talloc_zero(config, struct dircache_dir);
+	if (dir == NULL) {
+		return dirp;
+	}
+	dir->dirp = dirp;
+	dir->fsp = fsp;
+	dir->id = vfs_file_id_from_sbuf(handle->conn, &fsp->fsp_name->st);
+
+	status = dbwrap_fetch(dircache_db, dir, dircache_key(&dir->id),
+			      &value);
+	if (NT_STATUS_IS_OK(status)) {
+		ok = dircache_set_rec(config, dir, value.dptr, value.dsize);
+		if (ok) {
+			DBG_DEBUG("Serving %s from the cache\n",
+				  fsp_str_dbg(fsp));
+			DLIST_ADD(config->dirs, dir);
+			return dirp;
+		}
+		TALLOC_FREE(value.dptr);
+	}
+
+	ok = dircache_read_dir(handle, config, dir);
+	if (!ok) {
+		SMB_VFS_NEXT_REWINDDIR(handle, dirp);
+		TALLOC_FREE(dir);
+		return dirp;
+	}
+
+	dircache_store_new(config, dir, value.dsize);
+
+	DLIST_ADD(config->dirs, dir);
+	return dirp;
+}
+
+static struct dirent *dircache_readdir(vfs_handle_struct *handle,
+				       DIR *dirp,
+				       SMB_STRUCT_STAT *sbuf)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+	struct dircache_entry *e = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return NULL);
+
+	dir = dircache_find_dir(config, dirp);
+	if (dir == NULL) {
+		return SMB_VFS_NEXT_READDIR(handle, dirp, sbuf);
+	}
+
+	if (dir->pos >= dir->hdr->num_entries) {
+		return NULL;
+	}
+	e = &dir->entries[dir->pos++];
+
+	strlcpy(dir->dirent.d_name,
+		dir->names + e->name_ofs,
+		sizeof(dir->dirent.d_name));
+	dir->dirent.d_ino = e->st.st_ex_ino;
+
+	if (sbuf != NULL) {
+		*sbuf = e->st;
+	}
+
+	return &dir->dirent;
+}
+
+static void dircache_seekdir(vfs_handle_struct *handle,
+			     DIR *dirp,
+			     long offset)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return);
+
+	dir = dircache_find_dir(config, dirp);
+	if (dir == NULL) {
+		SMB_VFS_NEXT_SEEKDIR(handle, dirp, offset);
+		return;
+	}
+	if (offset < 0 || offset > dir->hdr->num_entries) {
+		return;
+	}
+	dir->pos = offset;
+}
+
+static long dircache_telldir(vfs_handle_struct *handle, DIR *dirp)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return -1);
+
+	dir = dircache_find_dir(config, dirp);
+	if (dir == NULL) {
+		return SMB_VFS_NEXT_TELLDIR(handle, dirp);
+	}
+	return dir->pos;
+}
+
+static void dircache_rewinddir(vfs_handle_struct *handle, DIR *dirp)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return);
+
+	dir = dircache_find_dir(config, dirp);
+	if (dir == NULL) {
+		SMB_VFS_NEXT_REWINDDIR(handle, dirp);
+		return;
+	}
+	dir->pos = 0;
+}
+
+static int dircache_closedir(vfs_handle_struct *handle, DIR *dirp)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+	int ret;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return -1);
+
+	dir = dircache_find_dir(config, dirp);
+	if (dir != NULL) {
+		if (dir->dirty) {
+			dircache_store_dirty(dir);
+		}
+		DLIST_REMOVE(config->dirs, dir);
+		TALLOC_FREE(dir);
+	}
+
+	ret = SMB_VFS_NEXT_CLOSEDIR(handle, dirp);
+	return ret;
+}
+
+/*
+ * Find the entry for a file in a cached directory we are listing.
+ * smbd asks for the DOS attributes of the entry READDIR just returned,
+ * don't bother searching for others.
+ */
+
+static struct dircache_entry *dircache_find_entry(
+	struct dircache_config *config,
+	const struct smb_filename *smb_fname,
+	struct dircache_dir **_dir)
+{
+	const char *base_name = smb_fname->base_name;
+	const char *name = NULL;
+	struct dircache_dir *dir = NULL;
+	size_t dirlen = 0;
+
+	if (smb_fname->stream_name != NULL) {
+		return NULL;
+	}
+
+	name = strrchr(base_name, '/');
+	if (name != NULL) {
+		dirlen = name - base_name;
+		name += 1;
+	} else {
+		name = base_name;
+	}
+
+	for (dir = config->dirs; dir != NULL; dir = dir->next) {
+		const char *dir_name = dir->fsp->fsp_name->base_name;
+		struct dircache_entry *e = NULL;
+
+		if (dirlen == 0) {
+			if (!ISDOT(dir_name)) {
+				continue;
+			}
+		} else if ((strlen(dir_name) != dirlen) ||
+			   (strncmp(dir_name, base_name, dirlen) != 0))
+		{
+			continue;
+		}
+
+		if (dir->pos == 0) {
+			continue;
+		}
+		e = &dir->entries[dir->pos - 1];
+
+		if ((strcmp(dir->names + e->name_ofs, name) != 0) ||
+		    (e->st.st_ex_dev != smb_fname->st.st_ex_dev) ||
+		    (e->st.st_ex_ino != smb_fname->st.st_ex_ino) ||
+		    (timespec_compare(&e->st.st_ex_ctime,
+				      &smb_fname->st.st_ex_ctime) != 0))
+		{
+			continue;
+		}
+
+		*_dir = dir;
+		return e;
+	}
+
+	return NULL;
+}
+
+static NTSTATUS dircache_get_dos_attributes(vfs_handle_struct *handle,
+					    struct smb_filename *smb_fname,
+					    uint32_t *dosmode)
+{
+	struct dircache_config *config = NULL;
+	struct dircache_dir *dir = NULL;
+	struct dircache_entry *e = NULL;
+	NTSTATUS status;
+
+	SMB_VFS_HANDLE_GET_DATA(handle, config, struct dircache_config,
+				return NT_STATUS_INTERNAL_ERROR);
+
+	e = dircache_find_entry(config, smb_fname, &dir);
+	if ((e != NULL) && (e->flags & DIRCACHE_ENTRY_DOSMODE)) {
+		*dosmode = e->dosmode;
+		return NT_STATUS_OK;
+	}
+
+	status = SMB_VFS_NEXT_GET_DOS_ATTRIBUTES(handle, smb_fname, dosmode);
+	if ((e != NULL) && NT_STATUS_IS_OK(status)) {
+		e->dosmode = *dosmode;
+		e->flags |= DIRCACHE_ENTRY_DOSMODE;
+		dir->dirty = true;
+	}
+	return status;
+}
+
+/*
+ * The functions below change entries without changing the
+ * directory. Remove the record of the parent directory.
+ */
+
+static void dircache_invalidate_parent(vfs_handle_struct *handle,
+				       const struct smb_filename *smb_fname)
+{
+	struct smb_filename *parent = NULL;
+	struct file_id id;
+	int ret;
+	bool ok;
+
+	ok = parent_smb_fname(talloc_tos(), smb_fname, &parent, NULL);
+	if (!ok) {
+		return;
+	}
+
+	ret = SMB_VFS_NEXT_STAT(handle, parent);
+	if (ret == 0) {
+		id = vfs_file_id_from_sbuf(handle->conn, &parent->st);
+		dircache_delete(id);
+	}
+
+	TALLOC_FREE(parent);
+}
+
+static int dircache_close(vfs_handle_struct *handle, files_struct *fsp)
+{
+	if (fsp->fsp_flags.modified && !fsp->fsp_flags.is_directory) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return SMB_VFS_NEXT_CLOSE(handle, fsp);
+}
+
+/*
+ * Only the first write to a file removes the record, the later ones
+ * would cost a lookup in dircache.tdb each. A listing stored while the
+ * file is being written may show an outdated size and write time until
+ * the file is closed.
+ */
+
+static void dircache_written(vfs_handle_struct *handle, files_struct *fsp)
+{
+	bool *written = NULL;
+
+	written = VFS_FETCH_FSP_EXTENSION(handle, fsp);
+	if (written != NULL) {
+		return;
+	}
+
+	written = VFS_ADD_FSP_EXTENSION(handle, fsp, bool, NULL);
+	if (written != NULL) {
+		*written = true;
+	}
+
+	dircache_invalidate_parent(handle, fsp->fsp_name);
+}
+
+static ssize_t dircache_pwrite(vfs_handle_struct *handle,
+			       files_struct *fsp,
+			       const void *data,
+			       size_t n,
+			       off_t offset)
+{
+	ssize_t nwritten;
+
+	nwritten = SMB_VFS_NEXT_PWRITE(handle, fsp, data, n, offset);
+	if (nwritten > 0) {
+		dircache_written(handle, fsp);
+	}
+	return nwritten;
+}
+
+struct dircache_pwrite_state {
+	vfs_handle_struct *handle;
+	files_struct *fsp;
+	ssize_t ret;
+	struct vfs_aio_state vfs_aio_state;
+};
+
+static void dircache_pwrite_done(struct tevent_req *subreq);
+
+static struct tevent_req *dircache_pwrite_send(vfs_handle_struct *handle,
+					       TALLOC_CTX *mem_ctx,
+					       struct tevent_context *ev,
+					       files_struct *fsp,
+					       const void *data,
+					       size_t n,
+					       off_t offset)
+{
+	struct tevent_req *req = NULL;
+	struct tevent_req *subreq = NULL;
+	struct dircache_pwrite_state *state = NULL;
+
+	req = tevent_req_create(mem_ctx, &state,
+				struct dircache_pwrite_state);
+	if (req == NULL) {
+		return NULL;
+	}
+	state->handle = handle;
+	state->fsp = fsp;
+
+	subreq = SMB_VFS_NEXT_PWRITE_SEND(state, ev, handle, fsp, data,
+					  n, offset);
+	if (tevent_req_nomem(subreq, req)) {
+		return tevent_req_post(req, ev);
+	}
+	tevent_req_set_callback(subreq, dircache_pwrite_done, req);
+	return req;
+}
+
+static void dircache_pwrite_done(struct tevent_req *subreq)
+{
+	struct tevent_req *req = tevent_req_callback_data(
+		subreq, struct tevent_req);
+	struct dircache_pwrite_state *state = tevent_req_data(
+		req, struct dircache_pwrite_state);
+
+	state->ret = SMB_VFS_PWRITE_RECV(subreq, &state->vfs_aio_state);
+	TALLOC_FREE(subreq);
+
+	if (state->ret > 0) {
+		dircache_written(state->handle, state->fsp);
+	}
+	tevent_req_done(req);
+}
+
+static ssize_t dircache_pwrite_recv(struct tevent_req *req,
+				    struct vfs_aio_state *vfs_aio_state)
+{
+	struct dircache_pwrite_state *state = tevent_req_data(
+		req, struct dircache_pwrite_state);
+
+	if (tevent_req_is_unix_error(req, &vfs_aio_state->error)) {
+		return -1;
+	}
+
+	*vfs_aio_state = state->vfs_aio_state;
+	return state->ret;
+}
+
+/*
+ * Remove the record only after the change is done. A listing that
+ * raced with the change and stored the old state could otherwise
+ * survive until "dircache:max age".
+ */
+
+static int dircache_ftruncate(vfs_handle_struct *handle,
+			      files_struct *fsp,
+			      off_t len)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_FTRUNCATE(handle, fsp, len);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static int dircache_fallocate(vfs_handle_struct *handle,
+			      files_struct *fsp,
+			      uint32_t mode,
+			      off_t offset,
+			      off_t len)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_FALLOCATE(handle, fsp, mode, offset, len);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static int dircache_ntimes(vfs_handle_struct *handle,
+			   const struct smb_filename *smb_fname,
+			   struct smb_file_time *ft)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_NTIMES(handle, smb_fname, ft);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_fchmod(vfs_handle_struct *handle,
+			   files_struct *fsp,
+			   mode_t mode)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_FCHMOD(handle, fsp, mode);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static int dircache_fchown(vfs_handle_struct *handle,
+			   files_struct *fsp,
+			   uid_t uid,
+			   gid_t gid)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_FCHOWN(handle, fsp, uid, gid);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static int dircache_chmod(vfs_handle_struct *handle,
+			  const struct smb_filename *smb_fname,
+			  mode_t mode)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_CHMOD(handle, smb_fname, mode);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_lchown(vfs_handle_struct *handle,
+			   const struct smb_filename *smb_fname,
+			   uid_t uid,
+			   gid_t gid)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_LCHOWN(handle, smb_fname, uid, gid);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_sys_acl_set_file(vfs_handle_struct *handle,
+				     const struct smb_filename *smb_fname,
+				     SMB_ACL_TYPE_T acltype,
+				     SMB_ACL_T theacl)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_SYS_ACL_SET_FILE(handle, smb_fname, acltype,
+					    theacl);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_sys_acl_set_fd(vfs_handle_struct *handle,
+				   files_struct *fsp,
+				   SMB_ACL_T theacl)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_SYS_ACL_SET_FD(handle, fsp, theacl);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static int dircache_sys_acl_delete_def_file(
+	vfs_handle_struct *handle,
+	const struct smb_filename *smb_fname)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_SYS_ACL_DELETE_DEF_FILE(handle, smb_fname);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_setxattr(vfs_handle_struct *handle,
+			     const struct smb_filename *smb_fname,
+			     const char *name,
+			     const void *value,
+			     size_t size,
+			     int flags)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_SETXATTR(handle, smb_fname, name, value, size,
+				    flags);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_fsetxattr(vfs_handle_struct *handle,
+			      files_struct *fsp,
+			      const char *name,
+			      const void *value,
+			      size_t size,
+			      int flags)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_FSETXATTR(handle, fsp, name, value, size, flags);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static int dircache_removexattr(vfs_handle_struct *handle,
+				const struct smb_filename *smb_fname,
+				const char *name)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_REMOVEXATTR(handle, smb_fname, name);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return ret;
+}
+
+static int dircache_fremovexattr(vfs_handle_struct *handle,
+				 files_struct *fsp,
+				 const char *name)
+{
+	int ret;
+
+	ret = SMB_VFS_NEXT_FREMOVEXATTR(handle, fsp, name);
+	if (ret == 0) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return ret;
+}
+
+static NTSTATUS dircache_set_dos_attributes(
+	vfs_handle_struct *handle,
+	const struct smb_filename *smb_fname,
+	uint32_t dosmode)
+{
+	NTSTATUS status;
+
+	status = SMB_VFS_NEXT_SET_DOS_ATTRIBUTES(handle, smb_fname, dosmode);
+	if (NT_STATUS_IS_OK(status)) {
+		dircache_invalidate_parent(handle, smb_fname);
+	}
+	return status;
+}
+
+static NTSTATUS dircache_fset_dos_attributes(vfs_handle_struct *handle,
+					     files_struct *fsp,
+					     uint32_t dosmode)
+{
+	NTSTATUS status;
+
+	status = SMB_VFS_NEXT_FSET_DOS_ATTRIBUTES(handle, fsp, dosmode);
+	if (NT_STATUS_IS_OK(status)) {
+		dircache_invalidate_parent(handle, fsp->fsp_name);
+	}
+	return status;
+}
+
+static struct vfs_fn_pointers vfs_dircache_fns = {
+	.connect_fn = dircache_connect,
+	.disconnect_fn = dircache_disconnect,
+	.fdopendir_fn = dircache_fdopendir,
+	.readdir_fn = dircache_readdir,
+	.seekdir_fn = dircache_seekdir,
+	.telldir_fn = dircache_telldir,
+	.rewind_dir_fn = dircache_rewinddir,
+	.closedir_fn = dircache_closedir,
+	.get_dos_attributes_fn = dircache_get_dos_attributes,
+	.close_fn = dircache_close,
+	.pwrite_fn = dircache_pwrite,
+	.pwrite_send_fn = dircache_pwrite_send,
+	.pwrite_recv_fn = dircache_pwrite_recv,
+	.ftruncate_fn = dircache_ftruncate,
+	.fallocate_fn = dircache_fallocate,
+	.ntimes_fn = dircache_ntimes,
+	.chmod_fn = dircache_chmod,
+	.fchmod_fn = dircache_fchmod,
+	.fchown_fn = dircache_fchown,
+	.lchown_fn = dircache_lchown,
+	.sys_acl_set_file_fn = dircache_sys_acl_set_file,
+	.sys_acl_set_fd_fn = dircache_sys_acl_set_fd,
+	.sys_acl_delete_def_file_fn = dircache_sys_acl_delete_def_file,
+	.setxattr_fn = dircache_setxattr,
+	.fsetxattr_fn = dircache_fsetxattr,
+	.removexattr_fn = dircache_removexattr,
+	.fremovexattr_fn = dircache_fremovexattr,
+	.set_dos_attributes_fn = dircache_set_dos_attributes,
+	.fset_dos_attributes_fn = dircache_fset_dos_attributes,
+};
+
+static_decl_vfs;
+NTSTATUS vfs_dircache_init(TALLOC_CTX *ctx)
+{
+	return smb_register_vfs(SMB_VFS_INTERFACE_VERSION, DIRCACHE_MODULE_NAME,
+				&vfs_dircache_fns);
+}
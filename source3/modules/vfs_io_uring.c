@@ -33,6 +33,11 @@
 struct vfs_io_uring_request;
 
 struct vfs_io_uring_config {
+	/*
+	 * If smbd runs on the io_uring tevent backend, our requests
+	 * are queued on its ring and uring/fde are not used.
+	 */
+	struct tevent_context *ev;
 	struct io_uring uring;
 	struct tevent_fd *fde;
 	/* recursion guard. See comment above vfs_io_uring_queue_run() */
@@ -48,6 +53,8 @@ struct vfs_io_uring_request {
 	struct vfs_io_uring_request **list_head;
 	struct vfs_io_uring_config *config;
 	struct tevent_req *req;
+	/* the request on the ring of config->ev, if any */
+	struct tevent_req *subreq;
 	struct io_uring_sqe sqe;
 	struct io_uring_cqe cqe;
 	void (*completion_fn)(struct vfs_io_uring_request *cur,
@@ -72,6 +79,8 @@ static void vfs_io_uring_finish_req(struct vfs_io_uring_request *cur,
 		DLIST_REMOVE((*cur->list_head), cur);
 		cur->list_head = NULL;
 	}
+	/* cancels an operation still in flight on config->ev */
+	TALLOC_FREE(cur->subreq);
 	cur->cqe = *cqe;
 
 	SMBPROFILE_BYTES_ASYNC_SET_IDLE(cur->profile_bytes);
@@ -150,6 +159,23 @@ static int vfs_io_uring_request_state_deny_destructor(void *_state)
 	return 0;
 }
 
+static int vfs_io_uring_request_state_tevent_destructor(void *_state)
+{
+	struct __vfs_io_uring_generic_state {
+		struct vfs_io_uring_request ur;
+	} *state = (struct __vfs_io_uring_generic_state *)_state;
+	struct vfs_io_uring_request *cur = &state->ur;
+
+	/*
+	 * Our subreq goes away with us, which cancels the operation.
+	 * tevent keeps the iovec until the kernel is done with it,
+	 * so we only need to remove ourself from the pending list.
+	 */
+	DLIST_REMOVE((*cur->list_head), cur);
+	cur->list_head = NULL;
+	return 0;
+}
+
 static void vfs_io_uring_fd_handler(struct tevent_context *ev,
 				    struct tevent_fd *fde,
 				    uint16_t flags,
@@ -179,6 +205,17 @@ static int vfs_io_uring_connect(vfs_handle_struct *handle, const char *service,
 		return ret;
 	}
 
+	if (tevent_context_have_uring(handle->conn->sconn->ev_ctx)) {
+		/*
+		 * The event loop already waits on an io_uring, share
+		 * it instead of setting up and polling a second one.
+		 */
+		config->ev = handle->conn->sconn->ev_ctx;
+		config->uring.ring_fd = -1;
+		talloc_set_destructor(config, vfs_io_uring_config_destructor);
+		return 0;
+	}
+
 	num_entries = lp_parm_ulong(SNUM(handle->conn),
 				    "io_uring",
 				    "num_entries",
@@ -372,10 +409,80 @@ static void vfs_io_uring_queue_run(struct vfs_io_uring_config *config)
 	config->busy = false;
 }
 
+static void vfs_io_uring_tevent_done(struct tevent_req *subreq);
+
+/*
+ * Queue the request on the io_uring of the tevent backend. The kernel
+ * may still read the iovec after we were freed, so it goes to tevent
+ * as a buffer. The data itself belongs to our caller.
+ */
+static void vfs_io_uring_tevent_submit(struct vfs_io_uring_request *cur)
+{
+	struct vfs_io_uring_config *config = cur->config;
+	void *state = _tevent_req_data(cur->req);
+	struct io_uring_sqe sqe = cur->sqe;
+	struct iovec *iov = NULL;
+
+	if ((sqe.opcode == IORING_OP_READV) ||
+	    (sqe.opcode == IORING_OP_WRITEV)) {
+		iov = talloc_memdup(cur->req,
+				    (const void *)(uintptr_t)sqe.addr,
+				    sizeof(struct iovec) * sqe.len);
+		if (tevent_req_nomem(iov, cur->req)) {
+			return;
+		}
+		sqe.addr = (uintptr_t)iov;
+	}
+
+	cur->subreq = tevent_uring_sqe_send(cur->req, config->ev, &sqe, iov);
+	if (tevent_req_nomem(cur->subreq, cur->req)) {
+		return;
+	}
+	tevent_req_set_callback(cur->subreq, vfs_io_uring_tevent_done, cur);
+
+	talloc_set_destructor(state,
+		vfs_io_uring_request_state_tevent_destructor);
+	DLIST_ADD_END(config->pending, cur);
+	cur->list_head = &config->pending;
+	SMBPROFILE_BYTES_ASYNC_SET_BUSY(cur->profile_bytes);
+
+	PROFILE_TIMESTAMP(&cur->start_time);
+}
+
+static void vfs_io_uring_tevent_done(struct tevent_req *subreq)
+{
+	struct vfs_io_uring_request *cur = tevent_req_callback_data(
+		subreq, struct vfs_io_uring_request);
+	struct io_uring_cqe cqe = {
+		.user_data = (uintptr_t)(void *)cur,
+	};
+	struct timespec end_time;
+	int32_t res = 0;
+	int ret;
+
+	SMB_ASSERT(subreq == cur->subreq);
+
+	ret = tevent_uring_sqe_recv(subreq, NULL, &res, NULL);
+	TALLOC_FREE(cur->subreq);
+	if (ret != 0) {
+		res = -ret;
+	}
+	cqe.res = res;
+
+	PROFILE_TIMESTAMP(&end_time);
+
+	vfs_io_uring_finish_req(cur, &cqe, end_time, __location__);
+}
+
 static void vfs_io_uring_request_submit(struct vfs_io_uring_request *cur)
 {
 	struct vfs_io_uring_config *config = cur->config;
 
+	if (config->ev != NULL) {
+		vfs_io_uring_tevent_submit(cur);
+		return;
+	}
+
 	io_uring_sqe_set_data(&cur->sqe, cur);
 	DLIST_ADD_END(config->queue, cur);
 	cur->list_head = &config->queue;
@@ -85,6 +85,7 @@ static int readonly_connect(vfs_handle_struct *handle,
         struct vuid_cache_entry *ent = &conn->vuid_cache->array[i];
         ent->vuid = UID_FIELD_INVALID;
         TALLOC_FREE(ent->session_info);
+        ent->sid_index = NULL;
         ent->read_only = false;
         ent->share_access = 0;
       }
@@ -723,7 +723,7 @@ static void init_globals(struct loadparm_context *lp_ctx, bool reinit_globals)
 	Globals.log_writeable_files_on_exit = false;
 	Globals.create_krb5_conf = true;
 	Globals.include_system_krb5_conf = true;
-	Globals._winbind_max_domain_connections = 1;
+	Globals._winbind_max_domain_connections = 4;
 
 	/* hostname lookups can be very expensive and are broken on
 	   a large number of sites (tridge) */
@@ -896,6 +896,7 @@ static void init_globals(struct loadparm_context *lp_ctx, bool reinit_globals)
 
 	Globals.allow_dns_updates = DNS_UPDATE_SIGNED;
 	Globals.dns_zone_scavenging = false;
+	Globals.dns_forwarder_cache_size = 4194304;
 
 	lpcfg_string_set(Globals.ctx, &Globals.ntp_signd_socket_directory,
 			 get_dyn_NTP_SIGND_SOCKET_DIR());
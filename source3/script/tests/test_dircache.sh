@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Check that a listing cached by vfs_dircache is not served anymore
+# after a file in the directory was changed through another connection.
+
+if [ $# -lt 5 ]; then
+cat <<EOF
+Usage: test_dircache.sh SERVER USERNAME PASSWORD LOCAL_PATH SMBCLIENT
+EOF
+exit 1;
+fi
+
+SERVER=${1}
+USERNAME=${2}
+PASSWORD=${3}
+LOCAL_PATH=${4}
+SMBCLIENT=${5}
+
+. $(dirname $0)/../../../testprogs/blackbox/subunit.sh
+failed=0
+
+TESTDIR=$LOCAL_PATH/dircache_test
+
+# Every call is a new connection, served by another smbd
+smb_cmd() {
+	$SMBCLIENT //$SERVER/dircache -U$USERNAME%$PASSWORD -c "$1"
+}
+
+# Print field $1 of the listing of the test file, 2 are the attributes
+# and 3 the size
+testfile_field() {
+	smb_cmd "ls dircache_test/*" |
+		awk -v f="$1" '$1 == "testfile" { print $f }'
+}
+
+# List from two connections, so the second one is served from the cache.
+# Field $1 must match the regular expression $2 in both listings.
+list_twice() {
+	field="$1"
+	expected="$2"
+
+	for i in 1 2; do
+		out=$(testfile_field $field) || return 1
+		echo "listing $i: $out"
+		echo "$out" | grep -q "^$expected\$" || return 1
+	done
+}
+
+rm -rf $TESTDIR
+mkdir -p $TESTDIR
+chmod 777 $TESTDIR
+
+printf '0123456789' > $TESTDIR/testfile
+printf '01234567890123456789' > $TESTDIR/bigger
+: > $TESTDIR/empty
+chmod 666 $TESTDIR/testfile
+
+testit "list" list_twice 3 10 ||
+	failed=$(expr $failed + 1)
+
+testit "write" smb_cmd "put $TESTDIR/bigger dircache_test/testfile" ||
+	failed=$(expr $failed + 1)
+testit "list after write" list_twice 3 20 ||
+	failed=$(expr $failed + 1)
+
+testit "truncate" smb_cmd "put $TESTDIR/empty dircache_test/testfile" ||
+	failed=$(expr $failed + 1)
+testit "list after truncate" list_twice 3 0 ||
+	failed=$(expr $failed + 1)
+
+testit "set attributes" smb_cmd "setmode dircache_test/testfile +r" ||
+	failed=$(expr $failed + 1)
+testit "list after setting attributes" list_twice 2 '.*R.*' ||
+	failed=$(expr $failed + 1)
+
+rm -rf $TESTDIR
+
+testok $0 $failed
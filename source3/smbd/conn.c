@@ -156,6 +156,7 @@ static void conn_clear_vuid_cache(connection_struct *conn, uint64_t vuid)
 			} else {
 				TALLOC_FREE(ent->session_info);
 			}
+			ent->sid_index = NULL;
 			ent->read_only = False;
 			ent->share_access = 0;
 		}
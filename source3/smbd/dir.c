@@ -77,6 +77,10 @@ struct dptr_struct {
 	bool priv;     /* Directory handle opened with privilege. */
 	uint32_t counter;
 	struct memcache *dptr_cache;
+	/* The last mask given to dptr_mask_match(), compiled. */
+	char *match_mask;
+	bool match_case_sensitive;
+	struct ms_fnmatch_pattern *match_pattern;
 };
 
 static struct smb_Dir *OpenDir_fsp(TALLOC_CTX *mem_ctx, connection_struct *conn,
@@ -379,6 +383,43 @@ bool dptr_has_wild(struct dptr_struct *dptr)
 	return dptr->has_wild;
 }
 
+/****************************************************************************
+ mask_match() for the names read from a dptr. The mask is compiled once
+ and only again if a different one is passed in.
+****************************************************************************/
+
+bool dptr_mask_match(struct dptr_struct *dptr,
+		     const char *string,
+		     const char *mask,
+		     bool is_case_sensitive)
+{
+	if (ISDOT(mask)) {
+		return false;
+	}
+
+	if (dptr->match_pattern == NULL ||
+	    dptr->match_case_sensitive != is_case_sensitive ||
+	    strcmp(dptr->match_mask, mask) != 0) {
+		TALLOC_FREE(dptr->match_pattern);
+		TALLOC_FREE(dptr->match_mask);
+
+		dptr->match_mask = talloc_strdup(dptr, mask);
+		if (dptr->match_mask == NULL) {
+			return mask_match(string, mask, is_case_sensitive);
+		}
+		dptr->match_case_sensitive = is_case_sensitive;
+		dptr->match_pattern = ms_fnmatch_compile(dptr,
+							 mask,
+							 get_Protocol(),
+							 is_case_sensitive);
+		if (dptr->match_pattern == NULL) {
+			return mask_match(string, mask, is_case_sensitive);
+		}
+	}
+
+	return ms_fnmatch_compiled(dptr->match_pattern, string) == 0;
+}
+
 int dptr_dnum(struct dptr_struct *dptr)
 {
 	return dptr->dnum;
@@ -1138,8 +1179,9 @@ static bool user_can_read_file(connection_struct *conn,
 		return false;
         }
 
-	status = se_file_access_check(sd,
+	status = se_file_access_check_index(sd,
 				get_current_nttok(conn),
+				get_current_nttok_sid_index(conn),
 				false,
 				access_mask,
 				&rejected_mask);
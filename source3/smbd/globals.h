@@ -71,6 +71,7 @@ extern struct smb_trans_enc_state *srv_trans_enc_ctx;
 struct sec_ctx {
 	struct security_unix_token ut;
 	struct security_token *token;
+	struct security_token_sid_index *sid_index;
 };
 /* A stack of security contexts.  We include the current context as being
    the first one, so there is room for another MAX_SEC_CTX_DEPTH more. */
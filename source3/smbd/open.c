@@ -192,8 +192,9 @@ NTSTATUS smbd_check_access_rights(struct connection_struct *conn,
 		do_not_check_mask |= FILE_EXECUTE;
 	}
 
-	status = se_file_access_check(sd,
+	status = se_file_access_check_index(sd,
 				get_current_nttok(conn),
+				get_current_nttok_sid_index(conn),
 				use_privs,
 				(access_mask & ~do_not_check_mask),
 				&rejected_mask);
@@ -332,8 +333,9 @@ NTSTATUS check_parent_access(struct connection_struct *conn,
 	 * se_file_access_check() also takes care of
 	 * owner WRITE_DAC and READ_CONTROL.
 	 */
-	status = se_file_access_check(parent_sd,
+	status = se_file_access_check_index(parent_sd,
 				get_current_nttok(conn),
+				get_current_nttok_sid_index(conn),
 				false,
 				(access_mask & ~FILE_READ_ATTRIBUTES),
 				&access_granted);
@@ -1972,7 +1974,7 @@ static NTSTATUS open_mode_check(connection_struct *conn,
 	}
 
 	d->flags = new_flags;
-	d->modified = true;
+	d->header_modified = true;
 
 	conflict = share_conflict(
 		state.access_mask,
@@ -2708,7 +2710,7 @@ grant:
 	if ((granted & SMB2_LEASE_READ) &&
 	    ((lck->data->flags & SHARE_MODE_LEASE_READ) == 0)) {
 		lck->data->flags |= SHARE_MODE_LEASE_READ;
-		lck->data->modified = true;
+		lck->data->header_modified = true;
 	}
 
 	DBG_DEBUG("oplock type 0x%x on file %s\n",
@@ -3205,8 +3207,9 @@ static NTSTATUS smbd_calculate_maximum_allowed_access(
 	 * se_file_access_check()
 	 * also takes care of owner WRITE_DAC and READ_CONTROL.
 	 */
-	status = se_file_access_check(sd,
+	status = se_file_access_check_index(sd,
 				 get_current_nttok(conn),
+				 get_current_nttok_sid_index(conn),
 				 use_privs,
 				 (*p_access_mask & ~FILE_READ_ATTRIBUTES),
 				 &access_granted);
@@ -3975,7 +3978,7 @@ static NTSTATUS open_file_ntcreate(connection_struct *conn,
 
 		if (new_flags != d->flags) {
 			d->flags = new_flags;
-			d->modified = true;
+			d->header_modified = true;
 		}
 	}
 
@@ -4665,7 +4668,7 @@ static NTSTATUS open_directory(connection_struct *conn,
 
 		if (new_flags != d->flags) {
 			d->flags = new_flags;
-			d->modified = true;
+			d->header_modified = true;
 		}
 	}
 
@@ -1345,7 +1345,7 @@ static void contend_level2_oplocks_begin_default(files_struct *fsp,
 		 * has gone in the meantime.
 		 */
 		d->flags &= ~SHARE_MODE_LEASE_READ;
-		d->modified = true;
+		d->header_modified = true;
 	}
 
 	TALLOC_FREE(lck);
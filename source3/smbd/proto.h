@@ -205,6 +205,10 @@ void dptr_CloseDir(files_struct *fsp);
 void dptr_SeekDir(struct dptr_struct *dptr, long offset);
 long dptr_TellDir(struct dptr_struct *dptr);
 bool dptr_has_wild(struct dptr_struct *dptr);
+bool dptr_mask_match(struct dptr_struct *dptr,
+		     const char *string,
+		     const char *mask,
+		     bool is_case_sensitive);
 int dptr_dnum(struct dptr_struct *dptr);
 bool dptr_get_priv(struct dptr_struct *dptr);
 void dptr_set_priv(struct dptr_struct *dptr);
@@ -1101,10 +1105,14 @@ void server_encryption_shutdown(struct smbXsrv_connection *xconn);
 bool unix_token_equal(const struct security_unix_token *t1, const struct security_unix_token *t2);
 bool push_sec_ctx(void);
 void set_sec_ctx(uid_t uid, gid_t gid, int ngroups, gid_t *groups, const struct security_token *token);
+void set_sec_ctx_sid_index(uid_t uid, gid_t gid, int ngroups, gid_t *groups,
+			   const struct security_token *token,
+			   const struct security_token_sid_index *sid_index);
 void set_root_sec_ctx(void);
 bool pop_sec_ctx(void);
 void init_sec_ctx(void);
 const struct security_token *sec_ctx_active_token(void);
+const struct security_token_sid_index *sec_ctx_active_sid_index(void);
 
 /* The following definitions come from smbd/server.c  */
 
@@ -1285,6 +1293,8 @@ uid_t get_current_uid(connection_struct *conn);
 gid_t get_current_gid(connection_struct *conn);
 const struct security_unix_token *get_current_utok(connection_struct *conn);
 const struct security_token *get_current_nttok(connection_struct *conn);
+const struct security_token_sid_index *get_current_nttok_sid_index(
+	connection_struct *conn);
 
 /* The following definitions come from smbd/utmp.c  */
 
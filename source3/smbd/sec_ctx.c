@@ -217,6 +217,12 @@ bool push_sec_ctx(void)
 
 	ctx_p->token = dup_nt_token(NULL,
 				    sec_ctx_stack[sec_ctx_stack_ndx-1].token);
+	ctx_p->sid_index = NULL;
+	if (ctx_p->token != NULL) {
+		ctx_p->sid_index = security_token_sid_index_dup(
+			ctx_p->token,
+			sec_ctx_stack[sec_ctx_stack_ndx-1].sid_index);
+	}
 
 	ctx_p->ut.ngroups = sys_getgroups(0, NULL);
 
@@ -224,6 +230,7 @@ bool push_sec_ctx(void)
 		if (!(ctx_p->ut.groups = SMB_MALLOC_ARRAY(gid_t, ctx_p->ut.ngroups))) {
 			DEBUG(0, ("Out of memory in push_sec_ctx()\n"));
 			TALLOC_FREE(ctx_p->token);
+			ctx_p->sid_index = NULL;
 			return False;
 		}
 
@@ -310,7 +317,8 @@ static void set_unix_security_ctx(uid_t uid, gid_t gid, int ngroups, gid_t *grou
 
 static void set_sec_ctx_internal(uid_t uid, gid_t gid,
 				 int ngroups, gid_t *groups,
-				 const struct security_token *token)
+				 const struct security_token *token,
+				 const struct security_token_sid_index *sid_index)
 {
 	struct sec_ctx *ctx_p = &sec_ctx_stack[sec_ctx_stack_ndx];
 
@@ -333,6 +341,7 @@ static void set_sec_ctx_internal(uid_t uid, gid_t gid,
 	}
 
 	TALLOC_FREE(ctx_p->token);
+	ctx_p->sid_index = NULL;
 
 	if (ngroups) {
 		ctx_p->ut.groups = (gid_t *)smb_xmemdup(groups,
@@ -346,6 +355,9 @@ static void set_sec_ctx_internal(uid_t uid, gid_t gid,
 		if (!ctx_p->token) {
 			smb_panic("dup_nt_token failed");
 		}
+		/* Copying the sorted index is cheaper than a sort */
+		ctx_p->sid_index = security_token_sid_index_dup(
+			ctx_p->token, sid_index);
 	} else {
 		ctx_p->token = NULL;
 	}
@@ -365,7 +377,21 @@ static void set_sec_ctx_internal(uid_t uid, gid_t gid,
 void set_sec_ctx(uid_t uid, gid_t gid, int ngroups, gid_t *groups, const struct security_token *token)
 {
 	START_PROFILE(set_sec_ctx);
-	set_sec_ctx_internal(uid, gid, ngroups, groups, token);
+	set_sec_ctx_internal(uid, gid, ngroups, groups, token, NULL);
+	END_PROFILE(set_sec_ctx);
+}
+
+/****************************************************************************
+ Like set_sec_ctx(), with a SID index the caller keeps next to token,
+ see security_token_sid_index().
+****************************************************************************/
+
+void set_sec_ctx_sid_index(uid_t uid, gid_t gid, int ngroups, gid_t *groups,
+			   const struct security_token *token,
+			   const struct security_token_sid_index *sid_index)
+{
+	START_PROFILE(set_sec_ctx);
+	set_sec_ctx_internal(uid, gid, ngroups, groups, token, sid_index);
 	END_PROFILE(set_sec_ctx);
 }
 
@@ -378,7 +404,7 @@ void set_root_sec_ctx(void)
 	/* May need to worry about supplementary groups at some stage */
 
 	START_PROFILE(set_root_sec_ctx);
-	set_sec_ctx_internal(0, 0, 0, NULL, NULL);
+	set_sec_ctx_internal(0, 0, 0, NULL, NULL, NULL);
 	END_PROFILE(set_root_sec_ctx);
 }
 
@@ -411,6 +437,7 @@ bool pop_sec_ctx(void)
 	ctx_p->ut.ngroups = 0;
 
 	TALLOC_FREE(ctx_p->token);
+	ctx_p->sid_index = NULL;
 
 	/* Pop back previous user */
 
@@ -465,6 +492,7 @@ void init_sec_ctx(void)
 	get_current_groups(ctx_p->ut.gid, &ctx_p->ut.ngroups, &ctx_p->ut.groups);
 
 	ctx_p->token = NULL; /* Maps to guest user. */
+	ctx_p->sid_index = NULL;
 
 	/* Initialise current_user global */
 
@@ -505,3 +533,23 @@ const struct security_token *sec_ctx_active_token(void)
 	}
 	return ctx_p->token;
 }
+
+/*************************************************************
+ The SID index of the token sec_ctx_active_token() returns, if
+ whoever set the security context provided one.
+*************************************************************/
+
+const struct security_token_sid_index *sec_ctx_active_sid_index(void)
+{
+	int stack_index = sec_ctx_stack_ndx;
+	struct sec_ctx *ctx_p = &sec_ctx_stack[stack_index];
+
+	while (ctx_p->token == NULL) {
+		stack_index--;
+		if (stack_index < 0) {
+			return NULL;
+		}
+		ctx_p = &sec_ctx_stack[stack_index];
+	}
+	return ctx_p->sid_index;
+}
@@ -57,6 +57,8 @@
 #include "rpc_server/lsasd.h"
 #include "rpc_server/fssd.h"
 #include "rpc_server/mdssd.h"
+#include "lib/server_prefork.h"
+#include "lib/util/tevent_unix.h"
 
 #ifdef CLUSTER_SUPPORT
 #include "ctdb_protocol.h"
@@ -83,6 +85,10 @@ struct smbd_parent_context {
 	struct server_id notifyd;
 
 	struct tevent_timer *cleanup_te;
+
+	/* pre-forked smbds waiting for a connection, see smbd_pool_init() */
+	struct prefork_pool *pool;
+	int pool_size;
 };
 
 struct smbd_open_socket {
@@ -92,6 +98,8 @@ struct smbd_open_socket {
 	struct tevent_fd *fde;
 };
 
+static void smbd_pool_reload(struct smbd_parent_context *parent);
+
 struct smbd_child_pid {
 	struct smbd_child_pid *prev, *next;
 	pid_t pid;
@@ -115,6 +123,9 @@ static void smbd_parent_conf_updated(struct messaging_context *msg,
 		  "updated. Reloading.\n"));
 	change_to_root_user();
 	reload_services(NULL, NULL, false);
+	if (am_parent != NULL) {
+		smbd_pool_reload(am_parent);
+	}
 	printing_subsystem_update(ev_ctx, msg, false);
 
 	ok = reinit_guest_session_info(NULL);
@@ -144,7 +155,19 @@ static void smb_stat_cache_delete(struct messaging_context *msg,
 
 static void  killkids(void)
 {
-	if(am_parent) kill(0,SIGTERM);
+	if (am_parent == NULL) {
+		return;
+	}
+
+	/*
+	 * The pooled smbds are not serving a client yet, stop them even
+	 * if they are not in our process group.
+	 */
+	if (am_parent->pool != NULL) {
+		prefork_send_signal_to_all(am_parent->pool, SIGTERM);
+	}
+
+	kill(0,SIGTERM);
 }
 
 static void msg_exit_server(struct messaging_context *msg,
@@ -241,6 +264,15 @@ static NTSTATUS messaging_send_to_children(struct messaging_context *msg_ctx,
 				  (int)child->pid, nt_errstr(status));
 		}
 	}
+
+	/* the idle pooled smbds are not in the children list */
+	if (parent->pool != NULL) {
+		prefork_send_message_to_all(parent->msg_ctx,
+					    parent->pool,
+					    msg_type,
+					    data);
+	}
+
 	return NT_STATUS_OK;
 }
 
@@ -865,6 +897,21 @@ static void remove_child_pid(struct smbd_parent_context *parent,
 	}
 }
 
+/****************************************************************************
+ Number of child processes, including the idle pooled smbds.
+****************************************************************************/
+
+static int smbd_num_processes(struct smbd_parent_context *parent)
+{
+	int num_processes = parent->num_children;
+
+	if (parent->pool != NULL) {
+		num_processes += prefork_count_children(parent->pool, NULL);
+	}
+
+	return num_processes;
+}
+
 /****************************************************************************
  Have we reached the process limit ?
 ****************************************************************************/
@@ -876,7 +923,7 @@ static bool allowable_number_of_smbd_processes(struct smbd_parent_context *paren
 	if (!max_processes)
 		return True;
 
-	return parent->num_children < max_processes;
+	return smbd_num_processes(parent) < max_processes;
 }
 
 static void smbd_sig_chld_handler(struct tevent_context *ev,
@@ -908,6 +955,9 @@ static void smbd_sig_chld_handler(struct tevent_context *ev,
 		if (WIFSIGNALED(status)) {
 			unclean_shutdown = True;
 		}
+		if (parent->pool != NULL) {
+			prefork_child_exited(parent->pool, pid);
+		}
 		remove_child_pid(parent, pid, unclean_shutdown);
 	}
 }
@@ -935,6 +985,403 @@ static void smbd_open_socket_close_fn(struct tevent_context *ev,
 	close(fd);
 }
 
+/****************************************************************************
+ Monotonic timestamp in usec, used to measure the time from accepting a
+ connection until smbd_process() starts to serve it.
+****************************************************************************/
+
+static uint64_t smbd_accept_timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime_mono(&ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void smbd_account_connect_setup(uint64_t accepted, const char *how)
+{
+	uint64_t setup = smbd_accept_timestamp() - accepted;
+
+	SMBPROFILE_BASIC_ADD(connect_setup, profile_p, setup);
+	DBG_DEBUG("connection setup (%s) took %"PRIu64" usec\n", how, setup);
+}
+
+/*
+ * How often an idle pooled smbd checks whether the parent is still
+ * there, in seconds
+ */
+#define SMBD_POOL_PARENT_CHECK_INTERVAL 5
+
+struct smbd_pool_worker_state {
+	pid_t parent_pid;
+};
+
+static bool smbd_pool_connection_pass_filter(struct messaging_rec *rec,
+					     void *private_data)
+{
+	struct smbd_pool_worker_state *state =
+		talloc_get_type_abort(private_data,
+		struct smbd_pool_worker_state);
+
+	if (rec->msg_type != MSG_SMB_CONNECTION_PASS) {
+		return false;
+	}
+
+	if (rec->num_fds != 1) {
+		return false;
+	}
+
+	if (rec->buf.length != sizeof(uint64_t)) {
+		return false;
+	}
+
+	/* only our parent hands out connections */
+	if (rec->src.pid != (uint64_t)state->parent_pid) {
+		return false;
+	}
+
+	return true;
+}
+
+/****************************************************************************
+ The parent's message handlers are still registered after the fork. They
+ must not run in an idle pooled smbd: each of them would reload the
+ configuration and the printers on MSG_SMB_CONF_UPDATED. smbd_process()
+ reloads the configuration if it changed and registers the handlers of
+ an smbd serving a client.
+****************************************************************************/
+
+static void smbd_pool_worker_messaging(struct messaging_context *msg_ctx,
+				       struct tevent_context *ev)
+{
+	messaging_deregister(msg_ctx, MSG_SMB_CONF_UPDATED, ev);
+	messaging_deregister(msg_ctx, MSG_SMB_FORCE_TDIS, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_FORCE_TDIS_DENIED, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_KILL_CLIENT_IP, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_TELL_NUM_CHILDREN, NULL);
+	messaging_deregister(msg_ctx, MSG_SMB_NOTIFY_STARTED, NULL);
+
+	/* no children to pass these on to */
+	messaging_deregister(msg_ctx, MSG_DEBUG, NULL);
+	messaging_register(msg_ctx, NULL, MSG_DEBUG, debug_message);
+
+	messaging_deregister(msg_ctx, ID_CACHE_DELETE, NULL);
+	messaging_deregister(msg_ctx, ID_CACHE_KILL, NULL);
+	id_cache_register_msgs(msg_ctx);
+	/* there is no client to kill yet, just forget the id */
+	messaging_register(msg_ctx, NULL,
+			   ID_CACHE_KILL, id_cache_delete_message);
+}
+
+/****************************************************************************
+ A pooled smbd that is still waiting for a connection has no client to
+ serve, it exits when the parent is gone. Retiring it from the pool is
+ done with a SIGTERM from the parent.
+****************************************************************************/
+
+static void smbd_pool_check_parent(struct tevent_context *ev,
+				   struct tevent_timer *te,
+				   struct timeval current_time,
+				   void *private_data)
+{
+	struct smbd_pool_worker_state *state =
+		talloc_get_type_abort(private_data,
+		struct smbd_pool_worker_state);
+
+	TALLOC_FREE(te);
+
+	if (getppid() != state->parent_pid) {
+		DBG_NOTICE("parent smbd %d exited\n", (int)state->parent_pid);
+		exit_server_cleanly("parent smbd exited");
+		return;
+	}
+
+	te = tevent_add_timer(ev,
+			      state,
+			      timeval_current_ofs(
+				      SMBD_POOL_PARENT_CHECK_INTERVAL, 0),
+			      smbd_pool_check_parent,
+			      state);
+	if (te == NULL) {
+		exit_server_cleanly("tevent_add_timer() failed");
+	}
+}
+
+/****************************************************************************
+ Main function of a pooled smbd: do the per process initialization that
+ does not depend on the client, then wait for the parent to pass us an
+ accepted connection.
+****************************************************************************/
+
+static int smbd_pool_worker_main(struct tevent_context *ev,
+				 struct messaging_context *msg_ctx,
+				 struct pf_worker_data *pf,
+				 int child_id,
+				 int listen_fd_size,
+				 struct pf_listen_fd *listen_fds,
+				 void *private_data)
+{
+	struct smbd_parent_context *parent =
+		talloc_get_type_abort(private_data,
+		struct smbd_parent_context);
+	struct dcesrv_context *dce_ctx = parent->dce_ctx;
+	/* msg_ctx has the id of the parent until smbd_reinit_after_fork() */
+	pid_t parent_pid = messaging_server_id(msg_ctx).pid;
+	TALLOC_CTX *frame = NULL;
+	struct smbd_pool_worker_state *state = NULL;
+	struct tevent_req *req = NULL;
+	struct messaging_rec *rec = NULL;
+	NTSTATUS status;
+	uint64_t accepted;
+	int fd;
+	int ret;
+	int err;
+	bool ok;
+
+	/*
+	 * As in smbd_accept_connection(), this closes the listening
+	 * sockets.
+	 */
+	talloc_free(parent);
+	parent = NULL;
+
+	/* Stop zombies, the parent explicitly handles
+	 * them, counting worker smbds. */
+	CatchChild();
+
+	status = smbd_reinit_after_fork(msg_ctx, ev, true, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("pooled smbd %d: reinit_after_fork() failed: %s\n",
+			child_id, nt_errstr(status));
+		exit_server_cleanly("pooled smbd failed to initialize");
+	}
+
+	if (!init_account_policy()) {
+		exit_server("Could not open account policy tdb.\n");
+	}
+
+	smbd_pool_worker_messaging(msg_ctx, ev);
+
+	frame = talloc_stackframe();
+
+	state = talloc_zero(frame, struct smbd_pool_worker_state);
+	if (state == NULL) {
+		exit_server_cleanly("talloc_zero() failed");
+	}
+	state->parent_pid = parent_pid;
+
+	/* the parent may have gone before we got here */
+	smbd_pool_check_parent(ev, NULL, timeval_current(), state);
+
+	req = messaging_filtered_read_send(frame,
+					   ev,
+					   msg_ctx,
+					   smbd_pool_connection_pass_filter,
+					   state);
+	if (req == NULL) {
+		exit_server_cleanly("messaging_filtered_read_send() failed");
+	}
+
+	/* from now on the parent may pass us a connection */
+	pf->status = PF_WORKER_ACCEPTING;
+	DBG_DEBUG("pooled smbd %d ready\n", child_id);
+
+	ok = tevent_req_poll_unix(req, ev, &err);
+	if (!ok) {
+		DBG_ERR("tevent_req_poll_unix() failed: %s\n", strerror(err));
+		exit_server_cleanly("waiting for a connection failed");
+	}
+
+	ret = messaging_filtered_read_recv(req, frame, &rec);
+	TALLOC_FREE(req);
+	if (ret != 0) {
+		DBG_ERR("messaging_filtered_read_recv() failed: %s\n",
+			strerror(ret));
+		exit_server_cleanly("receiving a connection failed");
+	}
+
+	/*
+	 * The parent detached us from the pool before passing the
+	 * connection, pf must not be touched anymore.
+	 */
+	pf = NULL;
+
+	fd = rec->fds[0];
+	rec->num_fds = 0;
+	accepted = BVAL(rec->buf.data, 0);
+	TALLOC_FREE(frame);
+
+	smb_set_close_on_exec(fd);
+	smbd_account_connect_setup(accepted, "pooled");
+
+	smbd_process(ev, msg_ctx, dce_ctx, fd, false);
+
+	exit_server_cleanly("end of child");
+	return 0;
+}
+
+/****************************************************************************
+ Fork pooled smbds until the pool is full again.
+****************************************************************************/
+
+static void smbd_pool_replenish(struct smbd_parent_context *parent)
+{
+	int max_processes = lp_max_smbd_processes();
+	int num_new;
+
+	if (parent->pool == NULL) {
+		return;
+	}
+
+	num_new = parent->pool_size -
+		prefork_count_children(parent->pool, NULL);
+
+	/* idle pooled smbds count for "max smbd processes" */
+	if (max_processes != 0) {
+		num_new = MIN(num_new,
+			      max_processes - smbd_num_processes(parent));
+	}
+
+	if (num_new <= 0) {
+		return;
+	}
+
+	prefork_add_children(parent->ev_ctx,
+			     parent->msg_ctx,
+			     parent->pool,
+			     num_new);
+}
+
+/****************************************************************************
+ Pass an accepted connection to an idle pooled smbd. Returns false if no
+ pooled smbd took the connection, the caller forks a new smbd then.
+****************************************************************************/
+
+static bool smbd_pool_pass_connection(struct smbd_parent_context *parent,
+				      int fd,
+				      uint64_t accepted)
+{
+	uint8_t buf[sizeof(uint64_t)];
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = sizeof(buf),
+	};
+	NTSTATUS status;
+	pid_t pid;
+
+	if (parent->pool == NULL) {
+		return false;
+	}
+
+	pid = prefork_detach_idle_child(parent->pool);
+	if (pid == -1) {
+		DBG_INFO("No idle pooled smbd, forking a new one\n");
+		return false;
+	}
+
+	SBVAL(buf, 0, accepted);
+
+	status = messaging_send_iov(parent->msg_ctx,
+				    pid_to_procid(pid),
+				    MSG_SMB_CONNECTION_PASS,
+				    &iov, 1,
+				    &fd, 1);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("Passing connection to pooled smbd %d "
+			    "failed: %s\n",
+			    (int)pid,
+			    nt_errstr(status));
+		/* it is no longer part of the pool, don't leave it idle */
+		kill(pid, SIGTERM);
+		return false;
+	}
+
+	add_child_pid(parent, pid);
+	return true;
+}
+
+/****************************************************************************
+ Create the pool of pre-forked smbds, if configured.
+****************************************************************************/
+
+static void smbd_pool_init(struct smbd_parent_context *parent)
+{
+	int pool_size = lp_smbd_prefork_pool_size();
+	int max_processes = lp_max_smbd_processes();
+	int num_start = pool_size;
+	bool ok;
+
+	if (parent->pool != NULL || pool_size <= 0) {
+		return;
+	}
+
+	if (max_processes != 0) {
+		num_start = MIN(num_start,
+				max_processes - smbd_num_processes(parent));
+		num_start = MAX(num_start, 0);
+	}
+
+	/*
+	 * The pool must outlive the parent context in the pooled
+	 * smbds, they free it after the fork.
+	 */
+	ok = prefork_create_pool(parent->ev_ctx,
+				 parent->ev_ctx,
+				 parent->msg_ctx,
+				 0, NULL,
+				 num_start, pool_size,
+				 smbd_pool_worker_main,
+				 parent,
+				 &parent->pool);
+	if (!ok) {
+		DBG_ERR("Failed to create a pool of %d smbd processes, "
+			"forking a process per connection\n",
+			pool_size);
+		return;
+	}
+
+	/* smbd_sig_chld_handler() reaps all our children */
+	prefork_disable_sigchld_handler(parent->pool);
+	parent->pool_size = pool_size;
+
+	DBG_NOTICE("Started %d of a pool of %d smbd processes\n",
+		   num_start, pool_size);
+}
+
+/****************************************************************************
+ Apply a changed "smbd prefork pool size" after a reload. The pooled smbds
+ that are serving a client have been detached from the pool already, all
+ smbds left in the pool are idle. So the pool is replaced by one of the
+ new size.
+****************************************************************************/
+
+static void smbd_pool_reload(struct smbd_parent_context *parent)
+{
+	int pool_size = lp_smbd_prefork_pool_size();
+
+	if (parent->interactive) {
+		return;
+	}
+
+	if (pool_size < 0) {
+		pool_size = 0;
+	}
+
+	if (pool_size == parent->pool_size) {
+		return;
+	}
+
+	if (parent->pool != NULL) {
+		DBG_NOTICE("Stopping the pool of %d smbd processes\n",
+			   parent->pool_size);
+		prefork_send_signal_to_all(parent->pool, SIGTERM);
+		TALLOC_FREE(parent->pool);
+		parent->pool_size = 0;
+	}
+
+	smbd_pool_init(parent);
+}
+
 static void smbd_accept_connection(struct tevent_context *ev,
 				   struct tevent_fd *fde,
 				   uint16_t flags,
@@ -946,6 +1393,7 @@ static void smbd_accept_connection(struct tevent_context *ev,
 	struct dcesrv_context *dce_ctx = s->parent->dce_ctx;
 	struct sockaddr_storage addr;
 	socklen_t in_addrlen = sizeof(addr);
+	uint64_t accepted;
 	int fd;
 	pid_t pid = 0;
 
@@ -959,6 +1407,7 @@ static void smbd_accept_connection(struct tevent_context *ev,
 		return;
 	}
 	smb_set_close_on_exec(fd);
+	accepted = smbd_accept_timestamp();
 
 	if (s->parent->interactive) {
 		reinit_after_fork(msg_ctx, ev, true, NULL);
@@ -967,6 +1416,18 @@ static void smbd_accept_connection(struct tevent_context *ev,
 		return;
 	}
 
+	/*
+	 * An idle pooled smbd is counted already, handing it the
+	 * connection does not add a process.
+	 */
+	if (smbd_pool_pass_connection(s->parent, fd, accepted)) {
+		/* The pooled smbd has its own copy of the socket */
+		close(fd);
+		smbd_pool_replenish(s->parent);
+		force_check_log_size();
+		return;
+	}
+
 	if (!allowable_number_of_smbd_processes(s->parent)) {
 		close(fd);
 		return;
@@ -1011,6 +1472,7 @@ static void smbd_accept_connection(struct tevent_context *ev,
 			smb_panic("reinit_after_fork() failed");
 		}
 
+		smbd_account_connect_setup(accepted, "forked");
 		smbd_process(ev, msg_ctx, dce_ctx, fd, false);
 	 exit:
 		exit_server_cleanly("end of child");
@@ -1037,6 +1499,8 @@ static void smbd_accept_connection(struct tevent_context *ev,
 		add_child_pid(s->parent, pid);
 	}
 
+	smbd_pool_replenish(s->parent);
+
 	/* Force parent to check log size after
 	 * spawning child.  Fix from
 	 * klausr@ITAP.Physik.Uni-Stuttgart.De.  The
@@ -1414,6 +1878,7 @@ static void smbd_parent_sig_hup_handler(struct tevent_context *ev,
 	change_to_root_user();
 	DEBUG(1,("parent: Reloading services after SIGHUP\n"));
 	reload_services(NULL, NULL, false);
+	smbd_pool_reload(parent);
 
 	printing_subsystem_update(parent->ev_ctx, parent->msg_ctx, true);
 }
@@ -2178,6 +2643,10 @@ extern void build_options(bool screen);
 	if (!open_sockets_smbd(parent, ev_ctx, msg_ctx, ports))
 		exit_server("open_sockets_smbd() failed");
 
+	if (!interactive) {
+		smbd_pool_init(parent);
+	}
+
 	/* do a printer update now that all messaging has been set up,
 	 * before we allow clients to start connecting */
 	if (!lp__disable_spoolss() &&
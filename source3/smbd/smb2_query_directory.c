@@ -238,6 +238,10 @@ struct smbd_smb2_query_directory_state {
 	bool ask_sharemode;
 	bool async_dosmode;
 	bool async_ask_sharemode;
+	bool deferred_write_times;
+	struct file_id *write_time_ids;
+	int *write_time_offs;
+	size_t num_write_times;
 	int last_entry_off;
 	size_t max_async_dosmode_active;
 	uint32_t async_dosmode_active;
@@ -245,6 +249,11 @@ struct smbd_smb2_query_directory_state {
 };
 
 static bool smb2_query_directory_next_entry(struct tevent_req *req);
+static bool smb2_query_directory_add_write_time(
+	struct smbd_smb2_query_directory_state *state,
+	struct file_id id);
+static void smb2_query_directory_fill_write_times(
+	struct smbd_smb2_query_directory_state *state);
 static void smb2_query_directory_fetch_write_time_done(struct tevent_req *subreq);
 static void smb2_query_directory_dos_mode_done(struct tevent_req *subreq);
 static void smb2_query_directory_waited(struct tevent_req *subreq);
@@ -525,6 +534,26 @@ static struct tevent_req *smbd_smb2_query_directory_send(TALLOC_CTX *mem_ctx,
 		state->async_ask_sharemode = true;
 	}
 
+	if (state->ask_sharemode) {
+		switch (state->info_level) {
+		case SMB_FIND_FILE_DIRECTORY_INFO:
+		case SMB_FIND_FILE_FULL_DIRECTORY_INFO:
+		case SMB_FIND_FILE_BOTH_DIRECTORY_INFO:
+		case SMB_FIND_ID_FULL_DIRECTORY_INFO:
+		case SMB_FIND_ID_BOTH_DIRECTORY_INFO:
+			/*
+			 * Don't look up the write time per entry, fetch
+			 * them for all entries of the reply once it is
+			 * filled.
+			 */
+			state->ask_sharemode = false;
+			state->deferred_write_times = true;
+			break;
+		default:
+			break;
+		}
+	}
+
 	if (state->async_dosmode) {
 		size_t max_threads;
 
@@ -655,6 +684,18 @@ static bool smb2_query_directory_next_entry(struct tevent_req *req)
 		state->async_sharemode_count++;
 	}
 
+	if (state->deferred_write_times &&
+	    !S_ISDIR(smb_fname->st.st_ex_mode))
+	{
+		bool ok;
+
+		ok = smb2_query_directory_add_write_time(state, file_id);
+		if (!ok) {
+			tevent_req_oom(req);
+			return true;
+		}
+	}
+
 	if (state->async_dosmode) {
 		struct tevent_req *subreq = NULL;
 		uint8_t *buf = NULL;
@@ -699,6 +740,10 @@ last_entry_done:
 
 	state->done = true;
 
+	if (state->num_write_times > 0) {
+		smb2_query_directory_fill_write_times(state);
+	}
+
 	if (state->async_sharemode_count > 0) {
 		DBG_DEBUG("Stopping after %"PRIu64" async mtime "
 			  "updates\n", state->async_sharemode_count);
@@ -736,6 +781,75 @@ last_entry_done:
 	return true;
 }
 
+static bool smb2_query_directory_add_write_time(
+	struct smbd_smb2_query_directory_state *state,
+	struct file_id id)
+{
+	size_t n = state->num_write_times;
+	struct file_id *ids = NULL;
+	int *offs = NULL;
+
+	ids = talloc_realloc(state,
+			     state->write_time_ids,
+			     struct file_id,
+			     n + 1);
+	if (ids == NULL) {
+		return false;
+	}
+	state->write_time_ids = ids;
+
+	offs = talloc_realloc(state, state->write_time_offs, int, n + 1);
+	if (offs == NULL) {
+		return false;
+	}
+	state->write_time_offs = offs;
+
+	ids[n] = id;
+	offs[n] = state->last_entry_off;
+	state->num_write_times = n + 1;
+
+	return true;
+}
+
+/*
+ * Overwrite the last write and change times of all entries in the
+ * reply with the write times from locking.tdb, like
+ * smbd_dirptr_get_entry() does for ask_sharemode. Only called for
+ * the info levels allowed in smbd_smb2_query_directory_send().
+ */
+static void smb2_query_directory_fill_write_times(
+	struct smbd_smb2_query_directory_state *state)
+{
+	connection_struct *conn = state->fsp->conn;
+	bool dos_resolution = lp_dos_filetime_resolution(SNUM(conn));
+	size_t i;
+
+	for (i = 0; i < state->num_write_times; i++) {
+		char *buf = state->base_data + state->write_time_offs[i];
+		struct timespec write_time = fetch_share_mode_write_time(
+			state->write_time_ids[i]);
+
+		if (is_omit_timespec(&write_time)) {
+			continue;
+		}
+		if (dos_resolution) {
+			dos_filetime_timespec(&write_time);
+		}
+
+		/* LastWriteTime and ChangeTime */
+		put_long_date_full_timespec(conn->ts_res,
+					    buf + 24,
+					    &write_time);
+		put_long_date_full_timespec(conn->ts_res,
+					    buf + 32,
+					    &write_time);
+	}
+
+	TALLOC_FREE(state->write_time_ids);
+	TALLOC_FREE(state->write_time_offs);
+	state->num_write_times = 0;
+}
+
 static void smb2_query_directory_check_next_entry(struct tevent_req *req);
 
 static void smb2_query_directory_fetch_write_time_done(struct tevent_req *subreq)
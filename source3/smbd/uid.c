@@ -227,6 +227,7 @@ static bool check_user_ok(connection_struct *conn,
 		(conn->vuid_cache->next_entry + 1) % VUID_CACHE_SIZE;
 
 	TALLOC_FREE(ent->session_info);
+	ent->sid_index = NULL;
 
 	/*
 	 * If force_user was set, all session_info's are based on the same
@@ -277,6 +278,37 @@ static bool check_user_ok(connection_struct *conn,
 	return(True);
 }
 
+/****************************************************************************
+ The SID index for the token of conn->session_info. It is built once per
+ vuid cache entry, after "force group" has adjusted the token, and
+ freed with the entry's session_info.
+****************************************************************************/
+
+static const struct security_token_sid_index *conn_session_sid_index(
+	connection_struct *conn)
+{
+	unsigned int i;
+
+	for (i = 0; i < VUID_CACHE_SIZE; i++) {
+		struct vuid_cache_entry *ent = &conn->vuid_cache->array[i];
+
+		if ((ent->vuid == UID_FIELD_INVALID) ||
+		    (ent->session_info == NULL) ||
+		    (ent->session_info != conn->session_info)) {
+			continue;
+		}
+		if (ent->sid_index == NULL) {
+			ent->sid_index = security_token_sid_index(
+				ent->session_info,
+				ent->session_info->security_token,
+				UINT32_MAX);
+		}
+		return ent->sid_index;
+	}
+
+	return NULL;
+}
+
 static void print_impersonation_info(connection_struct *conn)
 {
 	struct smb_filename *cwdfname = NULL;
@@ -413,11 +445,12 @@ static bool change_to_user_impersonate(connection_struct *conn,
 		}
 	}
 
-	set_sec_ctx(uid,
-		    gid,
-		    num_groups,
-		    group_list,
-		    conn->session_info->security_token);
+	set_sec_ctx_sid_index(uid,
+			      gid,
+			      num_groups,
+			      group_list,
+			      conn->session_info->security_token,
+			      conn_session_sid_index(conn));
 
 	current_user.conn = conn;
 	current_user.vuid = vuid;
@@ -745,3 +778,14 @@ const struct security_token *get_current_nttok(connection_struct *conn)
 	}
 	return sec_ctx_active_token();
 }
+
+/****************************************************************************
+ The SID index of the token get_current_nttok() returns, NULL if there is
+ none. Pass both to se_file_access_check_index().
+****************************************************************************/
+
+const struct security_token_sid_index *get_current_nttok_sid_index(
+	connection_struct *conn)
+{
+	return sec_ctx_active_sid_index();
+}
@@ -0,0 +1,194 @@
+/*
+ * Unix SMB/CIFS implementation.
+ * Access check benchmark for tokens with many SIDs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "includes.h"
+#include "libcli/security/security.h"
+#include "proto.h"
+
+extern int torture_numops;
+
+#define BENCH_NUM_ACES 50
+
+/*
+ * The token holds S-1-5-21-1-2-3-<1000..1000+num_sids-1>, the DACL
+ * denies write access to 49 groups the token is not a member of and
+ * grants full access to the last group of the token, so every check
+ * has to look at all ACEs.
+ */
+
+static struct security_token *bench_token(TALLOC_CTX *mem_ctx,
+					  uint32_t num_sids)
+{
+	struct security_token *token = NULL;
+	uint32_t i;
+
+	token = talloc_zero(mem_ctx, struct security_token);
+	if (token == NULL) {
+		return NULL;
+	}
+	token->sids = talloc_array(token, struct dom_sid, num_sids);
+	if (token->sids == NULL) {
+		TALLOC_FREE(token);
+		return NULL;
+	}
+	token->num_sids = num_sids;
+
+	for (i=0; i<num_sids; i++) {
+		token->sids[i] = (struct dom_sid) {
+			.sid_rev_num = 1, .num_auths = 5,
+			.id_auth = { 0, 0, 0, 0, 0, 5 },
+			.sub_auths = { 21, 1, 2, 3, 1000 + i },
+		};
+	}
+
+	return token;
+}
+
+static struct security_descriptor *bench_sd(TALLOC_CTX *mem_ctx,
+					    const struct security_token *token)
+{
+	struct security_ace aces[BENCH_NUM_ACES];
+	struct security_acl *dacl = NULL;
+	struct dom_sid sid = token->sids[0];
+	size_t sd_size;
+	int i;
+
+	for (i=0; i<BENCH_NUM_ACES-1; i++) {
+		sid.sub_auths[4] = 100 + i;
+		init_sec_ace(&aces[i],
+			     &sid,
+			     SEC_ACE_TYPE_ACCESS_DENIED,
+			     SEC_FILE_WRITE_DATA,
+			     0);
+	}
+	init_sec_ace(&aces[BENCH_NUM_ACES-1],
+		     &token->sids[token->num_sids-1],
+		     SEC_ACE_TYPE_ACCESS_ALLOWED,
+		     SEC_FILE_ALL,
+		     0);
+
+	dacl = make_sec_acl(mem_ctx, NT4_ACL_REVISION, BENCH_NUM_ACES, aces);
+	if (dacl == NULL) {
+		return NULL;
+	}
+
+	/* Owned by a group outside the token */
+	sid.sub_auths[4] = 99;
+
+	return make_sec_desc(mem_ctx,
+			     SECURITY_DESCRIPTOR_REVISION_1,
+			     SEC_DESC_SELF_RELATIVE|SEC_DESC_DACL_PRESENT,
+			     &sid,
+			     &sid,
+			     NULL,
+			     dacl,
+			     &sd_size);
+}
+
+bool run_bench_access_check(int dummy)
+{
+	static const uint32_t token_sizes[] = { 8, 32, 128, 512, 1500 };
+	TALLOC_CTX *frame = talloc_stackframe();
+	size_t i;
+	bool ret = false;
+
+	for (i=0; i<ARRAY_SIZE(token_sizes); i++) {
+		struct security_token *token = NULL;
+		struct security_descriptor *sd = NULL;
+		struct timeval start;
+		double elapsed;
+		int num_checks = torture_numops * 100;
+		int j;
+
+		token = bench_token(frame, token_sizes[i]);
+		if (token == NULL) {
+			d_fprintf(stderr, "bench_token failed\n");
+			goto fail;
+		}
+		sd = bench_sd(frame, token);
+		if (sd == NULL) {
+			d_fprintf(stderr, "bench_sd failed\n");
+			goto fail;
+		}
+
+		start = timeval_current();
+
+		for (j=0; j<num_checks; j++) {
+			uint32_t access_granted;
+			NTSTATUS status;
+
+			status = se_access_check(sd,
+						 token,
+						 SEC_FILE_READ_DATA|
+						 SEC_FILE_WRITE_DATA,
+						 &access_granted);
+			if (!NT_STATUS_IS_OK(status)) {
+				d_fprintf(stderr,
+					  "se_access_check with %"PRIu32" "
+					  "SIDs returned %s\n",
+					  token_sizes[i],
+					  nt_errstr(status));
+				goto fail;
+			}
+		}
+
+		elapsed = timeval_elapsed(&start);
+
+		printf("%5"PRIu32" SIDs, %d ACEs: %d checks in %f seconds, "
+		       "%.0f checks/sec\n",
+		       token_sizes[i],
+		       BENCH_NUM_ACES,
+		       num_checks,
+		       elapsed,
+		       elapsed > 0 ? num_checks / elapsed : 0.0);
+
+		/*
+		 * Deny write access to a group in the middle of the
+		 * token, that must be found as well
+		 */
+		sd->dacl->aces[0].trustee = token->sids[token->num_sids/2];
+
+		for (j=0; j<2; j++) {
+			uint32_t access_granted;
+			NTSTATUS status;
+
+			status = se_access_check(sd,
+						 token,
+						 SEC_FILE_READ_DATA|
+						 SEC_FILE_WRITE_DATA,
+						 &access_granted);
+			if (!NT_STATUS_EQUAL(status,
+					     NT_STATUS_ACCESS_DENIED)) {
+				d_fprintf(stderr,
+					  "se_access_check with %"PRIu32" "
+					  "SIDs and deny ACE returned %s\n",
+					  token_sizes[i],
+					  nt_errstr(status));
+				goto fail;
+			}
+		}
+
+		TALLOC_FREE(sd);
+		TALLOC_FREE(token);
+	}
+
+	ret = true;
+fail:
+	TALLOC_FREE(frame);
+	return ret;
+}
@@ -122,6 +122,7 @@ bool run_idmap_tdb_common_test(int dummy);
 bool run_local_dbwrap_ctdb1(int dummy);
 bool run_qpathinfo_bufsize(int dummy);
 bool run_bench_pthreadpool(int dummy);
+bool run_bench_access_check(int dummy);
 bool run_messaging_read1(int dummy);
 bool run_messaging_read2(int dummy);
 bool run_messaging_read3(int dummy);
@@ -42,6 +42,11 @@
 #define DOM_SID4 "S-1-5-21-0001-5678-9012"
 #define DOM_SID5 "S-1-5-21-2345-5678-9012"
 #define DOM_SID6 "S-1-5-21-3456-5678-9012"
+#define DOM_SID7 "S-1-5-21-4567-5678-9012"
+
+/* a token with many group SIDs */
+#define BULK_NUM_SIDS 2000
+#define BULK_LOW_ID 10000
 
 /* overwrite some winbind internal functions */
 struct winbindd_domain *find_domain_from_name(const char *domain_name)
@@ -960,6 +965,91 @@ out:
 	return retval;
 }
 
+static bool test_sids2unixids_bulk(TALLOC_CTX *memctx,
+				   struct idmap_domain *dom)
+{
+	NTSTATUS status;
+	struct idmap_domain *bulk_dom;
+	struct id_map **test_maps;
+	struct dom_sid domsid;
+	struct timeval start;
+	uint32_t i;
+	bool retval = false;
+
+	/* a domain with a range large enough for all the SIDs */
+	bulk_dom = createdomain(memctx);
+	bulk_dom->low_id = BULK_LOW_ID;
+	bulk_dom->high_id = BULK_LOW_ID + BULK_NUM_SIDS - 1;
+	bulk_dom->private_data = dom->private_data;
+
+	if (!string_to_sid(&domsid, DOM_SID7)) {
+		DEBUG(0, ("test_sids2unixids_bulk: invalid domain sid!\n"));
+		return false;
+	}
+
+	test_maps = talloc_zero_array(memctx, struct id_map*,
+				      BULK_NUM_SIDS + 1);
+	if (test_maps == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < BULK_NUM_SIDS; i++) {
+		struct id_map *m = talloc_zero(test_maps, struct id_map);
+
+		m->sid = talloc(m, struct dom_sid);
+		sid_compose(m->sid, &domsid, 1000 + i);
+		m->xid.id = BULK_LOW_ID + i;
+		m->xid.type = (i % 2 == 0) ? ID_TYPE_UID : ID_TYPE_GID;
+
+		status = idmap_tdb_common_set_mapping(bulk_dom, m);
+		if (!NT_STATUS_IS_OK(status) &&
+		    !NT_STATUS_EQUAL(status, NT_STATUS_OBJECT_NAME_COLLISION)) {
+			DEBUG(0, ("test_sids2unixids_bulk: could not create "
+				  "map %"PRIu32": %s!\n", i, nt_errstr(status)));
+			goto out;
+		}
+
+		test_maps[i] = m;
+	}
+
+	/* now read them back in one go */
+	for (i = 0; i < BULK_NUM_SIDS; i++) {
+		test_maps[i]->xid.id = 0;
+		test_maps[i]->xid.type = ID_TYPE_NOT_SPECIFIED;
+	}
+
+	start = timeval_current();
+
+	status = idmap_tdb_common_sids_to_unixids(bulk_dom, test_maps);
+	if (!NT_STATUS_IS_OK(status)) {
+		DEBUG(0, ("test_sids2unixids_bulk: sids2unixids failed: %s!\n",
+			  nt_errstr(status)));
+		goto out;
+	}
+
+	DEBUG(0, ("test_sids2unixids_bulk: mapped %d SIDs in %f seconds\n",
+		  BULK_NUM_SIDS, timeval_elapsed(&start)));
+
+	for (i = 0; i < BULK_NUM_SIDS; i++) {
+		enum id_type type = (i % 2 == 0) ? ID_TYPE_UID : ID_TYPE_GID;
+
+		if ((test_maps[i]->status != ID_MAPPED) ||
+		    (test_maps[i]->xid.id != BULK_LOW_ID + i) ||
+		    (test_maps[i]->xid.type != type)) {
+			DEBUG(0, ("test_sids2unixids_bulk: sid2unixid "
+				  "returned wrong xid for %"PRIu32"!\n", i));
+			goto out;
+		}
+	}
+
+	DEBUG(0, ("test_sids2unixids_bulk: PASSED!\n"));
+	retval = true;
+
+out:
+	talloc_free(test_maps);
+	return retval;
+}
+
 #define CHECKRESULT(r) if(!r) {return r;}
 
 bool run_idmap_tdb_common_test(int dummy)
@@ -1001,6 +1091,8 @@ bool run_idmap_tdb_common_test(int dummy)
 	CHECKRESULT(result);
 	result = test_sids2unixids3(memctx, dom);
 	CHECKRESULT(result);
+	result = test_sids2unixids_bulk(memctx, dom);
+	CHECKRESULT(result);
 
 	/* test idmap_tdb_common_unixid_to_sid */
 	result = test_unixid2sid1(memctx, dom);
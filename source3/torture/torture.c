@@ -12808,6 +12808,29 @@ static bool run_local_gencache(int dummy)
 
 	TALLOC_FREE(val);
 
+	/*
+	 * "foo" is in the in-memory front cache now, make sure it
+	 * sees the update
+	 */
+	if (!gencache_set("foo", "baz", time(NULL) + 1000)) {
+		d_printf("%s: gencache_set() failed\n", __location__);
+		return False;
+	}
+
+	if (!gencache_get("foo", talloc_tos(), &val, &tm)) {
+		d_printf("%s: gencache_get() failed\n", __location__);
+		return False;
+	}
+
+	if (strcmp(val, "baz") != 0) {
+		d_printf("%s: gencache_get() returned %s, expected %s\n",
+			 __location__, val, "baz");
+		TALLOC_FREE(val);
+		return False;
+	}
+
+	TALLOC_FREE(val);
+
 	if (!gencache_del("foo")) {
 		d_printf("%s: gencache_del() failed\n", __location__);
 		return False;
@@ -15014,6 +15037,10 @@ static struct {
 		.name  = "LOCAL-BENCH-PTHREADPOOL",
 		.fn    = run_bench_pthreadpool,
 	},
+	{
+		.name  = "LOCAL-BENCH-ACCESS-CHECK",
+		.fn    = run_bench_access_check,
+	},
 	{
 		.name  = "LOCAL-PTHREADPOOL-TEVENT",
 		.fn    = run_pthreadpool_tevent,
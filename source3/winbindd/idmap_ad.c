@@ -835,6 +835,11 @@ static NTSTATUS idmap_ad_unixids_to_sids(struct idmap_domain *dom,
 	return NT_STATUS_OK;
 }
 
+static int idmap_ad_map_sid_cmp(struct id_map **m1, struct id_map **m2)
+{
+	return dom_sid_compare_total((*m1)->sid, (*m2)->sid);
+}
+
 static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 					 struct id_map **ids)
 {
@@ -842,9 +847,10 @@ static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 	TLDAPRC rc;
 	NTSTATUS status;
 	struct tldap_message **msgs;
+	struct id_map **sorted;
 
 	char *filter;
-	size_t i, num_msgs;
+	size_t i, num_ids, num_msgs;
 
 	const char *attrs[] = {
 		"sAMAccountType",
@@ -894,6 +900,17 @@ static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 	if (filter == NULL) {
 		return NT_STATUS_NO_MEMORY;
 	}
+	num_ids = i;
+
+	/*
+	 * Tokens carry thousands of group SIDs, don't walk all of
+	 * them for each object returned.
+	 */
+	sorted = talloc_memdup(talloc_tos(), ids, num_ids * sizeof(*ids));
+	if ((num_ids != 0) && (sorted == NULL)) {
+		return NT_STATUS_NO_MEMORY;
+	}
+	TYPESAFE_QSORT(sorted, num_ids, idmap_ad_map_sid_cmp);
 
 	DBG_DEBUG("Filter: [%s]\n", filter);
 
@@ -901,6 +918,7 @@ static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 			  attrs, ARRAY_SIZE(attrs), 0, NULL, 0, NULL, 0,
 			  0, 0, 0, talloc_tos(), &msgs);
 	if (!TLDAP_RC_IS_SUCCESS(rc)) {
+		TALLOC_FREE(sorted);
 		return NT_STATUS_LDAP(TLDAP_RC_V(rc));
 	}
 
@@ -913,7 +931,6 @@ static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 		char *dn;
 		struct id_map *map;
 		struct dom_sid sid;
-		size_t j;
 		bool ok;
 		uint64_t account_type, xid;
 		enum id_type type;
@@ -935,13 +952,8 @@ static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 			continue;
 		}
 
-		map = NULL;
-		for (j=0; ids[j]; j++) {
-			if (dom_sid_equal(&sid, ids[j]->sid)) {
-				map = ids[j];
-				break;
-			}
-		}
+		BINARY_ARRAY_SEARCH_P(sorted, num_ids, sid, &sid,
+				      dom_sid_compare_total, map);
 		if (map == NULL) {
 			DBG_DEBUG("Got unexpected sid %s from object %s\n",
 				  dom_sid_str_buf(&sid, &buf),
@@ -991,6 +1003,7 @@ static NTSTATUS idmap_ad_sids_to_unixids(struct idmap_domain *dom,
 	}
 
 	TALLOC_FREE(msgs);
+	TALLOC_FREE(sorted);
 
 	return NT_STATUS_OK;
 }
@@ -541,8 +541,65 @@ static bool idmap_autorid_domsid_is_for_alloc(struct dom_sid *sid)
 	return false;
 }
 
+/*
+ * The domain ranges looked up during one sids_to_unixids call. The
+ * SIDs of a token usually come from a handful of domains, so there is
+ * no need to read the range record and the configuration again for
+ * each SID.
+ */
+#define IDMAP_AUTORID_RANGE_CACHE_SIZE 8
+
+struct idmap_autorid_range_cache {
+	unsigned int num_ranges;
+	unsigned int next;
+	struct {
+		struct dom_sid domsid;
+		uint32_t domain_range_index;
+		uint32_t low_id;
+	} ranges[IDMAP_AUTORID_RANGE_CACHE_SIZE];
+};
+
+static bool idmap_autorid_range_cache_find(
+	const struct idmap_autorid_range_cache *cache,
+	const struct dom_sid *domsid,
+	uint32_t domain_range_index,
+	uint32_t *low_id)
+{
+	unsigned int i;
+
+	for (i=0; i<cache->num_ranges; i++) {
+		if ((cache->ranges[i].domain_range_index ==
+		     domain_range_index) &&
+		    dom_sid_equal(&cache->ranges[i].domsid, domsid)) {
+			*low_id = cache->ranges[i].low_id;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void idmap_autorid_range_cache_add(
+	struct idmap_autorid_range_cache *cache,
+	const struct dom_sid *domsid,
+	uint32_t domain_range_index,
+	uint32_t low_id)
+{
+	unsigned int i = cache->next;
+
+	sid_copy(&cache->ranges[i].domsid, domsid);
+	cache->ranges[i].domain_range_index = domain_range_index;
+	cache->ranges[i].low_id = low_id;
+
+	cache->next = (i + 1) % IDMAP_AUTORID_RANGE_CACHE_SIZE;
+	if (cache->num_ranges < IDMAP_AUTORID_RANGE_CACHE_SIZE) {
+		cache->num_ranges += 1;
+	}
+}
+
 static NTSTATUS idmap_autorid_sid_to_id(struct idmap_tdb_common_context *common,
 					struct idmap_domain *dom,
+					struct idmap_autorid_range_cache *cache,
 					struct id_map *map)
 {
 	struct autorid_global_config *global =
@@ -581,14 +638,26 @@ static NTSTATUS idmap_autorid_sid_to_id(struct idmap_tdb_common_context *common,
 		return NT_STATUS_NONE_MAPPED;
 	}
 
-	sid_to_fstring(range.domsid, &domainsid);
-
 	range.domain_range_index = rid / (global->rangesize);
 
+	if (idmap_autorid_range_cache_find(cache,
+					   &domainsid,
+					   range.domain_range_index,
+					   &range.low_id)) {
+		return idmap_autorid_sid_to_id_rid(
+			global->rangesize, range.low_id, map);
+	}
+
+	sid_to_fstring(range.domsid, &domainsid);
+
 	ret = idmap_autorid_getrange(autorid_db, range.domsid,
 				     range.domain_range_index,
 				     &range.rangenum, &range.low_id);
 	if (NT_STATUS_IS_OK(ret)) {
+		idmap_autorid_range_cache_add(cache,
+					      &domainsid,
+					      range.domain_range_index,
+					      range.low_id);
 		return idmap_autorid_sid_to_id_rid(
 			global->rangesize, range.low_id, map);
 	}
@@ -684,6 +753,11 @@ allocate:
 		return ret;
 	}
 
+	idmap_autorid_range_cache_add(cache,
+				      &domainsid,
+				      range.domain_range_index,
+				      range.low_id);
+
 	return idmap_autorid_sid_to_id_rid(global->rangesize, range.low_id,
 					   map);
 }
@@ -696,6 +770,7 @@ static NTSTATUS idmap_autorid_sids_to_unixids(struct idmap_domain *dom,
 					      struct id_map **ids)
 {
 	struct idmap_tdb_common_context *commoncfg;
+	struct idmap_autorid_range_cache cache = { .num_ranges = 0, };
 	NTSTATUS ret;
 	int i;
 	int num_tomap = 0;
@@ -712,7 +787,7 @@ static NTSTATUS idmap_autorid_sids_to_unixids(struct idmap_domain *dom,
 				  struct idmap_tdb_common_context);
 
 	for (i = 0; ids[i]; i++) {
-		ret = idmap_autorid_sid_to_id(commoncfg, dom, ids[i]);
+		ret = idmap_autorid_sid_to_id(commoncfg, dom, &cache, ids[i]);
 		if ((!NT_STATUS_IS_OK(ret)) &&
 		    (!NT_STATUS_EQUAL(ret, NT_STATUS_NONE_MAPPED))) {
 			struct dom_sid_buf buf;
@@ -442,18 +442,67 @@ NTSTATUS idmap_tdb_common_unixid_to_sid(struct idmap_domain * dom,
  Single sid to id lookup function.
 **********************************/
 
+struct idmap_tdb_common_parse_xid_state {
+	const char *keystr;
+	struct unixid xid;
+	NTSTATUS status;
+};
+
+static void idmap_tdb_common_parse_xid(TDB_DATA key, TDB_DATA data,
+				       void *private_data)
+{
+	struct idmap_tdb_common_parse_xid_state *state = private_data;
+	char buf[32];
+	unsigned long rec_id = 0;
+
+	/*
+	 * Parse the record in place instead of fetching a copy, this
+	 * is called for every SID of a token.
+	 */
+	if ((data.dsize == 0) || (data.dsize > sizeof(buf))) {
+		DEBUG(2, ("Found INVALID record %s with length %zu\n",
+			  state->keystr, data.dsize));
+		state->status = NT_STATUS_INTERNAL_DB_ERROR;
+		return;
+	}
+	memcpy(buf, data.dptr, data.dsize);
+	buf[data.dsize-1] = '\0';
+
+	/* What type of record is this ? */
+	if (sscanf(buf, "UID %lu", &rec_id) == 1) {
+		/* Try a UID record. */
+		state->xid.id = rec_id;
+		state->xid.type = ID_TYPE_UID;
+		DEBUG(10,
+		      ("Found uid record %s -> %s \n", state->keystr, buf));
+		state->status = NT_STATUS_OK;
+
+	} else if (sscanf(buf, "GID %lu", &rec_id) == 1) {
+		/* Try a GID record. */
+		state->xid.id = rec_id;
+		state->xid.type = ID_TYPE_GID;
+		DEBUG(10,
+		      ("Found gid record %s -> %s \n", state->keystr, buf));
+		state->status = NT_STATUS_OK;
+
+	} else {		/* Unknown record type ! */
+		DEBUG(2,
+		      ("Found INVALID record %s -> %s\n", state->keystr, buf));
+		state->status = NT_STATUS_INTERNAL_DB_ERROR;
+	}
+}
+
 NTSTATUS idmap_tdb_common_sid_to_unixid(struct idmap_domain * dom,
 					struct id_map * map)
 {
 	NTSTATUS ret;
-	TDB_DATA data;
 	struct dom_sid_buf keystr;
-	unsigned long rec_id = 0;
 	struct idmap_tdb_common_context *ctx;
-	TALLOC_CTX *tmp_ctx = talloc_stackframe();
+	struct idmap_tdb_common_parse_xid_state state = {
+		.status = NT_STATUS_INTERNAL_ERROR,
+	};
 
 	if (!dom || !map) {
-		talloc_free(tmp_ctx);
 		return NT_STATUS_INVALID_PARAMETER;
 	}
 
@@ -461,56 +510,35 @@ NTSTATUS idmap_tdb_common_sid_to_unixid(struct idmap_domain * dom,
 	    talloc_get_type_abort(dom->private_data,
 				  struct idmap_tdb_common_context);
 
-	dom_sid_str_buf(map->sid, &keystr);
+	state.keystr = dom_sid_str_buf(map->sid, &keystr);
 
 	DEBUG(10, ("Fetching record %s\n", keystr.buf));
 
 	/* Check if sid is present in database */
-	ret = dbwrap_fetch_bystring(ctx->db, tmp_ctx, keystr.buf, &data);
+	ret = dbwrap_parse_record(ctx->db,
+				  string_term_tdb_data(keystr.buf),
+				  idmap_tdb_common_parse_xid,
+				  &state);
 	if (!NT_STATUS_IS_OK(ret)) {
 		DEBUG(10, ("Record %s not found\n", keystr.buf));
-		ret = NT_STATUS_NONE_MAPPED;
-		goto done;
+		return NT_STATUS_NONE_MAPPED;
 	}
-
-	/* What type of record is this ? */
-	if (sscanf((const char *)data.dptr, "UID %lu", &rec_id) == 1) {
-		/* Try a UID record. */
-		map->xid.id = rec_id;
-		map->xid.type = ID_TYPE_UID;
-		DEBUG(10,
-		      ("Found uid record %s -> %s \n", keystr.buf,
-		       (const char *)data.dptr));
-		ret = NT_STATUS_OK;
-
-	} else if (sscanf((const char *)data.dptr, "GID %lu", &rec_id) == 1) {
-		/* Try a GID record. */
-		map->xid.id = rec_id;
-		map->xid.type = ID_TYPE_GID;
-		DEBUG(10,
-		      ("Found gid record %s -> %s \n", keystr.buf,
-		       (const char *)data.dptr));
-		ret = NT_STATUS_OK;
-
-	} else {		/* Unknown record type ! */
-		DEBUG(2,
-		      ("Found INVALID record %s -> %s\n", keystr.buf,
-		       (const char *)data.dptr));
-		ret = NT_STATUS_INTERNAL_DB_ERROR;
-		goto done;
+	if (!NT_STATUS_IS_OK(state.status)) {
+		return state.status;
 	}
 
+	map->xid.id = state.xid.id;
+	map->xid.type = state.xid.type;
+
 	/* apply filters before returning result */
 	if (!idmap_unix_id_is_in_range(map->xid.id, dom)) {
 		DEBUG(5,
 		      ("Requested id (%u) out of range (%u - %u). Filtered!\n",
 		       map->xid.id, dom->low_id, dom->high_id));
-		ret = NT_STATUS_NONE_MAPPED;
+		return NT_STATUS_NONE_MAPPED;
 	}
 
-      done:
-	talloc_free(tmp_ctx);
-	return ret;
+	return NT_STATUS_OK;
 }
 
 /**********************************
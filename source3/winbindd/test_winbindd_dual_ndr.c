@@ -0,0 +1,359 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *
+ *  Unit test for sharing identical wbint calls in winbindd_dual_ndr.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "winbindd_dual_ndr.c"
+#include <cmocka.h>
+
+/*
+ * Replacements for the requests to the domain children and for the
+ * winbindd cache. The requests only complete when a test says so.
+ */
+
+#define MAX_CHILD_REQUESTS 8
+
+struct mock_request_state {
+	struct winbindd_response *response;
+};
+
+static struct tevent_req *child_requests[MAX_CHILD_REQUESTS];
+static unsigned num_child_requests;
+static unsigned num_cache_stores;
+
+static struct tevent_req *mock_request_send(TALLOC_CTX *mem_ctx)
+{
+	struct tevent_req *req = NULL;
+	struct mock_request_state *state = NULL;
+
+	assert_true(num_child_requests < MAX_CHILD_REQUESTS);
+
+	req = tevent_req_create(mem_ctx, &state, struct mock_request_state);
+	assert_non_null(req);
+
+	child_requests[num_child_requests++] = req;
+	return req;
+}
+
+static int mock_request_recv(struct tevent_req *req,
+			     TALLOC_CTX *mem_ctx,
+			     struct winbindd_response **presponse,
+			     int *err)
+{
+	struct mock_request_state *state =
+		tevent_req_data(req, struct mock_request_state);
+
+	if (tevent_req_is_unix_error(req, err)) {
+		return -1;
+	}
+
+	*presponse = talloc_move(mem_ctx, &state->response);
+	return 0;
+}
+
+static void mock_request_finish(unsigned i, const char *out)
+{
+	struct tevent_req *req = child_requests[i];
+	struct mock_request_state *state =
+		tevent_req_data(req, struct mock_request_state);
+	size_t len = strlen(out);
+
+	child_requests[i] = NULL;
+
+	state->response = talloc_zero(state, struct winbindd_response);
+	assert_non_null(state->response);
+
+	state->response->length = sizeof(struct winbindd_response) + len;
+	state->response->extra_data.data = talloc_memdup(state->response,
+							 out,
+							 len);
+	assert_non_null(state->response->extra_data.data);
+
+	tevent_req_done(req);
+}
+
+struct tevent_req *wb_child_request_send(TALLOC_CTX *mem_ctx,
+					 struct tevent_context *ev,
+					 struct winbindd_child *child,
+					 struct winbindd_request *request)
+{
+	return mock_request_send(mem_ctx);
+}
+
+int wb_child_request_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
+			  struct winbindd_response **presponse, int *err)
+{
+	return mock_request_recv(req, mem_ctx, presponse, err);
+}
+
+struct tevent_req *wb_domain_request_send(TALLOC_CTX *mem_ctx,
+					  struct tevent_context *ev,
+					  struct winbindd_domain *domain,
+					  struct winbindd_request *request)
+{
+	return mock_request_send(mem_ctx);
+}
+
+int wb_domain_request_recv(struct tevent_req *req, TALLOC_CTX *mem_ctx,
+			   struct winbindd_response **presponse, int *err)
+{
+	return mock_request_recv(req, mem_ctx, presponse, err);
+}
+
+bool wcache_fetch_ndr(TALLOC_CTX *mem_ctx, struct winbindd_domain *domain,
+		      uint32_t opnum, const DATA_BLOB *req, DATA_BLOB *resp)
+{
+	return false;
+}
+
+void wcache_store_ndr(struct winbindd_domain *domain, uint32_t opnum,
+		      const DATA_BLOB *req, const DATA_BLOB *resp)
+{
+	num_cache_stores += 1;
+}
+
+struct test_call {
+	TALLOC_CTX *mem_ctx;
+	struct tevent_req *req;
+	bool done;
+	NTSTATUS status;
+	DATA_BLOB out;
+};
+
+static void test_call_done(struct tevent_req *req)
+{
+	struct test_call *call = tevent_req_callback_data(
+		req, struct test_call);
+	uint32_t out_flags;
+
+	call->status = dcerpc_binding_handle_raw_call_recv(req,
+							   call->mem_ctx,
+							   &call->out.data,
+							   &call->out.length,
+							   &out_flags);
+	TALLOC_FREE(call->req);
+	call->done = true;
+}
+
+static void test_call_send(TALLOC_CTX *mem_ctx,
+			   struct tevent_context *ev,
+			   struct dcerpc_binding_handle *h,
+			   struct test_call *call,
+			   uint32_t opnum,
+			   const char *in)
+{
+	call->mem_ctx = mem_ctx;
+	call->req = dcerpc_binding_handle_raw_call_send(mem_ctx,
+							ev,
+							h,
+							NULL,
+							opnum,
+							0,
+							(const uint8_t *)in,
+							strlen(in));
+	assert_non_null(call->req);
+	tevent_req_set_callback(call->req, test_call_done, call);
+}
+
+static void test_call_check(struct test_call *call, const char *out)
+{
+	assert_true(call->done);
+	assert_true(NT_STATUS_IS_OK(call->status));
+	assert_int_equal(call->out.length, strlen(out));
+	assert_memory_equal(call->out.data, out, call->out.length);
+}
+
+static int setup(void **state)
+{
+	ZERO_ARRAY(child_requests);
+	num_child_requests = 0;
+	num_cache_stores = 0;
+
+	*state = talloc_new(NULL);
+	assert_non_null(*state);
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	TALLOC_FREE(*state);
+
+	/* every shared call must have been handed out and freed */
+	assert_null(wbint_bh_shared_calls);
+
+	return 0;
+}
+
+/*
+ * Concurrent identical lookups sent to a child share one request, all
+ * callers get the result.
+ */
+
+static void test_share_identical(void **state)
+{
+	TALLOC_CTX *mem_ctx = *state;
+	struct tevent_context *ev = NULL;
+	struct winbindd_child child = { .logfilename = discard_const_p(
+						char, "log.test") };
+	struct dcerpc_binding_handle *h = NULL;
+	struct test_call *calls = NULL;
+	unsigned i;
+
+	ev = samba_tevent_context_init(mem_ctx);
+	assert_non_null(ev);
+
+	h = wbint_binding_handle(mem_ctx, NULL, &child);
+	assert_non_null(h);
+
+	calls = talloc_zero_array(mem_ctx, struct test_call, 4);
+	assert_non_null(calls);
+
+	for (i = 0; i < 3; i++) {
+		test_call_send(mem_ctx, ev, h, &calls[i],
+			       NDR_WBINT_LOOKUPSID, "sid1");
+	}
+	test_call_send(mem_ctx, ev, h, &calls[3],
+		       NDR_WBINT_LOOKUPSID, "sid2");
+
+	/* the three identical lookups share the first request */
+	assert_int_equal(num_child_requests, 2);
+
+	mock_request_finish(0, "name1");
+	for (i = 0; i < 3; i++) {
+		test_call_check(&calls[i], "name1");
+	}
+	assert_false(calls[3].done);
+
+	mock_request_finish(1, "name2");
+	test_call_check(&calls[3], "name2");
+
+	/* the next identical lookup starts a new request */
+	ZERO_STRUCT(calls[0]);
+	test_call_send(mem_ctx, ev, h, &calls[0],
+		       NDR_WBINT_LOOKUPSID, "sid1");
+	assert_int_equal(num_child_requests, 3);
+	mock_request_finish(2, "name1");
+	test_call_check(&calls[0], "name1");
+}
+
+/*
+ * Calls that are not read-only lookups are never shared.
+ */
+
+static void test_no_share_other_calls(void **state)
+{
+	TALLOC_CTX *mem_ctx = *state;
+	struct tevent_context *ev = NULL;
+	struct winbindd_child child = { .logfilename = discard_const_p(
+						char, "log.test") };
+	struct dcerpc_binding_handle *h = NULL;
+	struct test_call *calls = NULL;
+
+	ev = samba_tevent_context_init(mem_ctx);
+	assert_non_null(ev);
+
+	h = wbint_binding_handle(mem_ctx, NULL, &child);
+	assert_non_null(h);
+
+	calls = talloc_zero_array(mem_ctx, struct test_call, 2);
+	assert_non_null(calls);
+
+	test_call_send(mem_ctx, ev, h, &calls[0],
+		       NDR_WBINT_PING, "ping");
+	test_call_send(mem_ctx, ev, h, &calls[1],
+		       NDR_WBINT_PING, "ping");
+	assert_int_equal(num_child_requests, 2);
+
+	mock_request_finish(0, "pong");
+	mock_request_finish(1, "pong");
+	test_call_check(&calls[0], "pong");
+	test_call_check(&calls[1], "pong");
+}
+
+/*
+ * One caller giving up doesn't affect the others. If every caller is
+ * gone, the shared request still completes and stores its result in
+ * the cache.
+ */
+
+static void test_waiters_gone(void **state)
+{
+	TALLOC_CTX *mem_ctx = *state;
+	struct tevent_context *ev = NULL;
+	struct winbindd_domain domain = { .name = discard_const_p(
+						  char, "TESTDOM") };
+	struct dcerpc_binding_handle *h = NULL;
+	struct test_call *calls = NULL;
+
+	ev = samba_tevent_context_init(mem_ctx);
+	assert_non_null(ev);
+
+	h = wbint_binding_handle(mem_ctx, &domain, NULL);
+	assert_non_null(h);
+
+	calls = talloc_zero_array(mem_ctx, struct test_call, 3);
+	assert_non_null(calls);
+
+	test_call_send(mem_ctx, ev, h, &calls[0],
+		       NDR_WBINT_LOOKUPUSERGROUPS, "user");
+	test_call_send(mem_ctx, ev, h, &calls[1],
+		       NDR_WBINT_LOOKUPUSERGROUPS, "user");
+	assert_int_equal(num_child_requests, 1);
+
+	/* one caller gives up, the other one still gets the result */
+	TALLOC_FREE(calls[0].req);
+	mock_request_finish(0, "groups");
+	assert_false(calls[0].done);
+	test_call_check(&calls[1], "groups");
+	assert_int_equal(num_cache_stores, 1);
+
+	/* all callers give up */
+	test_call_send(mem_ctx, ev, h, &calls[0],
+		       NDR_WBINT_LOOKUPUSERGROUPS, "user");
+	test_call_send(mem_ctx, ev, h, &calls[2],
+		       NDR_WBINT_LOOKUPUSERGROUPS, "user");
+	assert_int_equal(num_child_requests, 2);
+
+	TALLOC_FREE(calls[0].req);
+	TALLOC_FREE(calls[2].req);
+
+	/* the request keeps running without any caller */
+	assert_non_null(wbint_bh_shared_calls);
+	assert_null(wbint_bh_shared_calls->waiters);
+
+	mock_request_finish(1, "groups");
+	assert_false(calls[0].done);
+	assert_false(calls[2].done);
+	assert_int_equal(num_cache_stores, 2);
+}
+
+int main(int argc, char **argv)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_share_identical,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_no_share_other_calls,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_waiters_gone,
+						setup, teardown),
+	};
+
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
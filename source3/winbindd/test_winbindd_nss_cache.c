@@ -0,0 +1,427 @@
+/*
+ *  Unix SMB/CIFS implementation.
+ *
+ *  Unit test for the passwd/group cache winbindd shares with nss_winbind
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The writer side, as run in the winbindd parent */
+#include "winbindd_nss_cache.c"
+
+/*
+ * The reader side, as run in nss_winbind. Make it look for the map in
+ * our directory and accept a map that is not owned by root.
+ */
+#define nss_wrapper_enabled() true
+#define uid_wrapper_enabled() true
+#include "nsswitch/wb_common.c"
+#undef nss_wrapper_enabled
+#undef uid_wrapper_enabled
+
+#include <cmocka.h>
+
+/*
+ * Replacements for the smb.conf parameters the writer uses
+ */
+
+static char *socket_dir;
+static int nss_cache_size;
+
+const char *lp_winbindd_socket_directory(void)
+{
+	return socket_dir;
+}
+
+int lp_winbind_nss_cache_size(void)
+{
+	return nss_cache_size;
+}
+
+int lp_winbind_cache_time(void)
+{
+	return 300;
+}
+
+#ifdef WINBINDD_NSS_CACHE_SUPPORTED
+
+static void store_pw(const char *name, uint32_t uid, const char *variant)
+{
+	struct winbindd_request request = {
+		.cmd = WINBINDD_GETPWNAM,
+	};
+	struct winbindd_response response = {
+		.result = WINBINDD_OK,
+	};
+	struct winbindd_pw *pw = &response.data.pw;
+
+	fstrcpy(request.data.username, name);
+
+	fstrcpy(pw->pw_name, name);
+	fstrcpy(pw->pw_passwd, "*");
+	pw->pw_uid = uid;
+	pw->pw_gid = 100;
+	fstr_sprintf(pw->pw_gecos, "gecos-%s", variant);
+	fstr_sprintf(pw->pw_dir, "/home/%s", variant);
+	fstrcpy(pw->pw_shell, "/bin/sh");
+
+	winbindd_nss_cache_store(&request, &response);
+
+	request.cmd = WINBINDD_GETPWUID;
+	request.data.uid = uid;
+	winbindd_nss_cache_store(&request, &response);
+}
+
+static bool lookup_pwnam(const char *name, struct winbindd_pw *pw)
+{
+	struct winbindd_request request = {
+		.cmd = WINBINDD_GETPWNAM,
+	};
+	struct winbindd_response response;
+	bool ok;
+
+	fstrcpy(request.data.username, name);
+
+	ok = winbindd_nss_cache_lookup(WINBINDD_GETPWNAM,
+				       &request,
+				       &response);
+	if (ok) {
+		assert_int_equal(response.result, WINBINDD_OK);
+		*pw = response.data.pw;
+	}
+	return ok;
+}
+
+static bool lookup_pwuid(uint32_t uid)
+{
+	struct winbindd_request request = {
+		.cmd = WINBINDD_GETPWUID,
+		.data.uid = uid,
+	};
+	struct winbindd_response response;
+
+	return winbindd_nss_cache_lookup(WINBINDD_GETPWUID,
+					 &request,
+					 &response);
+}
+
+/*
+ * The slot the writer filled for a getpwnam of name
+ */
+static struct winbindd_nss_cache_slot *pwnam_slot(const char *name)
+{
+	uint32_t i;
+
+	for (i=0; i<nss_cache->num_slots; i++) {
+		struct winbindd_nss_cache_slot *slot = &nss_cache->slots[i];
+
+		if ((slot->type == WINBINDD_NSS_CACHE_PWNAM) &&
+		    (strcmp(slot->key_name, name) == 0)) {
+			return slot;
+		}
+	}
+
+	fail_msg("No slot for %s", name);
+	return NULL;
+}
+
+/*
+ * nss_winbind only tries to open a missing or replaced map once per
+ * second, don't make the tests wait for that.
+ */
+static void reader_reopen_now(void)
+{
+	wb_nss_cache.last_open = 0;
+}
+
+static int setup(void **state)
+{
+	char tmpl[] = "/tmp/test_winbindd_nss_cache.XXXXXX";
+	char *dir = NULL;
+	int ret;
+
+	dir = mkdtemp(tmpl);
+	assert_non_null(dir);
+
+	socket_dir = talloc_strdup(NULL, dir);
+	assert_non_null(socket_dir);
+
+	ret = setenv("SELFTEST_WINBINDD_SOCKET_DIR", socket_dir, 1);
+	assert_int_equal(ret, 0);
+
+	nss_cache_size = 64;
+	winbindd_nss_cache_init();
+	assert_non_null(nss_cache);
+
+	reader_reopen_now();
+
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	winbindd_nss_cache_shutdown();
+	winbindd_nss_cache_close();
+
+	rmdir(socket_dir);
+	TALLOC_FREE(socket_dir);
+
+	return 0;
+}
+
+static void test_hit_miss(void **state)
+{
+	struct winbindd_request request = {
+		.cmd = WINBINDD_GETGRGID,
+		.data.gid = 200,
+	};
+	struct winbindd_response response = {
+		.result = WINBINDD_OK,
+	};
+	struct winbindd_pw pw;
+	bool ok;
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_false(ok);
+
+	store_pw("alice", 1000, "a");
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_true(ok);
+	assert_string_equal(pw.pw_name, "alice");
+	assert_int_equal(pw.pw_uid, 1000);
+	assert_int_equal(pw.pw_gid, 100);
+	assert_string_equal(pw.pw_gecos, "gecos-a");
+	assert_string_equal(pw.pw_dir, "/home/a");
+	assert_string_equal(pw.pw_shell, "/bin/sh");
+
+	assert_true(lookup_pwuid(1000));
+
+	ok = lookup_pwnam("bob", &pw);
+	assert_false(ok);
+	assert_false(lookup_pwuid(1001));
+
+	/* groups with members are not published */
+	fstrcpy(response.data.gr.gr_name, "staff");
+	response.data.gr.gr_gid = 200;
+	response.data.gr.num_gr_mem = 1;
+	winbindd_nss_cache_store(&request, &response);
+
+	ok = winbindd_nss_cache_lookup(WINBINDD_GETGRGID,
+				       &request,
+				       &response);
+	assert_false(ok);
+
+	/* flushing the winbindd cache wipes the map */
+	winbindd_nss_cache_flush();
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_false(ok);
+	assert_false(lookup_pwuid(1000));
+}
+
+static void test_expiry(void **state)
+{
+	struct winbindd_nss_cache_slot *slot = NULL;
+	struct winbindd_pw pw;
+	bool ok;
+
+	store_pw("alice", 1000, "a");
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_true(ok);
+
+	slot = pwnam_slot("alice");
+	slot->expiry = time(NULL) - 1;
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_false(ok);
+
+	/* a new answer replaces the expired one */
+	store_pw("alice", 1000, "b");
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_true(ok);
+	assert_string_equal(pw.pw_gecos, "gecos-b");
+}
+
+static void test_restart(void **state)
+{
+	struct winbindd_pw pw;
+	bool ok;
+
+	store_pw("alice", 1000, "a");
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_true(ok);
+
+	/* winbindd exits, the reader must not use the old map */
+	winbindd_nss_cache_shutdown();
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_false(ok);
+	assert_null(wb_nss_cache.hdr);
+
+	/* a new winbindd publishes a new map */
+	winbindd_nss_cache_init();
+	assert_non_null(nss_cache);
+	store_pw("bob", 1001, "b");
+	reader_reopen_now();
+
+	ok = lookup_pwnam("bob", &pw);
+	assert_true(ok);
+	ok = lookup_pwnam("alice", &pw);
+	assert_false(ok);
+
+	/*
+	 * A reload with a different size replaces the map while the
+	 * reader still has the old one mapped
+	 */
+	nss_cache_size = 128;
+	winbindd_nss_cache_reload();
+	assert_int_equal(nss_cache->num_slots, 128);
+	store_pw("carol", 1002, "c");
+
+	ok = lookup_pwnam("bob", &pw);
+	assert_false(ok);
+
+	reader_reopen_now();
+
+	ok = lookup_pwnam("carol", &pw);
+	assert_true(ok);
+	assert_int_equal(wb_nss_cache.hdr->num_slots, 128);
+}
+
+static void test_seqnum_odd(void **state)
+{
+	struct winbindd_nss_cache_slot *slot = NULL;
+	struct winbindd_pw pw;
+	bool ok;
+
+	store_pw("alice", 1000, "a");
+
+	/* winbindd is in the middle of changing the slot */
+	slot = pwnam_slot("alice");
+	assert_int_equal(slot->seqnum % 2, 0);
+	slot->seqnum += 1;
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_false(ok);
+
+	slot->seqnum += 1;
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_true(ok);
+}
+
+#define NUM_WRITES 100000
+
+static void *concurrent_writer(void *arg)
+{
+	bool *done = arg;
+	int i;
+
+	for (i=0; i<NUM_WRITES; i++) {
+		store_pw("alice", 1000, ((i % 2) == 0) ? "a" : "b");
+	}
+
+	__atomic_store_n(done, true, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+static void test_concurrent_writer(void **state)
+{
+	pthread_t writer;
+	bool done = false;
+	unsigned num_hits = 0;
+	struct winbindd_pw pw;
+	bool ok;
+	int ret;
+
+	store_pw("alice", 1000, "a");
+
+	ret = pthread_create(&writer, NULL, concurrent_writer, &done);
+	assert_int_equal(ret, 0);
+
+	/*
+	 * The writer changes gecos and dir together, a reader must
+	 * never see one without the other.
+	 */
+	while (!__atomic_load_n(&done, __ATOMIC_SEQ_CST)) {
+		ok = lookup_pwnam("alice", &pw);
+		if (!ok) {
+			continue;
+		}
+		num_hits += 1;
+
+		assert_string_equal(pw.pw_name, "alice");
+		if (strcmp(pw.pw_gecos, "gecos-a") == 0) {
+			assert_string_equal(pw.pw_dir, "/home/a");
+		} else {
+			assert_string_equal(pw.pw_gecos, "gecos-b");
+			assert_string_equal(pw.pw_dir, "/home/b");
+		}
+	}
+
+	ret = pthread_join(writer, NULL);
+	assert_int_equal(ret, 0);
+
+	ok = lookup_pwnam("alice", &pw);
+	assert_true(ok);
+	assert_string_equal(pw.pw_gecos, "gecos-b");
+
+	print_message("%u consistent hits during %d writes\n",
+		      num_hits,
+		      NUM_WRITES);
+}
+
+int main(int argc, char **argv)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_hit_miss,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_expiry,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_restart,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_seqnum_odd,
+						setup, teardown),
+		cmocka_unit_test_setup_teardown(test_concurrent_writer,
+						setup, teardown),
+	};
+
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#else /* WINBINDD_NSS_CACHE_SUPPORTED */
+
+static void test_unsupported(void **state)
+{
+	skip();
+}
+
+int main(int argc, char **argv)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_unsupported),
+	};
+
+	cmocka_set_message_output(CM_OUTPUT_SUBUNIT);
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#endif /* WINBINDD_NSS_CACHE_SUPPORTED */
@@ -129,6 +129,7 @@ static bool reload_services_file(const char *lfile)
 	reopen_logs();
 	load_interfaces();
 	winbindd_setup_max_fds();
+	winbindd_nss_cache_reload();
 
 	return(ret);
 }
@@ -168,6 +169,8 @@ static void flush_caches(void)
 			exit(1);
 		}
 	}
+
+	winbindd_nss_cache_flush();
 }
 
 static void flush_caches_noinit(void)
@@ -191,6 +194,8 @@ static void flush_caches_noinit(void)
 			exit(1);
 		}
 	}
+
+	winbindd_nss_cache_flush();
 }
 
 /* Handle the signal by unlinking socket and exiting */
@@ -209,6 +214,8 @@ static void terminate(bool is_parent)
 			unlink(path);
 			SAFE_FREE(path);
 		}
+
+		winbindd_nss_cache_shutdown();
 	}
 
 	idmap_close();
@@ -819,6 +826,11 @@ static void process_request_done(struct tevent_req *subreq)
 	ok = NT_STATUS_IS_OK(status);
 	cli_state->response->result = ok ? WINBINDD_OK : WINBINDD_ERROR;
 
+	if (ok) {
+		winbindd_nss_cache_store(cli_state->request,
+					 cli_state->response);
+	}
+
 	TALLOC_FREE(cli_state->io_req);
 	TALLOC_FREE(cli_state->request);
 
@@ -1999,6 +2011,8 @@ int main(int argc, const char **argv)
 		exit_daemon("Winbindd failed to setup listeners", EPIPE);
 	}
 
+	winbindd_nss_cache_init();
+
 	irpc_add_name(winbind_imessaging_context(), "winbind_server");
 
 	TALLOC_FREE(frame);
@@ -175,6 +175,7 @@ struct winbindd_domain {
 	/* The child pid we're talking to */
 
 	struct winbindd_child *children;
+	int num_children;
 
 	struct tevent_queue *queue;
 	struct dcerpc_binding_handle *binding_handle;
@@ -71,7 +71,7 @@ void setup_domain_child(struct winbindd_domain *domain)
 {
 	int i;
 
-        for (i=0; i<lp_winbind_max_domain_connections(); i++) {
+        for (i=0; i<domain->num_children; i++) {
                 setup_child(domain, &domain->children[i],
 			    domain_dispatch_table,
                             "log.wb", domain->name);
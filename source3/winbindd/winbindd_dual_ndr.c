@@ -29,12 +29,7 @@
 #include "includes.h"
 #include "winbindd/winbindd.h"
 #include "winbindd/winbindd_proto.h"
-#include "ntdomain.h"
-#include "librpc/rpc/dcesrv_core.h"
 #include "librpc/gen_ndr/ndr_winbind.h"
-#include "rpc_server/rpc_config.h"
-#include "rpc_server/rpc_server.h"
-#include "rpc_dce.h"
 
 struct wbint_bh_state {
 	struct winbindd_domain *domain;
@@ -60,7 +55,38 @@ static uint32_t wbint_bh_set_timeout(struct dcerpc_binding_handle *h,
 	return UINT32_MAX;
 }
 
+/*
+ * Identical lookups running concurrently against the same domain or
+ * child are sent only once. During logon storms many clients ask for
+ * the same user's groups or the same SIDs at the same time, and with
+ * a slow DC each of them would otherwise occupy a domain child.
+ *
+ * The shared call is not owned by any of the callers, it keeps
+ * running if all of them give up and stores its result in the cache.
+ *
+ * This only removes duplicates. Different lookups run in parallel on
+ * up to "winbind max domain connections" domain children, each of
+ * which works on one request at a time.
+ */
+
+struct wbint_bh_raw_call_state;
+
+struct wbint_bh_shared_call {
+	struct wbint_bh_shared_call *prev, *next;
+	struct winbindd_domain *domain;
+	struct winbindd_child *child;
+	uint32_t opnum;
+	DATA_BLOB in_data;
+	struct winbindd_request request;
+	struct wbint_bh_raw_call_state *waiters;
+};
+
+static struct wbint_bh_shared_call *wbint_bh_shared_calls;
+
 struct wbint_bh_raw_call_state {
+	struct wbint_bh_raw_call_state *prev, *next;
+	struct tevent_req *req;
+	struct wbint_bh_shared_call *shared;
 	struct winbindd_domain *domain;
 	uint32_t opnum;
 	DATA_BLOB in_data;
@@ -71,6 +97,31 @@ struct wbint_bh_raw_call_state {
 
 static void wbint_bh_raw_call_child_done(struct tevent_req *subreq);
 static void wbint_bh_raw_call_domain_done(struct tevent_req *subreq);
+static bool wbint_bh_raw_call_share(struct tevent_req *req,
+				    struct tevent_context *ev,
+				    struct wbint_bh_state *hs);
+
+static bool wbint_bh_opnum_shareable(uint32_t opnum)
+{
+	switch (opnum) {
+	case NDR_WBINT_LOOKUPSID:
+	case NDR_WBINT_LOOKUPSIDS:
+	case NDR_WBINT_LOOKUPNAME:
+	case NDR_WBINT_SIDS2UNIXIDS:
+	case NDR_WBINT_UNIXIDS2SIDS:
+	case NDR_WBINT_GETNSSINFO:
+	case NDR_WBINT_LOOKUPUSERALIASES:
+	case NDR_WBINT_LOOKUPUSERGROUPS:
+	case NDR_WBINT_QUERYSEQUENCENUMBER:
+	case NDR_WBINT_LOOKUPGROUPMEMBERS:
+	case NDR_WBINT_QUERYGROUPLIST:
+	case NDR_WBINT_QUERYUSERRIDLIST:
+	case NDR_WBINT_DSGETDCNAME:
+	case NDR_WBINT_LOOKUPRIDS:
+		return true;
+	}
+	return false;
+}
 
 static struct tevent_req *wbint_bh_raw_call_send(TALLOC_CTX *mem_ctx,
 						  struct tevent_context *ev,
@@ -94,6 +145,7 @@ static struct tevent_req *wbint_bh_raw_call_send(TALLOC_CTX *mem_ctx,
 	if (req == NULL) {
 		return NULL;
 	}
+	state->req = req;
 	state->domain = hs->domain;
 	state->opnum = opnum;
 	state->in_data.data = discard_const_p(uint8_t, in_data);
@@ -114,6 +166,14 @@ static struct tevent_req *wbint_bh_raw_call_send(TALLOC_CTX *mem_ctx,
 		return tevent_req_post(req, ev);
 	}
 
+	if (wbint_bh_opnum_shareable(state->opnum)) {
+		ok = wbint_bh_raw_call_share(req, ev, hs);
+		if (!ok) {
+			return tevent_req_post(req, ev);
+		}
+		return req;
+	}
+
 	state->request.cmd = WINBINDD_DUAL_NDRCMD;
 	state->request.data.ndrcmd = state->opnum;
 	state->request.extra_data.data = (char *)state->in_data.data;
@@ -208,6 +268,157 @@ static void wbint_bh_raw_call_domain_done(struct tevent_req *subreq)
 	tevent_req_done(req);
 }
 
+static void wbint_bh_shared_call_done(struct tevent_req *subreq);
+
+static void wbint_bh_raw_call_cleanup(struct tevent_req *req,
+				      enum tevent_req_state req_state)
+{
+	struct wbint_bh_raw_call_state *state =
+		tevent_req_data(req,
+		struct wbint_bh_raw_call_state);
+
+	if (state->shared == NULL) {
+		return;
+	}
+
+	DLIST_REMOVE(state->shared->waiters, state);
+	state->shared = NULL;
+}
+
+static bool wbint_bh_raw_call_share(struct tevent_req *req,
+				    struct tevent_context *ev,
+				    struct wbint_bh_state *hs)
+{
+	struct wbint_bh_raw_call_state *state =
+		tevent_req_data(req,
+		struct wbint_bh_raw_call_state);
+	struct wbint_bh_shared_call *shared = NULL;
+	struct tevent_req *subreq = NULL;
+
+	for (shared = wbint_bh_shared_calls;
+	     shared != NULL;
+	     shared = shared->next) {
+		if ((shared->domain == hs->domain) &&
+		    (shared->child == hs->child) &&
+		    (shared->opnum == state->opnum) &&
+		    (data_blob_cmp(&shared->in_data, &state->in_data) == 0)) {
+			break;
+		}
+	}
+
+	if (shared != NULL) {
+		DBG_DEBUG("Joining pending opnum %"PRIu32" for %s\n",
+			  state->opnum,
+			  (hs->domain != NULL) ?
+			  hs->domain->name : hs->child->logfilename);
+		goto join;
+	}
+
+	shared = talloc_zero(NULL, struct wbint_bh_shared_call);
+	if (tevent_req_nomem(shared, req)) {
+		return false;
+	}
+	shared->domain = hs->domain;
+	shared->child = hs->child;
+	shared->opnum = state->opnum;
+
+	shared->in_data = data_blob_talloc(shared,
+					   state->in_data.data,
+					   state->in_data.length);
+	if ((state->in_data.length != 0) && (shared->in_data.data == NULL)) {
+		TALLOC_FREE(shared);
+		tevent_req_oom(req);
+		return false;
+	}
+
+	shared->request.cmd = WINBINDD_DUAL_NDRCMD;
+	shared->request.data.ndrcmd = shared->opnum;
+	shared->request.extra_data.data = (char *)shared->in_data.data;
+	shared->request.extra_len = shared->in_data.length;
+
+	if (shared->child != NULL) {
+		subreq = wb_child_request_send(shared, ev, shared->child,
+					       &shared->request);
+	} else {
+		subreq = wb_domain_request_send(shared, ev, shared->domain,
+						&shared->request);
+	}
+	if (subreq == NULL) {
+		TALLOC_FREE(shared);
+		tevent_req_oom(req);
+		return false;
+	}
+	tevent_req_set_callback(subreq, wbint_bh_shared_call_done, shared);
+
+	DLIST_ADD(wbint_bh_shared_calls, shared);
+
+join:
+	DLIST_ADD_END(shared->waiters, state);
+	state->shared = shared;
+	tevent_req_set_cleanup_fn(req, wbint_bh_raw_call_cleanup);
+
+	return true;
+}
+
+static void wbint_bh_shared_call_done(struct tevent_req *subreq)
+{
+	struct wbint_bh_shared_call *shared =
+		tevent_req_callback_data(subreq,
+		struct wbint_bh_shared_call);
+	struct wbint_bh_raw_call_state *state = NULL;
+	struct winbindd_response *response = NULL;
+	DATA_BLOB out_data = data_blob_null;
+	NTSTATUS status = NT_STATUS_OK;
+	int ret, err;
+
+	if (shared->child != NULL) {
+		ret = wb_child_request_recv(subreq, shared, &response, &err);
+	} else {
+		ret = wb_domain_request_recv(subreq, shared, &response, &err);
+	}
+	TALLOC_FREE(subreq);
+	if (ret == -1) {
+		status = map_nt_error_from_unix(err);
+	} else {
+		out_data = data_blob_const(
+			response->extra_data.data,
+			response->length - sizeof(struct winbindd_response));
+		if (shared->domain != NULL) {
+			wcache_store_ndr(shared->domain, shared->opnum,
+					 &shared->in_data, &out_data);
+		}
+	}
+
+	/*
+	 * Don't let new callers join while we hand out the result,
+	 * the callbacks below might start identical requests.
+	 */
+	DLIST_REMOVE(wbint_bh_shared_calls, shared);
+
+	while ((state = shared->waiters) != NULL) {
+		struct tevent_req *req = state->req;
+
+		DLIST_REMOVE(shared->waiters, state);
+		state->shared = NULL;
+
+		if (!NT_STATUS_IS_OK(status)) {
+			tevent_req_nterror(req, status);
+			continue;
+		}
+
+		state->out_data = data_blob_talloc(state,
+						   out_data.data,
+						   out_data.length);
+		if ((out_data.length != 0) && (state->out_data.data == NULL)) {
+			tevent_req_oom(req);
+			continue;
+		}
+		tevent_req_done(req);
+	}
+
+	TALLOC_FREE(shared);
+}
+
 static NTSTATUS wbint_bh_raw_call_recv(struct tevent_req *req,
 					TALLOC_CTX *mem_ctx,
 					uint8_t **out_data,
@@ -323,134 +534,6 @@ static const struct dcerpc_binding_handle_ops wbint_bh_ops = {
 	.do_ndr_print		= wbint_bh_do_ndr_print,
 };
 
-static NTSTATUS make_internal_ncacn_conn(TALLOC_CTX *mem_ctx,
-				const struct ndr_interface_table *table,
-				struct dcerpc_ncacn_conn **_out)
-{
-	struct dcerpc_ncacn_conn *ncacn_conn = NULL;
-	NTSTATUS status;
-
-	ncacn_conn = talloc_zero(mem_ctx, struct dcerpc_ncacn_conn);
-	if (ncacn_conn == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-
-	ncacn_conn->p = talloc_zero(ncacn_conn, struct pipes_struct);
-	if (ncacn_conn->p == NULL) {
-		status = NT_STATUS_NO_MEMORY;
-		goto fail;
-	}
-	ncacn_conn->p->mem_ctx = mem_ctx;
-
-	*_out = ncacn_conn;
-
-	return NT_STATUS_OK;
-
-fail:
-	talloc_free(ncacn_conn);
-	return status;
-}
-
-static NTSTATUS find_ncalrpc_default_endpoint(struct dcesrv_context *dce_ctx,
-					      struct dcesrv_endpoint **ep)
-{
-	TALLOC_CTX *tmp_ctx = NULL;
-	struct dcerpc_binding *binding = NULL;
-	NTSTATUS status;
-
-	tmp_ctx = talloc_new(dce_ctx);
-	if (tmp_ctx == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-
-	/*
-	 * Some services use a rpcint binding handle in their initialization,
-	 * before the server is fully initialized. Search the NCALRPC endpoint
-	 * with and without endpoint
-	 */
-	status = dcerpc_parse_binding(tmp_ctx, "ncalrpc:", &binding);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	status = dcesrv_find_endpoint(dce_ctx, binding, ep);
-	if (NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	status = dcerpc_parse_binding(tmp_ctx, "ncalrpc:[DEFAULT]", &binding);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	status = dcesrv_find_endpoint(dce_ctx, binding, ep);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-out:
-	talloc_free(tmp_ctx);
-	return status;
-}
-
-static NTSTATUS make_internal_dcesrv_connection(TALLOC_CTX *mem_ctx,
-				const struct ndr_interface_table *ndr_table,
-				struct dcerpc_ncacn_conn *ncacn_conn,
-				struct dcesrv_connection **_out)
-{
-	struct dcesrv_connection *conn = NULL;
-	struct dcesrv_connection_context *context = NULL;
-	struct dcesrv_endpoint *endpoint = NULL;
-	NTSTATUS status;
-
-	conn = talloc_zero(mem_ctx, struct dcesrv_connection);
-	if (conn == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-	conn->dce_ctx = global_dcesrv_context();
-	conn->preferred_transfer = &ndr_transfer_syntax_ndr;
-	conn->transport.private_data = ncacn_conn;
-
-	status = find_ncalrpc_default_endpoint(conn->dce_ctx, &endpoint);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto fail;
-	}
-	conn->endpoint = endpoint;
-
-	conn->default_auth_state = talloc_zero(conn, struct dcesrv_auth);
-	if (conn->default_auth_state == NULL) {
-		status = NT_STATUS_NO_MEMORY;
-		goto fail;
-	}
-	conn->default_auth_state->session_info = ncacn_conn->session_info;
-	conn->default_auth_state->auth_finished = true;
-
-	context = talloc_zero(conn, struct dcesrv_connection_context);
-	if (context == NULL) {
-		status = NT_STATUS_NO_MEMORY;
-		goto fail;
-	}
-	context->conn = conn;
-	context->context_id = 0;
-	context->transfer_syntax = *(conn->preferred_transfer);
-	context->iface = find_interface_by_uuid(conn->endpoint,
-					&ndr_table->syntax_id.uuid,
-					ndr_table->syntax_id.if_version);
-	if (context->iface == NULL) {
-		status = NT_STATUS_RPC_INTERFACE_NOT_FOUND;
-		goto fail;
-	}
-
-	DLIST_ADD(conn->contexts, context);
-
-	*_out = conn;
-
-	return NT_STATUS_OK;
-fail:
-	talloc_free(conn);
-	return status;
-}
-
 /* initialise a wbint binding handle */
 struct dcerpc_binding_handle *wbint_binding_handle(TALLOC_CTX *mem_ctx,
 						struct winbindd_domain *domain,
@@ -474,149 +557,3 @@ struct dcerpc_binding_handle *wbint_binding_handle(TALLOC_CTX *mem_ctx,
 
 	return h;
 }
-
-static NTSTATUS rpcint_dispatch(struct dcesrv_call_state *call)
-{
-	NTSTATUS status;
-	struct ndr_pull *pull = NULL;
-	struct ndr_push *push = NULL;
-	struct data_blob_list_item *rep = NULL;
-
-	pull = ndr_pull_init_blob(&call->pkt.u.request.stub_and_verifier,
-				  call);
-	if (pull == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-
-	pull->flags |= LIBNDR_FLAG_REF_ALLOC;
-
-	call->ndr_pull = pull;
-
-	/* unravel the NDR for the packet */
-	status = call->context->iface->ndr_pull(call, call, pull, &call->r);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_ERR("DCE/RPC fault in call %s:%02X - %s\n",
-			call->context->iface->name,
-			call->pkt.u.request.opnum,
-			dcerpc_errstr(call, call->fault_code));
-		return status;
-	}
-
-	status = call->context->iface->local(call, call, call->r);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_ERR("DCE/RPC fault in call %s:%02X - %s\n",
-			call->context->iface->name,
-			call->pkt.u.request.opnum,
-			dcerpc_errstr(call, call->fault_code));
-		return status;
-	}
-
-	push = ndr_push_init_ctx(call);
-	if (push == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-
-	push->ptr_count = call->ndr_pull->ptr_count;
-
-	status = call->context->iface->ndr_push(call, call, push, call->r);
-	if (!NT_STATUS_IS_OK(status)) {
-		DBG_ERR("DCE/RPC fault in call %s:%02X - %s\n",
-			call->context->iface->name,
-			call->pkt.u.request.opnum,
-			dcerpc_errstr(call, call->fault_code));
-		return status;
-	}
-
-	rep = talloc_zero(call, struct data_blob_list_item);
-	if (rep == NULL) {
-		return NT_STATUS_NO_MEMORY;
-	}
-
-	rep->blob = ndr_push_blob(push);
-	DLIST_ADD_END(call->replies, rep);
-
-	return NT_STATUS_OK;
-}
-
-enum winbindd_result winbindd_dual_ndrcmd(struct winbindd_domain *domain,
-					  struct winbindd_cli_state *state)
-{
-	struct dcerpc_ncacn_conn *ncacn_conn = NULL;
-	struct dcesrv_connection *dcesrv_conn = NULL;
-	struct dcesrv_call_state *dcesrv_call = NULL;
-	struct data_blob_list_item *rep = NULL;
-	uint32_t opnum = state->request->data.ndrcmd;
-	TALLOC_CTX *mem_ctx;
-	NTSTATUS status;
-
-	DBG_DEBUG("Running command %s (domain '%s')\n",
-		  ndr_table_winbind.calls[opnum].name,
-		  domain ? domain->name : "(null)");
-
-	mem_ctx = talloc_stackframe();
-	if (mem_ctx == NULL) {
-		DBG_ERR("No memory");
-		return WINBINDD_ERROR;
-	}
-
-	status = make_internal_ncacn_conn(mem_ctx,
-					  &ndr_table_winbind,
-					  &ncacn_conn);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	status = make_internal_dcesrv_connection(ncacn_conn,
-						 &ndr_table_winbind,
-						 ncacn_conn,
-						 &dcesrv_conn);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	dcesrv_call = talloc_zero(dcesrv_conn, struct dcesrv_call_state);
-	if (dcesrv_call == NULL) {
-		status = NT_STATUS_NO_MEMORY;
-		goto out;
-	}
-
-	dcesrv_call->conn = dcesrv_conn;
-	dcesrv_call->context = dcesrv_conn->contexts;
-	dcesrv_call->auth_state = dcesrv_conn->default_auth_state;
-
-	ZERO_STRUCT(dcesrv_call->pkt);
-	dcesrv_call->pkt.u.bind.assoc_group_id = 0;
-	status = dcesrv_call->conn->dce_ctx->callbacks.assoc_group.find(
-								dcesrv_call);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	ZERO_STRUCT(dcesrv_call->pkt);
-	dcesrv_call->pkt.u.request.opnum = opnum;
-	dcesrv_call->pkt.u.request.context_id = 0;
-	dcesrv_call->pkt.u.request.stub_and_verifier =
-		data_blob_const(state->request->extra_data.data,
-				state->request->extra_len);
-
-	status = rpcint_dispatch(dcesrv_call);
-	if (!NT_STATUS_IS_OK(status)) {
-		goto out;
-	}
-
-	rep = dcesrv_call->replies;
-	DLIST_REMOVE(dcesrv_call->replies, rep);
-
-	state->response->extra_data.data = talloc_steal(state->mem_ctx,
-							rep->blob.data);
-	state->response->length += rep->blob.length;
-
-	talloc_free(rep);
-
-out:
-	talloc_free(mem_ctx);
-	if (NT_STATUS_IS_OK(status)) {
-		return WINBINDD_OK;
-	}
-	return WINBINDD_ERROR;
-}
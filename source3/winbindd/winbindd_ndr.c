@@ -150,7 +150,7 @@ void ndr_print_winbindd_domain(struct ndr_print *ndr,
 	ndr_print_uint32(ndr, "sequence_number", r->sequence_number);
 	ndr_print_NTSTATUS(ndr, "last_status", r->last_status);
 	ndr_print_winbindd_cm_conn(ndr, "conn", &r->conn);
-	for (i=0; i<lp_winbind_max_domain_connections(); i++) {
+	for (i=0; i<r->num_children; i++) {
 		ndr_print_winbindd_child(ndr, "children", &r->children[i]);
 	}
 	ndr_print_uint32(ndr, "check_online_timeout", r->check_online_timeout);
@@ -0,0 +1,475 @@
+/*
+ * Unix SMB/CIFS implementation.
+ *
+ * Publish passwd and group entries to nss_winbind in a shared map
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The winbindd parent stores every successful getpwnam, getpwuid,
+ * getgrnam and getgrgid answer it sends to a client in the file
+ * described in nsswitch/winbind_nss_cache.h. nss_winbind looks there
+ * before it asks winbindd. Entries expire after "winbind cache time"
+ * seconds, the whole map is wiped when winbindd flushes its caches.
+ *
+ * Only the parent writes the map. Children inherit the mapping when
+ * they fork but never touch it, all functions here check the pid.
+ */
+
+#include "includes.h"
+#include "winbindd.h"
+#include "system/filesys.h"
+#include "system/shmem.h"
+#include "system/threads.h"
+#include "nsswitch/winbind_nss_cache.h"
+
+#undef DBGC_CLASS
+#define DBGC_CLASS DBGC_WINBIND
+
+struct winbindd_nss_cache {
+	pid_t owner;
+	char *path;
+	uint32_t num_slots;
+	size_t size;
+	struct winbindd_nss_cache_header *hdr;
+	struct winbindd_nss_cache_slot *slots;
+};
+
+/*
+ * Whether winbindd_nss_cache_init() was called in this process. Keeps
+ * children from picking up a changed "winbind nss cache size" on
+ * reload.
+ */
+static pid_t nss_cache_initialized_pid;
+
+#ifdef HAVE_ATOMIC_THREAD_FENCE
+
+static struct winbindd_nss_cache *nss_cache;
+
+static int winbindd_nss_cache_destructor(struct winbindd_nss_cache *c)
+{
+	if (c->hdr != NULL) {
+		munmap(c->hdr, c->size);
+		c->hdr = NULL;
+		c->slots = NULL;
+	}
+	return 0;
+}
+
+/****************************************************************************
+ Tell readers of a map left behind by an earlier winbindd to drop it.
+****************************************************************************/
+
+static void nss_cache_invalidate_file(const char *path)
+{
+	struct winbindd_nss_cache_header *hdr = NULL;
+	int fd;
+
+	fd = open(path, O_RDWR);
+	if (fd == -1) {
+		return;
+	}
+
+	hdr = mmap(NULL,
+		   sizeof(*hdr),
+		   PROT_READ|PROT_WRITE,
+		   MAP_SHARED,
+		   fd,
+		   0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		return;
+	}
+
+	hdr->valid = 0;
+	munmap(hdr, sizeof(*hdr));
+}
+
+static struct winbindd_nss_cache *nss_cache_create(TALLOC_CTX *mem_ctx,
+						   uint32_t num_slots)
+{
+	struct winbindd_nss_cache *c = NULL;
+	char *tmp_path = NULL;
+	void *p = NULL;
+	int fd = -1;
+	int ret;
+
+	c = talloc_zero(mem_ctx, struct winbindd_nss_cache);
+	if (c == NULL) {
+		return NULL;
+	}
+	c->owner = getpid();
+	c->num_slots = num_slots;
+	c->size = sizeof(struct winbindd_nss_cache_header) +
+		(size_t)num_slots * sizeof(struct winbindd_nss_cache_slot);
+
+	c->path = talloc_asprintf(c,
+				  "%s/%s",
+				  lp_winbindd_socket_directory(),
+				  WINBINDD_NSS_CACHE_NAME);
+	tmp_path = talloc_asprintf(c, "%s.XXXXXX", c->path);
+	if ((c->path == NULL) || (tmp_path == NULL)) {
+		goto fail;
+	}
+
+	fd = mkstemp(tmp_path);
+	if (fd == -1) {
+		DBG_WARNING("mkstemp(%s) failed: %s\n",
+			    tmp_path,
+			    strerror(errno));
+		goto fail;
+	}
+
+	/*
+	 * The entries are what "getent passwd" shows to everyone
+	 */
+	ret = fchmod(fd, 0644);
+	if (ret == -1) {
+		DBG_WARNING("fchmod(%s) failed: %s\n",
+			    tmp_path,
+			    strerror(errno));
+		goto fail_unlink;
+	}
+
+	ret = ftruncate(fd, c->size);
+	if (ret == -1) {
+		DBG_WARNING("ftruncate(%s, %zu) failed: %s\n",
+			    tmp_path,
+			    c->size,
+			    strerror(errno));
+		goto fail_unlink;
+	}
+
+	p = mmap(NULL, c->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		DBG_WARNING("mmap(%s) failed: %s\n",
+			    tmp_path,
+			    strerror(errno));
+		goto fail_unlink;
+	}
+	close(fd);
+	fd = -1;
+
+	c->hdr = p;
+	c->slots = (struct winbindd_nss_cache_slot *)(c->hdr + 1);
+	talloc_set_destructor(c, winbindd_nss_cache_destructor);
+
+	*c->hdr = (struct winbindd_nss_cache_header) {
+		.magic = WINBINDD_NSS_CACHE_MAGIC,
+		.version = WINBINDD_NSS_CACHE_VERSION,
+		.num_slots = num_slots,
+		.valid = 1,
+	};
+
+	nss_cache_invalidate_file(c->path);
+
+	ret = rename(tmp_path, c->path);
+	if (ret == -1) {
+		DBG_WARNING("rename(%s, %s) failed: %s\n",
+			    tmp_path,
+			    c->path,
+			    strerror(errno));
+		goto fail_unlink;
+	}
+
+	TALLOC_FREE(tmp_path);
+	return c;
+
+fail_unlink:
+	unlink(tmp_path);
+fail:
+	if (fd != -1) {
+		close(fd);
+	}
+	TALLOC_FREE(c);
+	return NULL;
+}
+
+static void nss_cache_destroy(void)
+{
+	if (nss_cache == NULL) {
+		return;
+	}
+	nss_cache->hdr->valid = 0;
+	unlink(nss_cache->path);
+	TALLOC_FREE(nss_cache);
+}
+
+/****************************************************************************
+ (Re-)create the map if "winbind nss cache size" asks for one. Called
+ in the parent once the sockets are set up and after each reload.
+****************************************************************************/
+
+void winbindd_nss_cache_init(void)
+{
+	int num_slots = lp_winbind_nss_cache_size();
+
+	nss_cache_initialized_pid = getpid();
+
+	if (num_slots <= 0) {
+		nss_cache_destroy();
+		return;
+	}
+
+	if ((nss_cache != NULL) &&
+	    (nss_cache->num_slots == (uint32_t)num_slots)) {
+		return;
+	}
+
+	nss_cache_destroy();
+
+	nss_cache = nss_cache_create(NULL, num_slots);
+	if (nss_cache == NULL) {
+		DBG_WARNING("Could not create nss cache with %d entries\n",
+			    num_slots);
+		return;
+	}
+
+	DBG_NOTICE("Publishing up to %d passwd and group entries in %s\n",
+		   num_slots,
+		   nss_cache->path);
+}
+
+void winbindd_nss_cache_reload(void)
+{
+	if (nss_cache_initialized_pid != getpid()) {
+		return;
+	}
+	winbindd_nss_cache_init();
+}
+
+static struct winbindd_nss_cache *nss_cache_get(void)
+{
+	if (nss_cache == NULL) {
+		return NULL;
+	}
+	if (nss_cache->owner != getpid()) {
+		return NULL;
+	}
+	return nss_cache;
+}
+
+static void nss_cache_put(struct winbindd_nss_cache *c,
+			  enum winbindd_nss_cache_type type,
+			  uint64_t key_id,
+			  const char *key_name,
+			  const void *data,
+			  size_t datalen)
+{
+	struct winbindd_nss_cache_slot *slot = NULL;
+	time_t now = time(NULL);
+	uint32_t h;
+	uint32_t i;
+
+	if (strnlen(key_name, sizeof(fstring)) >= sizeof(fstring)) {
+		return;
+	}
+
+	h = winbindd_nss_cache_hash(type, key_id, key_name);
+
+	for (i=0; i<WINBINDD_NSS_CACHE_PROBES; i++) {
+		struct winbindd_nss_cache_slot *s =
+			&c->slots[(h + i) % c->num_slots];
+
+		if ((s->type == type) &&
+		    (s->key_id == key_id) &&
+		    (strcmp(s->key_name, key_name) == 0)) {
+			slot = s;
+			break;
+		}
+		if ((slot == NULL) &&
+		    ((s->type == WINBINDD_NSS_CACHE_EMPTY) ||
+		     (s->expiry <= (uint64_t)now))) {
+			slot = s;
+		}
+	}
+
+	if (slot == NULL) {
+		slot = &c->slots[h % c->num_slots];
+	}
+
+	slot->seqnum += 1;
+	atomic_thread_fence(memory_order_seq_cst);
+
+	slot->type = type;
+	slot->key_id = key_id;
+	slot->expiry = now + lp_winbind_cache_time();
+	strlcpy(slot->key_name, key_name, sizeof(slot->key_name));
+	memset(&slot->data, 0, sizeof(slot->data));
+	memcpy(&slot->data, data, datalen);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	slot->seqnum += 1;
+}
+
+/****************************************************************************
+ Publish the answer to a request from the parent's async table.
+****************************************************************************/
+
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response)
+{
+	struct winbindd_nss_cache *c = nss_cache_get();
+	const struct winbindd_pw *pw = &response->data.pw;
+	const struct winbindd_gr *gr = &response->data.gr;
+
+	if (c == NULL) {
+		return;
+	}
+	if (lp_winbind_cache_time() <= 0) {
+		return;
+	}
+
+	switch (request->cmd) {
+	case WINBINDD_GETPWNAM:
+		nss_cache_put(c,
+			      WINBINDD_NSS_CACHE_PWNAM,
+			      0,
+			      request->data.username,
+			      pw,
+			      sizeof(*pw));
+		if (strcmp(request->data.username, pw->pw_name) != 0) {
+			nss_cache_put(c,
+				      WINBINDD_NSS_CACHE_PWNAM,
+				      0,
+				      pw->pw_name,
+				      pw,
+				      sizeof(*pw));
+		}
+		break;
+	case WINBINDD_GETPWUID:
+		nss_cache_put(c,
+			      WINBINDD_NSS_CACHE_PWUID,
+			      request->data.uid,
+			      "",
+			      pw,
+			      sizeof(*pw));
+		break;
+	case WINBINDD_GETGRNAM:
+		/*
+		 * Members come in extra_data, only empty groups fit
+		 * into a slot.
+		 */
+		if (gr->num_gr_mem != 0) {
+			break;
+		}
+		nss_cache_put(c,
+			      WINBINDD_NSS_CACHE_GRNAM,
+			      0,
+			      request->data.groupname,
+			      gr,
+			      sizeof(*gr));
+		if (strcmp(request->data.groupname, gr->gr_name) != 0) {
+			nss_cache_put(c,
+				      WINBINDD_NSS_CACHE_GRNAM,
+				      0,
+				      gr->gr_name,
+				      gr,
+				      sizeof(*gr));
+		}
+		break;
+	case WINBINDD_GETGRGID:
+		if (gr->num_gr_mem != 0) {
+			break;
+		}
+		nss_cache_put(c,
+			      WINBINDD_NSS_CACHE_GRGID,
+			      request->data.gid,
+			      "",
+			      gr,
+			      sizeof(*gr));
+		break;
+	default:
+		break;
+	}
+}
+
+/****************************************************************************
+ Drop all entries, done whenever winbindd flushes its own cache.
+****************************************************************************/
+
+void winbindd_nss_cache_flush(void)
+{
+	struct winbindd_nss_cache *c = nss_cache_get();
+	uint32_t i;
+
+	if (c == NULL) {
+		return;
+	}
+
+	for (i=0; i<c->num_slots; i++) {
+		struct winbindd_nss_cache_slot *slot = &c->slots[i];
+
+		if (slot->type == WINBINDD_NSS_CACHE_EMPTY) {
+			continue;
+		}
+
+		slot->seqnum += 1;
+		atomic_thread_fence(memory_order_seq_cst);
+		slot->type = WINBINDD_NSS_CACHE_EMPTY;
+		atomic_thread_fence(memory_order_seq_cst);
+		slot->seqnum += 1;
+	}
+}
+
+/****************************************************************************
+ The parent exits, make readers go back to the socket.
+****************************************************************************/
+
+void winbindd_nss_cache_shutdown(void)
+{
+	if (nss_cache_get() == NULL) {
+		return;
+	}
+	nss_cache_destroy();
+}
+
+#else /* HAVE_ATOMIC_THREAD_FENCE */
+
+void winbindd_nss_cache_init(void)
+{
+	if (lp_winbind_nss_cache_size() > 0) {
+		DBG_WARNING("winbind nss cache size is set but this "
+			    "platform lacks atomic_thread_fence, "
+			    "not publishing an nss cache\n");
+	}
+	nss_cache_initialized_pid = getpid();
+}
+
+void winbindd_nss_cache_reload(void)
+{
+	if (nss_cache_initialized_pid != getpid()) {
+		return;
+	}
+	winbindd_nss_cache_init();
+}
+
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response)
+{
+	return;
+}
+
+void winbindd_nss_cache_flush(void)
+{
+	return;
+}
+
+void winbindd_nss_cache_shutdown(void)
+{
+	return;
+}
+
+#endif /* HAVE_ATOMIC_THREAD_FENCE */
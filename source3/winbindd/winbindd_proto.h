@@ -32,6 +32,14 @@ bool winbindd_use_idmap_cache(void);
 bool winbindd_use_cache(void);
 char *get_winbind_priv_pipe_dir(void);
 
+/* The following definitions come from winbindd/winbindd_nss_cache.c  */
+void winbindd_nss_cache_init(void);
+void winbindd_nss_cache_reload(void);
+void winbindd_nss_cache_store(const struct winbindd_request *request,
+			      const struct winbindd_response *response);
+void winbindd_nss_cache_flush(void);
+void winbindd_nss_cache_shutdown(void);
+
 /* The following definitions come from winbindd/winbindd_ads.c  */
 
 /* The following definitions come from winbindd/winbindd_rpc.c  */
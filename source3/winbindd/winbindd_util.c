@@ -215,9 +215,15 @@ static NTSTATUS add_trusted_domain(const char *domain_name,
 		return NT_STATUS_NO_MEMORY;
 	}
 
+	/*
+	 * The number of children is fixed when the domain is added, a
+	 * reload changing "winbind max domain connections" only
+	 * affects domains added later.
+	 */
+	domain->num_children = lp_winbind_max_domain_connections();
 	domain->children = talloc_zero_array(domain,
 					     struct winbindd_child,
-					     lp_winbind_max_domain_connections());
+					     domain->num_children);
 	if (domain->children == NULL) {
 		TALLOC_FREE(domain);
 		return NT_STATUS_NO_MEMORY;
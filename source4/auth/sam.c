@@ -47,6 +47,10 @@
 	"supplementalCredentials",		\
 	"msDS-AllowedToDelegateTo",		\
 						\
+	/* KDC key cache, SendToSAM requests */	\
+	"objectGUID",				\
+	"uSNChanged",				\
+						\
 	/* passwords */				\
 	"dBCSPwd",				\
 	"unicodePwd",				\
@@ -86,11 +90,6 @@ const char *user_attrs[] = {
 	 */
 	"lockoutTime",
 
-	/*
-	 * Needed for SendToSAM requests
-	 */
-	"objectGUID",
-
 	/* check 'allowed workstations' */
 	"userWorkstations",
 
@@ -34,6 +34,7 @@
 #include "lib/util/dlinklist.h"
 #include "lib/util/util_net.h"
 #include "lib/util/tevent_werror.h"
+#include "lib/util/memcache.h"
 #include "auth/auth.h"
 #include "auth/credentials/credentials.h"
 #include "auth/gensec/gensec.h"
@@ -270,51 +271,351 @@ static WERROR add_dns_res_rec(struct dns_res_rec **pdst,
 	return WERR_OK;
 }
 
+/*
+ * Replies from the forwarders are kept in dns->forwarder_cache as the
+ * NDR blob of the reply packet, behind this header.  memcache evicts
+ * the least recently used entries once the configured size is reached.
+ */
+struct dns_forwarder_cache_entry {
+	time_t stored;
+	time_t expires;
+};
+
+/*
+ * A query that has been sent to a forwarder and not yet answered.
+ * Identical queries arriving in the meantime wait for the same reply
+ * instead of being forwarded again.
+ */
+struct dns_forwarder_inflight {
+	struct dns_forwarder_inflight *prev, *next;
+	struct dns_server *dns;
+	const char *forwarder;
+	const char *key;
+	struct ask_forwarder_state *waiters;
+};
+
 struct ask_forwarder_state {
+	struct ask_forwarder_state *prev, *next;
+	struct tevent_req *req;
+	struct dns_forwarder_inflight *inflight;
 	struct dns_name_packet *reply;
 };
 
+static const char *dns_forwarder_cache_key(
+	TALLOC_CTX *mem_ctx, const struct dns_name_question *question)
+{
+	char *name = strlower_talloc(mem_ctx, question->name);
+	char *key;
+
+	if (name == NULL) {
+		return NULL;
+	}
+	key = talloc_asprintf(mem_ctx, "%s/%u/%u", name,
+			      (unsigned)question->question_class,
+			      (unsigned)question->question_type);
+	TALLOC_FREE(name);
+	return key;
+}
+
+static void dns_forwarder_age_rrs(struct dns_res_rec *rrs, uint16_t count,
+				  uint32_t age)
+{
+	uint16_t i;
+
+	for (i = 0; i < count; i++) {
+		if (rrs[i].rr_type == DNS_QTYPE_OPT) {
+			/* The TTL of an OPT record holds flags */
+			continue;
+		}
+		rrs[i].ttl = rrs[i].ttl > age ? rrs[i].ttl - age : 0;
+	}
+}
+
+static bool dns_forwarder_cache_lookup(struct dns_server *dns,
+				       TALLOC_CTX *mem_ctx,
+				       const char *key,
+				       struct dns_name_packet **preply)
+{
+	struct dns_forwarder_cache_entry entry;
+	struct dns_name_packet *reply = NULL;
+	enum ndr_err_code ndr_err;
+	DATA_BLOB value;
+	DATA_BLOB packet;
+	time_t now;
+	uint32_t age;
+	bool ok;
+
+	if (dns->forwarder_cache == NULL) {
+		return false;
+	}
+
+	ok = memcache_lookup(dns->forwarder_cache, DNS_FORWARDER_CACHE,
+			     data_blob_string_const(key), &value);
+	if (!ok) {
+		return false;
+	}
+	if (value.length < sizeof(entry)) {
+		memcache_delete(dns->forwarder_cache, DNS_FORWARDER_CACHE,
+				data_blob_string_const(key));
+		return false;
+	}
+	memcpy(&entry, value.data, sizeof(entry));
+
+	now = time_mono(NULL);
+	if (now >= entry.expires) {
+		memcache_delete(dns->forwarder_cache, DNS_FORWARDER_CACHE,
+				data_blob_string_const(key));
+		dns->forwarder_stats.expired += 1;
+		return false;
+	}
+
+	reply = talloc_zero(mem_ctx, struct dns_name_packet);
+	if (reply == NULL) {
+		return false;
+	}
+	packet = data_blob_const(value.data + sizeof(entry),
+				 value.length - sizeof(entry));
+	ndr_err = ndr_pull_struct_blob(
+		&packet, reply, reply,
+		(ndr_pull_flags_fn_t)ndr_pull_dns_name_packet);
+	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+		TALLOC_FREE(reply);
+		return false;
+	}
+
+	age = now - entry.stored;
+	dns_forwarder_age_rrs(reply->answers, reply->ancount, age);
+	dns_forwarder_age_rrs(reply->nsrecs, reply->nscount, age);
+	dns_forwarder_age_rrs(reply->additional, reply->arcount, age);
+
+	*preply = reply;
+	return true;
+}
+
+/*
+ * Keep a reply for as long as the shortest TTL of the records in its
+ * answer and authority sections allows.  For a name that does not
+ * exist that is the TTL of the SOA in the authority section.
+ */
+static void dns_forwarder_cache_store(struct dns_server *dns,
+				      const char *key,
+				      const struct dns_name_packet *reply,
+				      DATA_BLOB packet)
+{
+	struct dns_forwarder_cache_entry entry;
+	uint16_t rcode = reply->operation & DNS_RCODE;
+	uint32_t ttl = DNS_FORWARDER_CACHE_MAX_TTL;
+	uint8_t *value;
+	uint16_t i;
+
+	if (dns->forwarder_cache == NULL) {
+		return;
+	}
+	if (rcode != DNS_RCODE_OK && rcode != DNS_RCODE_NXDOMAIN) {
+		return;
+	}
+	if (reply->operation & DNS_FLAG_TRUNCATION) {
+		return;
+	}
+	if (reply->ancount == 0 && reply->nscount == 0) {
+		return;
+	}
+
+	for (i = 0; i < reply->ancount; i++) {
+		ttl = MIN(ttl, reply->answers[i].ttl);
+	}
+	for (i = 0; i < reply->nscount; i++) {
+		ttl = MIN(ttl, reply->nsrecs[i].ttl);
+	}
+	if (ttl == 0) {
+		return;
+	}
+
+	value = talloc_size(dns, sizeof(entry) + packet.length);
+	if (value == NULL) {
+		return;
+	}
+	entry.stored = time_mono(NULL);
+	entry.expires = entry.stored + ttl;
+	memcpy(value, &entry, sizeof(entry));
+	memcpy(value + sizeof(entry), packet.data, packet.length);
+
+	memcache_add(dns->forwarder_cache, DNS_FORWARDER_CACHE,
+		     data_blob_string_const(key),
+		     data_blob_const(value, sizeof(entry) + packet.length));
+	TALLOC_FREE(value);
+
+	dns->forwarder_stats.stored += 1;
+}
+
+static int dns_forwarder_inflight_destructor(
+	struct dns_forwarder_inflight *inflight)
+{
+	struct ask_forwarder_state *state;
+
+	DLIST_REMOVE(inflight->dns->forwarder_inflight, inflight);
+
+	for (state = inflight->waiters; state != NULL; state = state->next) {
+		state->inflight = NULL;
+	}
+	return 0;
+}
+
+static void ask_forwarder_cleanup(struct tevent_req *req,
+				  enum tevent_req_state req_state)
+{
+	struct ask_forwarder_state *state = tevent_req_data(
+		req, struct ask_forwarder_state);
+
+	if (state->inflight != NULL) {
+		DLIST_REMOVE(state->inflight->waiters, state);
+		state->inflight = NULL;
+	}
+}
+
 static void ask_forwarder_done(struct tevent_req *subreq);
 
 static struct tevent_req *ask_forwarder_send(
 	TALLOC_CTX *mem_ctx, struct tevent_context *ev,
+	struct dns_server *dns,
 	const char *forwarder, struct dns_name_question *question)
 {
 	struct tevent_req *req, *subreq;
 	struct ask_forwarder_state *state;
+	struct dns_forwarder_inflight *inflight;
+	const char *key;
 
 	req = tevent_req_create(mem_ctx, &state, struct ask_forwarder_state);
 	if (req == NULL) {
 		return NULL;
 	}
+	state->req = req;
 
-	subreq = dns_cli_request_send(state, ev, forwarder,
-				      question->name, question->question_class,
-				      question->question_type);
-	if (tevent_req_nomem(subreq, req)) {
+	key = dns_forwarder_cache_key(state, question);
+	if (tevent_req_nomem(key, req)) {
 		return tevent_req_post(req, ev);
 	}
-	tevent_req_set_callback(subreq, ask_forwarder_done, req);
+
+	if (dns_forwarder_cache_lookup(dns, state, key, &state->reply)) {
+		dns->forwarder_stats.hits += 1;
+		tevent_req_done(req);
+		return tevent_req_post(req, ev);
+	}
+
+	for (inflight = dns->forwarder_inflight;
+	     inflight != NULL;
+	     inflight = inflight->next) {
+		if (strcmp(inflight->key, key) == 0 &&
+		    strequal(inflight->forwarder, forwarder)) {
+			break;
+		}
+	}
+
+	if (inflight != NULL) {
+		dns->forwarder_stats.coalesced += 1;
+	} else {
+		dns->forwarder_stats.misses += 1;
+
+		inflight = talloc_zero(dns, struct dns_forwarder_inflight);
+		if (tevent_req_nomem(inflight, req)) {
+			return tevent_req_post(req, ev);
+		}
+		inflight->dns = dns;
+		inflight->forwarder = talloc_strdup(inflight, forwarder);
+		inflight->key = talloc_move(inflight, &key);
+
+		subreq = dns_cli_request_send(inflight, ev, forwarder,
+					      question->name,
+					      question->question_class,
+					      question->question_type);
+		if (subreq == NULL) {
+			TALLOC_FREE(inflight);
+			tevent_req_oom(req);
+			return tevent_req_post(req, ev);
+		}
+		tevent_req_set_callback(subreq, ask_forwarder_done, inflight);
+
+		DLIST_ADD(dns->forwarder_inflight, inflight);
+		talloc_set_destructor(inflight,
+				      dns_forwarder_inflight_destructor);
+	}
+
+	DLIST_ADD_END(inflight->waiters, state);
+	state->inflight = inflight;
+	tevent_req_set_cleanup_fn(req, ask_forwarder_cleanup);
+
 	return req;
 }
 
 static void ask_forwarder_done(struct tevent_req *subreq)
 {
-	struct tevent_req *req = tevent_req_callback_data(
-		subreq, struct tevent_req);
-	struct ask_forwarder_state *state = tevent_req_data(
-		req, struct ask_forwarder_state);
+	struct dns_forwarder_inflight *inflight = tevent_req_callback_data(
+		subreq, struct dns_forwarder_inflight);
+	struct dns_server *dns = inflight->dns;
+	struct ask_forwarder_state *state;
+	struct dns_name_packet *reply = NULL;
+	DATA_BLOB packet = data_blob_null;
+	enum ndr_err_code ndr_err;
 	int ret;
 
-	ret = dns_cli_request_recv(subreq, state, &state->reply);
+	ret = dns_cli_request_recv(subreq, inflight, &reply);
 	TALLOC_FREE(subreq);
 
-	if (ret != 0) {
-		tevent_req_werror(req, unix_to_werror(ret));
-		return;
+	/*
+	 * Take ourselves off the list first, so that a waiter asking
+	 * again from its callback starts a new query.
+	 */
+	DLIST_REMOVE(dns->forwarder_inflight, inflight);
+	talloc_set_destructor(inflight, NULL);
+
+	if (ret == 0) {
+		ndr_err = ndr_push_struct_blob(
+			&packet, inflight, reply,
+			(ndr_push_flags_fn_t)ndr_push_dns_name_packet);
+		if (NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			dns_forwarder_cache_store(dns, inflight->key,
+						  reply, packet);
+		} else {
+			packet = data_blob_null;
+		}
 	}
 
-	tevent_req_done(req);
+	while ((state = inflight->waiters) != NULL) {
+		DLIST_REMOVE(inflight->waiters, state);
+		state->inflight = NULL;
+
+		if (ret != 0) {
+			tevent_req_werror(state->req, unix_to_werror(ret));
+			continue;
+		}
+
+		if (inflight->waiters == NULL) {
+			/* The last one can have the reply itself */
+			state->reply = talloc_move(state, &reply);
+			tevent_req_done(state->req);
+			continue;
+		}
+
+		if (packet.data == NULL) {
+			tevent_req_werror(state->req, DNS_ERR(SERVER_FAILURE));
+			continue;
+		}
+
+		state->reply = talloc_zero(state, struct dns_name_packet);
+		if (tevent_req_nomem(state->reply, state->req)) {
+			continue;
+		}
+		ndr_err = ndr_pull_struct_blob(
+			&packet, state->reply, state->reply,
+			(ndr_pull_flags_fn_t)ndr_pull_dns_name_packet);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			tevent_req_werror(state->req, DNS_ERR(SERVER_FAILURE));
+			continue;
+		}
+		tevent_req_done(state->req);
+	}
+
+	TALLOC_FREE(inflight);
 }
 
 static WERROR ask_forwarder_recv(
@@ -365,7 +666,7 @@ static WERROR add_zone_authority_record(struct dns_server *dns,
 		return werror;
 	}
 
-	werror = dns_lookup_records(dns, mem_ctx, dn, &recs, &rec_count);
+	werror = dns_lookup_records_cached(dns, mem_ctx, dn, &recs, &rec_count);
 	if (!W_ERROR_IS_OK(werror)) {
 		return werror;
 	}
@@ -476,7 +777,7 @@ static struct tevent_req *handle_dnsrpcrec_send(
 		return req;
 	}
 
-	subreq = ask_forwarder_send(state, ev, forwarder, new_q);
+	subreq = ask_forwarder_send(state, ev, dns, forwarder, new_q);
 	if (tevent_req_nomem(subreq, req)) {
 		return tevent_req_post(req, ev);
 	}
@@ -587,8 +888,9 @@ static struct tevent_req *handle_authoritative_send(
 	if (tevent_req_werror(req, werr)) {
 		return tevent_req_post(req, ev);
 	}
-	werr = dns_lookup_records_wildcard(dns, state, dn, &state->recs,
-				           &state->rec_count);
+	werr = dns_lookup_records_wildcard_cached(dns, state, dn,
+						  &state->recs,
+						  &state->rec_count);
 	TALLOC_FREE(dn);
 	if (tevent_req_werror(req, werr)) {
 		return tevent_req_post(req, ev);
@@ -1016,7 +1318,7 @@ struct tevent_req *dns_server_process_query_send(
 		DEBUG(5, ("Not authoritative for '%s', forwarding\n",
 			  in->questions[0].name));
 
-		subreq = ask_forwarder_send(state, ev,
+		subreq = ask_forwarder_send(state, ev, dns,
 					    (forwarders == NULL ? NULL : forwarders[0]),
 					    &in->questions[0]);
 		if (tevent_req_nomem(subreq, req)) {
@@ -1059,7 +1361,7 @@ static void dns_server_process_query_got_response(struct tevent_req *subreq)
 
 		DEBUG(5, ("DNS query returned %s, trying another forwarder.\n",
 			  win_errstr(werr)));
-		subreq = ask_forwarder_send(state, state->ev,
+		subreq = ask_forwarder_send(state, state->ev, state->dns,
 					    state->forwarders->forwarder,
 					    state->question);
 
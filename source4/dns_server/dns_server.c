@@ -33,6 +33,7 @@
 #include "lib/stream/packet.h"
 #include "lib/socket/netif.h"
 #include "dns_server/dns_server.h"
+#include "lib/util/memcache.h"
 #include "param/param.h"
 #include "librpc/ndr/libndr.h"
 #include "librpc/gen_ndr/ndr_dns.h"
@@ -761,6 +762,7 @@ static NTSTATUS dns_server_reload_zones(struct dns_server *dns)
 		return status;
 	}
 	dns->zones = new_list;
+	dns_records_cache_set_zones(dns);
 	while ((old_zone = DLIST_TAIL(old_list)) != NULL) {
 		DLIST_REMOVE(old_list, old_zone);
 		talloc_free(old_zone);
@@ -790,6 +792,26 @@ static NTSTATUS dns_reload_zones(struct irpc_message *msg,
 	return NT_STATUS_OK;
 }
 
+/**
+ * Report how well the cache of replies from the forwarders is doing.
+ */
+static NTSTATUS dns_forwarder_cache_info(struct irpc_message *msg,
+					 struct dnssrv_forwarder_cache_info *r)
+{
+	struct dns_server *dns;
+
+	dns = talloc_get_type(msg->private_data, struct dns_server);
+	if (dns == NULL) {
+		r->out.result = NT_STATUS_INTERNAL_ERROR;
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	*r->out.stats = dns->forwarder_stats;
+	r->out.result = NT_STATUS_OK;
+
+	return NT_STATUS_OK;
+}
+
 static NTSTATUS dns_task_init(struct task_server *task)
 {
 	struct dns_server *dns;
@@ -800,6 +822,7 @@ static NTSTATUS dns_task_init(struct task_server *task)
 	struct ldb_message *dns_acc;
 	char *hostname_lower;
 	char *dns_spn;
+	int forwarder_cache_size;
 
 	switch (lpcfg_server_role(task->lp_ctx)) {
 	case ROLE_STANDALONE:
@@ -894,6 +917,22 @@ static NTSTATUS dns_task_init(struct task_server *task)
 		return NT_STATUS_NO_MEMORY;
 	}
 
+	dns->record_cache = memcache_init(dns, DNS_RECORD_CACHE_SIZE);
+	if (dns->record_cache == NULL) {
+		task_server_terminate(task, "Failed to allocate record cache\n", true);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	forwarder_cache_size = lpcfg_dns_forwarder_cache_size(task->lp_ctx);
+	if (forwarder_cache_size > 0) {
+		dns->forwarder_cache = memcache_init(dns, forwarder_cache_size);
+		if (dns->forwarder_cache == NULL) {
+			task_server_terminate(task, "Failed to allocate forwarder cache\n", true);
+			return NT_STATUS_NO_MEMORY;
+		}
+		dns->forwarder_stats.max_size = forwarder_cache_size;
+	}
+
 	status = dns_server_reload_zones(dns);
 	if (!NT_STATUS_IS_OK(status)) {
 		task_server_terminate(task, "dns: failed to load DNS zones", true);
@@ -919,6 +958,13 @@ static NTSTATUS dns_task_init(struct task_server *task)
 		task_server_terminate(task, "dns: failed to setup reload handler", true);
 		return status;
 	}
+
+	status = IRPC_REGISTER(task->msg_ctx, irpc, DNSSRV_FORWARDER_CACHE_INFO,
+			       dns_forwarder_cache_info, dns);
+	if (!NT_STATUS_IS_OK(status)) {
+		task_server_terminate(task, "dns: failed to setup forwarder cache info handler", true);
+		return status;
+	}
 	return NT_STATUS_OK;
 }
 
@@ -25,6 +25,7 @@
 #include "librpc/gen_ndr/dns.h"
 #include "librpc/gen_ndr/ndr_dnsp.h"
 #include "dnsserver_common.h"
+#include "librpc/gen_ndr/irpc.h"
 
 struct tsocket_address;
 struct dns_server_tkey {
@@ -37,6 +38,16 @@ struct dns_server_tkey {
 };
 
 #define TKEY_BUFFER_SIZE 128
+#define DNS_RECORD_CACHE_SIZE (4 * 1024 * 1024)
+#define DNS_FORWARDER_CACHE_MAX_TTL 86400
+
+struct dns_forwarder_inflight;
+
+/* The naming context a zone is stored in */
+struct dns_server_zone_nc {
+	struct ldb_dn *zone_dn;
+	struct ldb_dn *nc_root;
+};
 
 struct dns_server_tkey_store {
 	struct dns_server_tkey **tkeys;
@@ -50,6 +61,25 @@ struct dns_server {
 	struct dns_server_zone *zones;
 	struct dns_server_tkey_store *tkeys;
 	struct cli_credentials *server_credentials;
+
+	/*
+	 * Decoded dnsRecord values of recently queried names, including
+	 * names that do not exist.  An entry is only valid while the
+	 * highest USN of the naming context of its zone, found through
+	 * zone_ncs, is unchanged.
+	 */
+	struct memcache *record_cache;
+	struct dns_server_zone_nc *zone_ncs;
+	size_t num_zone_ncs;
+
+	/*
+	 * Replies from the forwarders, the queries still waiting for
+	 * one and the statistics returned by
+	 * dnssrv_forwarder_cache_info.
+	 */
+	struct memcache *forwarder_cache;
+	struct dns_forwarder_inflight *forwarder_inflight;
+	struct dnssrv_forwarder_cache_stats forwarder_stats;
 };
 
 struct dns_request_state {
@@ -98,6 +128,18 @@ WERROR dns_lookup_records_wildcard(struct dns_server *dns,
 			  struct ldb_dn *dn,
 			  struct dnsp_DnssrvRpcRecord **records,
 			  uint16_t *rec_count);
+WERROR dns_lookup_records_cached(struct dns_server *dns,
+				 TALLOC_CTX *mem_ctx,
+				 struct ldb_dn *dn,
+				 struct dnsp_DnssrvRpcRecord **records,
+				 uint16_t *rec_count);
+WERROR dns_lookup_records_wildcard_cached(struct dns_server *dns,
+					  TALLOC_CTX *mem_ctx,
+					  struct ldb_dn *dn,
+					  struct dnsp_DnssrvRpcRecord **records,
+					  uint16_t *rec_count);
+void dns_records_cache_flush(struct dns_server *dns);
+void dns_records_cache_set_zones(struct dns_server *dns);
 WERROR dns_replace_records(struct dns_server *dns,
 			   TALLOC_CTX *mem_ctx,
 			   struct ldb_dn *dn,
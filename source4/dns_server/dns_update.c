@@ -714,6 +714,7 @@ static WERROR handle_updates(struct dns_server *dns,
 	}
 
 	ldb_transaction_commit(dns->samdb);
+	dns_records_cache_flush(dns);
 	TALLOC_FREE(tmp_ctx);
 
 	if (tkey != NULL) {
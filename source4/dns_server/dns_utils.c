@@ -29,6 +29,7 @@
 #include "dsdb/samdb/samdb.h"
 #include "dsdb/common/util.h"
 #include "dns_server/dns_server.h"
+#include "lib/util/memcache.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS DBGC_DNS
@@ -135,6 +136,305 @@ WERROR dns_lookup_records_wildcard(struct dns_server *dns,
 				 records, rec_count);
 }
 
+/*
+ * The result of one lookup, as kept in dns->record_cache.  Lookups of
+ * names that do not exist are cached as well, with werr set.
+ */
+struct dns_cached_lookup {
+	uint64_t usn;
+	WERROR werr;
+	uint16_t rec_count;
+	struct dnsp_DnssrvRpcRecord *recs;
+};
+
+static bool dns_copy_string(TALLOC_CTX *mem_ctx,
+			    const char *src,
+			    const char **dst)
+{
+	if (src == NULL) {
+		*dst = NULL;
+		return true;
+	}
+	*dst = talloc_strdup(mem_ctx, src);
+	return *dst != NULL;
+}
+
+static bool dns_copy_record(TALLOC_CTX *mem_ctx,
+			    struct dnsp_DnssrvRpcRecord *dst,
+			    const struct dnsp_DnssrvRpcRecord *src)
+{
+	const union dnsRecordData *s = &src->data;
+	union dnsRecordData *d = &dst->data;
+	enum ndr_err_code ndr_err;
+
+	*dst = *src;
+
+	switch (src->wType) {
+	case DNS_TYPE_TOMBSTONE:
+		return true;
+	case DNS_TYPE_A:
+		return dns_copy_string(mem_ctx, s->ipv4, &d->ipv4);
+	case DNS_TYPE_AAAA:
+		return dns_copy_string(mem_ctx, s->ipv6, &d->ipv6);
+	case DNS_TYPE_NS:
+		return dns_copy_string(mem_ctx, s->ns, &d->ns);
+	case DNS_TYPE_CNAME:
+		return dns_copy_string(mem_ctx, s->cname, &d->cname);
+	case DNS_TYPE_PTR:
+		return dns_copy_string(mem_ctx, s->ptr, &d->ptr);
+	case DNS_TYPE_SOA:
+		return dns_copy_string(mem_ctx, s->soa.mname, &d->soa.mname) &&
+		       dns_copy_string(mem_ctx, s->soa.rname, &d->soa.rname);
+	case DNS_TYPE_MX:
+		return dns_copy_string(mem_ctx, s->mx.nameTarget,
+				       &d->mx.nameTarget);
+	case DNS_TYPE_SRV:
+		return dns_copy_string(mem_ctx, s->srv.nameTarget,
+				       &d->srv.nameTarget);
+	case DNS_TYPE_HINFO:
+		return dns_copy_string(mem_ctx, s->hinfo.cpu, &d->hinfo.cpu) &&
+		       dns_copy_string(mem_ctx, s->hinfo.os, &d->hinfo.os);
+	case DNS_TYPE_TXT:
+		ndr_err = ndr_dnsp_string_list_copy(mem_ctx, &s->txt, &d->txt);
+		return NDR_ERR_CODE_IS_SUCCESS(ndr_err);
+	default:
+		d->data = data_blob_talloc(mem_ctx,
+					   s->data.data,
+					   s->data.length);
+		return d->data.data != NULL || s->data.length == 0;
+	}
+}
+
+static WERROR dns_cached_lookup_copy(TALLOC_CTX *mem_ctx,
+				     const struct dns_cached_lookup *cached,
+				     struct dnsp_DnssrvRpcRecord **records,
+				     uint16_t *rec_count)
+{
+	struct dnsp_DnssrvRpcRecord *recs = NULL;
+	uint16_t i;
+
+	if (!W_ERROR_IS_OK(cached->werr)) {
+		return cached->werr;
+	}
+
+	if (cached->rec_count > 0) {
+		recs = talloc_array(mem_ctx,
+				    struct dnsp_DnssrvRpcRecord,
+				    cached->rec_count);
+		if (recs == NULL) {
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
+	}
+
+	for (i = 0; i < cached->rec_count; i++) {
+		if (!dns_copy_record(recs, &recs[i], &cached->recs[i])) {
+			TALLOC_FREE(recs);
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
+	}
+
+	*records = recs;
+	*rec_count = cached->rec_count;
+	return WERR_OK;
+}
+
+void dns_records_cache_flush(struct dns_server *dns)
+{
+	if (dns->record_cache == NULL) {
+		return;
+	}
+	memcache_flush(dns->record_cache, DNS_RECORDS_CACHE);
+	memcache_flush(dns->record_cache, DNS_WILDCARD_RECORDS_CACHE);
+}
+
+/*
+ * Remember the naming context each zone is stored in, usually
+ * DomainDnsZones or ForestDnsZones.  Called whenever the zones are
+ * (re)loaded.
+ */
+void dns_records_cache_set_zones(struct dns_server *dns)
+{
+	const struct dns_server_zone *z = NULL;
+	size_t num_zones = 0;
+	size_t i = 0;
+	int ret;
+
+	dns_records_cache_flush(dns);
+
+	TALLOC_FREE(dns->zone_ncs);
+	dns->num_zone_ncs = 0;
+
+	for (z = dns->zones; z != NULL; z = z->next) {
+		num_zones += 1;
+	}
+	if (num_zones == 0) {
+		return;
+	}
+
+	dns->zone_ncs = talloc_zero_array(dns,
+					  struct dns_server_zone_nc,
+					  num_zones);
+	if (dns->zone_ncs == NULL) {
+		return;
+	}
+
+	for (z = dns->zones; z != NULL; z = z->next) {
+		struct dns_server_zone_nc *nc = &dns->zone_ncs[i];
+
+		ret = dsdb_find_nc_root(dns->samdb, dns->zone_ncs, z->dn,
+					&nc->nc_root);
+		if (ret != LDB_SUCCESS) {
+			DBG_NOTICE("No naming context for zone %s: %s\n",
+				   z->name, ldb_strerror(ret));
+			continue;
+		}
+		nc->zone_dn = ldb_dn_copy(dns->zone_ncs, z->dn);
+		if (nc->zone_dn == NULL) {
+			continue;
+		}
+		i += 1;
+	}
+
+	dns->num_zone_ncs = i;
+}
+
+/*
+ * Any write to a naming context, be it a dynamic update, an RPC or
+ * LDAP modification or an inbound replication, moves its highest USN
+ * on.  Reading it is a single fetch of the @REPLCHANGED record of the
+ * partition, which is cheap compared to a search and unpacking the
+ * dnsRecord values.  Logons only write to the domain partition, so
+ * zones in the DNS partitions are not affected by them.
+ */
+static bool dns_records_cache_usn(struct dns_server *dns,
+				  struct ldb_dn *dn,
+				  uint64_t *usn)
+{
+	size_t i;
+	int ret;
+
+	if (dns->record_cache == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < dns->num_zone_ncs; i++) {
+		if (ldb_dn_compare_base(dns->zone_ncs[i].zone_dn, dn) == 0) {
+			break;
+		}
+	}
+	if (i == dns->num_zone_ncs) {
+		return false;
+	}
+
+	ret = dsdb_load_partition_usn(dns->samdb,
+				      dns->zone_ncs[i].nc_root,
+				      usn,
+				      NULL);
+	if (ret != LDB_SUCCESS || *usn == 0) {
+		return false;
+	}
+
+	return true;
+}
+
+static WERROR dns_lookup_records_cache(struct dns_server *dns,
+				       TALLOC_CTX *mem_ctx,
+				       struct ldb_dn *dn,
+				       bool wildcard,
+				       struct dnsp_DnssrvRpcRecord **records,
+				       uint16_t *rec_count)
+{
+	enum memcache_number n = wildcard ?
+		DNS_WILDCARD_RECORDS_CACHE : DNS_RECORDS_CACHE;
+	struct dns_cached_lookup *cached = NULL;
+	const char *casefold = NULL;
+	uint64_t usn = 0;
+	DATA_BLOB key;
+	WERROR werr;
+
+	if (!dns_records_cache_usn(dns, dn, &usn)) {
+		goto uncached;
+	}
+
+	casefold = ldb_dn_get_casefold(dn);
+	if (casefold == NULL) {
+		goto uncached;
+	}
+	key = data_blob_string_const(casefold);
+
+	cached = memcache_lookup_talloc(dns->record_cache, n, key);
+	if (cached != NULL && cached->usn == usn) {
+		return dns_cached_lookup_copy(mem_ctx, cached,
+					      records, rec_count);
+	}
+
+	/*
+	 * The USN was read before the search, a change racing with it
+	 * only makes the next lookup search again.
+	 */
+	cached = talloc_zero(dns, struct dns_cached_lookup);
+	if (cached == NULL) {
+		goto uncached;
+	}
+	cached->usn = usn;
+
+	if (wildcard) {
+		werr = dns_common_wildcard_lookup(dns->samdb, cached, dn,
+						  &cached->recs,
+						  &cached->rec_count);
+	} else {
+		werr = dns_common_lookup(dns->samdb, cached, dn,
+					 &cached->recs, &cached->rec_count,
+					 NULL);
+	}
+	if (!W_ERROR_IS_OK(werr) &&
+	    !W_ERROR_EQUAL(werr, WERR_DNS_ERROR_NAME_DOES_NOT_EXIST)) {
+		TALLOC_FREE(cached);
+		return werr;
+	}
+	cached->werr = werr;
+
+	werr = dns_cached_lookup_copy(mem_ctx, cached, records, rec_count);
+	memcache_add_talloc(dns->record_cache, n, key, &cached);
+	return werr;
+
+uncached:
+	if (wildcard) {
+		return dns_lookup_records_wildcard(dns, mem_ctx, dn,
+						   records, rec_count);
+	}
+	return dns_lookup_records(dns, mem_ctx, dn, records, rec_count);
+}
+
+/*
+ * As dns_lookup_records(), but answered from dns->record_cache where
+ * possible.  Only for use outside of a transaction, the callers get
+ * their own copy of the records.
+ */
+WERROR dns_lookup_records_cached(struct dns_server *dns,
+				 TALLOC_CTX *mem_ctx,
+				 struct ldb_dn *dn,
+				 struct dnsp_DnssrvRpcRecord **records,
+				 uint16_t *rec_count)
+{
+	return dns_lookup_records_cache(dns, mem_ctx, dn, false,
+					records, rec_count);
+}
+
+/*
+ * As dns_lookup_records_wildcard(), but answered from dns->record_cache
+ * where possible.
+ */
+WERROR dns_lookup_records_wildcard_cached(struct dns_server *dns,
+					  TALLOC_CTX *mem_ctx,
+					  struct ldb_dn *dn,
+					  struct dnsp_DnssrvRpcRecord **records,
+					  uint16_t *rec_count)
+{
+	return dns_lookup_records_cache(dns, mem_ctx, dn, true,
+					records, rec_count);
+}
+
 WERROR dns_replace_records(struct dns_server *dns,
 			   TALLOC_CTX *mem_ctx,
 			   struct ldb_dn *dn,
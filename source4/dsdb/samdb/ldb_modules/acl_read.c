@@ -37,6 +37,15 @@
 #include "librpc/gen_ndr/ndr_security.h"
 #include "param/param.h"
 #include "dsdb/samdb/ldb_modules/util.h"
+#include "lib/util/memcache.h"
+
+/*
+ * Upper bounds (in bytes) for the caches below. The SD cache is
+ * shared by all searches on this module, the access cache lives only
+ * for one search as its results depend on the user's token.
+ */
+#define ACLREAD_SD_CACHE_SIZE (4*1024*1024)
+#define ACLREAD_ACCESS_CACHE_SIZE (1024*1024)
 
 struct aclread_context {
 	struct ldb_module *module;
@@ -53,14 +62,49 @@ struct aclread_context {
 	/* cache on the last parent we checked in this search */
 	struct ldb_dn *last_parent_dn;
 	int last_parent_check_ret;
+
+	/* results of the attribute access checks done in this search */
+	struct memcache *access_cache;
 };
 
 struct aclread_private {
 	bool enabled;
 
-	/* cache of the last SD we read during any search */
-	struct security_descriptor *sd_cached;
-	struct ldb_val sd_cached_blob;
+	/* cache of the SDs we parsed during any search, keyed by the blob */
+	struct memcache *sd_cache;
+	uint64_t sd_serial;
+};
+
+/*
+ * A parsed nTSecurityDescriptor as held in the sd_cache
+ */
+struct aclread_sd {
+	struct security_descriptor *sd;
+
+	/*
+	 * Unique for every parse, used to key the access_cache so
+	 * that a recycled aclread_sd can never match stale results
+	 */
+	uint64_t serial;
+
+	/*
+	 * If the DACL has an ACE for PRINCIPAL_SELF the access check
+	 * result also depends on the objectSid of the object, so we
+	 * do not remember results against this SD.
+	 */
+	bool has_self_ace;
+};
+
+/*
+ * Key of the access_cache. The schema and the token are constant
+ * during a search, so the result of acl_check_access_on_attribute()
+ * only depends on these.
+ */
+struct aclread_access_key {
+	uint64_t sd_serial;
+	const struct dsdb_class *objectclass;
+	const struct dsdb_attribute *attr;
+	uint32_t access_mask;
 };
 
 static void aclread_mark_inaccesslible(struct ldb_message_element *el) {
@@ -152,23 +196,45 @@ static int aclread_check_parent(struct aclread_context *ac,
 	return ret;
 }
 
+static bool aclread_sd_has_self_ace(const struct security_descriptor *sd)
+{
+	struct dom_sid self_sid;
+	uint32_t i;
+
+	if (sd->dacl == NULL) {
+		return false;
+	}
+
+	dom_sid_parse(SID_NT_SELF, &self_sid);
+
+	for (i = 0; i < sd->dacl->num_aces; i++) {
+		if (dom_sid_equal(&sd->dacl->aces[i].trustee, &self_sid)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 /*
  * The sd returned from this function is valid until the next call on
  * this module context
  *
  * This helper function uses a cache on the module private data to
- * speed up repeated use of the same SD.
+ * speed up repeated use of the same SD. Most objects in a domain only
+ * carry the SD inherited from their container, so a large search
+ * typically parses just a handful of distinct SDs.
  */
 
 static int aclread_get_sd_from_ldb_message(struct aclread_context *ac,
 					   struct ldb_message *acl_res,
-					   struct security_descriptor **sd)
+					   struct aclread_sd **psd)
 {
 	struct ldb_message_element *sd_element;
 	struct ldb_context *ldb = ldb_module_get_ctx(ac->module);
 	struct aclread_private *private_data
 		= talloc_get_type(ldb_module_get_private(ac->module),
 				  struct aclread_private);
+	struct aclread_sd *entry = NULL;
 	enum ndr_err_code ndr_err;
 
 	sd_element = ldb_msg_find_element(acl_res, "nTSecurityDescriptor");
@@ -183,49 +249,103 @@ static int aclread_get_sd_from_ldb_message(struct aclread_context *ac,
 
 	/*
 	 * The time spent in ndr_pull_security_descriptor() is quite
-	 * expensive, so we check if this is the same binary blob as last
-	 * time, and if so return the memory tree from that previous parse.
+	 * expensive, so we check if we have seen this binary blob
+	 * before, and if so return the memory tree from that previous
+	 * parse.
 	 */
-
-	if (private_data->sd_cached != NULL &&
-	    private_data->sd_cached_blob.data != NULL &&
-	    ldb_val_equal_exact(&sd_element->values[0],
-				&private_data->sd_cached_blob)) {
-		*sd = private_data->sd_cached;
+	entry = memcache_lookup_talloc(private_data->sd_cache,
+				       ACLREAD_SD_CACHE,
+				       sd_element->values[0]);
+	if (entry != NULL) {
+		*psd = entry;
 		return LDB_SUCCESS;
 	}
 
-	*sd = talloc(private_data, struct security_descriptor);
-	if(!*sd) {
+	entry = talloc_zero(private_data, struct aclread_sd);
+	if (entry == NULL) {
 		return ldb_oom(ldb);
 	}
-	ndr_err = ndr_pull_struct_blob(&sd_element->values[0], *sd, *sd,
+	entry->sd = talloc(entry, struct security_descriptor);
+	if (entry->sd == NULL) {
+		TALLOC_FREE(entry);
+		return ldb_oom(ldb);
+	}
+	ndr_err = ndr_pull_struct_blob(&sd_element->values[0],
+				       entry->sd, entry->sd,
 			     (ndr_pull_flags_fn_t)ndr_pull_security_descriptor);
 
 	if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-		TALLOC_FREE(*sd);
+		TALLOC_FREE(entry);
 		return ldb_operr(ldb);
 	}
 
-	talloc_unlink(private_data, private_data->sd_cached_blob.data);
-	if (ac->added_nTSecurityDescriptor) {
-		private_data->sd_cached_blob = sd_element->values[0];
-		talloc_steal(private_data, sd_element->values[0].data);
-	} else {
-		private_data->sd_cached_blob = ldb_val_dup(private_data,
-							   &sd_element->values[0]);
-		if (private_data->sd_cached_blob.data == NULL) {
-			TALLOC_FREE(*sd);
-			return ldb_operr(ldb);
-		}
-	}
+	entry->serial = private_data->sd_serial++;
+	entry->has_self_ace = aclread_sd_has_self_ace(entry->sd);
 
-	talloc_unlink(private_data, private_data->sd_cached);
-	private_data->sd_cached = *sd;
+	/*
+	 * memcache_add_talloc() moves entry into the cache and
+	 * NULLs our pointer, the object itself stays valid until
+	 * it is evicted by a later add.
+	 */
+	*psd = entry;
+	memcache_add_talloc(private_data->sd_cache,
+			    ACLREAD_SD_CACHE,
+			    sd_element->values[0],
+			    &entry);
 
 	return LDB_SUCCESS;
 }
 
+/*
+ * Wrapper around acl_check_access_on_attribute() remembering the
+ * result for this search, so that every object sharing an SD costs a
+ * cache lookup per attribute rather than a walk over all of its ACEs.
+ */
+static int aclread_check_access_on_attribute(struct aclread_context *ac,
+					     TALLOC_CTX *mem_ctx,
+					     struct aclread_sd *sd,
+					     struct dom_sid *sid,
+					     uint32_t access_mask,
+					     const struct dsdb_attribute *attr,
+					     const struct dsdb_class *objectclass)
+{
+	struct aclread_access_key key;
+	DATA_BLOB key_blob = data_blob_const(&key, sizeof(key));
+	DATA_BLOB val;
+	int ret;
+
+	if (sd->has_self_ace) {
+		return acl_check_access_on_attribute(ac->module, mem_ctx,
+						     sd->sd, sid,
+						     access_mask, attr,
+						     objectclass);
+	}
+
+	ZERO_STRUCT(key);
+	key.sd_serial = sd->serial;
+	key.objectclass = objectclass;
+	key.attr = attr;
+	key.access_mask = access_mask;
+
+	if (memcache_lookup(ac->access_cache, ACLREAD_ACCESS_CACHE,
+			    key_blob, &val)) {
+		SMB_ASSERT(val.length == sizeof(ret));
+		memcpy(&ret, val.data, sizeof(ret));
+		return ret;
+	}
+
+	ret = acl_check_access_on_attribute(ac->module, mem_ctx, sd->sd, sid,
+					    access_mask, attr, objectclass);
+
+	/* Only definite answers are worth remembering */
+	if (ret == LDB_SUCCESS || ret == LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS) {
+		memcache_add(ac->access_cache, ACLREAD_ACCESS_CACHE,
+			     key_blob, data_blob_const(&ret, sizeof(ret)));
+	}
+
+	return ret;
+}
+
 /*
  * Returns the access mask required to read a given attribute
  */
@@ -267,7 +387,7 @@ struct parse_tree_aclread_ctx {
 	TALLOC_CTX *mem_ctx;
 	struct dom_sid *sid;
 	struct ldb_dn *dn;
-	struct security_descriptor *sd;
+	struct aclread_sd *sd;
 	const struct dsdb_class *objectclass;
 	bool suppress_result;
 };
@@ -277,7 +397,7 @@ struct parse_tree_aclread_ctx {
  */
 static int check_attr_access_rights(TALLOC_CTX *mem_ctx, const char *attr_name,
 				    struct aclread_context *ac,
-				    struct security_descriptor *sd,
+				    struct aclread_sd *sd,
 				    const struct dsdb_class *objectclass,
 				    struct dom_sid *sid, struct ldb_dn *dn)
 {
@@ -305,8 +425,8 @@ static int check_attr_access_rights(TALLOC_CTX *mem_ctx, const char *attr_name,
 		return LDB_SUCCESS;
 	}
 
-	ret = acl_check_access_on_attribute(ac->module, mem_ctx, sd, sid,
-					    access_mask, attr, objectclass);
+	ret = aclread_check_access_on_attribute(ac, mem_ctx, sd, sid,
+						access_mask, attr, objectclass);
 
 	if (ret == LDB_ERR_INSUFFICIENT_ACCESS_RIGHTS) {
 		return ret;
@@ -427,7 +547,7 @@ static int parse_tree_check_attr_access(struct ldb_parse_tree *tree,
  */
 static int check_search_ops_access(struct aclread_context *ac,
 				   TALLOC_CTX *mem_ctx,
-				   struct security_descriptor *sd,
+				   struct aclread_sd *sd,
 				   const struct dsdb_class *objectclass,
 				   struct dom_sid *sid, struct ldb_dn *dn,
 				   bool *suppress_result)
@@ -461,7 +581,7 @@ static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 	int ret;
 	size_t num_of_attrs = 0;
 	unsigned int i, k = 0;
-	struct security_descriptor *sd = NULL;
+	struct aclread_sd *sd = NULL;
 	struct dom_sid *sid = NULL;
 	TALLOC_CTX *tmp_ctx;
 	uint32_t instanceType;
@@ -576,13 +696,13 @@ static int aclread_callback(struct ldb_request *req, struct ldb_reply *ares)
 				continue;
 			}
 
-			ret = acl_check_access_on_attribute(ac->module,
-							    tmp_ctx,
-							    sd,
-							    sid,
-							    access_mask,
-							    attr,
-							    objectclass);
+			ret = aclread_check_access_on_attribute(ac,
+								tmp_ctx,
+								sd,
+								sid,
+								access_mask,
+								attr,
+								objectclass);
 
 			/*
 			 * Dirsync control needs the replpropertymetadata attribute
@@ -784,6 +904,10 @@ static int aclread_search(struct ldb_module *module, struct ldb_request *req)
 	ac->module = module;
 	ac->req = req;
 	ac->schema = dsdb_get_schema(ldb, req);
+	ac->access_cache = memcache_init(ac, ACLREAD_ACCESS_CACHE_SIZE);
+	if (ac->access_cache == NULL) {
+		return ldb_oom(ldb);
+	}
 	if (flags & DSDB_ACL_CHECKS_DIRSYNC_FLAG) {
 		ac->indirsync = true;
 	} else {
@@ -874,6 +998,11 @@ static int aclread_init(struct ldb_module *module)
 		return ldb_module_oom(module);
 	}
 	p->enabled = lpcfg_parm_bool(ldb_get_opaque(ldb, "loadparm"), NULL, "acl", "search", true);
+	p->sd_cache = memcache_init(p, ACLREAD_SD_CACHE_SIZE);
+	if (p->sd_cache == NULL) {
+		TALLOC_FREE(p);
+		return ldb_module_oom(module);
+	}
 	ldb_module_set_private(module, p);
 	return ldb_next_init(module);
 }
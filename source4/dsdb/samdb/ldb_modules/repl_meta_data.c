@@ -51,6 +51,7 @@
 #include "dsdb/samdb/ldb_modules/util.h"
 #include "lib/util/tsort.h"
 #include "lib/util/binsearch.h"
+#include "lib/util/rbtree.h"
 
 #undef strcasecmp
 
@@ -98,6 +99,12 @@ struct la_group {
 	struct la_entry *la_entries;
 };
 
+/*
+ * The minimum number of objects in an inbound replication chunk before
+ * we check for existing objects with one search for the whole chunk
+ */
+#define REPLMD_BULK_APPLY_MIN_OBJECTS 64
+
 struct la_entry {
 	struct la_entry *next, *prev;
 	struct drsuapi_DsReplicaLinkedAttribute *la;
@@ -126,6 +133,13 @@ struct replmd_replicated_request {
 	uint32_t index_current;
 	struct dsdb_extended_replicated_objects *objs;
 
+	/*
+	 * For large chunks of inbound objects, true for each object
+	 * we know doesn't exist locally yet (see
+	 * replmd_replicated_find_new_objects())
+	 */
+	bool *known_new;
+
 	struct ldb_message *search_msg;
 	struct GUID local_parent_guid;
 
@@ -148,6 +162,26 @@ typedef enum {
 	LINK_CHANGE_MODIFIED,
 } replmd_link_changed;
 
+/*
+ * Links added by replication while processing a single la_group.
+ *
+ * Inserting each new link straight into the msg element means a realloc,
+ * a memmove and a reparse of the whole parsed-DN list per link, which is
+ * quadratic for large groups.  Instead new links are kept in a tree,
+ * sorted the same way as the parsed-DN list (GUID, then extra_part), and
+ * merged into the element in a single pass once the group is processed.
+ */
+struct replmd_added_link {
+	struct rb_node rb_node;
+	struct parsed_dn pdn;
+	struct ldb_val val;
+};
+
+struct replmd_added_links {
+	struct rb_root tree;
+	unsigned int count;
+};
+
 static int replmd_replicated_apply_merge(struct replmd_replicated_request *ar);
 static int replmd_delete_internals(struct ldb_module *module, struct ldb_request *req, bool re_delete);
 static int replmd_check_upgrade_links(struct ldb_context *ldb,
@@ -6906,6 +6940,17 @@ static int replmd_replicated_apply_next(struct replmd_replicated_request *ar)
 	ar->search_msg = NULL;
 	ar->isDeleted = false;
 
+	/*
+	 * We already know this object doesn't exist locally, so go
+	 * straight to the ADD case of
+	 * replmd_replicated_apply_search_callback()
+	 */
+	if (ar->known_new != NULL && ar->known_new[ar->index_current]) {
+		ar->objs->objects[ar->index_current].local_parent_dn = NULL;
+		ar->objs->objects[ar->index_current].last_known_parent = NULL;
+		return replmd_replicated_apply_search_for_parent(ar);
+	}
+
 	tmp_str = GUID_buf_string(&ar->objs->objects[ar->index_current].object_guid,
 				  &guid_str_buf);
 
@@ -7417,6 +7462,173 @@ static int replmd_replicated_uptodate_vector(struct replmd_replicated_request *a
 
 
 
+static int replmd_guid_compare(const struct GUID *guid1, struct GUID guid2)
+{
+	return GUID_compare(guid1, &guid2);
+}
+
+/*
+ * Sorts indexes into the inbound objects by objectGUID, and the
+ * occurrences of the same objectGUID in the order they are applied
+ */
+static int replmd_object_index_compare(const uint32_t *idx1,
+				       const uint32_t *idx2,
+				       struct dsdb_extended_replicated_objects *objs)
+{
+	int ret;
+
+	ret = GUID_compare(&objs->objects[*idx1].object_guid,
+			   &objs->objects[*idx2].object_guid);
+	if (ret != 0) {
+		return ret;
+	}
+	if (*idx1 == *idx2) {
+		return 0;
+	}
+	return *idx1 < *idx2 ? -1 : 1;
+}
+
+/*
+ * Works out which of the inbound objects don't exist locally yet, with
+ * a single search of the partition. During an initial replication
+ * (e.g. a join) this is nearly every object, and saves a search per
+ * object in replmd_replicated_apply_next().
+ *
+ * Objects only come into existence when we apply them, so the answer
+ * stays valid for the whole chunk. Only worth it for large chunks, the
+ * incremental case usually sees just a few objects.
+ *
+ * There is no other bulk mode for joins, as the rest is already
+ * deferred to the end of the join:
+ *  - join_replicate() in python/samba/join.py wraps the whole
+ *    replication in one transaction, so the per chunk transaction of
+ *    dsdb_replicated_objects_commit() is nested and
+ *    ldb_transaction_prepare_commit()/ldb_transaction_commit() only
+ *    reach the modules when the join commits.
+ *  - ldb_kv keeps the index changes of a transaction in an in-memory
+ *    tdb (ldb_kv_index_transaction_start()) and writes each changed
+ *    index record once in ldb_kv_index_transaction_commit().
+ *  - The join opens sam.ldb with batch_mode, so
+ *    ldb_kv_sub_transaction_start() skips the per operation nested
+ *    transaction and its index copy.
+ *  - Linked attributes are queued on la_list and applied together in
+ *    replmd_prepare_commit().
+ * For replication by the drepl server each chunk is its own
+ * transaction, so the index is written out once per chunk.
+ */
+static int replmd_replicated_find_new_objects(struct replmd_replicated_request *ar)
+{
+	static const char * const attrs[] = { "objectGUID", NULL };
+	struct ldb_result *res = NULL;
+	struct GUID *found = NULL;
+	uint32_t *new_idx = NULL;
+	TALLOC_CTX *tmp_ctx = NULL;
+	char *filter = NULL;
+	uint32_t num_new = 0;
+	uint32_t num_dups = 0;
+	uint32_t i;
+	int ret;
+
+	if (ar->objs->num_objects < REPLMD_BULK_APPLY_MIN_OBJECTS) {
+		return LDB_SUCCESS;
+	}
+
+	tmp_ctx = talloc_new(ar);
+	if (tmp_ctx == NULL) {
+		return ldb_module_oom(ar->module);
+	}
+
+	filter = talloc_strdup(tmp_ctx, "(|");
+	for (i = 0; i < ar->objs->num_objects && filter != NULL; i++) {
+		struct GUID_txt_buf guid_str_buf;
+
+		filter = talloc_asprintf_append_buffer(
+			filter, "(objectGUID=%s)",
+			GUID_buf_string(&ar->objs->objects[i].object_guid,
+					&guid_str_buf));
+	}
+	if (filter != NULL) {
+		filter = talloc_strdup_append_buffer(filter, ")");
+	}
+	if (filter == NULL) {
+		TALLOC_FREE(tmp_ctx);
+		return ldb_module_oom(ar->module);
+	}
+
+	ret = dsdb_module_search(ar->module, tmp_ctx, &res,
+				 ar->objs->partition_dn, LDB_SCOPE_SUBTREE,
+				 attrs,
+				 DSDB_FLAG_NEXT_MODULE |
+				 DSDB_SEARCH_SHOW_RECYCLED,
+				 ar->req, "%s", filter);
+	if (ret != LDB_SUCCESS) {
+		/* Not fatal, we just search for each object instead */
+		DBG_NOTICE("Failed to search for %u inbound objects: %s\n",
+			   ar->objs->num_objects, ldb_strerror(ret));
+		TALLOC_FREE(tmp_ctx);
+		return LDB_SUCCESS;
+	}
+
+	found = talloc_array(tmp_ctx, struct GUID, res->count);
+	if (found == NULL) {
+		TALLOC_FREE(tmp_ctx);
+		return ldb_module_oom(ar->module);
+	}
+	for (i = 0; i < res->count; i++) {
+		found[i] = samdb_result_guid(res->msgs[i], "objectGUID");
+	}
+	TYPESAFE_QSORT(found, res->count, GUID_compare);
+
+	ar->known_new = talloc_array(ar, bool, ar->objs->num_objects);
+	if (ar->known_new == NULL) {
+		TALLOC_FREE(tmp_ctx);
+		return ldb_module_oom(ar->module);
+	}
+
+	new_idx = talloc_array(tmp_ctx, uint32_t, ar->objs->num_objects);
+	if (new_idx == NULL) {
+		TALLOC_FREE(tmp_ctx);
+		return ldb_module_oom(ar->module);
+	}
+
+	for (i = 0; i < ar->objs->num_objects; i++) {
+		struct GUID *match = NULL;
+
+		BINARY_ARRAY_SEARCH_V(found, res->count,
+				      &ar->objs->objects[i].object_guid,
+				      replmd_guid_compare, match);
+		ar->known_new[i] = (match == NULL);
+		if (ar->known_new[i]) {
+			new_idx[num_new++] = i;
+		}
+	}
+
+	/*
+	 * The same object can be sent more than once in a chunk. Only
+	 * its first occurrence is added, the later ones have to take
+	 * the search and merge path once it exists.
+	 */
+	LDB_TYPESAFE_QSORT(new_idx, num_new, ar->objs,
+			   replmd_object_index_compare);
+	for (i = 1; i < num_new; i++) {
+		const struct GUID *prev =
+			&ar->objs->objects[new_idx[i-1]].object_guid;
+		const struct GUID *cur =
+			&ar->objs->objects[new_idx[i]].object_guid;
+
+		if (GUID_equal(prev, cur)) {
+			ar->known_new[new_idx[i]] = false;
+			num_dups++;
+		}
+	}
+
+	DBG_DEBUG("%u of %u inbound objects are new\n",
+		  num_new - num_dups, ar->objs->num_objects);
+
+	TALLOC_FREE(tmp_ctx);
+	return LDB_SUCCESS;
+}
+
 static int replmd_extended_replicated_objects(struct ldb_module *module, struct ldb_request *req)
 {
 	struct ldb_context *ldb;
@@ -7480,6 +7692,11 @@ static int replmd_extended_replicated_objects(struct ldb_module *module, struct
 	ar->controls = req->controls;
 	req->controls = ctrls;
 
+	ret = replmd_replicated_find_new_objects(ar);
+	if (ret != LDB_SUCCESS) {
+		return ret;
+	}
+
 	return replmd_replicated_apply_next(ar);
 }
 
@@ -8111,6 +8328,128 @@ static int replmd_check_singleval_la_conflict(struct ldb_module *module,
 	return LDB_SUCCESS;
 }
 
+static int replmd_added_link_cmp(const struct GUID *guid,
+				 const DATA_BLOB *extra_part,
+				 const struct replmd_added_link *link)
+{
+	int cmp = ndr_guid_compare(guid, &link->pdn.guid);
+	if (cmp == 0) {
+		cmp = data_blob_cmp(extra_part, &link->pdn.dsdb_dn->extra_part);
+	}
+	return cmp;
+}
+
+/*
+ * Finds a link added earlier in the same la_group. If there is none, NULL
+ * is returned and *plink/*pparent are set to where it should be inserted.
+ */
+static struct replmd_added_link *replmd_added_link_find(
+	struct replmd_added_links *added,
+	const struct GUID *guid,
+	const DATA_BLOB *extra_part,
+	struct rb_node ***plink,
+	struct rb_node **pparent)
+{
+	struct rb_node **p = &added->tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p != NULL) {
+		struct replmd_added_link *link =
+			(struct replmd_added_link *)*p;
+		int cmp = replmd_added_link_cmp(guid, extra_part, link);
+
+		parent = *p;
+		if (cmp < 0) {
+			p = &(*p)->rb_left;
+		} else if (cmp > 0) {
+			p = &(*p)->rb_right;
+		} else {
+			return link;
+		}
+	}
+
+	*plink = p;
+	*pparent = parent;
+	return NULL;
+}
+
+/*
+ * Merges the links collected by replmd_process_linked_attribute() into
+ * old_el, keeping the values sorted. Each new link costs one binary search
+ * of pdn_list and the existing values are copied only once.
+ */
+static int replmd_merge_added_links(struct ldb_module *module,
+				    TALLOC_CTX *element_ctx,
+				    struct ldb_message_element *old_el,
+				    struct parsed_dn *pdn_list,
+				    struct replmd_added_links *added,
+				    const struct dsdb_attribute *attr)
+{
+	struct ldb_context *ldb = ldb_module_get_ctx(module);
+	struct ldb_val *values = NULL;
+	struct rb_node *node = NULL;
+	unsigned int i = 0;
+	unsigned int n = 0;
+	int ret;
+
+	if (added->count == 0) {
+		return LDB_SUCCESS;
+	}
+
+	values = talloc_array(element_ctx, struct ldb_val,
+			      old_el->num_values + added->count);
+	if (values == NULL) {
+		ldb_module_oom(module);
+		return LDB_ERR_OPERATIONS_ERROR;
+	}
+
+	for (node = rb_first(&added->tree); node != NULL; node = rb_next(node)) {
+		struct replmd_added_link *link =
+			(struct replmd_added_link *)node;
+		struct parsed_dn *exact = NULL;
+		struct parsed_dn *next = NULL;
+		unsigned int offset;
+
+		ret = parsed_dn_find(ldb, pdn_list, old_el->num_values,
+				     &link->pdn.guid,
+				     link->pdn.dsdb_dn->dn,
+				     link->pdn.dsdb_dn->extra_part, 0,
+				     &exact, &next,
+				     attr->syntax->ldap_oid,
+				     true);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+		if (exact != NULL) {
+			/* it was not there when we decided to add it */
+			return ldb_operr(ldb);
+		}
+
+		if (next == NULL) {
+			offset = old_el->num_values;
+		} else {
+			offset = next - pdn_list;
+		}
+		if (offset < i || offset > old_el->num_values) {
+			return ldb_operr(ldb);
+		}
+
+		for (; i < offset; i++) {
+			values[n++] = *pdn_list[i].v;
+		}
+		values[n++] = link->val;
+	}
+
+	for (; i < old_el->num_values; i++) {
+		values[n++] = *pdn_list[i].v;
+	}
+
+	old_el->values = values;
+	old_el->num_values = n;
+
+	return LDB_SUCCESS;
+}
+
 /**
  * Processes one linked attribute received via replication.
  * @param src_dn the DN of the source object for the link
@@ -8121,6 +8460,8 @@ static int replmd_check_singleval_la_conflict(struct ldb_module *module,
  * @param old_el the corresponding msg->element[] for the linked attribute
  * @param pdn_list a (binary-searchable) parsed DN array for the existing link
  * values in the msg. E.g. for a group, this is the existing members.
+ * @param added if not NULL, new links are collected here rather than being
+ * inserted into old_el, and must be merged with replmd_merge_added_links()
  * @param change what got modified: either nothing, an existing link value was
  * modified, or a new link value was added.
  * @returns LDB_SUCCESS if OK, an error otherwise
@@ -8135,6 +8476,7 @@ static int replmd_process_linked_attribute(struct ldb_module *module,
 					   struct ldb_message_element *old_el,
 					   TALLOC_CTX *element_ctx,
 					   struct parsed_dn *pdn_list,
+					   struct replmd_added_links *added,
 					   replmd_link_changed *change)
 {
 	struct drsuapi_DsReplicaLinkedAttribute *la = la_entry->la;
@@ -8150,6 +8492,9 @@ static int replmd_process_linked_attribute(struct ldb_module *module,
 	struct dsdb_dn *old_dsdb_dn = NULL;
 	struct ldb_val *val_to_update = NULL;
 	bool add_as_inactive = false;
+	struct replmd_added_link *added_link = NULL;
+	struct rb_node **added_rb_link = NULL;
+	struct rb_node *added_rb_parent = NULL;
 	WERROR status;
 
 	*change = LINK_CHANGE_NONE;
@@ -8192,6 +8537,17 @@ static int replmd_process_linked_attribute(struct ldb_module *module,
 		return ret;
 	}
 
+	/* or was added earlier in this group */
+	if (pdn == NULL && added != NULL && !GUID_all_zero(&guid)) {
+		added_link = replmd_added_link_find(added, &guid,
+						    &dsdb_dn->extra_part,
+						    &added_rb_link,
+						    &added_rb_parent);
+		if (added_link != NULL) {
+			pdn = &added_link->pdn;
+		}
+	}
+
 	if (!replmd_link_update_is_newer(pdn, la)) {
 		DEBUG(3,("Discarding older DRS linked attribute update to %s on %s from %s\n",
 			 old_el->name, ldb_dn_get_linearized(src_dn),
@@ -8240,6 +8596,29 @@ static int replmd_process_linked_attribute(struct ldb_module *module,
 		old_dsdb_dn = pdn->dsdb_dn;
 		*change = LINK_CHANGE_MODIFIED;
 
+	} else if (added_rb_link != NULL) {
+		/*
+		 * Keep the new link aside, it gets merged into old_el once
+		 * the whole group has been processed.
+		 */
+		added_link = talloc_zero(mem_ctx, struct replmd_added_link);
+		if (added_link == NULL) {
+			ldb_module_oom(module);
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+		added_link->pdn.guid = guid;
+		added_link->pdn.dsdb_dn = dsdb_dn;
+		added_link->pdn.v = &added_link->val;
+
+		rb_link_node(&added_link->rb_node, added_rb_parent,
+			     added_rb_link);
+		rb_insert_color(&added_link->rb_node, &added->tree);
+		added->count++;
+
+		val_to_update = &added_link->val;
+		old_dsdb_dn = NULL;
+		*change = LINK_CHANGE_ADDED;
+
 	} else {
 		unsigned offset;
 
@@ -8318,6 +8697,19 @@ static int replmd_process_linked_attribute(struct ldb_module *module,
 		}
 	}
 
+	if (added_link != NULL) {
+		/*
+		 * Reparse the value we just set, so a later update to the
+		 * same link in this group sees its current metadata
+		 */
+		ret = really_parse_trusted_dn(added_link, ldb,
+					      &added_link->pdn,
+					      attr->syntax->ldap_oid);
+		if (ret != LDB_SUCCESS) {
+			return ret;
+		}
+	}
+
 	ret = dsdb_check_single_valued_link(attr, old_el);
 	if (ret != LDB_SUCCESS) {
 		return ret;
@@ -8384,6 +8776,8 @@ static int replmd_process_la_group(struct ldb_module *module,
 	const struct dsdb_attribute *attr = NULL;
 	struct ldb_message_element *old_el = NULL;
 	struct parsed_dn *pdn_list = NULL;
+	struct replmd_added_links added;
+	struct replmd_added_links *added_ptr = NULL;
 	replmd_link_changed change_type;
 	uint32_t num_changes = 0;
 	time_t t;
@@ -8452,6 +8846,17 @@ static int replmd_process_la_group(struct ldb_module *module,
 		old_el->flags = LDB_FLAG_MOD_REPLACE;
 	}
 
+	/*
+	 * New links on multi-valued attributes are collected and merged in
+	 * one go at the end, so adding N links to a group of M members is
+	 * O(N log M + M) rather than O(N * M). Single-valued links need the
+	 * full list for conflict resolution, so they are added in place.
+	 */
+	ZERO_STRUCT(added);
+	if (!attr->isSingleValued) {
+		added_ptr = &added;
+	}
+
 	/*
 	 * go through and process the link target value(s) for this particular
 	 * source object and attribute. For optimization, the same msg is used
@@ -8462,6 +8867,8 @@ static int replmd_process_la_group(struct ldb_module *module,
 	 * pointers will be invalidated
 	 */
 	for (la = DLIST_TAIL(la_group->la_entries); la; la=prev) {
+		unsigned int num_added = added.count;
+
 		prev = DLIST_PREV(la);
 		DLIST_REMOVE(la_group->la_entries, la);
 
@@ -8485,17 +8892,20 @@ static int replmd_process_la_group(struct ldb_module *module,
 						      replmd_private,
 						      msg->dn, attr, la, NULL,
 						      msg->elements, old_el,
-						      pdn_list, &change_type);
+						      pdn_list, added_ptr,
+						      &change_type);
 		if (ret != LDB_SUCCESS) {
 			replmd_txn_cleanup(replmd_private);
 			return ret;
 		}
 
 		/*
-		 * Adding a link reallocs memory, and so invalidates all the
-		 * pointers in pdn_list. Reparse the PDNs on the next loop
+		 * Adding a link in place reallocs memory, and so invalidates
+		 * all the pointers in pdn_list. Reparse the PDNs on the next
+		 * loop
 		 */
-		if (change_type == LINK_CHANGE_ADDED) {
+		if (change_type == LINK_CHANGE_ADDED &&
+		    added.count == num_added) {
 			TALLOC_FREE(pdn_list);
 		}
 
@@ -8519,6 +8929,26 @@ static int replmd_process_la_group(struct ldb_module *module,
 		return LDB_SUCCESS;
 	}
 
+	if (added.count > 0) {
+		if (pdn_list == NULL) {
+			ret = get_parsed_dns_trusted_fallback(module,
+							replmd_private,
+							tmp_ctx, old_el,
+							&pdn_list,
+							attr->syntax->ldap_oid,
+							NULL);
+			if (ret != LDB_SUCCESS) {
+				return ret;
+			}
+		}
+		ret = replmd_merge_added_links(module, msg->elements, old_el,
+					       pdn_list, &added, attr);
+		if (ret != LDB_SUCCESS) {
+			replmd_txn_cleanup(replmd_private);
+			return ret;
+		}
+	}
+
 	/*
 	 * Note that adding the whenChanged/etc attributes below will realloc
 	 * msg->elements, invalidating the existing element/parsed-DN pointers
@@ -34,6 +34,7 @@ except ImportError:
 
 from samba.samdb import SamDB
 from samba.auth import system_session
+from samba.param import LoadParm
 from ldb import Message, MessageElement, Dn, LdbError
 from ldb import FLAG_MOD_ADD, FLAG_MOD_REPLACE, FLAG_MOD_DELETE
 from ldb import SCOPE_BASE, SCOPE_SUBTREE, SCOPE_ONELEVEL
@@ -71,6 +72,7 @@ class PerfTestException(Exception):
 
 BATCH_SIZE = 1000
 N_GROUPS = 5
+N_BIG_GROUP_MEMBERS = 50000
 
 
 class GlobalState(object):
@@ -80,6 +82,7 @@ class GlobalState(object):
     next_relinked_user = 0
     next_linked_user_3 = 0
     next_removed_link_0 = 0
+    big_group_dc = None
 
 
 class UserTests(samba.tests.TestCase):
@@ -131,20 +134,23 @@ class UserTests(samba.tests.TestCase):
                 "dn": "cn=u%d,%s" % (i, self.ou_users),
                 "objectclass": "user"})
 
-    def _test_join(self):
-        tmpdir = tempfile.mkdtemp()
+    def _server(self):
         if '://' in host:
-            server = host.split('://', 1)[1]
-        else:
-            server = host
+            return host.split('://', 1)[1]
+        return host
+
+    def _join(self, tmpdir):
         cmd = cmd_sambatool.subcommands['domain'].subcommands['join']
         result = cmd._run("samba-tool domain join",
                           creds.get_realm(),
                           "dc", "-U%s%%%s" % (creds.get_username(),
                                               creds.get_password()),
                           '--targetdir=%s' % tmpdir,
-                          '--server=%s' % server)
+                          '--server=%s' % self._server())
 
+    def _test_join(self):
+        tmpdir = tempfile.mkdtemp()
+        self._join(tmpdir)
         shutil.rmtree(tmpdir)
 
     def _test_unindexed_search(self):
@@ -293,6 +299,74 @@ class UserTests(samba.tests.TestCase):
     test_08_01_link_random_users_100_groups = _test_link_random_users_and_groups
     test_08_02_link_random_users_100_groups = _test_link_random_users_and_groups
 
+    def _add_members_in_batches(self, group, members, batch=BATCH_SIZE):
+        for s in range(0, len(members), batch):
+            m = Message()
+            m.dn = Dn(self.ldb, group)
+            m["member"] = MessageElement(members[s:s + batch],
+                                         FLAG_MOD_ADD, "member")
+            t = time.time()
+            self.ldb.modify(m)
+            print('adding members %d-%d took %s' %
+                  (s, s + batch, time.time() - t), file=sys.stderr)
+
+    def test_09_01_join_before_big_group(self):
+        # A DC that has the users and the empty group, so that
+        # test_09_03 replicates nothing but the new member links
+        group = "cn=big0,%s" % self.ou_groups
+        self.add_if_possible({
+            "dn": group,
+            "objectclass": "group"})
+        for i in range(N_BIG_GROUP_MEMBERS):
+            self.add_if_possible({
+                "dn": "cn=bu%d,%s" % (i, self.ou_users),
+                "objectclass": "user"})
+        self.state.big_group_dc = tempfile.mkdtemp()
+        self._join(self.state.big_group_dc)
+
+    def test_09_02_add_50k_members_in_batches(self):
+        group = "cn=big0,%s" % self.ou_groups
+        members = ["cn=bu%d,%s" % (i, self.ou_users)
+                   for i in range(N_BIG_GROUP_MEMBERS)]
+        # interleave the batches so each one lands all over the
+        # existing sorted member list rather than at one end
+        random.shuffle(members)
+        self._add_members_in_batches(group, members)
+
+    def test_09_03_replicate_50k_member_group(self):
+        # Pull the group into the DC joined in test_09_01. All 50k
+        # member links are new there, so this times how inbound
+        # replication applies them (replmd_process_la_group()).
+        tmpdir = self.state.big_group_dc
+        if tmpdir is None:
+            self.skipTest("test_09_01 did not join a DC")
+        self.state.big_group_dc = None
+        group = "cn=big0,%s" % self.ou_groups
+        smbconf = os.path.join(tmpdir, "etc", "smb.conf")
+        cmd = cmd_sambatool.subcommands['drs'].subcommands['replicate']
+        try:
+            t = time.time()
+            result = cmd._run("samba-tool drs replicate",
+                              "localhost", self._server(), group,
+                              "--local", "--single-object",
+                              "--configfile=%s" % smbconf,
+                              "-U%s%%%s" % (creds.get_username(),
+                                            creds.get_password()))
+            print('replicating %d members took %s' %
+                  (N_BIG_GROUP_MEMBERS, time.time() - t), file=sys.stderr)
+            self.assertIsNone(result)
+
+            local_lp = LoadParm()
+            local_lp.load(smbconf)
+            local = SamDB(url=local_lp.samdb_url(),
+                          session_info=system_session(local_lp),
+                          lp=local_lp)
+            res = local.search(group, scope=SCOPE_BASE,
+                               attrs=["member"])
+            self.assertEqual(len(res[0]["member"]), N_BIG_GROUP_MEMBERS)
+        finally:
+            shutil.rmtree(tmpdir)
+
     test_10_01_unindexed_search_full_dc = _test_unindexed_search
     test_10_02_indexed_search_full_dc = _test_indexed_search
     test_11_02_join_full_dc = _test_join
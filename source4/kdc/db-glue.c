@@ -37,6 +37,7 @@
 #include "kdc/db-glue.h"
 #include "librpc/gen_ndr/ndr_irpc_c.h"
 #include "lib/messaging/irpc.h"
+#include "lib/util/memcache.h"
 
 #undef strcasecmp
 #undef strncasecmp
@@ -48,6 +49,8 @@
 	((krb5_kvno)((((uint32_t)kvno) & 0xFFFF) | \
 	 ((((uint32_t)krbtgt) << 16) & 0xFFFF0000)))
 
+#define SAMBA_KDC_KEYS_CACHE_SIZE (1024*1024)
+
 enum samba_kdc_ent_type
 { SAMBA_KDC_ENT_TYPE_CLIENT, SAMBA_KDC_ENT_TYPE_SERVER,
   SAMBA_KDC_ENT_TYPE_KRBTGT, SAMBA_KDC_ENT_TYPE_TRUST, SAMBA_KDC_ENT_TYPE_ANY };
@@ -313,19 +316,60 @@ static int samba_kdc_sort_encryption_keys(struct sdb_entry_ex *entry_ex)
 	return 0;
 }
 
-static krb5_error_code samba_kdc_message2entry_keys(krb5_context context,
-						    struct samba_kdc_db_context *kdc_db_ctx,
-						    TALLOC_CTX *mem_ctx,
-						    struct ldb_message *msg,
-						    uint32_t rid,
-						    bool is_rodc,
-						    uint32_t userAccountControl,
-						    enum samba_kdc_ent_type ent_type,
-						    struct sdb_entry_ex *entry_ex)
+/*
+ * The keys of an account as found in unicodePwd and
+ * supplementalCredentials, before they are filtered by the supported
+ * encryption types and turned into sdb keys.
+ */
+struct samba_kdc_stored_key {
+	uint32_t keytype;
+	DATA_BLOB *value;
+};
+
+struct samba_kdc_stored_keys {
+	struct samr_Password *hash;
+	const char *salt;
+	uint32_t num_keys;
+	struct samba_kdc_stored_key *keys;
+};
+
+struct samba_kdc_keys_cache_key {
+	struct GUID guid;
+	uint64_t usn_changed;
+};
+
+static krb5_error_code samba_kdc_copy_stored_key(struct samba_kdc_stored_keys *keys,
+						 uint32_t keytype,
+						 const DATA_BLOB *value)
+{
+	struct samba_kdc_stored_key *key = &keys->keys[keys->num_keys++];
+
+	key->keytype = keytype;
+	if (value == NULL) {
+		return 0;
+	}
+
+	key->value = talloc_zero(keys->keys, DATA_BLOB);
+	if (key->value == NULL) {
+		return ENOMEM;
+	}
+	*key->value = data_blob_talloc(key->value, value->data, value->length);
+	if (key->value->data == NULL && value->length != 0) {
+		return ENOMEM;
+	}
+	talloc_keep_secret(key->value->data);
+
+	return 0;
+}
+
+static krb5_error_code samba_kdc_parse_stored_keys(krb5_context context,
+						   TALLOC_CTX *mem_ctx,
+						   struct ldb_message *msg,
+						   struct samba_kdc_stored_keys **_keys)
 {
 	krb5_error_code ret = 0;
 	enum ndr_err_code ndr_err;
-	struct samr_Password *hash;
+	struct samba_kdc_stored_keys *keys = NULL;
 	const struct ldb_val *sc_val;
 	struct supplementalCredentialsBlob scb;
 	struct supplementalCredentialsPackage *scpk = NULL;
@@ -333,8 +377,233 @@ static krb5_error_code samba_kdc_message2entry_keys(krb5_context context,
 	struct package_PrimaryKerberosBlob _pkb;
 	struct package_PrimaryKerberosCtr3 *pkb3 = NULL;
 	struct package_PrimaryKerberosCtr4 *pkb4 = NULL;
+	const char *salt = NULL;
+	TALLOC_CTX *tmp_ctx = NULL;
 	uint16_t i;
-	uint16_t allocated_keys = 0;
+
+	keys = talloc_zero(mem_ctx, struct samba_kdc_stored_keys);
+	if (keys == NULL) {
+		return ENOMEM;
+	}
+
+	tmp_ctx = talloc_new(keys);
+	if (tmp_ctx == NULL) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	keys->hash = samdb_result_hash(keys, msg, "unicodePwd");
+	if (keys->hash != NULL) {
+		talloc_keep_secret(keys->hash);
+	}
+
+	sc_val = ldb_msg_find_ldb_val(msg, "supplementalCredentials");
+
+	/* supplementalCredentials if present */
+	if (sc_val) {
+		ndr_err = ndr_pull_struct_blob_all(sc_val, tmp_ctx, &scb,
+						   (ndr_pull_flags_fn_t)ndr_pull_supplementalCredentialsBlob);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			dump_data(0, sc_val->data, sc_val->length);
+			ret = EINVAL;
+			goto out;
+		}
+
+		if (scb.sub.signature != SUPPLEMENTAL_CREDENTIALS_SIGNATURE) {
+			if (scb.sub.num_packages != 0) {
+				NDR_PRINT_DEBUG(supplementalCredentialsBlob, &scb);
+				ret = EINVAL;
+				goto out;
+			}
+		}
+
+		for (i=0; i < scb.sub.num_packages; i++) {
+			if (strcmp("Primary:Kerberos-Newer-Keys", scb.sub.packages[i].name) == 0) {
+				scpk = &scb.sub.packages[i];
+				if (!scpk->data || !scpk->data[0]) {
+					scpk = NULL;
+					continue;
+				}
+				newer_keys = true;
+				break;
+			} else if (strcmp("Primary:Kerberos", scb.sub.packages[i].name) == 0) {
+				scpk = &scb.sub.packages[i];
+				if (!scpk->data || !scpk->data[0]) {
+					scpk = NULL;
+				}
+				/*
+				 * we don't break here in hope to find
+				 * a Kerberos-Newer-Keys package
+				 */
+			}
+		}
+	}
+	/*
+	 * Primary:Kerberos-Newer-Keys or Primary:Kerberos element
+	 * of supplementalCredentials
+	 */
+	if (scpk) {
+		DATA_BLOB blob;
+
+		blob = strhex_to_data_blob(tmp_ctx, scpk->data);
+		if (!blob.data) {
+			ret = ENOMEM;
+			goto out;
+		}
+
+		/* we cannot use ndr_pull_struct_blob_all() here, as w2k and w2k3 add padding bytes */
+		ndr_err = ndr_pull_struct_blob(&blob, tmp_ctx, &_pkb,
+					       (ndr_pull_flags_fn_t)ndr_pull_package_PrimaryKerberosBlob);
+		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
+			ret = EINVAL;
+			krb5_set_error_message(context, ret, "samba_kdc_message2entry_keys: could not parse package_PrimaryKerberosBlob");
+			krb5_warnx(context, "samba_kdc_message2entry_keys: could not parse package_PrimaryKerberosBlob");
+			goto out;
+		}
+
+		if (newer_keys && _pkb.version != 4) {
+			ret = EINVAL;
+			krb5_set_error_message(context, ret, "samba_kdc_message2entry_keys: Primary:Kerberos-Newer-Keys not version 4");
+			krb5_warnx(context, "samba_kdc_message2entry_keys: Primary:Kerberos-Newer-Keys not version 4");
+			goto out;
+		}
+
+		if (!newer_keys && _pkb.version != 3) {
+			ret = EINVAL;
+			krb5_set_error_message(context, ret, "samba_kdc_message2entry_keys: could not parse Primary:Kerberos not version 3");
+			krb5_warnx(context, "samba_kdc_message2entry_keys: could not parse Primary:Kerberos not version 3");
+			goto out;
+		}
+
+		if (_pkb.version == 4) {
+			pkb4 = &_pkb.ctr.ctr4;
+			salt = pkb4->salt.string;
+			keys->keys = talloc_zero_array(keys,
+						       struct samba_kdc_stored_key,
+						       pkb4->num_keys);
+		} else if (_pkb.version == 3) {
+			pkb3 = &_pkb.ctr.ctr3;
+			salt = pkb3->salt.string;
+			keys->keys = talloc_zero_array(keys,
+						       struct samba_kdc_stored_key,
+						       pkb3->num_keys);
+		}
+		if (keys->keys == NULL) {
+			ret = ENOMEM;
+			goto out;
+		}
+	}
+
+	if (salt != NULL) {
+		keys->salt = talloc_strdup(keys, salt);
+		if (keys->salt == NULL) {
+			ret = ENOMEM;
+			goto out;
+		}
+	}
+
+	if (pkb4) {
+		/* TODO: maybe pass the iteration_count somehow... */
+		for (i=0; i < pkb4->num_keys; i++) {
+			ret = samba_kdc_copy_stored_key(keys,
+							pkb4->keys[i].keytype,
+							pkb4->keys[i].value);
+			if (ret != 0) {
+				goto out;
+			}
+		}
+	} else if (pkb3) {
+		for (i=0; i < pkb3->num_keys; i++) {
+			ret = samba_kdc_copy_stored_key(keys,
+							pkb3->keys[i].keytype,
+							pkb3->keys[i].value);
+			if (ret != 0) {
+				goto out;
+			}
+		}
+	}
+
+out:
+	TALLOC_FREE(tmp_ctx);
+	if (ret != 0) {
+		TALLOC_FREE(keys);
+		return ret;
+	}
+	*_keys = keys;
+	return 0;
+}
+
+/*
+ * Decoding supplementalCredentials is a large part of the cost of each
+ * AS-REQ and TGS-REQ, so the decoded keys are kept in a per-process cache.
+ * The cache key includes uSNChanged, so any change to the account, be it a
+ * password change or secrets replicated to an RODC, misses the old entry.
+ *
+ * The returned keys belong to the cache (or to mem_ctx if the account could
+ * not be cached) and must be used before the cache is touched again.
+ */
+static krb5_error_code samba_kdc_get_stored_keys(krb5_context context,
+						 struct samba_kdc_db_context *kdc_db_ctx,
+						 TALLOC_CTX *mem_ctx,
+						 struct ldb_message *msg,
+						 const struct samba_kdc_stored_keys **_keys)
+{
+	struct samba_kdc_keys_cache_key cache_key;
+	DATA_BLOB cache_blob = data_blob_const(&cache_key, sizeof(cache_key));
+	struct samba_kdc_stored_keys *keys = NULL;
+	bool cacheable;
+	krb5_error_code ret;
+
+	ZERO_STRUCT(cache_key);
+	cache_key.guid = samdb_result_guid(msg, "objectGUID");
+	cache_key.usn_changed = ldb_msg_find_attr_as_uint64(msg, "uSNChanged", 0);
+
+	cacheable = kdc_db_ctx->keys_cache != NULL &&
+		cache_key.usn_changed != 0 &&
+		!GUID_all_zero(&cache_key.guid);
+
+	if (cacheable) {
+		keys = memcache_lookup_talloc(kdc_db_ctx->keys_cache,
+					      KDC_KEYS_CACHE,
+					      cache_blob);
+		if (keys != NULL) {
+			*_keys = keys;
+			return 0;
+		}
+	}
+
+	ret = samba_kdc_parse_stored_keys(context, mem_ctx, msg, &keys);
+	if (ret != 0) {
+		return ret;
+	}
+
+	*_keys = keys;
+
+	if (cacheable) {
+		/* this moves keys into the cache and NULLs our pointer */
+		memcache_add_talloc(kdc_db_ctx->keys_cache,
+				    KDC_KEYS_CACHE,
+				    cache_blob,
+				    &keys);
+	}
+
+	return 0;
+}
+
+static krb5_error_code samba_kdc_message2entry_keys(krb5_context context,
+						    struct samba_kdc_db_context *kdc_db_ctx,
+						    TALLOC_CTX *mem_ctx,
+						    struct ldb_message *msg,
+						    uint32_t rid,
+						    bool is_rodc,
+						    uint32_t userAccountControl,
+						    enum samba_kdc_ent_type ent_type,
+						    struct sdb_entry_ex *entry_ex)
+{
+	krb5_error_code ret = 0;
+	const struct samba_kdc_stored_keys *stored = NULL;
+	uint32_t i;
+	uint32_t allocated_keys = 0;
 	int rodc_krbtgt_number = 0;
 	int kvno = 0;
 	uint32_t supported_enctypes
@@ -462,98 +731,22 @@ static krb5_error_code samba_kdc_message2entry_keys(krb5_context context,
 
 	/* Get keys from the db */
 
-	hash = samdb_result_hash(mem_ctx, msg, "unicodePwd");
-	sc_val = ldb_msg_find_ldb_val(msg, "supplementalCredentials");
+	ret = samba_kdc_get_stored_keys(context, kdc_db_ctx, mem_ctx, msg,
+					&stored);
+	if (ret != 0) {
+		goto out;
+	}
 
 	/* unicodePwd for enctype 0x17 (23) if present */
-	if (hash) {
+	if (stored->hash) {
 		allocated_keys++;
 	}
 
-	/* supplementalCredentials if present */
-	if (sc_val) {
-		ndr_err = ndr_pull_struct_blob_all(sc_val, mem_ctx, &scb,
-						   (ndr_pull_flags_fn_t)ndr_pull_supplementalCredentialsBlob);
-		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-			dump_data(0, sc_val->data, sc_val->length);
-			ret = EINVAL;
-			goto out;
-		}
-
-		if (scb.sub.signature != SUPPLEMENTAL_CREDENTIALS_SIGNATURE) {
-			if (scb.sub.num_packages != 0) {
-				NDR_PRINT_DEBUG(supplementalCredentialsBlob, &scb);
-				ret = EINVAL;
-				goto out;
-			}
-		}
-
-		for (i=0; i < scb.sub.num_packages; i++) {
-			if (strcmp("Primary:Kerberos-Newer-Keys", scb.sub.packages[i].name) == 0) {
-				scpk = &scb.sub.packages[i];
-				if (!scpk->data || !scpk->data[0]) {
-					scpk = NULL;
-					continue;
-				}
-				newer_keys = true;
-				break;
-			} else if (strcmp("Primary:Kerberos", scb.sub.packages[i].name) == 0) {
-				scpk = &scb.sub.packages[i];
-				if (!scpk->data || !scpk->data[0]) {
-					scpk = NULL;
-				}
-				/*
-				 * we don't break here in hope to find
-				 * a Kerberos-Newer-Keys package
-				 */
-			}
-		}
-	}
 	/*
 	 * Primary:Kerberos-Newer-Keys or Primary:Kerberos element
 	 * of supplementalCredentials
 	 */
-	if (scpk) {
-		DATA_BLOB blob;
-
-		blob = strhex_to_data_blob(mem_ctx, scpk->data);
-		if (!blob.data) {
-			ret = ENOMEM;
-			goto out;
-		}
-
-		/* we cannot use ndr_pull_struct_blob_all() here, as w2k and w2k3 add padding bytes */
-		ndr_err = ndr_pull_struct_blob(&blob, mem_ctx, &_pkb,
-					       (ndr_pull_flags_fn_t)ndr_pull_package_PrimaryKerberosBlob);
-		if (!NDR_ERR_CODE_IS_SUCCESS(ndr_err)) {
-			ret = EINVAL;
-			krb5_set_error_message(context, ret, "samba_kdc_message2entry_keys: could not parse package_PrimaryKerberosBlob");
-			krb5_warnx(context, "samba_kdc_message2entry_keys: could not parse package_PrimaryKerberosBlob");
-			goto out;
-		}
-
-		if (newer_keys && _pkb.version != 4) {
-			ret = EINVAL;
-			krb5_set_error_message(context, ret, "samba_kdc_message2entry_keys: Primary:Kerberos-Newer-Keys not version 4");
-			krb5_warnx(context, "samba_kdc_message2entry_keys: Primary:Kerberos-Newer-Keys not version 4");
-			goto out;
-		}
-
-		if (!newer_keys && _pkb.version != 3) {
-			ret = EINVAL;
-			krb5_set_error_message(context, ret, "samba_kdc_message2entry_keys: could not parse Primary:Kerberos not version 3");
-			krb5_warnx(context, "samba_kdc_message2entry_keys: could not parse Primary:Kerberos not version 3");
-			goto out;
-		}
-
-		if (_pkb.version == 4) {
-			pkb4 = &_pkb.ctr.ctr4;
-			allocated_keys += pkb4->num_keys;
-		} else if (_pkb.version == 3) {
-			pkb3 = &_pkb.ctr.ctr3;
-			allocated_keys += pkb3->num_keys;
-		}
-	}
+	allocated_keys += stored->num_keys;
 
 	if (allocated_keys == 0) {
 		if (kdc_db_ctx->rodc) {
@@ -577,13 +770,13 @@ static krb5_error_code samba_kdc_message2entry_keys(krb5_context context,
 		goto out;
 	}
 
-	if (hash && (supported_enctypes & ENC_RC4_HMAC_MD5)) {
+	if (stored->hash && (supported_enctypes & ENC_RC4_HMAC_MD5)) {
 		struct sdb_key key = {};
 
 		ret = smb_krb5_keyblock_init_contents(context,
 						      ENCTYPE_ARCFOUR_HMAC,
-						      hash->hash,
-						      sizeof(hash->hash),
+						      stored->hash->hash,
+						      sizeof(stored->hash->hash),
 						      &key.key);
 		if (ret) {
 			goto out;
@@ -593,120 +786,61 @@ static krb5_error_code samba_kdc_message2entry_keys(krb5_context context,
 		entry_ex->entry.keys.len++;
 	}
 
-	if (pkb4) {
-		for (i=0; i < pkb4->num_keys; i++) {
-			struct sdb_key key = {};
-
-			if (!pkb4->keys[i].value) continue;
-
-			if (!(kerberos_enctype_to_bitmap(pkb4->keys[i].keytype) & supported_enctypes)) {
-				continue;
-			}
+	for (i=0; i < stored->num_keys; i++) {
+		const struct samba_kdc_stored_key *skey = &stored->keys[i];
+		struct sdb_key key = {};
 
-			if (pkb4->salt.string) {
-				DATA_BLOB salt;
+		if (!skey->value) continue;
 
-				salt = data_blob_string_const(pkb4->salt.string);
+		if (!(kerberos_enctype_to_bitmap(skey->keytype) & supported_enctypes)) {
+			continue;
+		}
 
-				key.salt = calloc(1, sizeof(*key.salt));
-				if (key.salt == NULL) {
-					ret = ENOMEM;
-					goto out;
-				}
+		if (stored->salt) {
+			DATA_BLOB salt;
 
-				key.salt->type = KRB5_PW_SALT;
+			salt = data_blob_string_const(stored->salt);
 
-				ret = smb_krb5_copy_data_contents(&key.salt->salt,
-								  salt.data,
-								  salt.length);
-				if (ret) {
-					free(key.salt);
-					key.salt = NULL;
-					goto out;
-				}
+			key.salt = calloc(1, sizeof(*key.salt));
+			if (key.salt == NULL) {
+				ret = ENOMEM;
+				goto out;
 			}
 
-			/* TODO: maybe pass the iteration_count somehow... */
+			key.salt->type = KRB5_PW_SALT;
 
-			ret = smb_krb5_keyblock_init_contents(context,
-							      pkb4->keys[i].keytype,
-							      pkb4->keys[i].value->data,
-							      pkb4->keys[i].value->length,
-							      &key.key);
+			ret = smb_krb5_copy_data_contents(&key.salt->salt,
+							  salt.data,
+							  salt.length);
 			if (ret) {
-				if (key.salt) {
-					smb_krb5_free_data_contents(context, &key.salt->salt);
-					free(key.salt);
-					key.salt = NULL;
-				}
-				if (ret == KRB5_PROG_ETYPE_NOSUPP) {
-					DEBUG(2,("Unsupported keytype ignored - type %u\n",
-						 pkb4->keys[i].keytype));
-					ret = 0;
-					continue;
-				}
+				free(key.salt);
+				key.salt = NULL;
 				goto out;
 			}
-
-			entry_ex->entry.keys.val[entry_ex->entry.keys.len] = key;
-			entry_ex->entry.keys.len++;
 		}
-	} else if (pkb3) {
-		for (i=0; i < pkb3->num_keys; i++) {
-			struct sdb_key key = {};
-
-			if (!pkb3->keys[i].value) continue;
 
-			if (!(kerberos_enctype_to_bitmap(pkb3->keys[i].keytype) & supported_enctypes)) {
-				continue;
-			}
-
-			if (pkb3->salt.string) {
-				DATA_BLOB salt;
-
-				salt = data_blob_string_const(pkb3->salt.string);
-
-				key.salt = calloc(1, sizeof(*key.salt));
-				if (key.salt == NULL) {
-					ret = ENOMEM;
-					goto out;
-				}
-
-				key.salt->type = KRB5_PW_SALT;
-
-				ret = smb_krb5_copy_data_contents(&key.salt->salt,
-								  salt.data,
-								  salt.length);
-				if (ret) {
-					free(key.salt);
-					key.salt = NULL;
-					goto out;
-				}
+		ret = smb_krb5_keyblock_init_contents(context,
+						      skey->keytype,
+						      skey->value->data,
+						      skey->value->length,
+						      &key.key);
+		if (ret) {
+			if (key.salt) {
+				smb_krb5_free_data_contents(context, &key.salt->salt);
+				free(key.salt);
+				key.salt = NULL;
 			}
-
-			ret = smb_krb5_keyblock_init_contents(context,
-							      pkb3->keys[i].keytype,
-							      pkb3->keys[i].value->data,
-							      pkb3->keys[i].value->length,
-							      &key.key);
-			if (ret) {
-				if (key.salt) {
-					smb_krb5_free_data_contents(context, &key.salt->salt);
-					free(key.salt);
-					key.salt = NULL;
-				}
-				if (ret == KRB5_PROG_ETYPE_NOSUPP) {
-					DEBUG(2,("Unsupported keytype ignored - type %u\n",
-						 pkb3->keys[i].keytype));
-					ret = 0;
-					continue;
-				}
-				goto out;
+			if (ret == KRB5_PROG_ETYPE_NOSUPP) {
+				DEBUG(2,("Unsupported keytype ignored - type %u\n",
+					 skey->keytype));
+				ret = 0;
+				continue;
 			}
-
-			entry_ex->entry.keys.val[entry_ex->entry.keys.len] = key;
-			entry_ex->entry.keys.len++;
+			goto out;
 		}
+
+		entry_ex->entry.keys.val[entry_ex->entry.keys.len] = key;
+		entry_ex->entry.keys.len++;
 	}
 
 out:
@@ -1774,6 +1908,102 @@ static krb5_error_code samba_kdc_fetch_client(krb5_context context,
 	return ret;
 }
 
+/*
+ * The cached krbtgt message lives as long as the KDC, make sure its
+ * password hashes and keys are wiped when it is freed.
+ */
+static void samba_kdc_keep_secret_attrs(struct ldb_message *msg)
+{
+	static const char * const secret_attrs[] = {
+		DSDB_SECRET_ATTRIBUTES,
+		NULL
+	};
+	unsigned int i, j;
+
+	for (i = 0; i < msg->num_elements; i++) {
+		struct ldb_message_element *el = &msg->elements[i];
+
+		if (!is_attr_in_list(secret_attrs, el->name)) {
+			continue;
+		}
+		for (j = 0; j < el->num_values; j++) {
+			if (el->values[j].data != NULL) {
+				talloc_keep_secret(el->values[j].data);
+			}
+		}
+	}
+}
+
+/*
+ * Our own krbtgt is fetched for every TGS-REQ. Keep the last search
+ * result and hand out copies of it for as long as the uSNChanged of the
+ * krbtgt object is unchanged, as the keys cache does. The database
+ * sequence number would change with every logon that updates
+ * lastLogon or logonCount. Finding uSNChanged is a base search for a
+ * single attribute, much cheaper than the full search with its
+ * constructed attributes.
+ */
+static int samba_kdc_search_my_krbtgt(struct samba_kdc_db_context *kdc_db_ctx,
+				      TALLOC_CTX *mem_ctx,
+				      struct ldb_message **_msg)
+{
+	static const char * const usn_attrs[] = { "uSNChanged", NULL };
+	struct ldb_message *msg = NULL;
+	uint64_t usn_changed = 0;
+	int lret;
+
+	if (kdc_db_ctx->krbtgt_msg != NULL) {
+		lret = dsdb_search_one(kdc_db_ctx->samdb, mem_ctx,
+				       &msg, kdc_db_ctx->krbtgt_dn,
+				       LDB_SCOPE_BASE, usn_attrs,
+				       DSDB_SEARCH_NO_GLOBAL_CATALOG,
+				       "(objectClass=user)");
+		if (lret == LDB_SUCCESS) {
+			usn_changed = ldb_msg_find_attr_as_uint64(
+				msg, "uSNChanged", 0);
+		}
+		TALLOC_FREE(msg);
+	}
+
+	if (usn_changed != 0 &&
+	    kdc_db_ctx->krbtgt_usn_changed == usn_changed) {
+		msg = ldb_msg_copy(mem_ctx, kdc_db_ctx->krbtgt_msg);
+		if (msg == NULL) {
+			return LDB_ERR_OPERATIONS_ERROR;
+		}
+		*_msg = msg;
+		return LDB_SUCCESS;
+	}
+
+	TALLOC_FREE(kdc_db_ctx->krbtgt_msg);
+	kdc_db_ctx->krbtgt_usn_changed = 0;
+
+	lret = dsdb_search_one(kdc_db_ctx->samdb, mem_ctx,
+			       &msg, kdc_db_ctx->krbtgt_dn, LDB_SCOPE_BASE,
+			       krbtgt_attrs, DSDB_SEARCH_NO_GLOBAL_CATALOG,
+			       "(objectClass=user)");
+	if (lret != LDB_SUCCESS) {
+		return lret;
+	}
+
+	/*
+	 * The uSNChanged of the result itself is the key, a write
+	 * racing with the search only makes the next lookup search
+	 * again.
+	 */
+	usn_changed = ldb_msg_find_attr_as_uint64(msg, "uSNChanged", 0);
+	if (usn_changed != 0) {
+		kdc_db_ctx->krbtgt_msg = ldb_msg_copy(kdc_db_ctx, msg);
+		if (kdc_db_ctx->krbtgt_msg != NULL) {
+			samba_kdc_keep_secret_attrs(kdc_db_ctx->krbtgt_msg);
+			kdc_db_ctx->krbtgt_usn_changed = usn_changed;
+		}
+	}
+
+	*_msg = msg;
+	return LDB_SUCCESS;
+}
+
 static krb5_error_code samba_kdc_fetch_krbtgt(krb5_context context,
 					      struct samba_kdc_db_context *kdc_db_ctx,
 					      TALLOC_CTX *mem_ctx,
@@ -1828,10 +2058,8 @@ static krb5_error_code samba_kdc_fetch_krbtgt(krb5_context context,
 		}
 
 		if (krbtgt_number == kdc_db_ctx->my_krbtgt_number) {
-			lret = dsdb_search_one(kdc_db_ctx->samdb, mem_ctx,
-					       &msg, kdc_db_ctx->krbtgt_dn, LDB_SCOPE_BASE,
-					       krbtgt_attrs, DSDB_SEARCH_NO_GLOBAL_CATALOG,
-					       "(objectClass=user)");
+			lret = samba_kdc_search_my_krbtgt(kdc_db_ctx, mem_ctx,
+							  &msg);
 		} else {
 			/* We need to look up an RODC krbtgt (perhaps
 			 * ours, if we are an RODC, perhaps another
@@ -2755,6 +2983,13 @@ NTSTATUS samba_kdc_setup_db_ctx(TALLOC_CTX *mem_ctx, struct samba_kdc_base_conte
 	kdc_db_ctx->lp_ctx = base_ctx->lp_ctx;
 	kdc_db_ctx->msg_ctx = base_ctx->msg_ctx;
 
+	kdc_db_ctx->keys_cache = memcache_init(kdc_db_ctx,
+					       SAMBA_KDC_KEYS_CACHE_SIZE);
+	if (kdc_db_ctx->keys_cache == NULL) {
+		talloc_free(kdc_db_ctx);
+		return NT_STATUS_NO_MEMORY;
+	}
+
 	/* get default kdc policy */
 	lpcfg_default_kdc_policy(mem_ctx,
 				 base_ctx->lp_ctx,
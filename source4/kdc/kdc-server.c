@@ -22,6 +22,7 @@
 */
 
 #include "includes.h"
+#include "system/network.h"
 #include "param/param.h"
 #include "smbd/process_model.h"
 #include "lib/tsocket/tsocket.h"
@@ -111,6 +112,8 @@ static void kdc_udp_call_loop(struct tevent_req *subreq)
 	int sys_errno;
 	kdc_code ret;
 
+	sock->recvfrom_req = NULL;
+
 	call = talloc(sock, struct kdc_udp_call);
 	if (call == NULL) {
 		talloc_free(call);
@@ -194,6 +197,7 @@ done:
 		return;
 	}
 	tevent_req_set_callback(subreq, kdc_udp_call_loop, sock);
+	sock->recvfrom_req = subreq;
 }
 
 static void kdc_udp_call_proxy_done(struct tevent_req *subreq)
@@ -539,6 +543,182 @@ static const struct stream_server_ops kdc_tcp_stream_ops = {
 	.send_handler		= kdc_tcp_send
 };
 
+/*
+ * Open a UDP socket on the given address with SO_REUSEPORT set, so
+ * each prefork worker can receive on a socket of its own.
+ */
+static int kdc_udp_reuseport_socket(TALLOC_CTX *mem_ctx,
+				    const struct tsocket_address *address,
+				    struct tdgram_context **dgram,
+				    int *_fd)
+{
+	struct sockaddr_storage ss;
+	ssize_t sa_len;
+	int val = 1;
+	int saved_errno;
+	int fd;
+	int ret;
+
+	sa_len = tsocket_address_bsd_sockaddr(address,
+					      (struct sockaddr *)(void *)&ss,
+					      sizeof(ss));
+	if (sa_len == -1) {
+		return -1;
+	}
+
+	fd = socket(ss.ss_family, SOCK_DGRAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+
+	ret = set_blocking(fd, false);
+	if (ret == -1) {
+		goto fail;
+	}
+	smb_set_close_on_exec(fd);
+
+#ifdef HAVE_IPV6
+	if (ss.ss_family == AF_INET6) {
+		ret = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY,
+				 (const void *)&val, sizeof(val));
+		if (ret == -1) {
+			goto fail;
+		}
+	}
+#endif
+
+#ifdef SO_REUSEPORT
+	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+			 (const void *)&val, sizeof(val));
+#else
+	errno = ENOSYS;
+	ret = -1;
+#endif
+	if (ret == -1) {
+		goto fail;
+	}
+
+	ret = bind(fd, (struct sockaddr *)(void *)&ss, sa_len);
+	if (ret == -1) {
+		goto fail;
+	}
+
+	ret = tdgram_bsd_existing_socket(mem_ctx, fd, dgram);
+	if (ret == -1) {
+		goto fail;
+	}
+
+	*_fd = fd;
+	return 0;
+
+fail:
+	saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+/*
+ * Called in the prefork master before it forks the workers: open a
+ * SO_REUSEPORT socket on our address for each worker but the first,
+ * which uses our own socket, like stream_reuseport_prepare() does for
+ * the TCP listeners.
+ */
+static NTSTATUS kdc_udp_reuseport_prepare(void *private_data,
+					  unsigned num_workers,
+					  int *fd)
+{
+	struct kdc_udp_socket *sock =
+		talloc_get_type_abort(private_data, struct kdc_udp_socket);
+	unsigned i;
+
+	if (sock->worker_dgrams != NULL || num_workers == 0) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	sock->worker_dgrams = talloc_zero_array(sock,
+						struct tdgram_context *,
+						num_workers);
+	NT_STATUS_HAVE_NO_MEMORY(sock->worker_dgrams);
+
+	sock->worker_dgrams[0] = sock->dgram;
+	sock->num_worker_dgrams = 1;
+
+	for (i = 1; i < num_workers; i++) {
+		struct tdgram_context *dgram = NULL;
+		int worker_fd;
+		int ret;
+
+		ret = kdc_udp_reuseport_socket(sock->worker_dgrams,
+					       sock->kdc_socket->local_address,
+					       &dgram,
+					       &worker_fd);
+		if (ret != 0) {
+			NTSTATUS status = map_nt_error_from_unix_common(errno);
+			DBG_ERR("Failed to bind to %s UDP - %s\n",
+				tsocket_address_string(
+					sock->kdc_socket->local_address,
+					sock),
+				nt_errstr(status));
+			return status;
+		}
+
+		sock->worker_dgrams[i] = dgram;
+		sock->num_worker_dgrams++;
+	}
+
+	*fd = sock->reuseport_fd;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Called in a newly forked worker: receive on the socket of our
+ * instance only and close our copies of the others, so the kernel
+ * hands each request to one worker instead of waking all of them.
+ */
+static NTSTATUS kdc_udp_reuseport_select(void *private_data,
+					 unsigned instance)
+{
+	struct kdc_udp_socket *sock =
+		talloc_get_type_abort(private_data, struct kdc_udp_socket);
+	struct tdgram_context *dgram = NULL;
+	struct tevent_req *subreq = NULL;
+	unsigned i;
+
+	if (sock->num_worker_dgrams == 0) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	i = instance % sock->num_worker_dgrams;
+	dgram = sock->worker_dgrams[i];
+
+	if (dgram != sock->dgram) {
+		subreq = tdgram_recvfrom_send(sock,
+					      sock->kdc_socket->kdc->task->event_ctx,
+					      dgram);
+		NT_STATUS_HAVE_NO_MEMORY(subreq);
+		tevent_req_set_callback(subreq, kdc_udp_call_loop, sock);
+
+		/* this closes our copy of the inherited socket */
+		TALLOC_FREE(sock->recvfrom_req);
+		TALLOC_FREE(sock->dgram);
+
+		sock->dgram = talloc_steal(sock, dgram);
+		sock->recvfrom_req = subreq;
+	}
+
+	/* this closes our copies of the sockets of the other workers */
+	TALLOC_FREE(sock->worker_dgrams);
+	sock->num_worker_dgrams = 0;
+
+	return NT_STATUS_OK;
+}
+
+static const struct process_model_listener_ops kdc_udp_reuseport_ops = {
+	.prepare	= kdc_udp_reuseport_prepare,
+	.select		= kdc_udp_reuseport_select,
+};
+
 /*
  * Start listening on the given address
  */
@@ -554,6 +734,7 @@ NTSTATUS kdc_add_socket(struct kdc_server *kdc,
 	struct kdc_udp_socket *kdc_udp_socket;
 	struct tevent_req *udpsubreq;
 	NTSTATUS status;
+	bool reuseport = false;
 	int ret;
 
 	kdc_socket = talloc(kdc, struct kdc_socket);
@@ -588,15 +769,31 @@ NTSTATUS kdc_add_socket(struct kdc_server *kdc,
 		}
 	}
 
-	kdc_udp_socket = talloc(kdc_socket, struct kdc_udp_socket);
+	kdc_udp_socket = talloc_zero(kdc_socket, struct kdc_udp_socket);
 	NT_STATUS_HAVE_NO_MEMORY(kdc_udp_socket);
 
 	kdc_udp_socket->kdc_socket = kdc_socket;
+	kdc_udp_socket->reuseport_fd = -1;
 
-	ret = tdgram_inet_udp_socket(kdc_socket->local_address,
-				     NULL,
-				     kdc_udp_socket,
-				     &kdc_udp_socket->dgram);
+#ifdef SO_REUSEPORT
+	/*
+	 * Like the TCP listeners, give every prefork worker its own UDP
+	 * socket instead of all of them receiving on the inherited one.
+	 */
+	reuseport = process_model_reuseport();
+#endif
+
+	if (reuseport) {
+		ret = kdc_udp_reuseport_socket(kdc_udp_socket,
+					       kdc_socket->local_address,
+					       &kdc_udp_socket->dgram,
+					       &kdc_udp_socket->reuseport_fd);
+	} else {
+		ret = tdgram_inet_udp_socket(kdc_socket->local_address,
+					     NULL,
+					     kdc_udp_socket,
+					     &kdc_udp_socket->dgram);
+	}
 	if (ret != 0) {
 		status = map_nt_error_from_unix_common(errno);
 		DEBUG(0,("Failed to bind to %s:%u UDP - %s\n",
@@ -613,6 +810,16 @@ NTSTATUS kdc_add_socket(struct kdc_server *kdc,
 					 kdc_udp_socket->dgram);
 	NT_STATUS_HAVE_NO_MEMORY(udpsubreq);
 	tevent_req_set_callback(udpsubreq, kdc_udp_call_loop, kdc_udp_socket);
+	kdc_udp_socket->recvfrom_req = udpsubreq;
+
+	if (reuseport) {
+		status = process_model_add_listener(kdc_udp_socket,
+						    &kdc_udp_reuseport_ops,
+						    kdc_udp_socket);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
 
 	return NT_STATUS_OK;
 }
@@ -70,6 +70,15 @@ struct kdc_udp_socket {
 	struct kdc_socket *kdc_socket;
 	struct tdgram_context *dgram;
 	struct tevent_queue *send_queue;
+	struct tevent_req *recvfrom_req;
+	/* only used for sockets opened with SO_REUSEPORT */
+	int reuseport_fd;
+	/*
+	 * the sockets of the prefork workers in the order they joined
+	 * the SO_REUSEPORT group, worker_dgrams[0] is dgram
+	 */
+	struct tdgram_context **worker_dgrams;
+	unsigned num_worker_dgrams;
 };
 
 NTSTATUS kdc_add_socket(struct kdc_server *kdc,
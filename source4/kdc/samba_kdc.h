@@ -48,6 +48,9 @@ struct samba_kdc_db_context {
 	unsigned int my_krbtgt_number;
 	struct ldb_dn *krbtgt_dn;
 	struct samba_kdc_policy policy;
+	struct memcache *keys_cache;
+	struct ldb_message *krbtgt_msg;
+	uint64_t krbtgt_usn_changed;
 };
 
 struct samba_kdc_entry {
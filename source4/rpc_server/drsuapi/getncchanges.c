@@ -40,6 +40,9 @@
 #include "lib/dbwrap/dbwrap.h"
 #include "lib/dbwrap/dbwrap_rbt.h"
 #include "librpc/gen_ndr/ndr_misc.h"
+#include "libcli/ldap/ldap_ndr.h"
+#include "librpc/gen_ndr/ndr_irpc.h"
+#include "lib/messaging/irpc.h"
 
 #undef DBGC_CLASS
 #define DBGC_CLASS            DBGC_DRS_REPL
@@ -48,6 +51,12 @@
 #define DEFAULT_MAX_OBJECTS 1000
 #define DEFAULT_MAX_LINKS   1500
 
+/*
+ * The number of objects (or link targets) we fetch from the DB with a
+ * single search, rather than one base search per GUID
+ */
+#define GETNCCHANGES_PREFETCH_COUNT 100
+
 /*
  * state of a partially-completed replication cycle. This state persists
  * over multiple calls to dcesrv_drsuapi_DsGetNCChanges()
@@ -72,11 +81,67 @@ struct drsuapi_getncchanges_state {
 	uint32_t la_count;
 	uint32_t la_idx;
 
+	/*
+	 * cache of link targets we've already checked for existence
+	 * (for inactive links), keyed by GUID
+	 */
+	struct db_context *la_target_cache;
+
 	/* these are just used for debugging the replication's progress */
 	uint32_t links_given;
 	uint32_t total_links;
+	uint32_t objects_given;
+	struct timeval start_time;
 };
 
+/*
+ * DsGetNCChanges counters of this process, returned by the
+ * drsuapi_getncchanges_info IRPC call
+ */
+static struct drsuapi_getncchanges_stats getncchanges_stats;
+static pid_t getncchanges_stats_pid;
+
+static NTSTATUS getncchanges_info(struct irpc_message *msg,
+				  struct drsuapi_getncchanges_info *r)
+{
+	*r->out.stats = getncchanges_stats;
+	r->out.result = NT_STATUS_OK;
+
+	return NT_STATUS_OK;
+}
+
+/*
+ * Make the counters available as "drsuapi_server". The RPC server may
+ * fork a process per connection, so this is done once per process,
+ * which only counts its own replies.
+ */
+static void getncchanges_stats_register(struct imessaging_context *msg_ctx)
+{
+	NTSTATUS status;
+
+	if (getncchanges_stats_pid == getpid()) {
+		return;
+	}
+
+	status = IRPC_REGISTER(msg_ctx, irpc, DRSUAPI_GETNCCHANGES_INFO,
+			       getncchanges_info, NULL);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("Failed to register drsuapi_getncchanges_info: "
+			    "%s\n", nt_errstr(status));
+		return;
+	}
+
+	status = irpc_add_name(msg_ctx, "drsuapi_server");
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_WARNING("Failed to register drsuapi_server: %s\n",
+			    nt_errstr(status));
+		return;
+	}
+
+	ZERO_STRUCT(getncchanges_stats);
+	getncchanges_stats_pid = getpid();
+}
+
 /* We must keep the GUIDs in NDR form for sorting */
 struct la_for_sorting {
 	const struct drsuapi_DsReplicaLinkedAttribute *link;
@@ -721,6 +786,11 @@ static WERROR get_nc_changes_build_object(struct drsuapi_DsReplicaObjectListItem
 	return WERR_OK;
 }
 
+static WERROR dcesrv_drsuapi_obj_cache_add(struct db_context *obj_cache,
+					   const struct GUID *guid);
+static WERROR dcesrv_drsuapi_obj_cache_exists(struct db_context *obj_cache,
+					      const struct GUID *guid);
+
 /*
   add one linked attribute from an object to the list of linked
   attributes in a getncchanges request
@@ -733,7 +803,8 @@ static WERROR get_nc_changes_add_la(TALLOC_CTX *mem_ctx,
 				    struct dsdb_dn *dsdb_dn,
 				    struct drsuapi_DsReplicaLinkedAttribute **la_list,
 				    uint32_t *la_count,
-				    bool is_schema_nc)
+				    bool is_schema_nc,
+				    struct db_context *la_target_cache)
 {
 	struct drsuapi_DsReplicaLinkedAttribute *la;
 	bool active;
@@ -793,16 +864,36 @@ static WERROR get_nc_changes_add_la(TALLOC_CTX *mem_ctx,
 				sa->lDAPDisplayName, ldb_dn_get_linearized(msg->dn)));
 			return ntstatus_to_werror(status);
 		}
-		ret = dsdb_find_dn_by_guid(sam_ctx, mem_ctx, &guid, 0, &tdn);
-		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
-			DEBUG(2, (" Search of guid %s returned 0 objects, skipping it !\n",
-						GUID_string(mem_ctx, &guid)));
-			return WERR_OK;
-		} else if (ret != LDB_SUCCESS) {
-			DEBUG(0, (__location__ " Search of guid %s failed with error code %d\n",
-						GUID_string(mem_ctx, &guid),
-						ret));
-			return WERR_OK;
+
+		/*
+		 * Many inactive links (e.g. removed group members)
+		 * tend to point at the same few targets, so remember
+		 * the targets we've already found during this cycle
+		 */
+		werr = WERR_OBJECT_NOT_FOUND;
+		if (la_target_cache != NULL) {
+			werr = dcesrv_drsuapi_obj_cache_exists(la_target_cache,
+							       &guid);
+		}
+		if (!W_ERROR_EQUAL(werr, WERR_OBJECT_NAME_EXISTS)) {
+			ret = dsdb_find_dn_by_guid(sam_ctx, mem_ctx, &guid, 0, &tdn);
+			if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+				DEBUG(2, (" Search of guid %s returned 0 objects, skipping it !\n",
+							GUID_string(mem_ctx, &guid)));
+				return WERR_OK;
+			} else if (ret != LDB_SUCCESS) {
+				DEBUG(0, (__location__ " Search of guid %s failed with error code %d\n",
+							GUID_string(mem_ctx, &guid),
+							ret));
+				return WERR_OK;
+			}
+			TALLOC_FREE(tdn);
+
+			if (la_target_cache != NULL) {
+				werr = dcesrv_drsuapi_obj_cache_add(la_target_cache,
+								    &guid);
+				W_ERROR_NOT_OK_RETURN(werr);
+			}
 		}
 	}
 	la->attid = dsdb_attribute_get_attid(sa, is_schema_nc);
@@ -860,7 +951,8 @@ static WERROR get_nc_changes_add_links(struct ldb_context *sam_ctx,
 				       const struct ldb_message *msg,
 				       struct drsuapi_DsReplicaLinkedAttribute **la_list,
 				       uint32_t *la_count,
-				       struct drsuapi_DsReplicaCursorCtrEx *uptodateness_vector)
+				       struct drsuapi_DsReplicaCursorCtrEx *uptodateness_vector,
+				       struct db_context *la_target_cache)
 {
 	unsigned int i;
 	TALLOC_CTX *tmp_ctx = NULL;
@@ -952,7 +1044,8 @@ static WERROR get_nc_changes_add_links(struct ldb_context *sam_ctx,
 
 			werr = get_nc_changes_add_la(mem_ctx, sam_ctx, schema,
 						     sa, msg, dsdb_dn, la_list,
-						     la_count, is_schema_nc);
+						     la_count, is_schema_nc,
+						     la_target_cache);
 			if (!W_ERROR_IS_OK(werr)) {
 				talloc_free(tmp_ctx);
 				return werr;
@@ -2445,6 +2538,189 @@ static bool getncchanges_chunk_is_full(struct getncchanges_repl_chunk *repl_chun
 	return chunk_full;
 }
 
+/**
+ * Fetches the objects for a batch of GUIDs with a single search of the NC,
+ * rather than one base search per GUID. On return (*_msgs)[i] holds the
+ * object for guids[i], or NULL if the batch search didn't find it. The
+ * caller should then fall back to a base search on the GUID, which gives
+ * the definitive answer (e.g. the object may have been expunged).
+ */
+static WERROR getncchanges_prefetch_objects(struct ldb_context *sam_ctx,
+					    TALLOC_CTX *mem_ctx,
+					    struct ldb_dn *ncRoot_dn,
+					    const struct GUID *guids,
+					    uint32_t count,
+					    const char * const *attrs,
+					    struct ldb_message ***_msgs)
+{
+	TALLOC_CTX *tmp_ctx = NULL;
+	struct ldb_message **msgs = NULL;
+	struct ldb_result *res = NULL;
+	char *filter = NULL;
+	uint32_t i, j;
+	int ret;
+
+	*_msgs = NULL;
+
+	msgs = talloc_zero_array(mem_ctx, struct ldb_message *, count);
+	W_ERROR_HAVE_NO_MEMORY(msgs);
+
+	if (count == 0) {
+		*_msgs = msgs;
+		return WERR_OK;
+	}
+
+	tmp_ctx = talloc_new(mem_ctx);
+	W_ERROR_HAVE_NO_MEMORY(tmp_ctx);
+
+	filter = talloc_strdup(tmp_ctx, "(|");
+	for (i = 0; i < count && filter != NULL; i++) {
+		char *guid_str = ldap_encode_ndr_GUID(tmp_ctx, &guids[i]);
+		if (guid_str == NULL) {
+			TALLOC_FREE(tmp_ctx);
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
+		filter = talloc_asprintf_append_buffer(filter,
+						       "(objectGUID=%s)",
+						       guid_str);
+	}
+	if (filter != NULL) {
+		filter = talloc_strdup_append_buffer(filter, ")");
+	}
+	if (filter == NULL) {
+		TALLOC_FREE(tmp_ctx);
+		return WERR_NOT_ENOUGH_MEMORY;
+	}
+
+	ret = drsuapi_search_with_extended_dn(sam_ctx, tmp_ctx, &res,
+					      ncRoot_dn, LDB_SCOPE_SUBTREE,
+					      attrs, filter);
+	if (ret != LDB_SUCCESS) {
+		/* not fatal, the caller will search each GUID instead */
+		DBG_NOTICE("Prefetch of %u objects under %s failed - %s\n",
+			   count, ldb_dn_get_linearized(ncRoot_dn),
+			   ldb_errstring(sam_ctx));
+		TALLOC_FREE(tmp_ctx);
+		*_msgs = msgs;
+		return WERR_OK;
+	}
+
+	for (j = 0; j < res->count; j++) {
+		struct GUID guid = samdb_result_guid(res->msgs[j],
+						     "objectGUID");
+
+		for (i = 0; i < count; i++) {
+			if (msgs[i] == NULL && GUID_equal(&guid, &guids[i])) {
+				msgs[i] = talloc_steal(msgs, res->msgs[j]);
+				break;
+			}
+		}
+	}
+
+	TALLOC_FREE(tmp_ctx);
+	*_msgs = msgs;
+	return WERR_OK;
+}
+
+/*
+ * Details of the target of a linked attribute, gathered for a window of
+ * links at a time so that the targets can be fetched with one search
+ */
+struct la_target {
+	struct GUID guid;
+	struct dsdb_dn *dn;
+	bool same_nc;
+	struct ldb_message *msg;
+};
+
+/**
+ * Works out the targets for the linked attributes in the range specified,
+ * and prefetches the target objects that the client might not know about
+ */
+static WERROR getncchanges_prefetch_la_targets(struct drsuapi_getncchanges_state *getnc_state,
+					       uint32_t start_la_index,
+					       uint32_t count,
+					       TALLOC_CTX *mem_ctx,
+					       struct ldb_context *sam_ctx,
+					       struct dsdb_schema *schema,
+					       const char * const *attrs,
+					       struct la_target **_targets)
+{
+	struct la_target *targets = NULL;
+	struct GUID *fetch_guids = NULL;
+	uint32_t *fetch_idx = NULL;
+	struct ldb_message **msgs = NULL;
+	uint32_t num_fetch = 0;
+	uint32_t i;
+	WERROR werr;
+
+	targets = talloc_zero_array(mem_ctx, struct la_target, count);
+	W_ERROR_HAVE_NO_MEMORY(targets);
+	fetch_guids = talloc_array(targets, struct GUID, count);
+	W_ERROR_HAVE_NO_MEMORY(fetch_guids);
+	fetch_idx = talloc_array(targets, uint32_t, count);
+	W_ERROR_HAVE_NO_MEMORY(fetch_idx);
+
+	for (i = 0; i < count; i++) {
+		const struct drsuapi_DsReplicaLinkedAttribute *la;
+		const struct dsdb_attribute *schema_attrib;
+		struct la_target *tgt = &targets[i];
+		NTSTATUS status;
+
+		la = &getnc_state->la_list[start_la_index + i];
+
+		/* get the GUID of the linked attribute's target object */
+		schema_attrib = dsdb_attribute_by_attributeID_id(schema,
+								 la->attid);
+
+		werr = dsdb_dn_la_from_blob(sam_ctx, schema_attrib, schema,
+					    targets, la->value.blob, &tgt->dn);
+
+		if (!W_ERROR_IS_OK(werr)) {
+			DEBUG(0,(__location__ ": Bad la blob\n"));
+			return werr;
+		}
+
+		status = dsdb_get_extended_dn_guid(tgt->dn->dn, &tgt->guid,
+						   "GUID");
+
+		if (!NT_STATUS_IS_OK(status)) {
+			return ntstatus_to_werror(status);
+		}
+
+		/* don't try to fetch target objects from another partition */
+		tgt->same_nc = dsdb_objects_have_same_nc(sam_ctx, targets,
+							 tgt->dn->dn,
+							 getnc_state->ncRoot_dn);
+		if (!tgt->same_nc) {
+			continue;
+		}
+
+		werr = dcesrv_drsuapi_obj_cache_exists(getnc_state->obj_cache,
+						       &tgt->guid);
+		if (W_ERROR_EQUAL(werr, WERR_OBJECT_NAME_EXISTS)) {
+			continue;
+		}
+
+		fetch_guids[num_fetch] = tgt->guid;
+		fetch_idx[num_fetch] = i;
+		num_fetch++;
+	}
+
+	werr = getncchanges_prefetch_objects(sam_ctx, targets,
+					     getnc_state->ncRoot_dn,
+					     fetch_guids, num_fetch,
+					     attrs, &msgs);
+	W_ERROR_NOT_OK_RETURN(werr);
+
+	for (i = 0; i < num_fetch; i++) {
+		targets[fetch_idx[i]].msg = msgs[i];
+	}
+
+	*_targets = targets;
+	return WERR_OK;
+}
+
 /**
  * Goes through any new linked attributes and checks that the target object
  * will be known to the client, i.e. we've already sent it in an replication
@@ -2467,6 +2743,10 @@ static WERROR getncchanges_chunk_add_la_targets(struct getncchanges_repl_chunk *
 	uint32_t max_la_index;
 	uint32_t max_links;
 	uint32_t target_count = 0;
+	uint32_t window_start = 0;
+	uint32_t window_end = 0;
+	struct la_target *targets = NULL;
+	TALLOC_CTX *window_ctx = NULL;
 	WERROR werr = WERR_OK;
 	static const char * const msg_attrs[] = {
 					    "*",
@@ -2490,18 +2770,40 @@ static WERROR getncchanges_chunk_add_la_targets(struct getncchanges_repl_chunk *
 	      !getncchanges_chunk_is_full(repl_chunk, getnc_state));
 	     i++) {
 
-		struct GUID target_guid;
 		struct drsuapi_DsReplicaObjectListItemEx *new_objs = NULL;
-		const struct drsuapi_DsReplicaLinkedAttribute *la;
+		struct ldb_message *msg = NULL;
 		struct ldb_result *msg_res;
 		struct ldb_dn *search_dn;
+		struct la_target *tgt = NULL;
 		TALLOC_CTX *tmp_ctx;
-		struct dsdb_dn *dn;
-		const struct dsdb_attribute *schema_attrib;
-		NTSTATUS status;
-		bool same_nc;
 
-		la = &getnc_state->la_list[i];
+		/*
+		 * Work out the targets for the next window of links, and
+		 * fetch them from the DB in one go
+		 */
+		if (i >= window_end) {
+			TALLOC_FREE(window_ctx);
+			window_ctx = talloc_new(mem_ctx);
+			W_ERROR_HAVE_NO_MEMORY(window_ctx);
+
+			window_start = i;
+			window_end = MIN(max_la_index,
+					 i + GETNCCHANGES_PREFETCH_COUNT);
+
+			werr = getncchanges_prefetch_la_targets(getnc_state,
+								window_start,
+								window_end - window_start,
+								window_ctx,
+								sam_ctx,
+								schema,
+								msg_attrs,
+								&targets);
+			if (!W_ERROR_IS_OK(werr)) {
+				return werr;
+			}
+		}
+
+		tgt = &targets[i - window_start];
 		tmp_ctx = talloc_new(mem_ctx);
 
 		/*
@@ -2511,30 +2813,20 @@ static WERROR getncchanges_chunk_add_la_targets(struct getncchanges_repl_chunk *
 		 */
 		repl_chunk->tgt_la_count = i + 1;
 
-		/* get the GUID of the linked attribute's target object */
-		schema_attrib = dsdb_attribute_by_attributeID_id(schema,
-								 la->attid);
-
-		werr = dsdb_dn_la_from_blob(sam_ctx, schema_attrib, schema,
-					    tmp_ctx, la->value.blob, &dn);
-
-		if (!W_ERROR_IS_OK(werr)) {
-			DEBUG(0,(__location__ ": Bad la blob\n"));
-			return werr;
-		}
-
-		status = dsdb_get_extended_dn_guid(dn->dn, &target_guid, "GUID");
-
-		if (!NT_STATUS_IS_OK(status)) {
-			return ntstatus_to_werror(status);
+		/* don't try to fetch target objects from another partition */
+		if (!tgt->same_nc) {
+			TALLOC_FREE(tmp_ctx);
+			continue;
 		}
 
 		/*
 		 * if the target isn't in the cache, then the client
-		 * might not know about it, so send the target now
+		 * might not know about it, so send the target now. Note
+		 * that earlier links in this window may have already
+		 * caused the target to be sent
 		 */
 		werr = dcesrv_drsuapi_obj_cache_exists(getnc_state->obj_cache,
-						       &target_guid);
+						       &tgt->guid);
 
 		if (W_ERROR_EQUAL(werr, WERR_OBJECT_NAME_EXISTS)) {
 
@@ -2543,54 +2835,52 @@ static WERROR getncchanges_chunk_add_la_targets(struct getncchanges_repl_chunk *
 			continue;
 		}
 
-		same_nc = dsdb_objects_have_same_nc(sam_ctx, tmp_ctx, dn->dn,
-						    getnc_state->ncRoot_dn);
+		msg = tgt->msg;
 
-		/* don't try to fetch target objects from another partition */
-		if (!same_nc) {
-			TALLOC_FREE(tmp_ctx);
-			continue;
-		}
+		if (msg == NULL) {
+			search_dn = ldb_dn_new_fmt(tmp_ctx, sam_ctx, "<GUID=%s>",
+						   GUID_string(tmp_ctx, &tgt->guid));
+			W_ERROR_HAVE_NO_MEMORY(search_dn);
 
-		search_dn = ldb_dn_new_fmt(tmp_ctx, sam_ctx, "<GUID=%s>",
-					   GUID_string(tmp_ctx, &target_guid));
-		W_ERROR_HAVE_NO_MEMORY(search_dn);
+			ret = drsuapi_search_with_extended_dn(sam_ctx, tmp_ctx,
+							      &msg_res, search_dn,
+							      LDB_SCOPE_BASE,
+							      msg_attrs, NULL);
 
-		ret = drsuapi_search_with_extended_dn(sam_ctx, tmp_ctx,
-						      &msg_res, search_dn,
-						      LDB_SCOPE_BASE,
-						      msg_attrs, NULL);
+			/*
+			 * Don't fail the replication if we can't find the
+			 * target. This could happen for a one-way linked
+			 * attribute, if the target is deleted and then later
+			 * expunged (thus, the source object can be left with
+			 * a hanging link). Continue to send the the link (the
+			 * client-side has already tried once with GET_TGT, so
+			 * it should just end up ignoring it).
+			 */
+			if (ret == LDB_ERR_NO_SUCH_OBJECT) {
+				DBG_WARNING("Encountered unknown link target DN %s\n",
+					    ldb_dn_get_extended_linearized(tmp_ctx, tgt->dn->dn, 1));
+				TALLOC_FREE(tmp_ctx);
+				continue;
 
-		/*
-		 * Don't fail the replication if we can't find the target.
-		 * This could happen for a one-way linked attribute, if the
-		 * target is deleted and then later expunged (thus, the source
-		 * object can be left with a hanging link). Continue to send
-		 * the the link (the client-side has already tried once with
-		 * GET_TGT, so it should just end up ignoring it).
-		 */
-		if (ret == LDB_ERR_NO_SUCH_OBJECT) {
-			DBG_WARNING("Encountered unknown link target DN %s\n",
-				    ldb_dn_get_extended_linearized(tmp_ctx, dn->dn, 1));
-			TALLOC_FREE(tmp_ctx);
-			continue;
+			} else if (ret != LDB_SUCCESS) {
+				DBG_ERR("Failed to fetch link target DN %s - %s\n",
+					ldb_dn_get_extended_linearized(tmp_ctx, tgt->dn->dn, 1),
+					ldb_errstring(sam_ctx));
+				return WERR_DS_DRA_INCONSISTENT_DIT;
+			}
 
-		} else if (ret != LDB_SUCCESS) {
-			DBG_ERR("Failed to fetch link target DN %s - %s\n",
-				ldb_dn_get_extended_linearized(tmp_ctx, dn->dn, 1),
-				ldb_errstring(sam_ctx));
-			return WERR_DS_DRA_INCONSISTENT_DIT;
+			msg = msg_res->msgs[0];
 		}
 
 		/*
 		 * Construct an object, ready to send (this will include
 		 * the object's ancestors as well, if GET_ANC is set)
 		 */
-		werr = getncchanges_get_obj_to_send(msg_res->msgs[0], mem_ctx,
+		werr = getncchanges_get_obj_to_send(msg, mem_ctx,
 						    sam_ctx, getnc_state,
 						    schema, session_key, req10,
 						    false, local_pas,
-						    machine_dn, &target_guid,
+						    machine_dn, &tgt->guid,
 						    &new_objs);
 		if (!W_ERROR_IS_OK(werr)) {
 			return werr;
@@ -2603,6 +2893,8 @@ static WERROR getncchanges_chunk_add_la_targets(struct getncchanges_repl_chunk *
 		TALLOC_FREE(tmp_ctx);
 	}
 
+	TALLOC_FREE(window_ctx);
+
 	if (target_count > 0) {
 		DEBUG(3, ("GET_TGT: checked %u link-attrs, added %u target objs\n",
 			  i - start_la_index, target_count));
@@ -2707,10 +2999,17 @@ WERROR dcesrv_drsuapi_DsGetNCChanges(struct dcesrv_call_state *dce_call, TALLOC_
 	bool full = true;
 	uint32_t *local_pas = NULL;
 	struct ldb_dn *machine_dn = NULL; /* Only used for REPL SECRET EXOP */
+	struct ldb_message **prefetch_msgs = NULL;
+	uint32_t prefetch_start = 0;
+	uint32_t prefetch_count = 0;
+	struct timeval now;
+	double elapsed;
 
 	DCESRV_PULL_HANDLE_WERR(h, r->in.bind_handle, DRSUAPI_BIND_HANDLE);
 	b_state = h->data;
 
+	getncchanges_stats_register(imsg_ctx);
+
 	/* sam_ctx_system is not present for non-administrator users */
 	sam_ctx = b_state->sam_ctx_system?b_state->sam_ctx_system:b_state->sam_ctx;
 
@@ -3020,6 +3319,12 @@ allowed:
 			return WERR_NOT_ENOUGH_MEMORY;
 		}
 		b_state->getncchanges_state = getnc_state;
+		getnc_state->start_time = timeval_current();
+
+		getnc_state->la_target_cache = db_open_rbt(getnc_state);
+		if (getnc_state->la_target_cache == NULL) {
+			return WERR_NOT_ENOUGH_MEMORY;
+		}
 
 		getnc_state->ncRoot_dn = ncRoot_dn;
 		talloc_steal(getnc_state, ncRoot_dn);
@@ -3287,42 +3592,73 @@ allowed:
 		TALLOC_CTX *tmp_ctx = talloc_new(mem_ctx);
 		uint32_t old_la_index;
 
-		msg_dn = ldb_dn_new_fmt(tmp_ctx, sam_ctx, "<GUID=%s>",
-					GUID_string(tmp_ctx, &getnc_state->guids[i]));
-		W_ERROR_HAVE_NO_MEMORY(msg_dn);
-
 		/*
 		 * by re-searching here we avoid having a lot of full
 		 * records in memory between calls to getncchanges.
-		 *
-		 * We expect that we may get some objects that vanish
-		 * (tombstone expunge) between the first and second
-		 * check.
+		 * However, we fetch the next few objects with a single
+		 * search, rather than running the whole module stack
+		 * once per object.
 		 */
-		ret = drsuapi_search_with_extended_dn(sam_ctx, tmp_ctx, &msg_res,
-						      msg_dn,
-						      LDB_SCOPE_BASE, msg_attrs, NULL);
-		if (ret != LDB_SUCCESS) {
-			if (ret != LDB_ERR_NO_SUCH_OBJECT) {
-				DEBUG(1,("getncchanges: failed to fetch DN %s - %s\n",
-					 ldb_dn_get_extended_linearized(tmp_ctx, msg_dn, 1),
-					 ldb_errstring(sam_ctx)));
+		if (req10->extended_op == DRSUAPI_EXOP_NONE &&
+		    i >= prefetch_start + prefetch_count) {
+			TALLOC_FREE(prefetch_msgs);
+			prefetch_start = i;
+			prefetch_count = MIN(GETNCCHANGES_PREFETCH_COUNT,
+					     getnc_state->num_records - i);
+			werr = getncchanges_prefetch_objects(sam_ctx, mem_ctx,
+							     getnc_state->ncRoot_dn,
+							     &getnc_state->guids[i],
+							     prefetch_count,
+							     msg_attrs,
+							     &prefetch_msgs);
+			if (!W_ERROR_IS_OK(werr)) {
+				return werr;
 			}
-			TALLOC_FREE(tmp_ctx);
-			continue;
 		}
 
-		if (msg_res->count == 0) {
-			DEBUG(1,("getncchanges: got LDB_SUCCESS but failed"
-				 "to get any results in fetch of DN "
-				 "%s (race with tombstone expunge?)\n",
-				 ldb_dn_get_extended_linearized(tmp_ctx,
-								msg_dn, 1)));
-			TALLOC_FREE(tmp_ctx);
-			continue;
+		msg = NULL;
+		if (prefetch_msgs != NULL &&
+		    i >= prefetch_start &&
+		    i < prefetch_start + prefetch_count) {
+			msg = talloc_steal(tmp_ctx,
+					   prefetch_msgs[i - prefetch_start]);
 		}
 
-		msg = msg_res->msgs[0];
+		if (msg == NULL) {
+			msg_dn = ldb_dn_new_fmt(tmp_ctx, sam_ctx, "<GUID=%s>",
+						GUID_string(tmp_ctx, &getnc_state->guids[i]));
+			W_ERROR_HAVE_NO_MEMORY(msg_dn);
+
+			/*
+			 * We expect that we may get some objects that
+			 * vanish (tombstone expunge) between the first
+			 * and second check.
+			 */
+			ret = drsuapi_search_with_extended_dn(sam_ctx, tmp_ctx, &msg_res,
+							      msg_dn,
+							      LDB_SCOPE_BASE, msg_attrs, NULL);
+			if (ret != LDB_SUCCESS) {
+				if (ret != LDB_ERR_NO_SUCH_OBJECT) {
+					DEBUG(1,("getncchanges: failed to fetch DN %s - %s\n",
+						 ldb_dn_get_extended_linearized(tmp_ctx, msg_dn, 1),
+						 ldb_errstring(sam_ctx)));
+				}
+				TALLOC_FREE(tmp_ctx);
+				continue;
+			}
+
+			if (msg_res->count == 0) {
+				DEBUG(1,("getncchanges: got LDB_SUCCESS but failed"
+					 "to get any results in fetch of DN "
+					 "%s (race with tombstone expunge?)\n",
+					 ldb_dn_get_extended_linearized(tmp_ctx,
+									msg_dn, 1)));
+				TALLOC_FREE(tmp_ctx);
+				continue;
+			}
+
+			msg = msg_res->msgs[0];
+		}
 
 		/*
 		 * Check if we've already sent the object as an ancestor of
@@ -3371,7 +3707,8 @@ allowed:
 						msg,
 						&getnc_state->la_list,
 						&getnc_state->la_count,
-						req10->uptodateness_vector);
+						req10->uptodateness_vector,
+						getnc_state->la_target_cache);
 		if (!W_ERROR_IS_OK(werr)) {
 			return werr;
 		}
@@ -3419,9 +3756,12 @@ allowed:
 		TALLOC_FREE(tmp_ctx);
 	}
 
+	TALLOC_FREE(prefetch_msgs);
+
 	/* copy the constructed object list into the response message */
 	r->out.ctr->ctr6.object_count = repl_chunk->object_count;
 	r->out.ctr->ctr6.first_object = repl_chunk->object_list;
+	getnc_state->objects_given += repl_chunk->object_count;
 
 	getnc_state->num_processed = i;
 
@@ -3586,15 +3926,35 @@ allowed:
 
 	TALLOC_FREE(repl_chunk);
 
+	now = timeval_current();
+	elapsed = timeval_elapsed2(&getnc_state->start_time, &now);
+
+	getncchanges_stats.replies += 1;
+	getncchanges_stats.objects += r->out.ctr->ctr6.object_count;
+	getncchanges_stats.links += r->out.ctr->ctr6.linked_attributes_count;
+	if (!r->out.ctr->ctr6.more_data) {
+		int64_t usecs = usec_time_diff(&now, &getnc_state->start_time);
+
+		getncchanges_stats.cycles += 1;
+		getncchanges_stats.cycle_objects += getnc_state->objects_given;
+		getncchanges_stats.cycle_usecs += usecs;
+		getncchanges_stats.last_cycle_objects =
+			getnc_state->objects_given;
+		getncchanges_stats.last_cycle_usecs = usecs;
+	}
+
 	DEBUG(r->out.ctr->ctr6.more_data?4:2,
-	      ("DsGetNCChanges with uSNChanged >= %llu flags 0x%08x on %s gave %u objects (done %u/%u) %u links (done %u/%u (as %s))\n",
+	      ("DsGetNCChanges with uSNChanged >= %llu flags 0x%08x on %s gave %u objects (done %u/%u) %u links (done %u/%u (as %s)), "
+	       "%u objects in %.1fs (%.1f objects/sec)\n",
 	       (unsigned long long)(req10->highwatermark.highest_usn+1),
 	       req10->replica_flags, drs_ObjectIdentifier_to_string(mem_ctx, ncRoot),
 	       r->out.ctr->ctr6.object_count,
 	       i, r->out.ctr->ctr6.more_data?getnc_state->num_records:i,
 	       r->out.ctr->ctr6.linked_attributes_count,
 	       getnc_state->links_given, getnc_state->total_links,
-	       dom_sid_string(mem_ctx, user_sid)));
+	       dom_sid_string(mem_ctx, user_sid),
+	       getnc_state->objects_given, elapsed,
+	       elapsed > 0 ? getnc_state->objects_given / elapsed : 0.0));
 
 #if 0
 	if (!r->out.ctr->ctr6.more_data && req10->extended_op != DRSUAPI_EXOP_NONE) {
@@ -22,6 +22,7 @@
 #include "smbd/process_model.h"
 #include "param/param.h"
 #include "lib/util/samba_modules.h"
+#include "lib/util/dlinklist.h"
 
 /* the list of currently registered process models */
 static struct process_model {
@@ -30,6 +31,17 @@ static struct process_model {
 } *models = NULL;
 static int num_models;
 
+/*
+  listening sockets of which every worker process gets its own copy
+  with SO_REUSEPORT, see process_model_prepare_listeners()
+*/
+static struct process_model_listener {
+	struct process_model_listener *prev, *next;
+	const struct process_model_listener_ops *ops;
+	void *private_data;
+} *listeners = NULL;
+static bool reuseport_enabled;
+
 
 /*
   return the operations structure for a named backend of the specified type
@@ -121,6 +133,101 @@ _PUBLIC_ NTSTATUS process_model_init(struct loadparm_context *lp_ctx)
 	return NT_STATUS_OK;
 }
 
+/*
+  ask the listening sockets created from now on in this process to set
+  SO_REUSEPORT and register themselves with
+  process_model_add_listener(). Used by the prefork master before it
+  starts its task.
+*/
+_PUBLIC_ void process_model_set_reuseport(bool enable)
+{
+	reuseport_enabled = enable;
+}
+
+_PUBLIC_ bool process_model_reuseport(void)
+{
+	return reuseport_enabled;
+}
+
+static int process_model_listener_destructor(
+	struct process_model_listener *l)
+{
+	DLIST_REMOVE(listeners, l);
+	return 0;
+}
+
+/*
+  register a listening socket that can be re-opened in a forked worker.
+  The registration goes away when mem_ctx is freed.
+*/
+_PUBLIC_ NTSTATUS process_model_add_listener(
+	TALLOC_CTX *mem_ctx,
+	const struct process_model_listener_ops *ops,
+	void *private_data)
+{
+	struct process_model_listener *l;
+
+	l = talloc_zero(mem_ctx, struct process_model_listener);
+	NT_STATUS_HAVE_NO_MEMORY(l);
+
+	l->ops = ops;
+	l->private_data = private_data;
+
+	DLIST_ADD_END(listeners, l);
+	talloc_set_destructor(l, process_model_listener_destructor);
+
+	return NT_STATUS_OK;
+}
+
+/*
+  called in the process creating the workers before it forks them: open
+  the listening sockets of num_workers workers for each registered
+  listener. fn (if not NULL) is called once per listener with one of its
+  sockets, e.g. to attach a steering program to the SO_REUSEPORT group.
+*/
+_PUBLIC_ NTSTATUS process_model_prepare_listeners(
+	unsigned num_workers,
+	void (*fn)(int fd, void *private_data),
+	void *private_data)
+{
+	struct process_model_listener *l;
+
+	for (l = listeners; l != NULL; l = l->next) {
+		NTSTATUS status;
+		int fd = -1;
+
+		status = l->ops->prepare(l->private_data, num_workers, &fd);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+		if (fn != NULL) {
+			fn(fd, private_data);
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+  called in a freshly forked worker: accept on the sockets prepared for
+  this worker instance only
+*/
+_PUBLIC_ NTSTATUS process_model_select_listeners(unsigned instance)
+{
+	struct process_model_listener *l;
+
+	for (l = listeners; l != NULL; l = l->next) {
+		NTSTATUS status;
+
+		status = l->ops->select(l->private_data, instance);
+		if (!NT_STATUS_IS_OK(status)) {
+			return status;
+		}
+	}
+
+	return NT_STATUS_OK;
+}
+
 /*
   return the PROCESS_MODEL module version, and the size of some critical types
   This can be used by process model modules to either detect compilation errors, or provide
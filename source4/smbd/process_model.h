@@ -26,6 +26,9 @@
 
 #include "lib/socket/socket.h"
 #include "smbd/service.h"
+
+struct process_model_listener_ops;
+
 #include "smbd/process_model_proto.h"
 
 /* modules can use the following to determine if the interface has changed
@@ -81,6 +84,21 @@ struct model_ops {
 	void (*set_title)(struct tevent_context *, const char *title);
 };
 
+/*
+ * A listening socket that can be shared between pre-forked workers by
+ * giving each worker its own socket on the same address with
+ * SO_REUSEPORT, instead of all of them accepting on the inherited one.
+ */
+struct process_model_listener_ops {
+	/*
+	 * open the sockets of num_workers workers, in worker order, and
+	 * return the fd of one of them
+	 */
+	NTSTATUS (*prepare)(void *private_data, unsigned num_workers, int *fd);
+	/* accept on the socket of worker instance, close the others */
+	NTSTATUS (*select)(void *private_data, unsigned instance);
+};
+
 /* this structure is used by modules to determine the size of some critical types */
 struct process_model_critical_sizes {
 	int interface_version;
@@ -92,5 +110,16 @@ extern const struct model_ops single_ops;
 const struct model_ops *process_model_startup(const char *model);
 NTSTATUS register_process_model(const struct model_ops *ops);
 NTSTATUS process_model_init(struct loadparm_context *lp_ctx);
+void process_model_set_reuseport(bool enable);
+bool process_model_reuseport(void);
+NTSTATUS process_model_add_listener(
+	TALLOC_CTX *mem_ctx,
+	const struct process_model_listener_ops *ops,
+	void *private_data);
+NTSTATUS process_model_prepare_listeners(
+	unsigned num_workers,
+	void (*fn)(int fd, void *private_data),
+	void *private_data);
+NTSTATUS process_model_select_listeners(unsigned instance);
 
 #endif /* __PROCESS_MODEL_H__ */
@@ -31,9 +31,22 @@
  * doesn't handle the server workload (i.e. processing messages) itself, but is
  * responsible for restarting workers if they exit unexpectedly. The top-level
  * samba process is responsible for restarting the master process if it exits.
+ *
+ * By default the workers all accept on the listening sockets inherited from
+ * the master, so every worker is woken for each new connection. With
+ * 'prefork reuseport' each worker opens its own SO_REUSEPORT socket on the
+ * same address and the kernel distributes the connections instead. With
+ * 'prefork cpu affinity' the workers are also pinned to a CPU each and, where
+ * supported, connections are steered to a worker by the CPU they arrived on.
  */
 #include "includes.h"
 #include <unistd.h>
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+#ifdef HAVE_SO_ATTACH_REUSEPORT_CBPF
+#include <linux/filter.h>
+#endif
 
 #include "lib/events/events.h"
 #include "lib/messaging/messaging.h"
@@ -48,6 +61,9 @@
 
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 
+/* seconds between the per worker statistics debug messages */
+#define PREFORK_STATS_INTERVAL 60
+
 NTSTATUS process_model_prefork_init(void);
 static void prefork_new_task(
     struct tevent_context *ev,
@@ -77,6 +93,10 @@ static void prefork_child_pipe_handler(struct tevent_context *ev,
 static void setup_handlers(struct tevent_context *ev,
 			   struct loadparm_context *lp_ctx,
                            int from_parent_fd);
+static void prefork_prepare_listeners(TALLOC_CTX *mem_ctx,
+				      struct loadparm_context *lp_ctx,
+				      const char *service_name,
+				      unsigned num_workers);
 
 /*
  * State needed to restart the master process or a worker process if they
@@ -98,6 +118,30 @@ struct worker_restart_context {
 	int control_pipe[2];
 };
 
+/*
+ * State of this process as a prefork worker, including the per-worker
+ * accept and connection counters.
+ */
+static struct prefork_worker_state {
+	const char *service_name;
+	int instance;
+	int cpu;
+	/* connections accepted */
+	uint64_t accepted;
+	/* woken for a connection another worker accepted first */
+	uint64_t accept_lost;
+	/* accept failed */
+	uint64_t accept_errors;
+	/* connections currently being served, and the maximum seen */
+	uint64_t connections;
+	uint64_t max_connections;
+	/* value of accepted at the last statistics message */
+	uint64_t logged_accepted;
+} prefork_worker = {
+	.instance = -1,
+	.cpu = -1,
+};
+
 struct restart_context {
 	struct loadparm_context *lp_ctx;
 	struct tfork *t;
@@ -109,6 +153,46 @@ struct restart_context {
 	struct worker_restart_context *worker;
 };
 
+static void prefork_log_worker_stats(int level)
+{
+	if (prefork_worker.instance < 0) {
+		return;
+	}
+
+	DEBUG(level, ("prefork worker %s(%d) cpu[%d]: accepted %"PRIu64", "
+		      "lost %"PRIu64", errors %"PRIu64", "
+		      "connections %"PRIu64" (max %"PRIu64")\n",
+		      prefork_worker.service_name,
+		      prefork_worker.instance,
+		      prefork_worker.cpu,
+		      prefork_worker.accepted,
+		      prefork_worker.accept_lost,
+		      prefork_worker.accept_errors,
+		      prefork_worker.connections,
+		      prefork_worker.max_connections));
+
+	prefork_worker.logged_accepted = prefork_worker.accepted;
+}
+
+static void prefork_stats_timer(struct tevent_context *ev,
+				struct tevent_timer *te,
+				struct timeval current_time,
+				void *private_data)
+{
+	if (prefork_worker.accepted != prefork_worker.logged_accepted) {
+		prefork_log_worker_stats(DBGLVL_INFO);
+	}
+
+	te = tevent_add_timer(ev,
+			      ev,
+			      timeval_current_ofs(PREFORK_STATS_INTERVAL, 0),
+			      prefork_stats_timer,
+			      NULL);
+	if (te == NULL) {
+		DBG_WARNING("Unable to re-arm the statistics timer\n");
+	}
+}
+
 static void sighup_signal_handler(struct tevent_context *ev,
 				struct tevent_signal *se,
 				int signum, int count, void *siginfo,
@@ -133,6 +217,7 @@ static void sigterm_signal_handler(struct tevent_context *ev,
 	}
 #endif
 	DBG_NOTICE("Exiting pid %d on SIGTERM\n", getpid());
+	prefork_log_worker_stats(DBGLVL_NOTICE);
 	TALLOC_FREE(ev);
 	exit(127);
 }
@@ -215,6 +300,7 @@ static void prefork_pipe_handler(struct tevent_context *event_ctx,
 	irpc_cleanup(lp_ctx, event_ctx, pid);
 
 	DBG_NOTICE("Child %d exiting\n", getpid());
+	prefork_log_worker_stats(DBGLVL_NOTICE);
 	TALLOC_FREE(event_ctx);
 	exit(0);
 }
@@ -240,6 +326,7 @@ static void prefork_fork_master(
 	pid_t pid;
 	struct tfork* t = NULL;
 	int i, num_children;
+	bool reuseport = false;
 
 	struct tevent_context *ev2;
 	struct task_server *task = NULL;
@@ -321,6 +408,29 @@ static void prefork_fork_master(
 		exit(0);
 	}
 
+	{
+		int default_children;
+		default_children = lpcfg_prefork_children(lp_ctx);
+		num_children = lpcfg_parm_int(lp_ctx, NULL, "prefork children",
+			                      service_name, default_children);
+	}
+	{
+		bool default_value;
+		default_value = lpcfg_prefork_reuseport(lp_ctx);
+		reuseport = lpcfg_parm_bool(lp_ctx,
+					    NULL,
+					    "prefork reuseport",
+					    service_name,
+					    default_value);
+	}
+	/*
+	 * With no workers the master has to keep accepting on the
+	 * sockets itself
+	 */
+	if (num_children > 0 && reuseport) {
+		process_model_set_reuseport(true);
+	}
+
 	/*
 	 * This is now the child code. We need a completely new event_context
 	 * to work with
@@ -358,12 +468,6 @@ static void prefork_fork_master(
 		TALLOC_FREE(ctx);
 	}
 
-	{
-		int default_children;
-		default_children = lpcfg_prefork_children(lp_ctx);
-		num_children = lpcfg_parm_int(lp_ctx, NULL, "prefork children",
-			                      service_name, default_children);
-	}
 	if (num_children == 0) {
 		DBG_WARNING("Number of pre-fork children for %s is zero, "
 			    "NO worker processes will be started for %s\n",
@@ -388,6 +492,11 @@ static void prefork_fork_master(
 		smb_set_close_on_exec(control_pipe[1]);
 	}
 
+	if (process_model_reuseport()) {
+		prefork_prepare_listeners(task, lp_ctx, service_name,
+					  num_children);
+	}
+
 	/*
 	 * We are now free to spawn some worker processes
 	 */
@@ -570,13 +679,22 @@ static void prefork_accept_connection(
 		 * In the longer term socket_accept needs to implement a
 		 * mutex/semaphore (like apache does) to serialise the accepts
 		 */
-		if (!NT_STATUS_EQUAL(status, STATUS_MORE_ENTRIES)) {
+		if (NT_STATUS_EQUAL(status, STATUS_MORE_ENTRIES)) {
+			prefork_worker.accept_lost++;
+		} else {
+			prefork_worker.accept_errors++;
 			DBG_ERR("Worker process (%d), error in accept [%s]\n",
 				getpid(), nt_errstr(status));
 		}
 		return;
 	}
 
+	prefork_worker.accepted++;
+	prefork_worker.connections++;
+	if (prefork_worker.connections > prefork_worker.max_connections) {
+		prefork_worker.max_connections = prefork_worker.connections;
+	}
+
 	talloc_steal(private_data, connected_socket);
 
 	new_conn(ev, lp_ctx, connected_socket,
@@ -619,6 +737,286 @@ static void setup_handlers(
 	}
 }
 
+#ifdef HAVE_SCHED_SETAFFINITY
+/*
+ * The CPU a worker is pinned to, the workers are spread round robin over
+ * the CPUs the master is allowed to run on. Returns the CPU or -1.
+ */
+static int prefork_worker_cpu(const cpu_set_t *allowed, unsigned instance)
+{
+	int num_cpus;
+	int target;
+	int cpu;
+
+	num_cpus = CPU_COUNT(allowed);
+	if (num_cpus <= 0) {
+		return -1;
+	}
+	target = instance % num_cpus;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, allowed)) {
+			continue;
+		}
+		if (target == 0) {
+			return cpu;
+		}
+		target--;
+	}
+	return -1;
+}
+#endif
+
+/*
+ * Pin the worker to its CPU, see prefork_worker_cpu(). Returns the CPU or
+ * -1.
+ */
+static int prefork_pin_worker(unsigned instance)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t allowed;
+	cpu_set_t set;
+	int cpu;
+	int ret;
+
+	ret = sched_getaffinity(0, sizeof(allowed), &allowed);
+	if (ret != 0) {
+		DBG_WARNING("sched_getaffinity failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	cpu = prefork_worker_cpu(&allowed, instance);
+	if (cpu == -1) {
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	ret = sched_setaffinity(0, sizeof(set), &set);
+	if (ret != 0) {
+		DBG_WARNING("Unable to pin worker(%u) to cpu %d: %s\n",
+			    instance, cpu, strerror(errno));
+		return -1;
+	}
+	return cpu;
+#else
+	DBG_WARNING("prefork cpu affinity is not supported on this "
+		    "platform\n");
+	return -1;
+#endif
+}
+
+#if defined(HAVE_SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_SCHED_SETAFFINITY)
+/*
+ * Build a classic BPF program for the SO_REUSEPORT group of a listening
+ * socket that hands a connection to a worker pinned to the CPU the
+ * connection arrived on.
+ *
+ * The program returns an index into the sockets of the group. The master
+ * opens the sockets of all workers in order before it forks them (see
+ * process_model_prepare_listeners()), so the socket at index i is the
+ * one worker i accepts on. If several workers share the CPU one of them
+ * is picked at random, connections arriving on a CPU without a worker are
+ * spread by CPU number.
+ */
+static struct sock_fprog *prefork_cpu_steering_program(TALLOC_CTX *mem_ctx,
+							unsigned num_workers)
+{
+	struct sock_fprog *prog = NULL;
+	struct sock_filter *code = NULL;
+	cpu_set_t allowed;
+	unsigned num_cpus;
+	unsigned num_targets;
+	unsigned len = 0;
+	unsigned j;
+	int ret;
+
+	ret = sched_getaffinity(0, sizeof(allowed), &allowed);
+	if (ret != 0) {
+		DBG_WARNING("sched_getaffinity failed: %s\n", strerror(errno));
+		return NULL;
+	}
+	num_cpus = CPU_COUNT(&allowed);
+	if (num_cpus == 0 || num_workers == 0) {
+		return NULL;
+	}
+	num_targets = MIN(num_cpus, num_workers);
+
+	/*
+	 * At most 1 + 6 instructions per CPU with a worker + 2, see
+	 * below
+	 */
+	if (1 + 6 * num_targets + 2 > BPF_MAXINSNS) {
+		DBG_WARNING("Too many CPUs to steer connections by CPU\n");
+		return NULL;
+	}
+
+	prog = talloc_zero(mem_ctx, struct sock_fprog);
+	if (prog == NULL) {
+		return NULL;
+	}
+	code = talloc_zero_array(prog,
+				 struct sock_filter,
+				 1 + 6 * num_targets + 2);
+	if (code == NULL) {
+		TALLOC_FREE(prog);
+		return NULL;
+	}
+
+	/* A = the CPU the packet is processed on */
+	code[len++] = (struct sock_filter) {
+		BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU };
+
+	for (j = 0; j < num_targets; j++) {
+		/* workers j, j + num_cpus, ... share this CPU */
+		unsigned sharing = (num_workers - j + num_cpus - 1) / num_cpus;
+		int cpu = prefork_worker_cpu(&allowed, j);
+
+		if (cpu == -1) {
+			continue;
+		}
+
+		code[len++] = (struct sock_filter) {
+			BPF_JMP | BPF_JEQ | BPF_K, 0, sharing == 1 ? 1 : 5, cpu };
+		if (sharing == 1) {
+			code[len++] = (struct sock_filter) {
+				BPF_RET | BPF_K, 0, 0, j };
+			continue;
+		}
+		/* A = j + num_cpus * (random % sharing) */
+		code[len++] = (struct sock_filter) {
+			BPF_LD | BPF_W | BPF_ABS, 0, 0,
+			SKF_AD_OFF + SKF_AD_RANDOM };
+		code[len++] = (struct sock_filter) {
+			BPF_ALU | BPF_MOD | BPF_K, 0, 0, sharing };
+		code[len++] = (struct sock_filter) {
+			BPF_ALU | BPF_MUL | BPF_K, 0, 0, num_cpus };
+		code[len++] = (struct sock_filter) {
+			BPF_ALU | BPF_ADD | BPF_K, 0, 0, j };
+		code[len++] = (struct sock_filter) { BPF_RET | BPF_A, 0, 0, 0 };
+	}
+
+	/* No worker on this CPU, A = A % number of workers */
+	code[len++] = (struct sock_filter) {
+		BPF_ALU | BPF_MOD | BPF_K, 0, 0, num_workers };
+	code[len++] = (struct sock_filter) { BPF_RET | BPF_A, 0, 0, 0 };
+
+	prog->len = len;
+	prog->filter = code;
+	return prog;
+}
+
+/*
+ * Attach the program built by prefork_cpu_steering_program() to the
+ * SO_REUSEPORT group of a listening socket
+ */
+static void prefork_attach_cpu_steering(int fd, void *private_data)
+{
+	struct sock_fprog *prog = talloc_get_type_abort(private_data,
+							struct sock_fprog);
+	int ret;
+
+	ret = setsockopt(fd,
+			 SOL_SOCKET,
+			 SO_ATTACH_REUSEPORT_CBPF,
+			 prog,
+			 sizeof(*prog));
+	if (ret != 0) {
+		DBG_WARNING("Unable to attach reuseport steering program: "
+			    "%s\n", strerror(errno));
+	}
+}
+#endif
+
+/*
+ * Called in the prefork master before it forks the workers: open the
+ * SO_REUSEPORT listening sockets for all of them. The master keeps them
+ * open but never accepts on them. Each worker, including one restarted
+ * later, accepts on the socket of its instance. So a connection queued
+ * on a socket is not lost while its worker is started or restarted.
+ */
+static void prefork_prepare_listeners(TALLOC_CTX *mem_ctx,
+				      struct loadparm_context *lp_ctx,
+				      const char *service_name,
+				      unsigned num_workers)
+{
+	void (*steering_fn)(int fd, void *private_data) = NULL;
+	void *steering_data = NULL;
+	NTSTATUS status;
+
+#if defined(HAVE_SO_ATTACH_REUSEPORT_CBPF) && defined(HAVE_SCHED_SETAFFINITY)
+	if (lpcfg_parm_bool(lp_ctx,
+			    NULL,
+			    "prefork cpu affinity",
+			    service_name,
+			    lpcfg_prefork_cpu_affinity(lp_ctx))) {
+		steering_data = prefork_cpu_steering_program(mem_ctx,
+							     num_workers);
+		if (steering_data != NULL) {
+			steering_fn = prefork_attach_cpu_steering;
+		}
+	}
+#endif
+
+	status = process_model_prepare_listeners(num_workers,
+						 steering_fn,
+						 steering_data);
+	if (!NT_STATUS_IS_OK(status)) {
+		DBG_ERR("Unable to open the listening sockets of the %s "
+			"workers: %s\n",
+			service_name,
+			nt_errstr(status));
+		exit(127);
+	}
+}
+
+/*
+ * Set up the listening sockets and CPU placement of a new worker
+ */
+static void prefork_setup_worker(struct tevent_context *ev2,
+				 struct loadparm_context *lp_ctx,
+				 const char *service_name,
+				 unsigned instance)
+{
+	struct tevent_timer *te = NULL;
+	bool affinity;
+
+	prefork_worker.service_name = service_name;
+	prefork_worker.instance = instance;
+
+	affinity = lpcfg_parm_bool(lp_ctx,
+				   NULL,
+				   "prefork cpu affinity",
+				   service_name,
+				   lpcfg_prefork_cpu_affinity(lp_ctx));
+	if (affinity) {
+		prefork_worker.cpu = prefork_pin_worker(instance);
+	}
+
+	if (process_model_reuseport()) {
+		NTSTATUS status;
+
+		status = process_model_select_listeners(instance);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("Worker %s(%u) unable to use its listening "
+				"sockets: %s\n",
+				service_name,
+				instance,
+				nt_errstr(status));
+			exit(127);
+		}
+	}
+
+	te = tevent_add_timer(ev2,
+			      ev2,
+			      timeval_current_ofs(PREFORK_STATS_INTERVAL, 0),
+			      prefork_stats_timer,
+			      NULL);
+	if (te == NULL) {
+		DBG_WARNING("Unable to set up the statistics timer\n");
+	}
+}
+
 /*
  * Called by the prefork master to create a new prefork worker process
  */
@@ -704,6 +1102,7 @@ static void prefork_fork_worker(struct task_server *task,
 				  service_name,
 				  pd->instances);
 		prefork_reload_after_fork();
+		prefork_setup_worker(ev2, lp_ctx, service_name, pd->instances);
 		if (service_details->post_fork != NULL) {
 			service_details->post_fork(task, pd);
 		}
@@ -776,6 +1175,9 @@ static void prefork_terminate_connection(struct tevent_context *ev,
 					 const char *reason,
 					 void *process_context)
 {
+	if (prefork_worker.connections > 0) {
+		prefork_worker.connections--;
+	}
 }
 
 /* called to set a title of a task or connection */
@@ -45,6 +45,15 @@ struct stream_socket {
 	struct socket_context *sock;
 	void *private_data;
 	void *process_context;
+	/* only kept for sockets opened with SO_REUSEPORT */
+	struct socket_address *address;
+	const char *socket_options;
+	/*
+	 * the sockets of the workers in the order they joined the
+	 * SO_REUSEPORT group, worker_socks[0] is sock
+	 */
+	struct socket_context **worker_socks;
+	unsigned num_worker_socks;
 };
 
 
@@ -273,6 +282,173 @@ static void stream_accept_handler(struct tevent_context *ev, struct tevent_fd *f
 		stream_socket->process_context);
 }
 
+/*
+  set the options of a listening socket, SO_REUSEPORT is set if the
+  process model asked us to share the socket that way
+*/
+static NTSTATUS stream_set_listen_options(struct socket_context *sock,
+					  const char *socket_options,
+					  bool reuseport)
+{
+	NTSTATUS status;
+
+	status = socket_set_option(sock, "SO_KEEPALIVE", NULL);
+	NT_STATUS_NOT_OK_RETURN(status);
+
+	if (socket_options != NULL) {
+		status = socket_set_option(sock, socket_options, NULL);
+		NT_STATUS_NOT_OK_RETURN(status);
+	}
+
+	if (reuseport) {
+		status = socket_set_option(sock, "SO_REUSEPORT=1", NULL);
+		NT_STATUS_NOT_OK_RETURN(status);
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+  watch a listening socket for new connections
+*/
+static NTSTATUS stream_add_accept_fde(struct stream_socket *stream_socket,
+				      struct tevent_context *event_context)
+{
+	struct tevent_fd *fde;
+
+	fde = tevent_add_fd(event_context, stream_socket->sock,
+			    socket_get_fd(stream_socket->sock),
+			    TEVENT_FD_READ,
+			    stream_accept_handler, stream_socket);
+	if (!fde) {
+		DBG_ERR("Failed to setup fd event\n");
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	/* we let events system to the close on the socket. This avoids
+	 * nasty interactions with waiting for talloc to close the socket. */
+	tevent_fd_set_close_fn(fde, socket_tevent_fd_close_fn);
+	socket_set_flags(stream_socket->sock, SOCKET_FLAG_NOCLOSE);
+
+	return NT_STATUS_OK;
+}
+
+/*
+  called in the prefork master before it forks the workers: open a
+  SO_REUSEPORT socket on the address of the listening socket for each
+  worker but the first, which uses the listening socket itself. They all
+  join the SO_REUSEPORT group in worker order, and as the master keeps
+  them open for its lifetime, that order never changes.
+*/
+static NTSTATUS stream_reuseport_prepare(void *private_data,
+					 unsigned num_workers,
+					 int *fd)
+{
+	struct stream_socket *stream_socket =
+		talloc_get_type_abort(private_data, struct stream_socket);
+	unsigned i;
+
+	if (stream_socket->worker_socks != NULL || num_workers == 0) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	stream_socket->worker_socks = talloc_zero_array(stream_socket,
+							struct socket_context *,
+							num_workers);
+	NT_STATUS_HAVE_NO_MEMORY(stream_socket->worker_socks);
+
+	stream_socket->worker_socks[0] = stream_socket->sock;
+	stream_socket->num_worker_socks = 1;
+
+	for (i = 1; i < num_workers; i++) {
+		struct socket_context *sock = NULL;
+		NTSTATUS status;
+
+		status = socket_create(stream_socket->worker_socks,
+				       stream_socket->address->family,
+				       SOCKET_TYPE_STREAM,
+				       &sock, 0);
+		NT_STATUS_NOT_OK_RETURN(status);
+
+		status = stream_set_listen_options(sock,
+						   stream_socket->socket_options,
+						   true);
+		if (!NT_STATUS_IS_OK(status)) {
+			talloc_free(sock);
+			return status;
+		}
+
+		status = socket_listen(sock, stream_socket->address,
+				       SERVER_LISTEN_BACKLOG, 0);
+		if (!NT_STATUS_IS_OK(status)) {
+			DBG_ERR("Failed to listen on %s:%u - %s\n",
+				stream_socket->address->addr,
+				stream_socket->address->port,
+				nt_errstr(status));
+			talloc_free(sock);
+			return status;
+		}
+
+		stream_socket->worker_socks[i] = sock;
+		stream_socket->num_worker_socks++;
+	}
+
+	*fd = socket_get_fd(stream_socket->sock);
+	return NT_STATUS_OK;
+}
+
+/*
+  called in a newly forked worker: accept on the socket of our instance
+  only and close our copies of the others, so the kernel distributes
+  connections between the workers instead of waking all of them for each
+  connection.
+*/
+static NTSTATUS stream_reuseport_select(void *private_data, unsigned instance)
+{
+	struct stream_socket *stream_socket =
+		talloc_get_type_abort(private_data, struct stream_socket);
+	struct socket_context *old = stream_socket->sock;
+	struct socket_context *sock = NULL;
+	unsigned i;
+	NTSTATUS status;
+
+	if (stream_socket->num_worker_socks == 0) {
+		return NT_STATUS_INTERNAL_ERROR;
+	}
+
+	i = instance % stream_socket->num_worker_socks;
+	sock = stream_socket->worker_socks[i];
+
+	if (sock != old) {
+		stream_socket->sock = sock;
+
+		status = stream_add_accept_fde(stream_socket,
+					       stream_socket->event_ctx);
+		if (!NT_STATUS_IS_OK(status)) {
+			stream_socket->sock = old;
+			return status;
+		}
+
+		/* this closes our copy of the inherited socket */
+		TALLOC_FREE(old);
+
+		talloc_steal(stream_socket, sock);
+		stream_socket->worker_socks[0] = NULL;
+	}
+
+	/* this closes our copies of the sockets of the other workers */
+	stream_socket->worker_socks[i] = NULL;
+	TALLOC_FREE(stream_socket->worker_socks);
+	stream_socket->num_worker_socks = 0;
+
+	return NT_STATUS_OK;
+}
+
+static const struct process_model_listener_ops stream_reuseport_ops = {
+	.prepare	= stream_reuseport_prepare,
+	.select		= stream_reuseport_select,
+};
+
 /*
   setup a listen stream socket
   if you pass *port == 0, then a port > 1024 is used
@@ -296,9 +472,9 @@ NTSTATUS stream_setup_socket(TALLOC_CTX *mem_ctx,
 	NTSTATUS status;
 	struct stream_socket *stream_socket;
 	struct socket_address *socket_address;
-	struct tevent_fd *fde;
 	int i;
 	struct sockaddr_storage ss;
+	bool reuseport = false;
 
 	stream_socket = talloc_zero(mem_ctx, struct stream_socket);
 	NT_STATUS_HAVE_NO_MEMORY(stream_socket);
@@ -336,15 +512,23 @@ NTSTATUS stream_setup_socket(TALLOC_CTX *mem_ctx,
 
 	stream_socket->lp_ctx = talloc_reference(stream_socket, lp_ctx);
 
+#ifdef SO_REUSEPORT
+	/*
+	 * Only fixed IP ports are shared with SO_REUSEPORT: when
+	 * searching for a free port we could otherwise join the
+	 * listeners of an unrelated process of the same user.
+	 */
+	reuseport = process_model_reuseport() &&
+		    port != NULL && *port != 0 &&
+		    strcmp(family, "ip") == 0;
+#endif
+
 	/* ready to listen */
-	status = socket_set_option(stream_socket->sock, "SO_KEEPALIVE", NULL);
+	status = stream_set_listen_options(stream_socket->sock,
+					   socket_options,
+					   reuseport);
 	NT_STATUS_NOT_OK_RETURN(status);
 
-	if (socket_options != NULL) {
-		status = socket_set_option(stream_socket->sock, socket_options, NULL);
-		NT_STATUS_NOT_OK_RETURN(status);
-	}
-
 	/* TODO: set socket ACL's (host allow etc) here when they're
 	 * implemented */
 
@@ -379,28 +563,36 @@ NTSTATUS stream_setup_socket(TALLOC_CTX *mem_ctx,
 	/* Add the FD from the newly created socket into the event
 	 * subsystem.  it will call the accept handler whenever we get
 	 * new connections */
-
-	fde = tevent_add_fd(event_context, stream_socket->sock,
-			    socket_get_fd(stream_socket->sock),
-			    TEVENT_FD_READ,
-			    stream_accept_handler, stream_socket);
-	if (!fde) {
-		DBG_ERR("Failed to setup fd event\n");
+	status = stream_add_accept_fde(stream_socket, event_context);
+	if (!NT_STATUS_IS_OK(status)) {
 		talloc_free(stream_socket);
-		return NT_STATUS_NO_MEMORY;
+		return status;
 	}
 
-	/* we let events system to the close on the socket. This avoids
-	 * nasty interactions with waiting for talloc to close the socket. */
-	tevent_fd_set_close_fn(fde, socket_tevent_fd_close_fn);
-	socket_set_flags(stream_socket->sock, SOCKET_FLAG_NOCLOSE);
-
 	stream_socket->private_data     = talloc_reference(stream_socket, private_data);
 	stream_socket->ops              = stream_ops;
 	stream_socket->event_ctx	= event_context;
 	stream_socket->model_ops        = model_ops;
 	stream_socket->process_context  = process_context;
 
+	if (reuseport) {
+		stream_socket->address = socket_address;
+		stream_socket->socket_options = talloc_strdup(stream_socket,
+							      socket_options);
+		if (socket_options != NULL &&
+		    stream_socket->socket_options == NULL) {
+			talloc_free(stream_socket);
+			return NT_STATUS_NO_MEMORY;
+		}
+		status = process_model_add_listener(stream_socket,
+						    &stream_reuseport_ops,
+						    stream_socket);
+		if (!NT_STATUS_IS_OK(status)) {
+			talloc_free(stream_socket);
+			return status;
+		}
+	}
+
 	return NT_STATUS_OK;
 }
 
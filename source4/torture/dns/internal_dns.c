@@ -21,6 +21,9 @@
 #include "torture/smbtorture.h"
 #include <talloc.h>
 #include "lib/addns/dns.h"
+#include "lib/util/time.h"
+
+#define QTYPE_SRV 33
 
 static struct dns_connection *setup_connection(struct torture_context *tctx)
 {
@@ -158,6 +161,115 @@ static bool test_internal_dns_update_self(struct torture_context *tctx)
 	return true;
 }
 
+static bool query_expect(struct dns_connection *conn,
+			 const char *name,
+			 uint16_t q_type,
+			 uint8_t rcode)
+{
+	TALLOC_CTX *frame = talloc_stackframe();
+	struct dns_request *req, *resp;
+	DNS_ERROR err;
+	bool ok = false;
+
+	err = dns_create_query(frame, name, q_type, DNS_CLASS_IN, &req);
+	if (!ERR_DNS_IS_OK(err)) {
+		printf("Failed to create query for %s\n", name);
+		goto done;
+	}
+
+	err = dns_transaction(frame, conn, req, &resp);
+	if (!ERR_DNS_IS_OK(err)) {
+		printf("Failed to query DNS server for %s\n", name);
+		goto done;
+	}
+
+	if (dns_response_code(resp->flags) != rcode) {
+		printf("Query for %s returned %u, expected %u\n",
+		       name, dns_response_code(resp->flags), rcode);
+		goto done;
+	}
+
+	ok = true;
+done:
+	TALLOC_FREE(frame);
+	return ok;
+}
+
+/*
+ * A small dnsperf: replay the mix of queries a domain member sends at
+ * logon (our own A record, the SRV records of the DCs, the zone SOA)
+ * together with lookups of names that do not exist, and report the
+ * query rate.
+ */
+static bool test_internal_dns_query_perf(struct torture_context *tctx)
+{
+	struct dns_connection *conn;
+	const char *domain = get_dns_domain(tctx);
+	int num_queries = torture_setting_int(tctx, "dns_queries", 2000);
+	struct {
+		const char *name;
+		uint16_t q_type;
+		uint8_t rcode;
+	} queries[] = {
+		{
+			.name = talloc_asprintf(tctx, "%s.%s",
+						getenv("DC_SERVER"), domain),
+			.q_type = QTYPE_A,
+			.rcode = DNS_NO_ERROR,
+		},
+		{
+			.name = talloc_asprintf(tctx, "_ldap._tcp.%s", domain),
+			.q_type = QTYPE_SRV,
+			.rcode = DNS_NO_ERROR,
+		},
+		{
+			.name = talloc_asprintf(tctx, "_kerberos._tcp.%s",
+						domain),
+			.q_type = QTYPE_SRV,
+			.rcode = DNS_NO_ERROR,
+		},
+		{
+			.name = domain,
+			.q_type = QTYPE_SOA,
+			.rcode = DNS_NO_ERROR,
+		},
+		{
+			.name = talloc_asprintf(tctx, "nosuchhost.%s", domain),
+			.q_type = QTYPE_A,
+			.rcode = DNS_NAME_ERROR,
+		},
+	};
+	struct timeval tv;
+	double elapsed;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(queries); i++) {
+		torture_assert(tctx, queries[i].name != NULL, "no memory");
+	}
+
+	conn = setup_connection(tctx);
+	torture_assert(tctx, conn != NULL, "Failed to connect");
+
+	tv = timeval_current();
+
+	for (i = 0; i < num_queries; i++) {
+		bool ok;
+
+		ok = query_expect(conn,
+				  queries[i % ARRAY_SIZE(queries)].name,
+				  queries[i % ARRAY_SIZE(queries)].q_type,
+				  queries[i % ARRAY_SIZE(queries)].rcode);
+		torture_assert(tctx, ok, "query failed");
+	}
+
+	elapsed = timeval_elapsed(&tv);
+	torture_comment(tctx, "%d queries took %.3fs (%.1f queries/sec)\n",
+			num_queries, elapsed,
+			elapsed > 0 ? num_queries / elapsed : 0.0);
+
+	return true;
+}
+
 static struct torture_suite *internal_dns_suite(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite = torture_suite_create(ctx, "dns_internal");
@@ -166,6 +278,7 @@ static struct torture_suite *internal_dns_suite(TALLOC_CTX *ctx)
 	                                   "Tests for the internal DNS server");
 	torture_suite_add_simple_test(suite, "queryself", test_internal_dns_query_self);
 	torture_suite_add_simple_test(suite, "updateself", test_internal_dns_update_self);
+	torture_suite_add_simple_test(suite, "queryperf", test_internal_dns_query_perf);
 	return suite;
 }
 
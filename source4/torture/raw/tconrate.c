@@ -31,6 +31,14 @@
 #define TIME_LIMIT_SECS 30
 #define usec_to_sec(s) ((s) / 1000000)
 
+/* Per client counters, shared between the clients and the parent. */
+struct tcon_count {
+	int count;
+	/* time spent connecting, and the slowest connection */
+	uint64_t total_usec;
+	uint64_t max_usec;
+};
+
 /* Map a shared memory buffer of at least nelem counters. */
 static void * map_count_buffer(unsigned nelem, size_t elemsz)
 {
@@ -39,7 +47,7 @@ static void * map_count_buffer(unsigned nelem, size_t elemsz)
 	size_t pagesz = getpagesize();
 
 	bufsz = nelem * elemsz;
-	bufsz = (bufsz + pagesz) % pagesz; /* round up to pagesz */
+	bufsz = ((bufsz + pagesz - 1) / pagesz) * pagesz; /* round up to pagesz */
 
 #ifdef MAP_ANON
 	/* BSD */
@@ -61,7 +69,7 @@ static void * map_count_buffer(unsigned nelem, size_t elemsz)
 }
 
 static int fork_tcon_client(struct torture_context *tctx,
-		int *tcon_count, unsigned tcon_timelimit,
+		struct tcon_count *tcon_count, unsigned tcon_timelimit,
 		const char *host, const char *share)
 {
 	pid_t child;
@@ -93,9 +101,13 @@ static int fork_tcon_client(struct torture_context *tctx,
 	end = timeval_current();
 	now = timeval_current();
 	end.tv_sec += tcon_timelimit;
-	*tcon_count = 0;
+	tcon_count->count = 0;
+	tcon_count->total_usec = 0;
+	tcon_count->max_usec = 0;
 
 	while (timeval_compare(&now, &end) == -1) {
+		struct timeval begin = now;
+		uint64_t usec;
 		NTSTATUS status;
 
 		status = smbcli_full_connection(NULL, &cli,
@@ -112,10 +124,19 @@ static int fork_tcon_client(struct torture_context *tctx,
 			goto done;
 		}
 
+		/* The connection setup latency includes the negprot,
+		 * session setup and tree connect round trips. */
+		now = timeval_current();
+		usec = usec_time_diff(&now, &begin);
+
 		smbcli_tdis(cli);
 		talloc_free(cli);
 
-		*tcon_count = *tcon_count + 1;
+		tcon_count->total_usec += usec;
+		if (usec > tcon_count->max_usec) {
+			tcon_count->max_usec = usec;
+		}
+		tcon_count->count = tcon_count->count + 1;
 		now = timeval_current();
 	}
 
@@ -161,10 +182,12 @@ bool torture_bench_treeconnect(struct torture_context *tctx)
 					TIME_LIMIT_SECS);
 	int nprocs = torture_setting_int(tctx, "nprocs", 4);
 
-	int *curr_counts = map_count_buffer(nprocs, sizeof(int));
+	struct tcon_count *curr_counts = map_count_buffer(nprocs,
+					sizeof(struct tcon_count));
 	int *last_counts = talloc_zero_array(tctx, int, nprocs);
 
 	struct timeval now, last, start;
+	uint64_t total_usec, max_usec;
 	int i, delta;
 
 	torture_assert(tctx, nprocs > 0, "bad proc count");
@@ -183,25 +206,34 @@ bool torture_bench_treeconnect(struct torture_context *tctx)
 		now = timeval_current();
 
 		for (i = 0, delta = 0; i < nprocs; ++i) {
-			delta += curr_counts[i] - last_counts[i];
+			delta += curr_counts[i].count - last_counts[i];
+			last_counts[i] = curr_counts[i].count;
 		}
 
 		printf("%u connections/sec\n",
 			(unsigned)rate_convert_secs(delta, &last, &now));
 
-		memcpy(last_counts, curr_counts, nprocs * sizeof(int));
 		last = timeval_current();
 	}
 
 	now = timeval_current();
 
+	total_usec = 0;
+	max_usec = 0;
 	for (i = 0, delta = 0; i < nprocs; ++i) {
-		delta += curr_counts[i];
+		delta += curr_counts[i].count;
+		total_usec += curr_counts[i].total_usec;
+		max_usec = MAX(max_usec, curr_counts[i].max_usec);
 	}
 
 	printf("TOTAL: %u connections/sec over %u secs\n",
 			(unsigned)rate_convert_secs(delta, &start, &now),
 			timelimit);
+	if (delta > 0) {
+		printf("connection setup: %"PRIu64" usec average, "
+			"%"PRIu64" usec max\n",
+			total_usec / delta, max_usec);
+	}
 	return true;
 }
 
@@ -1404,6 +1404,122 @@ done:
 	return ret;
 }
 
+/*
+  benchmark listing a large directory while one file in it is open
+*/
+
+static bool test_bench_list(struct torture_context *tctx,
+			    struct smb2_tree *tree)
+{
+	TALLOC_CTX *mem_ctx = talloc_new(tctx);
+	int num_files = torture_setting_int(tctx, "numfiles", 1000);
+	int num_loops = torture_setting_int(tctx, "numloops", 3);
+	struct file_elem *files = NULL;
+	struct smb2_handle h = {{0}};
+	struct smb2_handle h_open = {{0}};
+	struct smb2_create create;
+	union smb_fileinfo finfo;
+	struct smb2_find f;
+	union smb_search_data *d;
+	bool ret = true;
+	NTSTATUS status;
+	int loop;
+
+	files = talloc_zero_array(mem_ctx, struct file_elem, num_files);
+	torture_assert_goto(tctx, files != NULL, ret, done, "talloc failed\n");
+
+	torture_comment(tctx, "Creating %d files\n", num_files);
+
+	status = populate_tree(tctx, mem_ctx, tree, files, num_files, &h);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "");
+
+	/*
+	 * Keep one file open, so the listing has to look at its
+	 * share mode record for the write time.
+	 */
+	ZERO_STRUCT(create);
+	create.in.desired_access = SEC_RIGHTS_FILE_ALL;
+	create.in.share_access = NTCREATEX_SHARE_ACCESS_MASK;
+	create.in.create_disposition = NTCREATEX_DISP_OPEN;
+	create.in.fname = talloc_asprintf(mem_ctx, "%s\\%s",
+					  DNAME, files[0].name);
+	status = smb2_create(tree, mem_ctx, &create);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "");
+	h_open = create.out.file.handle;
+
+	ZERO_STRUCT(finfo);
+	finfo.basic_info.level = RAW_FILEINFO_BASIC_INFORMATION;
+	finfo.basic_info.in.file.handle = h_open;
+	status = smb2_getinfo_file(tree, mem_ctx, &finfo);
+	torture_assert_ntstatus_ok_goto(tctx, status, ret, done, "");
+
+	for (loop = 0; loop < num_loops; loop++) {
+		struct timeval tv = timeval_current();
+		int file_count = 0;
+		unsigned int count;
+		double secs;
+		int i;
+
+		ZERO_STRUCT(f);
+		f.in.file.handle        = h;
+		f.in.pattern            = "*";
+		f.in.continue_flags     = SMB2_CONTINUE_FLAG_RESTART;
+		f.in.max_response_size  = 0x10000;
+		f.in.level              = SMB2_FIND_ID_BOTH_DIRECTORY_INFO;
+
+		do {
+			status = smb2_find_level(tree, mem_ctx, &f, &count, &d);
+			if (NT_STATUS_EQUAL(status, STATUS_NO_MORE_FILES)) {
+				break;
+			}
+			torture_assert_ntstatus_ok_goto(tctx, status, ret,
+							done, "");
+
+			for (i = 0; i < count; i++) {
+				const char *found =
+					d[i].id_both_directory_info.name.s;
+
+				if (strcmp(found, files[0].name) != 0) {
+					continue;
+				}
+				torture_assert_u64_equal_goto(
+					tctx,
+					d[i].id_both_directory_info.write_time,
+					finfo.basic_info.out.write_time,
+					ret, done,
+					"Bad write time of open file\n");
+			}
+			file_count += count;
+			f.in.continue_flags = 0;
+			TALLOC_FREE(d);
+		} while (count != 0);
+
+		secs = timeval_elapsed(&tv);
+
+		torture_assert_int_equal_goto(tctx, file_count, num_files + 2,
+					      ret, done, "");
+
+		torture_comment(tctx,
+				"Listed %d entries in %.3f seconds "
+				"(%.0f entries/sec)\n",
+				file_count,
+				secs,
+				file_count / secs);
+	}
+
+done:
+	if (!smb2_util_handle_empty(h_open)) {
+		smb2_util_close(tree, h_open);
+	}
+	if (!smb2_util_handle_empty(h)) {
+		smb2_util_close(tree, h);
+	}
+	smb2_deltree(tree, DNAME);
+	talloc_free(mem_ctx);
+
+	return ret;
+}
+
 struct torture_suite *torture_smb2_dir_init(TALLOC_CTX *ctx)
 {
 	struct torture_suite *suite =
@@ -1417,6 +1533,7 @@ struct torture_suite *torture_smb2_dir_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "sorted", test_sorted);
 	torture_suite_add_1smb2_test(suite, "file-index", test_file_index);
 	torture_suite_add_1smb2_test(suite, "large-files", test_large_files);
+	torture_suite_add_1smb2_test(suite, "bench-list", test_bench_list);
 	suite->description = talloc_strdup(suite, "SMB2-DIR tests");
 
 	return suite;
@@ -3465,6 +3465,161 @@ done:
 	return ret;
 }
 
+/**
+ * Benchmark locking with many byte-range locks on one file, like
+ * database applications do.
+ *
+ * One handle holds numlocks single byte locks at even offsets. A
+ * second handle then locks and unlocks the odd offsets in between and
+ * reads single bytes, each request has to be checked against all the
+ * locks held by the first handle.
+ */
+static bool test_bench_lock(struct torture_context *torture,
+			    struct smb2_tree *tree)
+{
+	int num_locks = torture_setting_int(torture, "numlocks", 5000);
+	int num_loops = torture_setting_int(torture, "numloops", 3);
+	const char *fname = BASEDIR "\\bench-lock.dat";
+	struct smb2_handle _h1, _h2;
+	struct smb2_handle *h1 = NULL, *h2 = NULL;
+	struct smb2_read rd;
+	struct timeval tv;
+	uint8_t *buf = NULL;
+	NTSTATUS status;
+	bool ret = true;
+	double secs;
+	int loop, i;
+
+	status = torture_smb2_testdir(tree, BASEDIR, &_h1);
+	torture_assert_ntstatus_ok(torture, status,
+				   "torture_smb2_testdir failed");
+	smb2_util_close(tree, _h1);
+
+	status = torture_smb2_testfile(tree, fname, &_h1);
+	torture_assert_ntstatus_ok_goto(torture, status, ret, done,
+					"torture_smb2_testfile failed");
+	h1 = &_h1;
+
+	status = torture_smb2_testfile(tree, fname, &_h2);
+	torture_assert_ntstatus_ok_goto(torture, status, ret, done,
+					"torture_smb2_testfile failed");
+	h2 = &_h2;
+
+	buf = talloc_zero_array(torture, uint8_t, num_locks * 2);
+	torture_assert_goto(torture, buf != NULL, ret, done,
+			    "talloc failed\n");
+
+	status = smb2_util_write(tree, *h1, buf, 0, num_locks * 2);
+	torture_assert_ntstatus_ok_goto(torture, status, ret, done,
+					"smb2_util_write failed");
+
+	tv = timeval_current();
+
+	for (i = 0; i < num_locks; i++) {
+		status = test_smb2_lock(tree, *h1, i * 2, 1, true);
+		torture_assert_ntstatus_ok_goto(torture, status, ret, done,
+						"test_smb2_lock failed");
+	}
+
+	secs = timeval_elapsed(&tv);
+	torture_comment(torture,
+			"Took %d locks in %.3f seconds (%.0f locks/sec)\n",
+			num_locks,
+			secs,
+			num_locks / secs);
+
+	status = test_smb2_lock(tree, *h2, (num_locks / 2) * 2, 1, true);
+	torture_assert_ntstatus_equal_goto(torture, status,
+					   NT_STATUS_LOCK_NOT_GRANTED,
+					   ret, done,
+					   "conflicting lock granted");
+
+	for (loop = 0; loop < num_loops; loop++) {
+		tv = timeval_current();
+
+		for (i = 0; i < num_locks; i++) {
+			status = test_smb2_lock(tree, *h2, i * 2 + 1, 1, true);
+			torture_assert_ntstatus_ok_goto(
+				torture, status, ret, done,
+				"test_smb2_lock failed");
+
+			status = test_smb2_unlock(tree, *h2, i * 2 + 1, 1);
+			torture_assert_ntstatus_ok_goto(
+				torture, status, ret, done,
+				"test_smb2_unlock failed");
+		}
+
+		secs = timeval_elapsed(&tv);
+		torture_comment(torture,
+				"Lock/unlock %d ranges in %.3f seconds "
+				"(%.0f ops/sec)\n",
+				num_locks,
+				secs,
+				num_locks * 2 / secs);
+
+		tv = timeval_current();
+
+		for (i = 0; i < num_locks; i++) {
+			ZERO_STRUCT(rd);
+			rd.in.file.handle = *h2;
+			rd.in.offset      = i * 2 + 1;
+			rd.in.length      = 1;
+
+			status = smb2_read(tree, tree, &rd);
+			torture_assert_ntstatus_ok_goto(
+				torture, status, ret, done,
+				"smb2_read failed");
+			TALLOC_FREE(rd.out.data.data);
+		}
+
+		secs = timeval_elapsed(&tv);
+		torture_comment(torture,
+				"Read %d bytes between locks in %.3f seconds "
+				"(%.0f reads/sec)\n",
+				num_locks,
+				secs,
+				num_locks / secs);
+	}
+
+	ZERO_STRUCT(rd);
+	rd.in.file.handle = *h2;
+	rd.in.offset      = 0;
+	rd.in.length      = 1;
+
+	status = smb2_read(tree, tree, &rd);
+	torture_assert_ntstatus_equal_goto(torture, status,
+					   NT_STATUS_FILE_LOCK_CONFLICT,
+					   ret, done,
+					   "read of locked byte succeeded");
+
+	tv = timeval_current();
+
+	for (i = 0; i < num_locks; i++) {
+		status = test_smb2_unlock(tree, *h1, i * 2, 1);
+		torture_assert_ntstatus_ok_goto(torture, status, ret, done,
+						"test_smb2_unlock failed");
+	}
+
+	secs = timeval_elapsed(&tv);
+	torture_comment(torture,
+			"Released %d locks in %.3f seconds "
+			"(%.0f unlocks/sec)\n",
+			num_locks,
+			secs,
+			num_locks / secs);
+
+done:
+	if (h2 != NULL) {
+		smb2_util_close(tree, *h2);
+	}
+	if (h1 != NULL) {
+		smb2_util_close(tree, *h1);
+	}
+	TALLOC_FREE(buf);
+	smb2_deltree(tree, BASEDIR);
+	return ret;
+}
+
 /* basic testing of SMB2 locking
 */
 struct torture_suite *torture_smb2_lock_init(TALLOC_CTX *ctx)
@@ -3506,6 +3661,7 @@ struct torture_suite *torture_smb2_lock_init(TALLOC_CTX *ctx)
 	torture_suite_add_1smb2_test(suite, "replay_smb3_specification_multi",
 				     test_replay_smb3_specification_multi);
 	torture_suite_add_1smb2_test(suite, "ctdb-delrec-deadlock", test_deadlock);
+	torture_suite_add_1smb2_test(suite, "bench-lock", test_bench_lock);
 
 	suite->description = talloc_strdup(suite, "SMB2-LOCK tests");
 